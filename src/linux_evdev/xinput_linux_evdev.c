@@ -31,9 +31,11 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/stat.h>
-#include <dirent.h>
+#include <limits.h>
 
 #if HAVE_WINE
 #include "wine/debug.h"
@@ -44,14 +46,13 @@
 #include "tools.h"
 
 #include "xinput_linux_evdev.h"
-/* #include "xinput_linux_evdev_xboxpad.h" */
+#include "xinput_linux_evdev_hotplug.h"
+#include "xinput_linux_evdev_xboxpad.h"
 #include "xinput_linux_evdev_generic.h"
-/* #include "xinput_linux_evdev_xboxpad_2.h" an example with table implementation */
+#include "xinput_linux_evdev_xboxpad_2.h"
 
 #include "xinput_linux_evdev_debug.h"
 
-#define EVENT_MAX 32
-
 WINE_DEFAULT_DEBUG_CHANNEL(xinput);
 
 struct XINPUT_GAMEPAD_PRIVATE_STATE
@@ -64,8 +65,6 @@ typedef struct XINPUT_GAMEPAD_PRIVATE_STATE XINPUT_GAMEPAD_PRIVATE_STATE;
 
 static XINPUT_GAMEPAD_PRIVATE_STATE xinput_linux_evdev_slot[XUSER_MAX_COUNT] = {0};
 
-static uint64_t xinput_linux_evdev_probe_last_epoch = 0;
-
 static int xinput_linux_evdev_next_free_slot(void)
 {
     for(int i = 0; i < XUSER_MAX_COUNT; ++i)
@@ -78,51 +77,81 @@ static int xinput_linux_evdev_next_free_slot(void)
     return -1;
 }
 
-int xinput_linux_evdev_read_next(int fd, struct input_event* ie)
+void xinput_linux_evdev_reader_init(xinput_linux_evdev_reader* reader, int fd)
 {
-    return read_fully(fd, ie, sizeof(*ie));
+    memset(reader, 0, offsetof(xinput_linux_evdev_reader, buffer));
+    reader->fd = fd;
+}
+
+int xinput_linux_evdev_reader_fill(xinput_linux_evdev_reader* reader)
+{
+    for(;;)
+    {
+        ssize_t n = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+
+        ++reader->reads;
+
+        if(n > 0)
+        {
+            /* evdev only returns whole events */
+
+            reader->index = 0;
+            reader->count = n / sizeof(struct input_event);
+            reader->events += reader->count;
+
+            return 0;
+        }
+        else if(n == 0)
+        {
+            return ENODEV;
+        }
+        else
+        {
+            int err = errno;
+
+            if(err != EINTR)
+            {
+                return err;
+            }
+        }
+    }
+}
+
+void xinput_linux_evdev_reader_statistics(const xinput_linux_evdev_reader* reader, xinput_gamepad_device_statistics* stats)
+{
+    stats->reads = reader->reads;
+    stats->events = reader->events;
+    stats->frames = reader->frames;
 }
 
 /**
- * The left motor is supposed to be low frequency, high magnitude
- * The right motor is supposed to be high frequency, weak magnitude
+ * Uploads, or updates, the rumble effect of a device.
  *
  * @param fd
  * @param id the current effect id, or -1
- * @param low
- * @param high
+ * @param low_left
+ * @param high_right
  *
  * @return the id of the effect or -1 if it failed to register the effect
  */
 
-int xinput_linux_evdev_rumble(int fd, int id, SHORT low_left, SHORT high_right)
+static int xinput_linux_evdev_rumble_upload(int fd, int id, WORD low_left, WORD high_right)
 {
     struct ff_effect effect;
 
+    memset(&effect, 0, sizeof(effect));
     effect.type = FF_RUMBLE;
     effect.id = id;
     effect.u.rumble.strong_magnitude = low_left;
     effect.u.rumble.weak_magnitude = high_right;
-    effect.replay.length = 5000;
+    effect.replay.length = 0;  /* until replaced: only the changes are sent */
     effect.replay.delay = 0;
 
-    if(ioctl(fd, EVIOCSFF, &effect) != -1)
-    {
-        struct input_event ie;
-        ie.type = EV_FF;
-        ie.code = effect.id;
-        ie.value = 1;
-
-        if(write_fully(fd, &ie, sizeof(ie)) < 0)
-        {
-            int err = errno;
-            TRACE("could not send rumble: %i [%i, %i]: %s\n", fd, low_left, high_right, strerror(err));
-        }
-    }
-    else
+    if(ioctl(fd, EVIOCSFF, &effect) == -1)
     {
         int err = errno;
         TRACE("could not setup rumble: %i [%i, %i]: %s\n", fd, low_left, high_right, strerror(err));
+        return -1;
     }
 
     return effect.id;
@@ -137,7 +166,117 @@ void xinput_linux_evdev_feedback_clear(int fd, int id)
     }
 }
 
-static BOOL xinput_linux_evdev_device_in_use(int inode)
+void xinput_linux_evdev_rumbler_init(xinput_linux_evdev_rumbler* rumbler, int64_t period_us)
+{
+    memset(rumbler, 0, sizeof(*rumbler));
+    rumbler->effect_id = -1;
+    rumbler->period_us = period_us;
+}
+
+int64_t xinput_linux_evdev_rumbler_period(const struct xinput_linux_evdev_probe_s* probed)
+{
+    return (probed->id.bustype == BUS_BLUETOOTH)?XINPUT_EVDEV_RUMBLE_BLUETOOTH_PERIOD_US:XINPUT_EVDEV_RUMBLE_PERIOD_US;
+}
+
+static int xinput_linux_evdev_rumbler_play(xinput_linux_evdev_rumbler* rumbler, int fd, BOOL play)
+{
+    struct input_event ie;
+
+    memset(&ie, 0, sizeof(ie));
+    ie.type = EV_FF;
+    ie.code = rumbler->effect_id;
+    ie.value = play?1:0;
+
+    if(write_fully(fd, &ie, sizeof(ie)) < 0)
+    {
+        int err = errno;
+        TRACE("could not %s rumble: %i: %s\n", play?"play":"stop", fd, strerror(err));
+        return err;
+    }
+
+    rumbler->playing = play;
+
+    return 0;
+}
+
+int xinput_linux_evdev_rumbler_set(xinput_linux_evdev_rumbler* rumbler, int fd, const XINPUT_VIBRATION* vibration)
+{
+    BOOL same = (rumbler->effect_id >= 0) &&
+                (rumbler->uploaded.wLeftMotorSpeed == vibration->wLeftMotorSpeed) &&
+                (rumbler->uploaded.wRightMotorSpeed == vibration->wRightMotorSpeed);
+    int64_t now;
+
+    ++rumbler->rumbles;
+
+    if((vibration->wLeftMotorSpeed == 0) && (vibration->wRightMotorSpeed == 0))
+    {
+        /* stopping is never delayed, and needs no upload */
+
+        ++rumbler->uploads_avoided;
+
+        return rumbler->playing?xinput_linux_evdev_rumbler_play(rumbler, fd, FALSE):0;
+    }
+
+    if(same && rumbler->playing)
+    {
+        ++rumbler->uploads_avoided;
+        return 0;
+    }
+
+    now = timeus();
+
+    if(now < rumbler->next_us)
+    {
+        ++rumbler->rumbles_deferred;
+        return EAGAIN;
+    }
+
+    if(same)
+    {
+        /* stopped, but still on the device */
+
+        ++rumbler->uploads_avoided;
+    }
+    else
+    {
+        int id = xinput_linux_evdev_rumble_upload(fd, rumbler->effect_id, vibration->wLeftMotorSpeed, vibration->wRightMotorSpeed);
+
+        if(id < 0)
+        {
+            return EIO;
+        }
+
+        ++rumbler->uploads;
+        rumbler->effect_id = id;
+        rumbler->uploaded = *vibration;
+    }
+
+    rumbler->next_us = now + rumbler->period_us;
+
+    /* an effect updated while playing goes on with the new magnitudes */
+
+    return rumbler->playing?0:xinput_linux_evdev_rumbler_play(rumbler, fd, TRUE);
+}
+
+void xinput_linux_evdev_rumbler_release(xinput_linux_evdev_rumbler* rumbler, int fd)
+{
+    if(rumbler->effect_id >= 0)
+    {
+        xinput_linux_evdev_feedback_clear(fd, rumbler->effect_id);
+        rumbler->effect_id = -1;
+        rumbler->playing = FALSE;
+    }
+}
+
+void xinput_linux_evdev_rumbler_statistics(const xinput_linux_evdev_rumbler* rumbler, xinput_gamepad_device_statistics* stats)
+{
+    stats->rumbles = rumbler->rumbles;
+    stats->uploads = rumbler->uploads;
+    stats->uploads_avoided = rumbler->uploads_avoided;
+    stats->rumbles_deferred = rumbler->rumbles_deferred;
+}
+
+static BOOL xinput_linux_evdev_device_in_use(uint64_t inode)
 {
     for(int i = 0; i < XUSER_MAX_COUNT; ++i)
     {
@@ -158,355 +297,317 @@ static BOOL xinput_linux_evdev_device_in_use(int inode)
 
 typedef struct xinput_linux_evdev_probe_s xinput_linux_evdev_probe_s;
 
-static const char device_dir_name[] = "/dev/input/by-path";
+/*
+ * Tried in order: the drivers dedicated to some pads, recognised by their
+ * vendor/product, then the generic one for everything else.
+ */
+
+static const xinput_linux_evdev_driver xinput_linux_evdev_drivers[] =
+{
+#if XINPUT_EVDEV_XBOXPAD_TABLES
+    {"xboxpad2", &xinput_linux_evdev_xboxpad2_can_translate, &xinput_linux_evdev_xboxpad2_new_instance},
+#else
+    {"xboxpad", &xinput_linux_evdev_xboxpad_can_translate, &xinput_linux_evdev_xboxpad_new_instance},
+#endif
+    {"generic", &xinput_linux_evdev_generic_can_translate, &xinput_linux_evdev_generic_new_instance},
+    {NULL, NULL, NULL}
+};
+
+static char device_dir_name[PATH_MAX] = XINPUT_EVDEV_DEVICE_DIRECTORY;
 static const char event_joystick[] = "-event-joystick";
 
-uint32_t xinput_linux_evdev_probe(void)
+static xinput_linux_evdev_hotplug xinput_linux_evdev_hotplug_watcher = {-1, -1, -1, NULL, {0}};
+
+void xinput_linux_evdev_set_device_directory(const char* directory)
+{
+    size_t directory_len = strlen(directory);
+
+    if(directory_len < sizeof(device_dir_name))
+    {
+        memcpy(device_dir_name, directory, directory_len + 1);
+    }
+}
+
+void xinput_linux_evdev_probe_device(int fd, struct xinput_linux_evdev_probe_s* probed)
 {
-    uint64_t now = timeus();
     int n;
-    int fd;
-        
-    int one = 1;
-    uint32_t mask = 0;
-    
-    struct xinput_linux_evdev_probe_s probed;
-    
-    struct inode_epoch_s
+
+    memset(probed, 0, sizeof(*probed));
+
+    if(ioctl(fd, EVIOCGVERSION, &probed->version) != -1)
     {
-        uint64_t inode;
-        uint64_t epoch;
-    };
-    
-    struct inode_epoch_s joystick_inodes[64] = {0};
-    size_t joystick_inodes_count = 0;
-    
-    char filename[128];
-   
-    if(now - xinput_linux_evdev_probe_last_epoch < 5000000)
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE("version: %x\n", probed->version);
+#endif
+    }
+
+    if(ioctl(fd, EVIOCGID, &probed->id) != -1)
     {
-        return 0;
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE("id: %x %x %x %x\n", probed->id.bustype, probed->id.product, probed->id.vendor, probed->id.version);
+#endif
     }
-    
-    /* to silence valgrind */
 
-    xinput_linux_evdev_probe_last_epoch = now;
+    if(ioctl(fd, EVIOCGNAME(sizeof(probed->device_name)), probed->device_name) != -1)
+    {
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE("name: '%s'\n", probed->device_name);
+#endif
+    }
 
+    if(ioctl(fd, EVIOCGPHYS(sizeof(probed->location)), probed->location) != -1)
+    {
 #if XINPUT_TRACE_DEVICE_DETECTION
-    TRACE("probing devices\n");
+        TRACE("loc: '%s'\n", probed->location);
 #endif
-    
-    DIR* devices_dir = opendir(device_dir_name);
-    
-    if(devices_dir != NULL)
+    }
+
+    if((n = ioctl(fd, EVIOCGPROP(sizeof(probed->prop)), probed->prop)) != -1)
     {
-        for(;;)
-        {
-            int slot = xinput_linux_evdev_next_free_slot();
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE("prop: %i\n", n);
+        hexdump(probed->prop, n);
+        TRACE("\n");
+#endif
+    }
 
-            if(slot < 0)
-            {
-                TRACE("all joystick slots are already allocated\n");
-                break;
-            }
-            
-            const struct dirent* dir_entry = readdir(devices_dir);
-            
-            if(dir_entry == NULL)
-            {
-                break;
-            }
-            
-            size_t dir_entry_name_len = strlen(dir_entry->d_name);
-            
-            if(sizeof(device_dir_name) + 1 + dir_entry_name_len > sizeof(filename))
-            {
-                /*  will not be able to handle the name (filename buffer is too small */
-                TRACE("%s/%s is bigger than expected", device_dir_name, filename);
-                continue;
-            }
-            
-            if((dir_entry_name_len < sizeof(event_joystick)) || (memcmp(&dir_entry->d_name[dir_entry_name_len - sizeof(event_joystick) + 1], event_joystick, sizeof(event_joystick)) != 0))
-            {
-                /*  not a joystick */
-                continue;
-            }
-            
-            /*  already in use ? */
+    if((n = ioctl(fd, EVIOCGBIT(0, EV_CNT), probed->ev_all)) != -1)
+    {
+#if XINPUT_TRACE_DEVICE_DETECTION
+        memdump(probed->ev_all, sizeof(probed->ev_all));
 
-            if(xinput_linux_evdev_device_in_use(dir_entry->d_ino))
+        for(int j = 0; j < EV_CNT; ++j)
+        {
+            BOOL on = bit_get(probed->ev_all, j);
+            if(on)
             {
-                continue;
+                TRACE("%s ", xinput_linux_evdev_event_type_get_name(j)); /* no LF */
             }
-            
-            /*  do not process a device that remains the same since the last probe (as it was discarded already) */
+        }
 
-            memcpy(filename, device_dir_name,  sizeof(device_dir_name));
-            filename[sizeof(device_dir_name) - 1] = '/';
-            memcpy(&filename[sizeof(device_dir_name)], dir_entry->d_name, dir_entry_name_len + 1);
-            
-            struct stat st;
+        TRACE("\n");
+#endif
+    }
+    else
+    {
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE("ev all: %s\n", strerror(errno));
+#endif
+    }
+
+    probed->key_count = 0;
+    probed->abs_count = 0;
+    probed->ff_count = 0;
 
-            if(lstat(filename, &st) < 0)
+    if((n = ioctl(fd, EVIOCGBIT(EV_KEY, KEY_CNT), probed->ev_key)) != -1)
+    {
+#if XINPUT_TRACE_DEVICE_DETECTION
+        //memdump(probed->ev_key, sizeof(probed->ev_key));
+#endif
+        for(int j = 0; j < KEY_CNT; ++j)
+        {
+            BOOL on = bit_get(probed->ev_key, j);
+            if(on)
             {
-                continue;
+#if XINPUT_TRACE_DEVICE_DETECTION
+                TRACE("%s ", xinput_linux_evdev_key_get_name(j)); /* no LF */
+#endif
+                ++probed->key_count;
             }
+        }
+
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE(": %i keys\n", probed->key_count);
+#endif
+    }
+    else
+    {
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE("ev key: %s\n", strerror(errno));
+#endif
+    }
 
-            uint64_t ct = st.st_ctim.tv_sec;
-            ct *= 1000ULL;
-            ct += st.st_ctim.tv_nsec / 1000000ULL;
-            
-            int joystick_inode_found = 0;
-            for(int i = 0; i < joystick_inodes_count; ++i)
+    if((n = ioctl(fd, EVIOCGBIT(EV_ABS, ABS_CNT), probed->ev_abs)) != -1)
+    {
+#if XINPUT_TRACE_DEVICE_DETECTION
+        memdump(probed->ev_abs, sizeof(probed->ev_abs));
+#endif
+        for(int j = 0; j < ABS_CNT; ++j)
+        {
+            BOOL on = bit_get(probed->ev_abs, j);
+            if(on)
             {
-                if(joystick_inodes[i].inode == dir_entry->d_ino)
+#if XINPUT_TRACE_DEVICE_DETECTION
+                TRACE("%s ", xinput_linux_evdev_abs_get_name(j)); /* no LF */
+#endif
+                ++probed->abs_count;
+
+                /* the range of the axis, for the calibration */
+
+                if(ioctl(fd, EVIOCGABS(j), &probed->absinfo[j]) < 0)
                 {
-                    if(joystick_inodes[i].epoch >= ct)
-                    {
-                        // no change
-                        continue;
-                    }
-                    
-                    joystick_inode_found = 1;
-                    break;
+                    bit_clear(probed->ev_abs, j);
+                    --probed->abs_count;
                 }
             }
+        }
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE(": %i abs\n", probed->abs_count);
+#endif
+    }
+    else
+    {
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE("ev abs: %s\n", strerror(errno));
+#endif
+    }
 
-            if(!joystick_inode_found)
+    if((n = ioctl(fd, EVIOCGBIT(EV_FF, FF_CNT), probed->ev_ff)) != -1)
+    {
+#if XINPUT_TRACE_DEVICE_DETECTION
+        memdump(probed->ev_ff, sizeof(probed->ev_ff));
+#endif
+        for(int j = 0; j < FF_CNT; ++j)
+        {
+            BOOL on = bit_get(probed->ev_ff, j);
+            if(on)
             {
-                if(joystick_inodes_count < (sizeof(joystick_inodes) / sizeof(joystick_inodes[0])) - 1 )
-                {
-                    joystick_inodes[joystick_inodes_count].inode = dir_entry->d_ino;
-                    joystick_inodes[joystick_inodes_count].epoch =  ct;
-                    ++joystick_inodes_count;
-                }
-                else
-                {
-                    // forget the first one
-                    memmove(&joystick_inodes[0], &joystick_inodes[1], sizeof(joystick_inodes) - sizeof(joystick_inodes[0]));
-                    joystick_inodes[joystick_inodes_count - 1].inode = dir_entry->d_ino;
-                    joystick_inodes[joystick_inodes_count - 1].epoch =  ct;
-                }
+#if XINPUT_TRACE_DEVICE_DETECTION
+                TRACE("%s ", xinput_linux_evdev_ff_get_name(j)); /* no LF */
+#endif
+                ++probed->ff_count;
             }
+        }
+#if XINPUT_TRACE_DEVICE_DETECTION
+        TRACE(": %i ff\n", probed->ff_count);
+#endif
+    }
+}
 
-            fd = open(filename, O_RDONLY);
+/**
+ * Probes one node and installs it in a free slot if it is supported.
+ *
+ * @param filename the path of the node
+ * @param args a pointer to the mask of the slots installed so far
+ */
 
-            if(fd < 0)
-            {
-                TRACE("cannot open joystick at %s: %s\n", filename, strerror(errno));
-                continue;
-            }
+static void xinput_linux_evdev_probe_path(const char* filename, void* args)
+{
+    uint32_t* mask = (uint32_t*)args;
+    int slot;
+    int fd;
+    int one = 1;
+    struct stat st;
+    struct xinput_linux_evdev_probe_s probed;
 
-            memset(&probed, 0, sizeof(struct xinput_linux_evdev_probe_s));
+    slot = xinput_linux_evdev_next_free_slot();
 
-    #if XINPUT_TRACE_DEVICE_DETECTION
-            TRACE("opened joystick at %s\n", filename);
-    #endif
+    if(slot < 0)
+    {
+        TRACE("all joystick slots are already allocated\n");
+        return;
+    }
 
-            if(ioctl(fd, EVIOCGVERSION, &probed.version) != -1)
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE("version: %x\n", probed.version);
-    #endif
-            }
+    if(lstat(filename, &st) < 0)
+    {
+        return;
+    }
 
-            if(ioctl(fd, EVIOCGID, &probed.id) != -1)
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE("id: %x %x %x %x\n", probed.id.bustype, probed.id.product, probed.id.vendor, probed.id.version);
-    #endif
-            }
+    /*  already in use ? */
 
-            if(ioctl(fd, EVIOCGNAME(sizeof(probed.device_name)), probed.device_name) != -1)
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE("name: '%s'\n", probed.device_name);
-    #endif
-            }
+    if(xinput_linux_evdev_device_in_use(st.st_ino))
+    {
+        return;
+    }
 
-            if(ioctl(fd, EVIOCGPHYS(sizeof(probed.location)), probed.location) != -1)
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE("loc: '%s'\n", probed.location);
-    #endif
-            }
+    /* writing is needed to play the rumble effects */
 
-            if((n = ioctl(fd, EVIOCGPROP(sizeof(probed.prop)), probed.prop)) != -1)
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE("prop: %i\n", n);
-                hexdump(probed.prop, n);
-                TRACE("\n");
-    #endif
-            }
+    fd = open(filename, O_RDWR);
 
-            if((n = ioctl(fd, EVIOCGBIT(0, EV_CNT), probed.ev_all)) != -1)
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                memdump(probed.ev_all, sizeof(probed.ev_all));
+    if((fd < 0) && (errno == EACCES))
+    {
+        fd = open(filename, O_RDONLY);
+    }
 
-                for(int j = 0; j < EV_CNT; ++j)
-                {
-                    BOOL on = bit_get(probed.ev_all, j);
-                    if(on)
-                    {
-                        TRACE("%s ", xinput_linux_evdev_event_type_get_name(j)); /* no LF */
-                    }
-                }
+    if(fd < 0)
+    {
+        TRACE("cannot open joystick at %s: %s\n", filename, strerror(errno));
+        return;
+    }
 
-                TRACE("\n");
-    #endif
-            }
-            else
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE("ev all: %s\n", strerror(errno));
-    #endif
-            }
+#if XINPUT_TRACE_DEVICE_DETECTION
+    TRACE("opened joystick at %s\n", filename);
+#endif
 
-            // uint8_t wanted_mask = (1<<EV_SYN)|(1<<EV_KEY)|(1<<EV_ABS)|(1<<EV_MSC);
-            // uint8_t rejected_mask = (1<<EV_REL)|(1<<EV_PWR);
+    xinput_linux_evdev_probe_device(fd, &probed);
 
-            if(!(bit_get(probed.ev_all, EV_KEY) && bit_get(probed.ev_all, EV_ABS)) || bit_get(probed.ev_all, EV_REL) || bit_get(probed.ev_all, EV_PWR))
-            {
-                TRACE("%s @%s: not a candidate\n",
-                        probed.device_name,
-                        filename);
-                close_ex(fd);
-                continue;
-            }
-            else
-            {
-                TRACE("%s @%s: is a candidate\n",
-                        probed.device_name,
-                        filename);
-            }
+    // uint8_t wanted_mask = (1<<EV_SYN)|(1<<EV_KEY)|(1<<EV_ABS)|(1<<EV_MSC);
+    // uint8_t rejected_mask = (1<<EV_REL)|(1<<EV_PWR);
 
-            probed.key_count = 0;
-            probed.abs_count = 0;
-            probed.ff_count = 0;
+    if(!(bit_get(probed.ev_all, EV_KEY) && bit_get(probed.ev_all, EV_ABS)) || bit_get(probed.ev_all, EV_REL) || bit_get(probed.ev_all, EV_PWR))
+    {
+        TRACE("%s @%s: not a candidate\n",
+                probed.device_name,
+                filename);
+        close_ex(fd);
+        return;
+    }
+    else
+    {
+        TRACE("%s @%s: is a candidate\n",
+                probed.device_name,
+                filename);
+    }
 
-            if((n = ioctl(fd, EVIOCGBIT(EV_KEY, KEY_CNT), probed.ev_key)) != -1)
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                //memdump(probed.ev_key, sizeof(probed.ev_key));
-    #endif
-                for(int j = 0; j < KEY_CNT; ++j)
-                {
-                    BOOL on = bit_get(probed.ev_key, j);
-                    if(on)
-                    {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                        TRACE("%s ", xinput_linux_evdev_key_get_name(j)); /* no LF */
-    #endif
-                        ++probed.key_count;
-                    }
-                }
+    if(ioctl(fd, EVIOCGRAB, &one) < 0)
+    {
+        /* cannot grab it for myself */
+        TRACE("cannot grab device: %s\n", strerror(errno));
+        close_ex(fd);
+        return;
+    }
 
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE(": %i keys\n", probed.key_count);
-    #endif
-            }
-            else
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE("ev key: %s\n", strerror(errno));
-    #endif
-            }
+    for(const xinput_linux_evdev_driver* driver = &xinput_linux_evdev_drivers[0]; driver->name != NULL; ++driver)
+    {
+        if(driver->can_translate(&probed))
+        {
+            xinput_gamepad_device* device = &xinput_linux_evdev_slot[slot].device;
 
-            if((n = ioctl(fd, EVIOCGBIT(EV_ABS, ABS_CNT), probed.ev_abs)) != -1)
+            if(driver->new_instance(&probed, fd, device))
             {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                memdump(probed.ev_abs, sizeof(probed.ev_abs));
-    #endif
-                for(int j = 0; j < ABS_CNT; ++j)
-                {
-                    BOOL on = bit_get(probed.ev_abs, j);
-                    if(on)
-                    {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                        TRACE("%s ", xinput_linux_evdev_abs_get_name(j)); /* no LF */
-    #endif
-                        ++probed.abs_count;
-                    }
-                }
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE(": %i abs\n", probed.abs_count);
-    #endif
-            }
-            else
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE("ev abs: %s\n", strerror(errno));
-    #endif
+                TRACE("%s @%s: %04x:%04x driven by %s in slot %i\n",
+                        probed.device_name,
+                        filename,
+                        probed.id.vendor,
+                        probed.id.product,
+                        driver->name,
+                        slot);
+
+                xinput_linux_evdev_slot[slot].inode = st.st_ino;
+                *mask |= 1 << slot;
+                return;
             }
+        }
+    }
 
-            if((n = ioctl(fd, EVIOCGBIT(EV_FF, FF_CNT), probed.ev_ff)) != -1)
-            {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                memdump(probed.ev_ff, sizeof(probed.ev_ff));
-    #endif
-                for(int j = 0; j < FF_CNT; ++j)
-                {
-                    BOOL on = bit_get(probed.ev_ff, j);
-                    if(on)
-                    {
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                        TRACE("%s ", xinput_linux_evdev_ff_get_name(j)); /* no LF */
-    #endif
-                        ++probed.ff_count;
-                    }
-                }
-    #if XINPUT_TRACE_DEVICE_DETECTION
-                TRACE(": %i ff\n", probed.ff_count);
-    #endif
-            }
+    /* no driver for it */
 
-            if(ioctl(fd, EVIOCGRAB, &one) < 0)
-            {
-                /* cannot grab it for myself */
-                TRACE("cannot grab device: %s\n", strerror(errno));
+    TRACE("%s @%s: no driver\n", probed.device_name, filename);
+    close_ex(fd);
+}
 
-                continue;
-            }
+uint32_t xinput_linux_evdev_probe(void)
+{
+    uint32_t mask = 0;
+    int err;
 
-            if(xinput_linux_evdev_generic_can_translate(&probed))
-            {
-                xinput_gamepad_device* device = &xinput_linux_evdev_slot[slot].device;
-                xinput_linux_evdev_generic_new_instance(&probed, fd, device);
-                xinput_linux_evdev_slot[slot].inode = dir_entry->d_ino;
-            }
-            /*
-            if(xinput_linux_evdev_xboxpad_can_translate(&probed))
-            {
-                xinput_gamepad_device* device = &xinput_linux_evdev_slot[slot].device;
-                xinput_linux_evdev_xboxpad_new_instance(&probed, fd, device);
-                xinput_linux_evdev_slot[slot].input_index = input_index;
-            }
-            */
-            /*
-            else if(xinput_linux_evdev_xboxpad2_can_translate(&id))
-            {
-                xinput_gamepad_device* device = &xinput_linux_evdev_slot[slot].device;
-                xinput_linux_evdev_xboxpad2_new_instance(&id, fd, device);
-                xinput_linux_evdev_slot[slot].input_index = input_index;
-            }
-            */
-            else
-            {
-                /* no more translators */
-                close_ex(fd);
-                continue;
-            }
+#if XINPUT_TRACE_DEVICE_DETECTION
+    TRACE("probing devices\n");
+#endif
 
-            mask |= 1 << slot;
-        }
-        
-        closedir(devices_dir);
-    }
-    else
+    if((err = xinput_linux_evdev_hotplug_scan(device_dir_name, event_joystick, xinput_linux_evdev_probe_path, &mask)) != 0)
     {
-        TRACE("could not open %s: %s\n", device_dir_name, strerror(errno));
+        TRACE("could not open %s: %s\n", device_dir_name, strerror(err));
     }
 
 #if XINPUT_TRACE_DEVICE_DETECTION
@@ -516,6 +617,37 @@ uint32_t xinput_linux_evdev_probe(void)
     return mask;
 }
 
+int xinput_linux_evdev_hotplug_start(void)
+{
+    int err = xinput_linux_evdev_hotplug_open(&xinput_linux_evdev_hotplug_watcher, device_dir_name, event_joystick);
+
+    if(err != 0)
+    {
+        TRACE("cannot watch %s: %s\n", device_dir_name, strerror(err));
+        return -1;
+    }
+
+    return xinput_linux_evdev_hotplug_watcher.fd;
+}
+
+uint32_t xinput_linux_evdev_hotplug_probe(void)
+{
+    uint32_t mask = 0;
+    int err = xinput_linux_evdev_hotplug_read(&xinput_linux_evdev_hotplug_watcher, xinput_linux_evdev_probe_path, &mask);
+
+    if(err != 0)
+    {
+        TRACE("cannot read the changes in %s: %s\n", device_dir_name, strerror(err));
+    }
+
+    return mask;
+}
+
+void xinput_linux_evdev_hotplug_stop(void)
+{
+    xinput_linux_evdev_hotplug_close(&xinput_linux_evdev_hotplug_watcher);
+}
+
 xinput_gamepad_device* xinput_linux_evdev_get_device(int slot)
 {
     if(slot >= 0 && slot < XUSER_MAX_COUNT)
@@ -28,6 +28,7 @@
 #define XINPUT_LINUX_EVDEV_H
 
 #include <stdint.h>
+#include "xinput_settings.h"
 #include "xinput_gamepad.h"
 #include <linux/input.h>
 
@@ -47,6 +48,7 @@ struct xinput_linux_evdev_probe_s
     uint8_t ev_key[KEY_CNT>>3];
     uint8_t ev_abs[ABS_CNT>>3];
     uint8_t ev_ff[FF_CNT>>3];
+    struct input_absinfo absinfo[ABS_CNT];  /* of the axes in ev_abs */
     char device_name[128];
     char location[128];  
 };
@@ -66,6 +68,47 @@ void xinput_linux_evdev_initialize(void);
 
 uint32_t xinput_linux_evdev_probe(void);
 
+/**
+ * Reads the identity and the capabilities of an opened device.
+ *
+ * @param fd the device
+ * @param probed receives what has been found
+ */
+
+void xinput_linux_evdev_probe_device(int fd, struct xinput_linux_evdev_probe_s* probed);
+
+/**
+ * Sets the directory the devices are looked for in.
+ * Must be called before probing or starting the hotplug detection.
+ *
+ * @param directory
+ */
+
+void xinput_linux_evdev_set_device_directory(const char* directory);
+
+/**
+ * Starts watching the device directory for new devices.
+ *
+ * @return a file descriptor that becomes readable when devices appear, or -1
+ */
+
+int xinput_linux_evdev_hotplug_start(void);
+
+/**
+ * Probes the devices that appeared since the last call.
+ * Does not block.
+ *
+ * @return a bitmask of the newly found devices
+ */
+
+uint32_t xinput_linux_evdev_hotplug_probe(void);
+
+/**
+ * Stops watching the device directory.
+ */
+
+void xinput_linux_evdev_hotplug_stop(void);
+
 /**
  * Returns the device in the specified slot
  *
@@ -90,6 +133,19 @@ void xinput_linux_evdev_device_close(int slot);
 
 void xinput_linux_evdev_finalize(void);
 
+/**
+ * A driver for some evdev devices.
+ */
+
+struct xinput_linux_evdev_driver
+{
+    const char* name;
+    BOOL (*can_translate)(const struct xinput_linux_evdev_probe_s* probed);
+    BOOL (*new_instance)(const struct xinput_linux_evdev_probe_s* probed, int fd, xinput_gamepad_device* instance);
+};
+
+typedef struct xinput_linux_evdev_driver xinput_linux_evdev_driver;
+
 /**
  * If multiple driver support is implemented, this will be replaced
  * by a function setting a virtual table.
@@ -98,30 +154,147 @@ void xinput_linux_evdev_finalize(void);
 
 #define xinput_driver_initialize xinput_linux_evdev_initialize
 #define xinput_driver_probe xinput_linux_evdev_probe
+#define xinput_driver_hotplug_start xinput_linux_evdev_hotplug_start
+#define xinput_driver_hotplug_probe xinput_linux_evdev_hotplug_probe
+#define xinput_driver_hotplug_stop xinput_linux_evdev_hotplug_stop
 #define xinput_driver_get_device xinput_linux_evdev_get_device
 #define xinput_driver_device_close xinput_linux_evdev_device_close
 #define xinput_driver_finalize xinput_linux_evdev_finalize
 
-struct input_event;
+/* older kernel headers */
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+/**
+ * Events are read from a device by batches, into this buffer.
+ */
+
+struct xinput_linux_evdev_reader
+{
+    int fd;
+    int index;
+    int count;
+    uint64_t reads;
+    uint64_t events;
+    uint64_t frames;
+    int64_t frame_us;       /* kernel time of the last SYN_REPORT, same clock as timeus() */
+    struct input_event buffer[XINPUT_EVDEV_READ_EVENTS];
+};
+
+typedef struct xinput_linux_evdev_reader xinput_linux_evdev_reader;
 
-int xinput_linux_evdev_read_next(int fd, struct input_event* ie);
+void xinput_linux_evdev_reader_init(xinput_linux_evdev_reader* reader, int fd);
 
 /**
- * The left motor is supposed to be low frequency, high magnitude
- * The right motor is supposed to be high frequency, weak magnitude
+ * Reads as many events as available (up to XINPUT_EVDEV_READ_EVENTS) from
+ * the device, with one system call.
  *
- * @param fd
- * @param id the current effect id, or -1
- * @param low
- * @param high
+ * @param reader
+ * @return 0 or an error code
+ */
+
+int xinput_linux_evdev_reader_fill(xinput_linux_evdev_reader* reader);
+
+void xinput_linux_evdev_reader_statistics(const xinput_linux_evdev_reader* reader, xinput_gamepad_device_statistics* stats);
+
+/**
+ * Returns the next event of the device, reading a new batch if needed.
  *
- * @return the id of the effect or -1 if it failed to register the effect
+ * @param reader
+ * @param ie
+ * @return 0 or an error code
  */
 
-int xinput_linux_evdev_rumble(int fd, int id, SHORT low_left, SHORT high_right);
+static inline int xinput_linux_evdev_read_next(xinput_linux_evdev_reader* reader, struct input_event* ie)
+{
+    if(reader->index == reader->count)
+    {
+        int ret = xinput_linux_evdev_reader_fill(reader);
+
+        if(ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    *ie = reader->buffer[reader->index++];
+
+    if((ie->type == EV_SYN) && (ie->code == SYN_REPORT))
+    {
+        ++reader->frames;
+        reader->frame_us = ie->input_event_sec * 1000000LL + ie->input_event_usec;
+    }
+
+    return 0;
+}
 
 void xinput_linux_evdev_feedback_clear(int fd, int id);
 
+/**
+ * Keeps track of the rumble effect uploaded to a device so that it is only
+ * uploaded when the vibration changes, played when it was stopped, and
+ * stopped when both motors are still.
+ *
+ * Updates closer than period_us are refused, for the transports that cannot
+ * keep up (Bluetooth).
+ */
+
+struct xinput_linux_evdev_rumbler
+{
+    int effect_id;                  /* -1 until uploaded */
+    BOOL playing;
+    XINPUT_VIBRATION uploaded;
+    int64_t period_us;
+    int64_t next_us;                /* no update before this time */
+    uint64_t rumbles;
+    uint64_t uploads;
+    uint64_t uploads_avoided;
+    uint64_t rumbles_deferred;
+};
+
+typedef struct xinput_linux_evdev_rumbler xinput_linux_evdev_rumbler;
+
+/**
+ * @param rumbler
+ * @param period_us the minimum time between two updates of the device
+ */
+
+void xinput_linux_evdev_rumbler_init(xinput_linux_evdev_rumbler* rumbler, int64_t period_us);
+
+/**
+ * Returns the minimum time between two updates for that kind of device.
+ *
+ * @param probed
+ * @return a period in microseconds
+ */
+
+int64_t xinput_linux_evdev_rumbler_period(const struct xinput_linux_evdev_probe_s* probed);
+
+/**
+ * Makes the device vibrate, or stop, as asked.
+ *
+ * @param rumbler
+ * @param fd the device
+ * @param vibration
+ * @return 0, EAGAIN if the device has been updated too recently, or an error code
+ */
+
+int xinput_linux_evdev_rumbler_set(xinput_linux_evdev_rumbler* rumbler, int fd, const XINPUT_VIBRATION* vibration);
+
+/**
+ * Removes the effect from the device.
+ *
+ * @param rumbler
+ * @param fd the device
+ */
+
+void xinput_linux_evdev_rumbler_release(xinput_linux_evdev_rumbler* rumbler, int fd);
+
+void xinput_linux_evdev_rumbler_statistics(const xinput_linux_evdev_rumbler* rumbler, xinput_gamepad_device_statistics* stats);
+
 #ifdef __cplusplus
 }
 #endif
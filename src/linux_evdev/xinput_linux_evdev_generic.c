@@ -93,23 +93,35 @@ static int xinput_gamepad_generic_translation[20][2] =
 
 struct xinput_linux_evdev_generic_data
 {
-    struct xinput_linux_evdev_translator_abs_translator abs;    
-    SHORT key_buttons[KEY_CNT];
-    struct xinput_linux_evdev_translator_key_translator key;
+    struct xinput_linux_evdev_translator_compiled translator;
     XINPUT_GAMEPAD_EX gamepad;
     XINPUT_VIBRATION vibration;
-    int fd;
-    int effect_id;
+    xinput_linux_evdev_reader reader;
+    xinput_linux_evdev_rumbler rumbler;
+    BOOL dropped;
+    BOOL masked;                /* the kernel only sends what is mapped */
+    uint64_t events_unmapped;
+    uint64_t codes_masked;
+    xinput_gamepad_device_noise noise;
 };
 
 typedef struct xinput_linux_evdev_generic_data xinput_linux_evdev_generic_data;
 
+/*
+ * Events are accumulated in the private gamepad until the device reports the
+ * end of a frame (SYN_REPORT), so the service publishes once per report.
+ *
+ * After a SYN_DROPPED, the events are ignored up to the next SYN_REPORT and
+ * the state is then read back from the device.
+ */
+
 static int xinput_linux_evdev_generic_read(struct xinput_gamepad_device* device)
 {
     xinput_linux_evdev_generic_data* data = (xinput_linux_evdev_generic_data*)device->data;
     struct input_event ie;
-    int ret = xinput_linux_evdev_read_next(data->fd, &ie);
-    if(ret == 0)
+    int ret;
+
+    while((ret = xinput_linux_evdev_read_next(&data->reader, &ie)) == 0)
     {
         switch(ie.type)
         {
@@ -117,12 +129,19 @@ static int xinput_linux_evdev_generic_read(struct xinput_gamepad_device* device)
             {
 #if DEBUG_EVENTS
                 TRACE("EVENT %04hx=%s %04hx=%s %08x\n",
-                        ie->type, xinput_linux_evdev_event_type_get_name(ie->type),
-                        ie->code, xinput_linux_evdev_key_get_name(ie->code),
-                        ie->value
+                        ie.type, xinput_linux_evdev_event_type_get_name(ie.type),
+                        ie.code, xinput_linux_evdev_key_get_name(ie.code),
+                        ie.value
                         );
 #endif
-                xinput_linux_evdev_translator_key_input_event_to_gamepad(&data->key, &ie, &data->gamepad);
+                if(!data->masked && (xinput_linux_evdev_translator_compiled_key(&data->translator, ie.code) == 0))
+                {
+                    ++data->events_unmapped;
+                }
+                else if(!data->dropped)
+                {
+                    xinput_linux_evdev_translator_compiled_input_event_to_gamepad(&data->translator, &ie, &data->gamepad);
+                }
 
                 break;
             }
@@ -130,20 +149,46 @@ static int xinput_linux_evdev_generic_read(struct xinput_gamepad_device* device)
             {
 #if DEBUG_EVENTS
                 TRACE("EVENT %04hx=%s %04hx=%s %08x\n",
-                        ie->type, xinput_linux_evdev_event_type_get_name(ie->type),
-                        ie->code, xinput_linux_evdev_abs_get_name(ie->code),
-                        ie->value
+                        ie.type, xinput_linux_evdev_event_type_get_name(ie.type),
+                        ie.code, xinput_linux_evdev_abs_get_name(ie.code),
+                        ie.value
                         );
 #endif
-                xinput_linux_evdev_translator_abs_input_event_to_gamepad(&data->abs, &ie, &data->gamepad);
+                if(data->translator.abs_op[ie.code & (ABS_CNT - 1)] == 0)
+                {
+                    ++data->events_unmapped;
+                }
+                else if(!data->dropped)
+                {
+                    xinput_linux_evdev_translator_compiled_input_event_to_gamepad(&data->translator, &ie, &data->gamepad);
+                }
 
                 break;
             }
-            case EV_FF:
+            case EV_SYN:
             {
-                /* break; */
+                if(ie.code == SYN_REPORT)
+                {
+                    if(data->dropped)
+                    {
+                        xinput_linux_evdev_translator_compiled_resync(&data->translator, data->reader.fd, &data->gamepad);
+                        data->dropped = FALSE;
+                    }
+
+                    /* the frame is complete */
+
+                    return 0;
+                }
+                else if(ie.code == SYN_DROPPED)
+                {
+                    TRACE("events dropped on %i\n", data->reader.fd);
+
+                    data->dropped = TRUE;
+                }
+
+                break;
             }
-            case EV_SYN:
+            case EV_FF:
             {
                 /* break; */
             }
@@ -151,15 +196,15 @@ static int xinput_linux_evdev_generic_read(struct xinput_gamepad_device* device)
             {
 #if DEBUG_EVENTS
                 TRACE("EVENT %04hx=%s %04hx %08x\n",
-                        ie->type, xinput_linux_evdev_event_type_get_name(ie->type),
-                        ie->code,
-                        ie->value
+                        ie.type, xinput_linux_evdev_event_type_get_name(ie.type),
+                        ie.code,
+                        ie.value
                         );
 #endif
+                ++data->events_unmapped;
                 break;
             }
         }
-        
     }
 
     return ret;
@@ -182,14 +227,32 @@ static void xinput_linux_evdev_generic_update(struct xinput_gamepad_device* devi
 static int xinput_linux_evdev_generic_rumble(struct xinput_gamepad_device* device, const XINPUT_VIBRATION* vibration)
 {
     xinput_linux_evdev_generic_data* data = (xinput_linux_evdev_generic_data*)device->data;
-    int id;
-    id = xinput_linux_evdev_rumble(data->fd, data->effect_id, vibration->wLeftMotorSpeed, vibration->wRightMotorSpeed);
-    if(id >= 0)
-    {
-        data->effect_id = id;
-    }
 
-    return 0;
+    return xinput_linux_evdev_rumbler_set(&data->rumbler, data->reader.fd, vibration);
+}
+
+static void xinput_linux_evdev_generic_statistics(struct xinput_gamepad_device* device, xinput_gamepad_device_statistics* stats)
+{
+    xinput_linux_evdev_generic_data* data = (xinput_linux_evdev_generic_data*)device->data;
+
+    xinput_linux_evdev_reader_statistics(&data->reader, stats);
+    xinput_linux_evdev_rumbler_statistics(&data->rumbler, stats);
+    stats->events_unmapped = data->events_unmapped;
+    stats->codes_masked = data->codes_masked;
+}
+
+static int xinput_linux_evdev_generic_get_fd(struct xinput_gamepad_device* device)
+{
+    xinput_linux_evdev_generic_data* data = (xinput_linux_evdev_generic_data*)device->data;
+
+    return data->reader.fd;
+}
+
+static int64_t xinput_linux_evdev_generic_get_event_us(struct xinput_gamepad_device* device)
+{
+    xinput_linux_evdev_generic_data* data = (xinput_linux_evdev_generic_data*)device->data;
+
+    return data->reader.frame_us;
 }
 
 static void xinput_linux_evdev_generic_release(struct xinput_gamepad_device* device)
@@ -198,25 +261,32 @@ static void xinput_linux_evdev_generic_release(struct xinput_gamepad_device* dev
     
     TRACE("release %p", device);
 
-    if(data->effect_id >= 0)
-    {
-        xinput_linux_evdev_feedback_clear(data->fd, data->effect_id);
-        data->effect_id = -1;
-    }
+    xinput_linux_evdev_rumbler_release(&data->rumbler, data->reader.fd);
 
-    close_ex(data->fd);
-    data->fd = -1;
+    close_ex(data->reader.fd);
+    data->reader.fd = -1;
     free(data);
     device->data = NULL;
     device->vtbl = NULL;
 }
 
+static void xinput_linux_evdev_generic_get_noise(struct xinput_gamepad_device* device, xinput_gamepad_device_noise* noise)
+{
+    xinput_linux_evdev_generic_data* data = (xinput_linux_evdev_generic_data*)device->data;
+
+    *noise = data->noise;
+}
+
 static const xinput_gamepad_device_vtbl xinput_xboxpad_vtbl =
 {
     &xinput_linux_evdev_generic_read,
     &xinput_linux_evdev_generic_update,
     &xinput_linux_evdev_generic_rumble,
-    &xinput_linux_evdev_generic_release
+    &xinput_linux_evdev_generic_release,
+    &xinput_linux_evdev_generic_statistics,
+    &xinput_linux_evdev_generic_get_fd,
+    &xinput_linux_evdev_generic_get_event_us,
+    &xinput_linux_evdev_generic_get_noise
 };
 
 static void xinput_linux_evdev_generic_init(struct xinput_gamepad_device* device, int fd)
@@ -226,42 +296,26 @@ static void xinput_linux_evdev_generic_init(struct xinput_gamepad_device* device
     TRACE("init %p with fd %i", device, fd);
     
     memset(data, 0, sizeof(xinput_linux_evdev_generic_data));
-    data->fd = fd;
-    data->effect_id = -1;
+    xinput_linux_evdev_reader_init(&data->reader, fd);
+    xinput_linux_evdev_rumbler_init(&data->rumbler, XINPUT_EVDEV_RUMBLE_PERIOD_US);
     device->data = data;
     device->vtbl = &xinput_xboxpad_vtbl;
 }
 
 static BOOL xinput_linux_evdev_generic_translate(const struct xinput_linux_evdev_probe_s* probedp, xinput_linux_evdev_generic_data *data)
 {
-    struct xinput_linux_evdev_translator_abs_translator *abs;
-    SHORT *key_buttons;
+    struct xinput_linux_evdev_translator_abs_translator local_abs;
+    struct xinput_linux_evdev_translator_abs_translator *abs = &local_abs;
     SHORT local_key_buttons[KEY_CNT];
+    SHORT *key_buttons = &local_key_buttons[0];
     WORD buttons = XINPUT_GAMEPAD_RESERVED0;
     static const WORD BUTTONS_ALL = ((WORD)~0);
     BYTE axis = 0;  // TLX, TLY, TRX, TRY, TL, TR : 1 -> 32
     uint8_t ev_key[KEY_CNT>>3];
     uint8_t ev_abs[ABS_CNT>>3];
-    struct xinput_linux_evdev_translator_abs_translator local_abs;
 
     memcpy(ev_key, probedp->ev_key, sizeof(ev_key));
     memcpy(ev_abs, probedp->ev_abs, sizeof(ev_abs));
- 
-    if(data != NULL)
-    {
-        abs = &data->abs;
-        key_buttons = &data->key_buttons[0];
-        
-        data->key._first = 0;
-        data->key._last = KEY_MAX;
-        data->key._buttons = data->key_buttons;
-    }
-    else
-    {
-        abs = &local_abs;
-        key_buttons = &local_key_buttons[0];
-    }
-    
     
     memset(abs, 0, sizeof(local_abs));
     memset(key_buttons, 0, sizeof(local_key_buttons));
@@ -288,8 +342,8 @@ static BOOL xinput_linux_evdev_generic_translate(const struct xinput_linux_evdev
     
     if(bit_get(ev_abs, ABS_X) && bit_get(ev_abs, ABS_Y))
     {
-        bit_clear(ev_key, ABS_X);
-        bit_clear(ev_key, ABS_Y);
+        bit_clear(ev_abs, ABS_X);
+        bit_clear(ev_abs, ABS_Y);
         XINPUT_GAMEPAD_ABS_SET_AXIS(abs, ABS_X, sThumbLX);
         XINPUT_GAMEPAD_ABS_SET_SIXA(abs, ABS_Y, sThumbLY);
         axis |= ABS_TLX|ABS_TLY;
@@ -297,8 +351,8 @@ static BOOL xinput_linux_evdev_generic_translate(const struct xinput_linux_evdev
     
     if(bit_get(ev_abs, ABS_RX) && bit_get(ev_abs, ABS_RY))
     {
-        bit_clear(ev_key, ABS_RX);
-        bit_clear(ev_key, ABS_RY);
+        bit_clear(ev_abs, ABS_RX);
+        bit_clear(ev_abs, ABS_RY);
         XINPUT_GAMEPAD_ABS_SET_AXIS(abs, ABS_RX, sThumbRX);
         XINPUT_GAMEPAD_ABS_SET_SIXA(abs, ABS_RY, sThumbRY);
         axis |= ABS_TRX|ABS_TRY;
@@ -306,15 +360,15 @@ static BOOL xinput_linux_evdev_generic_translate(const struct xinput_linux_evdev
     
     if(bit_get(ev_abs, ABS_Z))
     {
-        bit_clear(ev_key, ABS_Z);
-        XINPUT_GAMEPAD_ABS_SET_AXIS(abs, ABS_Z, bLeftTrigger);
+        bit_clear(ev_abs, ABS_Z);
+        XINPUT_GAMEPAD_ABS_SET_TRIG(abs, ABS_Z, bLeftTrigger);
         axis |= ABS_TL;
     }
     
     if(bit_get(ev_abs, ABS_RZ))
     {
-        bit_clear(ev_key, ABS_RZ);
-        XINPUT_GAMEPAD_ABS_SET_AXIS(abs, ABS_RZ, bRightTrigger);
+        bit_clear(ev_abs, ABS_RZ);
+        XINPUT_GAMEPAD_ABS_SET_TRIG(abs, ABS_RZ, bRightTrigger);
         axis |= ABS_TR;
     }
     
@@ -385,7 +439,7 @@ static BOOL xinput_linux_evdev_generic_translate(const struct xinput_linux_evdev
     
     {
         int ax = 1;
-        for(int abs_index = 0; axis != ABS_ALL; ++abs_index)
+        for(int abs_index = 0; (axis != ABS_ALL) && (abs_index < ABS_CNT); ++abs_index)
         {
             if(bit_get(ev_abs, abs_index))
             {
@@ -398,35 +452,60 @@ static BOOL xinput_linux_evdev_generic_translate(const struct xinput_linux_evdev
                         switch(ax)
                         {
                             case ABS_TLX:
-                                XINPUT_GAMEPAD_ABS_SET_AXIS(abs, ax, sThumbLX);
+                                XINPUT_GAMEPAD_ABS_SET_AXIS(abs, abs_index, sThumbLX);
                                 break;
                             case ABS_TLY:
-                                XINPUT_GAMEPAD_ABS_SET_SIXA(abs, ax, sThumbLY);
+                                XINPUT_GAMEPAD_ABS_SET_SIXA(abs, abs_index, sThumbLY);
                                 break;
                             case ABS_TRX:
-                                XINPUT_GAMEPAD_ABS_SET_AXIS(abs, ax, sThumbRX);
+                                XINPUT_GAMEPAD_ABS_SET_AXIS(abs, abs_index, sThumbRX);
                                 break;
                             case ABS_TRY:
-                                XINPUT_GAMEPAD_ABS_SET_SIXA(abs, ax, sThumbRY);
+                                XINPUT_GAMEPAD_ABS_SET_SIXA(abs, abs_index, sThumbRY);
                                 break;
                             case ABS_TL:
-                                XINPUT_GAMEPAD_ABS_SET_AXIS(abs, ax, sThumbLX);
+                                XINPUT_GAMEPAD_ABS_SET_TRIG(abs, abs_index, bLeftTrigger);
                                 break;
                             case ABS_TR:
-                                XINPUT_GAMEPAD_ABS_SET_AXIS(abs, ax, sThumbLY);
+                                XINPUT_GAMEPAD_ABS_SET_TRIG(abs, abs_index, bRightTrigger);
                                 break;
                         }
                         
                         axis |= ax;
+                        break;
                     }
                 }
             }
         }
     }
     
+    if((buttons != BUTTONS_ALL) || (axis != ABS_ALL))
+    {
+        return FALSE;
+    }
     
+    if(data != NULL)
+    {
+        struct xinput_linux_evdev_translator_key_translator key = { 0, KEY_MAX, key_buttons };
+        
+        // the ranges of the axes, as probed
+        
+        for(int abs_index = 0; abs_index < ABS_CNT; ++abs_index)
+        {
+            if(bit_get(probedp->ev_abs, abs_index))
+            {
+                xinput_linux_evdev_translator_abs_calibrate(&abs->_item[abs_index], &probedp->absinfo[abs_index]);
+            }
+        }
+        
+        if(xinput_linux_evdev_translator_compile(&data->translator, abs, &key) != 0)
+        {
+            TRACE("%s: too many axes or keys mapped\n", probedp->device_name);
+            return FALSE;
+        }
+    }
     
-    return (buttons == BUTTONS_ALL) && (axis == ABS_ALL);
+    return TRUE;
 }
 
 BOOL xinput_linux_evdev_generic_can_translate(const struct xinput_linux_evdev_probe_s* probed)
@@ -434,6 +513,33 @@ BOOL xinput_linux_evdev_generic_can_translate(const struct xinput_linux_evdev_pr
     return xinput_linux_evdev_generic_translate(probed, NULL);
 }
 
+/**
+ * Asks the kernel to only send the events the translator maps.
+ */
+
+static void xinput_linux_evdev_generic_mask(const struct xinput_linux_evdev_probe_s* probed, xinput_linux_evdev_generic_data* data, int fd)
+{
+    int ret;
+
+    if((ret = xinput_linux_evdev_translator_compiled_mask(&data->translator, fd, probed->ev_all)) != 0)
+    {
+        TRACE("%s: events not masked: %s\n", probed->device_name, strerror(ret));
+        return;
+    }
+
+    data->masked = TRUE;
+
+    for(int code = 0; code < KEY_CNT; ++code)
+    {
+        data->codes_masked += bit_get(probed->ev_key, code) && (xinput_linux_evdev_translator_compiled_key(&data->translator, code) == 0);
+    }
+
+    for(int code = 0; code < ABS_CNT; ++code)
+    {
+        data->codes_masked += bit_get(probed->ev_abs, code) && (data->translator.abs_op[code] == 0);
+    }
+}
+
 BOOL xinput_linux_evdev_generic_new_instance(const struct xinput_linux_evdev_probe_s* probed, int fd, xinput_gamepad_device* instance)
 {
     xinput_linux_evdev_generic_data *data = (xinput_linux_evdev_generic_data*)malloc(sizeof(xinput_linux_evdev_generic_data));
@@ -442,7 +548,10 @@ BOOL xinput_linux_evdev_generic_new_instance(const struct xinput_linux_evdev_pro
     ret = xinput_linux_evdev_generic_translate(probed, data);
     if(ret)
     {
-        data->fd = fd;
+        xinput_linux_evdev_reader_init(&data->reader, fd);
+        xinput_linux_evdev_rumbler_init(&data->rumbler, xinput_linux_evdev_rumbler_period(probed));
+        xinput_linux_evdev_generic_mask(probed, data, fd);
+        xinput_linux_evdev_translator_compiled_noise(&data->translator, fd, &data->noise);
         instance->data = data;
         instance->vtbl = &xinput_xboxpad_vtbl;
     }
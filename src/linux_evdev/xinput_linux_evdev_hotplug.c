@@ -0,0 +1,323 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#if HAVE_LINUX_INPUT_H
+
+#include "xinput_settings.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#if HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#if HAVE_WINE
+#include "wine/debug.h"
+#endif
+
+#include "xinput.h"
+#include "tools.h"
+#include "debug.h"
+
+#include "xinput_linux_evdev_hotplug.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(xinput);
+
+static BOOL xinput_linux_evdev_hotplug_matches(const char* name, const char* suffix)
+{
+    size_t name_len;
+    size_t suffix_len;
+
+    if(name[0] == '.')
+    {
+        return FALSE;
+    }
+
+    if(suffix == NULL)
+    {
+        return TRUE;
+    }
+
+    name_len = strlen(name);
+    suffix_len = strlen(suffix);
+
+    return (name_len >= suffix_len) && (memcmp(&name[name_len - suffix_len], suffix, suffix_len) == 0);
+}
+
+static void xinput_linux_evdev_hotplug_notify(const char* directory, const char* name, xinput_linux_evdev_hotplug_callback* callback, void* args)
+{
+    char path[PATH_MAX];
+
+    if(snprintf(path, sizeof(path), "%s/%s", directory, name) >= (int)sizeof(path))
+    {
+        /* will not be able to handle the name (path buffer is too small) */
+        TRACE("%s/%s is bigger than expected\n", directory, name);
+        return;
+    }
+
+    callback(path, args);
+}
+
+int xinput_linux_evdev_hotplug_scan(const char* directory, const char* suffix, xinput_linux_evdev_hotplug_callback* callback, void* args)
+{
+    DIR* devices_dir = opendir(directory);
+
+    if(devices_dir == NULL)
+    {
+        return errno;
+    }
+
+    for(;;)
+    {
+        const struct dirent* dir_entry = readdir(devices_dir);
+
+        if(dir_entry == NULL)
+        {
+            break;
+        }
+
+        if(xinput_linux_evdev_hotplug_matches(dir_entry->d_name, suffix))
+        {
+            xinput_linux_evdev_hotplug_notify(directory, dir_entry->d_name, callback, args);
+        }
+    }
+
+    closedir(devices_dir);
+
+    return 0;
+}
+
+#if HAVE_SYS_INOTIFY_H
+
+/* udev creates the by-path links once the node is ready, renames cover atomic links */
+
+#define XINPUT_LINUX_EVDEV_HOTPLUG_DIRECTORY_EVENTS (IN_CREATE|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF)
+#define XINPUT_LINUX_EVDEV_HOTPLUG_PARENT_EVENTS    (IN_CREATE|IN_MOVED_TO)
+
+/**
+ * Watches the directory or, if it does not exist, its parent.
+ *
+ * @return TRUE if the directory itself is watched
+ */
+
+static BOOL xinput_linux_evdev_hotplug_watch(xinput_linux_evdev_hotplug* hotplug)
+{
+    hotplug->directory_wd = inotify_add_watch(hotplug->fd, hotplug->directory, XINPUT_LINUX_EVDEV_HOTPLUG_DIRECTORY_EVENTS|IN_ONLYDIR);
+
+    if(hotplug->directory_wd >= 0)
+    {
+        if(hotplug->parent_wd >= 0)
+        {
+            inotify_rm_watch(hotplug->fd, hotplug->parent_wd);
+            hotplug->parent_wd = -1;
+        }
+
+        return TRUE;
+    }
+
+    if(hotplug->parent_wd < 0)
+    {
+        char parent[PATH_MAX];
+        char* slash;
+
+        memcpy(parent, hotplug->directory, sizeof(parent));
+
+        if((slash = strrchr(parent, '/')) != NULL)
+        {
+            if(slash == parent)
+            {
+                ++slash;
+            }
+
+            *slash = '\0';
+        }
+        else
+        {
+            strcpy(parent, ".");
+        }
+
+        hotplug->parent_wd = inotify_add_watch(hotplug->fd, parent, XINPUT_LINUX_EVDEV_HOTPLUG_PARENT_EVENTS|IN_ONLYDIR);
+
+        if(hotplug->parent_wd < 0)
+        {
+            int err = errno;
+            TRACE("cannot watch %s: %s\n", parent, strerror(err));
+        }
+    }
+
+    return FALSE;
+}
+
+int xinput_linux_evdev_hotplug_open(xinput_linux_evdev_hotplug* hotplug, const char* directory, const char* suffix)
+{
+    size_t directory_len = strlen(directory);
+
+    if(directory_len >= sizeof(hotplug->directory))
+    {
+        return ENAMETOOLONG;
+    }
+
+    memcpy(hotplug->directory, directory, directory_len + 1);
+    hotplug->suffix = suffix;
+    hotplug->directory_wd = -1;
+    hotplug->parent_wd = -1;
+
+    hotplug->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if(hotplug->fd < 0)
+    {
+        return errno;
+    }
+
+    xinput_linux_evdev_hotplug_watch(hotplug);
+
+    if((hotplug->directory_wd < 0) && (hotplug->parent_wd < 0))
+    {
+        close_ex(hotplug->fd);
+        hotplug->fd = -1;
+        return ENOENT;
+    }
+
+    return 0;
+}
+
+int xinput_linux_evdev_hotplug_read(xinput_linux_evdev_hotplug* hotplug, xinput_linux_evdev_hotplug_callback* callback, void* args)
+{
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    BOOL rescan = FALSE;
+
+    for(;;)
+    {
+        ssize_t n = read(hotplug->fd, buffer, sizeof(buffer));
+
+        if(n < 0)
+        {
+            int err = errno;
+
+            if(err == EINTR)
+            {
+                continue;
+            }
+
+            if(err != EAGAIN)
+            {
+                return err;
+            }
+
+            break;
+        }
+
+        for(char* p = buffer; p < &buffer[n];)
+        {
+            const struct inotify_event* ie = (const struct inotify_event*)p;
+
+            p += sizeof(struct inotify_event) + ie->len;
+
+            if(ie->mask & IN_Q_OVERFLOW)
+            {
+                /* lost track of what happened */
+                rescan = TRUE;
+            }
+            else if(ie->wd == hotplug->directory_wd)
+            {
+                if(ie->mask & (IN_DELETE_SELF|IN_MOVE_SELF))
+                {
+                    /* the directory will be back with the next device */
+                    inotify_rm_watch(hotplug->fd, hotplug->directory_wd);
+                    hotplug->directory_wd = -1;
+                    xinput_linux_evdev_hotplug_watch(hotplug);
+                }
+                else if((ie->len > 0) && xinput_linux_evdev_hotplug_matches(ie->name, hotplug->suffix))
+                {
+                    xinput_linux_evdev_hotplug_notify(hotplug->directory, ie->name, callback, args);
+                }
+            }
+            else if((ie->wd == hotplug->parent_wd) && (ie->len > 0))
+            {
+                const char* base = strrchr(hotplug->directory, '/');
+                base = (base != NULL)?base + 1:hotplug->directory;
+
+                if((strcmp(ie->name, base) == 0) && xinput_linux_evdev_hotplug_watch(hotplug))
+                {
+                    /* nodes may have been created before the watch was set */
+                    rescan = TRUE;
+                }
+            }
+        }
+    }
+
+    if(rescan && (hotplug->directory_wd >= 0))
+    {
+        xinput_linux_evdev_hotplug_scan(hotplug->directory, hotplug->suffix, callback, args);
+    }
+
+    return 0;
+}
+
+void xinput_linux_evdev_hotplug_close(xinput_linux_evdev_hotplug* hotplug)
+{
+    if(hotplug->fd >= 0)
+    {
+        close_ex(hotplug->fd);
+        hotplug->fd = -1;
+    }
+
+    hotplug->directory_wd = -1;
+    hotplug->parent_wd = -1;
+}
+
+#else
+
+int xinput_linux_evdev_hotplug_open(xinput_linux_evdev_hotplug* hotplug, const char* directory, const char* suffix)
+{
+    (void)directory;
+    (void)suffix;
+    hotplug->fd = -1;
+    return ENOSYS;
+}
+
+int xinput_linux_evdev_hotplug_read(xinput_linux_evdev_hotplug* hotplug, xinput_linux_evdev_hotplug_callback* callback, void* args)
+{
+    (void)hotplug;
+    (void)callback;
+    (void)args;
+    return ENOSYS;
+}
+
+void xinput_linux_evdev_hotplug_close(xinput_linux_evdev_hotplug* hotplug)
+{
+    hotplug->fd = -1;
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+
+#endif /* HAVE_LINUX_INPUT_H */
@@ -0,0 +1,113 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef XINPUT_LINUX_EVDEV_HOTPLUG_H
+#define XINPUT_LINUX_EVDEV_HOTPLUG_H
+
+#include <limits.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Watches a device directory (ie: /dev/input/by-path) with inotify and
+ * reports the nodes appearing in it, so that only these are probed.
+ *
+ * If the directory does not exist yet (no input device has been plugged
+ * since boot) its parent is watched until it is created.
+ */
+
+struct xinput_linux_evdev_hotplug
+{
+    int fd;
+    int directory_wd;
+    int parent_wd;
+    const char* suffix;
+    char directory[PATH_MAX];
+};
+
+typedef struct xinput_linux_evdev_hotplug xinput_linux_evdev_hotplug;
+
+/**
+ * Called for each node found, with its full path.
+ */
+
+typedef void xinput_linux_evdev_hotplug_callback(const char* path, void* args);
+
+/**
+ * Starts watching a directory.
+ *
+ * @param hotplug
+ * @param directory the directory to watch
+ * @param suffix only the names ending with this are reported, can be NULL
+ *
+ * @return 0 or an error code
+ */
+
+int xinput_linux_evdev_hotplug_open(xinput_linux_evdev_hotplug* hotplug, const char* directory, const char* suffix);
+
+/**
+ * Reads all the pending notifications and calls the callback for every new
+ * node.  If the directory has just been created or notifications were lost,
+ * the whole directory is scanned.
+ * Does not block.
+ *
+ * @param hotplug
+ * @param callback
+ * @param args passed to the callback
+ *
+ * @return 0 or an error code
+ */
+
+int xinput_linux_evdev_hotplug_read(xinput_linux_evdev_hotplug* hotplug, xinput_linux_evdev_hotplug_callback* callback, void* args);
+
+/**
+ * Calls the callback for every matching node of a directory.
+ *
+ * @param directory
+ * @param suffix only the names ending with this are reported, can be NULL
+ * @param callback
+ * @param args passed to the callback
+ *
+ * @return 0 or an error code
+ */
+
+int xinput_linux_evdev_hotplug_scan(const char* directory, const char* suffix, xinput_linux_evdev_hotplug_callback* callback, void* args);
+
+/**
+ * Stops watching.
+ *
+ * @param hotplug
+ */
+
+void xinput_linux_evdev_hotplug_close(xinput_linux_evdev_hotplug* hotplug);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* XINPUT_LINUX_EVDEV_HOTPLUG_H */
@@ -0,0 +1,309 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#if HAVE_LINUX_INPUT_H
+
+#include "xinput_settings.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#if HAVE_WINE
+#include "wine/debug.h"
+#endif
+
+#include "xinput.h"
+#include "tools.h"
+#include "debug.h"
+
+#include "xinput_linux_evdev.h"
+#include "xinput_linux_evdev_generic.h"
+#include "xinput_linux_evdev_record.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(xinput);
+
+int xinput_linux_evdev_record_create(const char* path, const struct xinput_linux_evdev_probe_s* probed)
+{
+    xinput_linux_evdev_record_header header;
+    int fd;
+    int err;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = XINPUT_LINUX_EVDEV_RECORD_MAGIC;
+    header.version = XINPUT_LINUX_EVDEV_RECORD_VERSION;
+    header.header_size = sizeof(header);
+    header.probe_size = sizeof(header.probed);
+    header.event_size = sizeof(struct input_event);
+    memcpy(&header.probed, probed, sizeof(header.probed));
+
+    if((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) < 0)
+    {
+        return -1;
+    }
+
+    if((err = write_fully(fd, &header, sizeof(header))) != 0)
+    {
+        close_ex(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+int xinput_linux_evdev_record_write(int fd, const struct input_event* events, int count)
+{
+    return write_fully(fd, events, count * sizeof(struct input_event));
+}
+
+int xinput_linux_evdev_record_open(const char* path, struct xinput_linux_evdev_probe_s* probed)
+{
+    xinput_linux_evdev_record_header header;
+    int fd;
+    int err;
+
+    if((fd = open(path, O_RDONLY|O_CLOEXEC)) < 0)
+    {
+        return -1;
+    }
+
+    if((err = read_fully(fd, &header, sizeof(header))) != 0)
+    {
+        close_ex(fd);
+        errno = (err == ENODATA)?EPROTO:err;
+        return -1;
+    }
+
+    if( (header.magic != XINPUT_LINUX_EVDEV_RECORD_MAGIC) ||
+        (header.version != XINPUT_LINUX_EVDEV_RECORD_VERSION) ||
+        (header.header_size != sizeof(header)) ||
+        (header.probe_size != sizeof(header.probed)) ||
+        (header.event_size != sizeof(struct input_event)) )
+    {
+        TRACE("%s: not a recording of this version/architecture\n", path);
+        close_ex(fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    memcpy(probed, &header.probed, sizeof(*probed));
+
+    return fd;
+}
+
+struct xinput_linux_evdev_replay_feeder
+{
+    int from;
+    int to;
+    int err;
+};
+
+typedef struct xinput_linux_evdev_replay_feeder xinput_linux_evdev_replay_feeder;
+
+/*
+ * Sends the recording to the device one frame at a time, each when it is due.
+ * The socket keeps the frames apart, as evdev does.
+ */
+
+static void* xinput_linux_evdev_replay_feeder_thread(void* args)
+{
+    xinput_linux_evdev_replay_feeder* feeder = (xinput_linux_evdev_replay_feeder*)args;
+    struct input_event frame[XINPUT_EVDEV_READ_EVENTS];
+    int count = 0;
+    int64_t start_us = timeus();
+    int64_t first_us = -1;
+    int err;
+
+    while((err = read_fully(feeder->from, &frame[count], sizeof(frame[count]))) == 0)
+    {
+        const struct input_event* ie = &frame[count++];
+
+        if(((ie->type == EV_SYN) && (ie->code == SYN_REPORT)) || (count == XINPUT_EVDEV_READ_EVENTS))
+        {
+            int64_t at_us = ie->input_event_sec * 1000000LL + ie->input_event_usec;
+            int64_t wait_us;
+
+            if(first_us < 0)
+            {
+                first_us = at_us;
+            }
+
+            wait_us = start_us + (at_us - first_us) - timeus();
+
+            if(wait_us > 0)
+            {
+                usleep(wait_us);
+            }
+
+            if(send(feeder->to, frame, count * sizeof(frame[0]), MSG_NOSIGNAL) < 0)
+            {
+                err = errno;
+                break;
+            }
+
+            count = 0;
+        }
+    }
+
+    if(err == ENODATA)
+    {
+        /* the end of the recording */
+
+        err = 0;
+    }
+
+    feeder->err = err;
+    shutdown(feeder->to, SHUT_WR);
+
+    return NULL;
+}
+
+int xinput_linux_evdev_replay(const char* path, BOOL realtime, xinput_linux_evdev_replay_callback* callback, void* args, xinput_linux_evdev_replay_report* report)
+{
+    struct xinput_linux_evdev_probe_s probed;
+    xinput_gamepad_device device = {NULL, NULL};
+    xinput_gamepad_device_statistics stats;
+    xinput_linux_evdev_replay_feeder feeder = {-1, -1, 0};
+    pthread_t feeder_tid;
+    XINPUT_GAMEPAD_EX gamepad;
+    int64_t start;
+    int fd;
+    int device_fd;
+    int ret;
+
+    memset(report, 0, sizeof(*report));
+
+    if((fd = xinput_linux_evdev_record_open(path, &probed)) < 0)
+    {
+        return errno;
+    }
+
+    if(!xinput_linux_evdev_generic_can_translate(&probed))
+    {
+        TRACE("%s: the generic device cannot translate %s\n", path, probed.device_name);
+        close_ex(fd);
+        return ENOTSUP;
+    }
+
+    device_fd = fd;
+
+    /* the feeder paces the frames from its own start */
+
+    start = timeus();
+
+    if(realtime)
+    {
+        int sv[2];
+
+        if(socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) < 0)
+        {
+            ret = errno;
+            close_ex(fd);
+            return ret;
+        }
+
+        feeder.from = fd;
+        feeder.to = sv[1];
+
+        if((ret = pthread_create(&feeder_tid, NULL, xinput_linux_evdev_replay_feeder_thread, &feeder)) != 0)
+        {
+            close_ex(sv[0]);
+            close_ex(sv[1]);
+            close_ex(fd);
+            return ret;
+        }
+
+        device_fd = sv[0];
+    }
+
+    if(xinput_linux_evdev_generic_new_instance(&probed, device_fd, &device))
+    {
+        memset(&gamepad, 0, sizeof(gamepad));
+
+        if(!realtime)
+        {
+            start = timeus();
+        }
+
+        while((ret = device.vtbl->read(&device)) == 0)
+        {
+            device.vtbl->update(&device, &gamepad, NULL);
+
+            ++report->frames;
+
+            if(callback != NULL)
+            {
+                callback(report->frames, &gamepad, device.vtbl->get_event_us(&device), args);
+            }
+        }
+
+        report->elapsed_us = timeus() - start;
+
+        memset(&stats, 0, sizeof(stats));
+        device.vtbl->statistics(&device, &stats);
+        report->events = stats.events;
+        report->events_unmapped = stats.events_unmapped;
+        report->reads = stats.reads;
+
+        /* closes device_fd */
+
+        device.vtbl->release(&device);
+
+        if(ret == ENODEV)
+        {
+            /* the end of the recording */
+
+            ret = 0;
+        }
+    }
+    else
+    {
+        close_ex(device_fd);
+        ret = ENOTSUP;
+    }
+
+    if(realtime)
+    {
+        pthread_join(feeder_tid, NULL);
+        close_ex(feeder.to);
+        close_ex(fd);
+
+        if((ret == 0) && (feeder.err != 0) && (feeder.err != EPIPE))
+        {
+            ret = feeder.err;
+        }
+    }
+
+    return ret;
+}
+
+#endif /* HAVE_LINUX_INPUT_H */
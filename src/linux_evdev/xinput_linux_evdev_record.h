@@ -0,0 +1,140 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef XINPUT_LINUX_EVDEV_RECORD_H
+#define XINPUT_LINUX_EVDEV_RECORD_H
+
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "xinput.h"
+#include "xinput_linux_evdev.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A recording of a device: this header, with the probe of the device, then
+ * the struct input_event as read from it, timestamps included.
+ *
+ * The structures are written as they are in memory, the sizes in the header
+ * tell if a recording can be read back on this architecture.
+ */
+
+#define XINPUT_LINUX_EVDEV_RECORD_MAGIC     0x43455258 /* XREC */
+#define XINPUT_LINUX_EVDEV_RECORD_VERSION   1
+
+struct xinput_linux_evdev_record_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t probe_size;
+    uint32_t event_size;
+    uint32_t reserved;
+    struct xinput_linux_evdev_probe_s probed;
+};
+
+typedef struct xinput_linux_evdev_record_header xinput_linux_evdev_record_header;
+
+/**
+ * Creates a recording.
+ *
+ * @param path
+ * @param probed the probe of the device recorded
+ *
+ * @return the file descriptor to write the events to, or -1 (errno is set)
+ */
+
+int xinput_linux_evdev_record_create(const char* path, const struct xinput_linux_evdev_probe_s* probed);
+
+/**
+ * Appends events to a recording.
+ *
+ * @param fd
+ * @param events
+ * @param count
+ *
+ * @return 0 or an error code
+ */
+
+int xinput_linux_evdev_record_write(int fd, const struct input_event* events, int count);
+
+/**
+ * Opens a recording.
+ *
+ * @param path
+ * @param probed receives the probe of the device recorded
+ *
+ * @return the file descriptor positioned on the first event, or -1 (errno
+ * is set, EPROTO if it is not a recording this build can read)
+ */
+
+int xinput_linux_evdev_record_open(const char* path, struct xinput_linux_evdev_probe_s* probed);
+
+/**
+ * Called with the state of the gamepad after each frame of a replay, and the
+ * time the frame has been recorded at.
+ */
+
+typedef void xinput_linux_evdev_replay_callback(uint64_t frame, const XINPUT_GAMEPAD_EX* gamepad, int64_t event_us, void* args);
+
+struct xinput_linux_evdev_replay_report
+{
+    uint64_t frames;
+    uint64_t events;
+    uint64_t events_unmapped;
+    uint64_t reads;
+    int64_t elapsed_us;
+};
+
+typedef struct xinput_linux_evdev_replay_report xinput_linux_evdev_replay_report;
+
+/**
+ * Plays a recording through the generic device, as if it came from the
+ * device itself.
+ *
+ * At max speed, the device reads the recording directly.
+ * In real time, the events are fed to it through a socket, each frame at the
+ * time it has been recorded, relative to the first one.
+ *
+ * @param path
+ * @param realtime
+ * @param callback called after every frame, can be NULL
+ * @param args passed to the callback
+ * @param report receives the counters of the replay
+ *
+ * @return 0 or an error code
+ */
+
+int xinput_linux_evdev_replay(const char* path, BOOL realtime, xinput_linux_evdev_replay_callback* callback, void* args, xinput_linux_evdev_replay_report* report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* XINPUT_LINUX_EVDEV_RECORD_H */
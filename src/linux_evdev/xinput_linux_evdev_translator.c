@@ -30,6 +30,10 @@
 
 #include "xinput_settings.h"
 
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
 #if HAVE_WINE
 #include "wine/debug.h"
 #endif
@@ -42,7 +46,7 @@
 
 WINE_DEFAULT_DEBUG_CHANNEL(xinput);
 
-void xinput_linux_evdev_translator_abs_translate_nothing(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX* gamepad, int16_t value)
+void xinput_linux_evdev_translator_abs_translate_nothing(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX* gamepad, int32_t value)
 {
     (void)item;
     (void)gamepad;
@@ -50,25 +54,38 @@ void xinput_linux_evdev_translator_abs_translate_nothing(const struct xinput_lin
     FIXME("ABS input not supported\n");
 }
 
-void xinput_linux_evdev_translator_abs_translate_to_axis(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX* gamepad, int16_t value)
+void xinput_linux_evdev_translator_abs_translate_to_axis(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX* gamepad, int32_t value)
 {
     SHORT* p;
     char* base = (char*)gamepad;
     base += item->to;
     p = (SHORT*)base;
-    *p = value;
+    *p = (SHORT)xinput_linux_evdev_translator_abs_calibrated(&item->calibration, value);
 }
 
-void xinput_linux_evdev_translator_abs_translate_to_axis_reverse(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX* gamepad, int16_t value)
+/*
+ * The reversal is in the calibration.
+ */
+
+void xinput_linux_evdev_translator_abs_translate_to_axis_reverse(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX* gamepad, int32_t value)
 {
     SHORT* p;
     char* base = (char*)gamepad;
     base += item->to;
     p = (SHORT*)base;
-    *p = ~value;
+    *p = (SHORT)xinput_linux_evdev_translator_abs_calibrated(&item->calibration, value);
 }
 
-void xinput_linux_evdev_translator_abs_translate_to_buttons(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX* gamepad, int16_t value)
+void xinput_linux_evdev_translator_abs_translate_to_trigger(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX* gamepad, int32_t value)
+{
+    BYTE* p;
+    char* base = (char*)gamepad;
+    base += item->to;
+    p = (BYTE*)base;
+    *p = (BYTE)xinput_linux_evdev_translator_abs_calibrated(&item->calibration, value);
+}
+
+void xinput_linux_evdev_translator_abs_translate_to_buttons(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX* gamepad, int32_t value)
 {
     if(value > 0)
     {
@@ -88,7 +105,13 @@ void
 xinput_linux_evdev_translator_abs_input_event_to_gamepad(const struct xinput_linux_evdev_translator_abs_translator* translator, const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad)
 {
     const struct xinput_linux_evdev_translator_abs_translator_item* line = &translator->_item[ie->code];
-    line->translate(line, gamepad, ie->value);
+
+    /* axis the translator did not map */
+
+    if(line->translate != NULL)
+    {
+        line->translate(line, gamepad, ie->value);
+    }
 }
 
 void
@@ -108,28 +131,422 @@ xinput_linux_evdev_translator_key_input_event_to_gamepad(const struct xinput_lin
     }
 }
 
+void xinput_linux_evdev_translator_resync(const struct xinput_linux_evdev_translator_abs_translator* abs, const struct xinput_linux_evdev_translator_key_translator* key, int fd, XINPUT_GAMEPAD_EX* gamepad)
+{
+    struct input_event ie;
+    uint8_t key_state[KEY_CNT>>3];
+
+    memset(&ie, 0, sizeof(ie));
+
+    if(ioctl(fd, EVIOCGKEY(sizeof(key_state)), key_state) >= 0)
+    {
+        ie.type = EV_KEY;
+
+        for(int code = key->_first; code <= key->_last; ++code)
+        {
+            if(key->_buttons[code - key->_first] != 0)
+            {
+                ie.code = code;
+                ie.value = bit_get(key_state, code);
+                xinput_linux_evdev_translator_key_input_event_to_gamepad(key, &ie, gamepad);
+            }
+        }
+    }
+    else
+    {
+        TRACE("could not get keys state: %s\n", strerror(errno));
+    }
+
+    ie.type = EV_ABS;
+
+    for(int code = 0; code < ABS_CNT; ++code)
+    {
+        const struct xinput_linux_evdev_translator_abs_translator_item* line = &abs->_item[code];
+        struct input_absinfo absinfo;
+
+        if((line->translate == NULL) || (line->translate == &xinput_linux_evdev_translator_abs_translate_nothing))
+        {
+            continue;
+        }
+
+        if(ioctl(fd, EVIOCGABS(code), &absinfo) >= 0)
+        {
+            ie.code = code;
+            ie.value = absinfo.value;
+            xinput_linux_evdev_translator_abs_input_event_to_gamepad(abs, &ie, gamepad);
+        }
+    }
+}
+
+int xinput_linux_evdev_translator_compile(struct xinput_linux_evdev_translator_compiled* compiled, const struct xinput_linux_evdev_translator_abs_translator* abs, const struct xinput_linux_evdev_translator_key_translator* key)
+{
+    memset(compiled, 0, sizeof(*compiled));
+
+    for(int index = 0; index < XINPUT_EVDEV_TRANSLATOR_KEY_OPS; ++index)
+    {
+        compiled->key_code[index] = XINPUT_LINUX_EVDEV_TRANSLATOR_KEY_NONE;
+    }
+
+    for(int code = 0; code < ABS_CNT; ++code)
+    {
+        const struct xinput_linux_evdev_translator_abs_translator_item* line = &abs->_item[code];
+        struct xinput_linux_evdev_translator_op* op;
+        uint16_t kind;
+
+        switch(line->kind)
+        {
+            case XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS:
+            case XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS_REVERSE:
+            {
+                kind = XINPUT_LINUX_EVDEV_TRANSLATOR_OP_AXIS;
+                break;
+            }
+            case XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_TRIGGER:
+            {
+                kind = XINPUT_LINUX_EVDEV_TRANSLATOR_OP_TRIGGER;
+                break;
+            }
+            case XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_BUTTONS:
+            {
+                kind = XINPUT_LINUX_EVDEV_TRANSLATOR_OP_BUTTONS;
+                break;
+            }
+            default:
+            {
+                continue;
+            }
+        }
+
+        if(compiled->abs_count == XINPUT_EVDEV_TRANSLATOR_ABS_OPS)
+        {
+            return ENOSPC;
+        }
+
+        op = &compiled->abs_ops[++compiled->abs_count];
+        op->calibration = line->calibration;
+        op->to = (uint16_t)line->to;
+        op->kind = kind;
+        op->positive = line->positive;
+        op->negative = line->negative;
+        compiled->abs_op[code] = (uint8_t)compiled->abs_count;
+    }
+
+    /* in increasing order of code, as the lookup expects */
+
+    for(int code = key->_first; code <= key->_last; ++code)
+    {
+        WORD buttons = key->_buttons[code - key->_first];
+
+        if(buttons == 0)
+        {
+            continue;
+        }
+
+        if(compiled->key_count == XINPUT_EVDEV_TRANSLATOR_KEY_OPS)
+        {
+            return ENOSPC;
+        }
+
+        compiled->key_code[compiled->key_count] = (uint16_t)code;
+        compiled->key_buttons[compiled->key_count] = buttons;
+        ++compiled->key_count;
+    }
+
+    return 0;
+}
+
+void xinput_linux_evdev_translator_compiled_resync(const struct xinput_linux_evdev_translator_compiled* compiled, int fd, XINPUT_GAMEPAD_EX* gamepad)
+{
+    struct input_event ie;
+    uint8_t key_state[KEY_CNT>>3];
+
+    memset(&ie, 0, sizeof(ie));
+
+    if(ioctl(fd, EVIOCGKEY(sizeof(key_state)), key_state) >= 0)
+    {
+        ie.type = EV_KEY;
+
+        for(int index = 0; index < compiled->key_count; ++index)
+        {
+            ie.code = compiled->key_code[index];
+            ie.value = bit_get(key_state, ie.code);
+            xinput_linux_evdev_translator_compiled_input_event_to_gamepad(compiled, &ie, gamepad);
+        }
+    }
+    else
+    {
+        TRACE("could not get keys state: %s\n", strerror(errno));
+    }
+
+    ie.type = EV_ABS;
+
+    for(int code = 0; code < ABS_CNT; ++code)
+    {
+        struct input_absinfo absinfo;
+
+        if(compiled->abs_op[code] == 0)
+        {
+            continue;
+        }
+
+        if(ioctl(fd, EVIOCGABS(code), &absinfo) >= 0)
+        {
+            ie.code = code;
+            ie.value = absinfo.value;
+            xinput_linux_evdev_translator_compiled_input_event_to_gamepad(compiled, &ie, gamepad);
+        }
+    }
+}
+
+int xinput_linux_evdev_translator_compiled_mask(const struct xinput_linux_evdev_translator_compiled* compiled, int fd, const uint8_t* types)
+{
+#ifdef EVIOCSMASK
+    uint8_t codes[KEY_CNT >> 3];
+    struct input_mask mask;
+
+    /* EV_SYN cannot be masked, and the kernel then drops the empty reports */
+
+    for(int type = EV_SYN + 1; type < EV_CNT; ++type)
+    {
+        if(!bit_get(types, type))
+        {
+            continue;
+        }
+
+        memset(codes, 0, sizeof(codes));
+
+        if(type == EV_KEY)
+        {
+            for(int index = 0; index < compiled->key_count; ++index)
+            {
+                bit_set(codes, compiled->key_code[index]);
+            }
+        }
+        else if(type == EV_ABS)
+        {
+            for(int code = 0; code < ABS_CNT; ++code)
+            {
+                if(compiled->abs_op[code] != 0)
+                {
+                    bit_set(codes, code);
+                }
+            }
+        }
+
+        /* the other types are not translated at all (ie: EV_MSC/MSC_SCAN) */
+
+        mask.type = type;
+        mask.codes_size = sizeof(codes);
+        mask.codes_ptr = (uintptr_t)codes;
+
+        if(ioctl(fd, EVIOCSMASK, &mask) < 0)
+        {
+            return errno;
+        }
+    }
+
+    return 0;
+#else
+    (void)compiled;
+    (void)fd;
+    (void)types;
+
+    return ENOTSUP;
+#endif
+}
+
+/**
+ * The noise of the control of the gamepad an operation writes, or NULL.
+ */
+
+static int32_t* xinput_linux_evdev_translator_noise_control(xinput_gamepad_device_noise* noise, const struct xinput_linux_evdev_translator_op* op)
+{
+    switch(op->to)
+    {
+        case offsetof(XINPUT_GAMEPAD_EX, sThumbLX): return &noise->thumb[0];
+        case offsetof(XINPUT_GAMEPAD_EX, sThumbLY): return &noise->thumb[1];
+        case offsetof(XINPUT_GAMEPAD_EX, sThumbRX): return &noise->thumb[2];
+        case offsetof(XINPUT_GAMEPAD_EX, sThumbRY): return &noise->thumb[3];
+        case offsetof(XINPUT_GAMEPAD_EX, bLeftTrigger): return &noise->trigger[0];
+        case offsetof(XINPUT_GAMEPAD_EX, bRightTrigger): return &noise->trigger[1];
+        default: return NULL;
+    }
+}
+
+void xinput_linux_evdev_translator_compiled_noise(const struct xinput_linux_evdev_translator_compiled* compiled, int fd, xinput_gamepad_device_noise* noise)
+{
+    memset(noise, 0, sizeof(*noise));
+
+    for(int code = 0; code < ABS_CNT; ++code)
+    {
+        const struct xinput_linux_evdev_translator_op* op = &compiled->abs_ops[compiled->abs_op[code]];
+        struct input_absinfo absinfo;
+        int32_t* control;
+        int64_t scale = (op->calibration.scale < 0)?-op->calibration.scale:op->calibration.scale;
+        int64_t value;
+
+        if(((op->kind != XINPUT_LINUX_EVDEV_TRANSLATOR_OP_AXIS) && (op->kind != XINPUT_LINUX_EVDEV_TRANSLATOR_OP_TRIGGER)) ||
+           (scale == 0) ||
+           ((control = xinput_linux_evdev_translator_noise_control(noise, op)) == NULL))
+        {
+            continue;
+        }
+
+        if(ioctl(fd, EVIOCGABS(code), &absinfo) < 0)
+        {
+            continue;
+        }
+
+#if XINPUT_EVDEV_NOISE_FUZZ
+        if(absinfo.fuzz == 0)
+        {
+            int64_t gate = (op->kind == XINPUT_LINUX_EVDEV_TRANSLATOR_OP_AXIS)?XINPUT_FILTER_NOISE_STICK:XINPUT_FILTER_NOISE_TRIGGER;
+
+            /* the gate in the units of the device, rounded up */
+
+            absinfo.fuzz = (int32_t)((gate * XINPUT_GAMEPAD_ABS_CALIBRATION_ONE + scale - 1) / scale);
+
+            if(ioctl(fd, EVIOCSABS(code), &absinfo) < 0)
+            {
+                TRACE("could not set the fuzz of axis %i: %s\n", code, strerror(errno));
+                absinfo.fuzz = 0;
+            }
+        }
+#endif
+
+        /* clamped to the range, so the product cannot overflow */
+
+        value = (int64_t)absinfo.fuzz;
+        value = (value > (int64_t)absinfo.maximum - absinfo.minimum)?(int64_t)absinfo.maximum - absinfo.minimum:value;
+        value = (value < 0)?0:value;
+        value = (value * scale + XINPUT_GAMEPAD_ABS_CALIBRATION_ONE - 1) / XINPUT_GAMEPAD_ABS_CALIBRATION_ONE;
+
+        if(value > *control)
+        {
+            *control = (int32_t)value;
+        }
+    }
+}
+
+void xinput_linux_evdev_translator_abs_calibrate(struct xinput_linux_evdev_translator_abs_translator_item* item, const struct input_absinfo* absinfo)
+{
+    struct xinput_linux_evdev_translator_abs_calibration* calibration = &item->calibration;
+    int64_t range = (int64_t)absinfo->maximum - absinfo->minimum;
+    int64_t low;
+    int64_t high;
+    BOOL centered;
+
+    switch(item->kind)
+    {
+        case XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS:
+        {
+            low = -32768;
+            high = 32767;
+            centered = TRUE;
+            break;
+        }
+        case XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS_REVERSE:
+        {
+            low = 32767;
+            high = -32768;
+            centered = TRUE;
+            break;
+        }
+        case XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_TRIGGER:
+        {
+            low = 0;
+            high = 255;
+            centered = FALSE;
+            break;
+        }
+        default:
+        {
+            return;
+        }
+    }
+
+    if(range <= 0)
+    {
+        /* nothing sensible can be made out of it: stuck at rest */
+
+        calibration->minimum = absinfo->minimum;
+        calibration->maximum = absinfo->minimum;
+        calibration->flat_low = 1;
+        calibration->flat_high = 0;
+        calibration->base = 0;
+        calibration->scale = 0;
+        return;
+    }
+
+    calibration->minimum = absinfo->minimum;
+    calibration->maximum = absinfo->maximum;
+    calibration->base = (int32_t)low;
+    calibration->scale = ((high - low) * XINPUT_GAMEPAD_ABS_CALIBRATION_ONE) / range;
+
+    /* the flat zone of a stick is around its middle, a trigger only rests at one end */
+
+    if(centered && (absinfo->flat > 0))
+    {
+        int64_t center = (int64_t)absinfo->minimum + range / 2;
+        int64_t flat_low = center - absinfo->flat;
+        int64_t flat_high = center + absinfo->flat;
+
+        calibration->flat_low = (flat_low < absinfo->minimum)?absinfo->minimum:(int32_t)flat_low;
+        calibration->flat_high = (flat_high > absinfo->maximum)?absinfo->maximum:(int32_t)flat_high;
+    }
+    else
+    {
+        calibration->flat_low = 1;
+        calibration->flat_high = 0;
+    }
+
+#if XINPUT_TRACE_DEVICE_DETECTION
+    TRACE("calibration: [%i; %i] flat %i -> [%lli; %lli]\n", absinfo->minimum, absinfo->maximum, absinfo->flat, (long long)low, (long long)high);
+#endif
+}
+
 void xinput_gamepad_abs_set_axis(struct xinput_linux_evdev_translator_abs_translator *abs, int bit, ssize_t offs)
 {
+    static const struct xinput_linux_evdev_translator_abs_calibration calibration = XINPUT_GAMEPAD_ABS_CALIBRATION_AXIS;
     abs->_item[bit].translate = &xinput_linux_evdev_translator_abs_translate_to_axis;
+    abs->_item[bit].kind = XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS;
     abs->_item[bit].to = offs;
     abs->_item[bit].positive = 0;
     abs->_item[bit].negative = 0;
+    abs->_item[bit].calibration = calibration;
 }
 
 void xinput_gamepad_abs_set_sixa(struct xinput_linux_evdev_translator_abs_translator *abs, int bit, ssize_t offs)
 {
+    static const struct xinput_linux_evdev_translator_abs_calibration calibration = XINPUT_GAMEPAD_ABS_CALIBRATION_SIXA;
     abs->_item[bit].translate = &xinput_linux_evdev_translator_abs_translate_to_axis_reverse;
+    abs->_item[bit].kind = XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS_REVERSE;
+    abs->_item[bit].to = offs;
+    abs->_item[bit].positive = 0;
+    abs->_item[bit].negative = 0;
+    abs->_item[bit].calibration = calibration;
+}
+
+void xinput_gamepad_abs_set_trig(struct xinput_linux_evdev_translator_abs_translator *abs, int bit, ssize_t offs)
+{
+    static const struct xinput_linux_evdev_translator_abs_calibration calibration = XINPUT_GAMEPAD_ABS_CALIBRATION_TRIG;
+    abs->_item[bit].translate = &xinput_linux_evdev_translator_abs_translate_to_trigger;
+    abs->_item[bit].kind = XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_TRIGGER;
     abs->_item[bit].to = offs;
     abs->_item[bit].positive = 0;
     abs->_item[bit].negative = 0;
+    abs->_item[bit].calibration = calibration;
 }
 
 void xinput_gamepad_abs_set_bttn(struct xinput_linux_evdev_translator_abs_translator *abs, int bit, int16_t pos, int16_t neg)
 {
+    static const struct xinput_linux_evdev_translator_abs_calibration calibration = XINPUT_GAMEPAD_ABS_CALIBRATION_NONE;
     abs->_item[bit].translate = &xinput_linux_evdev_translator_abs_translate_to_buttons;
+    abs->_item[bit].kind = XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_BUTTONS;
     abs->_item[bit].to = 0;
     abs->_item[bit].positive = pos;
     abs->_item[bit].negative = neg;
+    abs->_item[bit].calibration = calibration;
 }
 
 #endif /* HAVE_LINUX_INPUT_H */
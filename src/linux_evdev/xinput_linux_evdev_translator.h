@@ -28,9 +28,13 @@
 #define XINPUT_LINUX_EVDEV_TRANSLATOR_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <linux/input.h>
 
+#include "xinput_settings.h"
+
 #include "xinput.h"
+#include "xinput_gamepad.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -38,14 +42,58 @@ extern "C" {
 
 struct xinput_linux_evdev_translator_abs_translator_item;
 
-typedef void (*xinput_linux_evdev_translator_abs_translator_callback)(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int16_t value);
+typedef void (*xinput_linux_evdev_translator_abs_translator_callback)(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int32_t value);
+
+/*
+ * Maps the range of an axis, as reported by EVIOCGABS, onto the range of the
+ * gamepad field, without floating point:
+ *
+ * value is clamped to [minimum; maximum]
+ * value in [flat_low; flat_high] gives 0
+ * otherwise, base + (value - minimum) * scale, scale being 32.32 fixed point
+ */
+
+struct xinput_linux_evdev_translator_abs_calibration
+{
+    int32_t minimum;
+    int32_t maximum;
+    int32_t flat_low;
+    int32_t flat_high;
+    int32_t base;
+    int64_t scale;
+};
+
+#define XINPUT_GAMEPAD_ABS_CALIBRATION_ONE (((int64_t)1) << 32)
+
+/*
+ * The ranges of the xpad driver, which are also the XInput ones.
+ */
+
+#define XINPUT_GAMEPAD_ABS_CALIBRATION_AXIS {-32768, 32767, 1, 0, -32768, XINPUT_GAMEPAD_ABS_CALIBRATION_ONE}
+#define XINPUT_GAMEPAD_ABS_CALIBRATION_SIXA {-32768, 32767, 1, 0, 32767, -XINPUT_GAMEPAD_ABS_CALIBRATION_ONE}
+#define XINPUT_GAMEPAD_ABS_CALIBRATION_TRIG {0, 255, 1, 0, 0, XINPUT_GAMEPAD_ABS_CALIBRATION_ONE}
+#define XINPUT_GAMEPAD_ABS_CALIBRATION_NONE {0, 0, 1, 0, 0, 0}
+
+/*
+ * What an axis is mapped to.
+ * Told by this rather than by the callback: the linker may fold callbacks
+ * with identical bodies into one.
+ */
+
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_NOTHING       0
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS          1
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS_REVERSE  2
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_TRIGGER       3
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_BUTTONS       4
 
 struct xinput_linux_evdev_translator_abs_translator_item
 {
     xinput_linux_evdev_translator_abs_translator_callback translate;
+    int kind;
     ssize_t to;
     int16_t positive;
     int16_t negative;
+    struct xinput_linux_evdev_translator_abs_calibration calibration;
 };
 
 struct xinput_linux_evdev_translator_abs_translator
@@ -53,19 +101,44 @@ struct xinput_linux_evdev_translator_abs_translator
     struct xinput_linux_evdev_translator_abs_translator_item _item[ABS_CNT];
 };
 
-void xinput_linux_evdev_translator_abs_translate_nothing(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int16_t value);
-void xinput_linux_evdev_translator_abs_translate_to_axis(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int16_t value);
-void xinput_linux_evdev_translator_abs_translate_to_axis_reverse(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int16_t value);
-void xinput_linux_evdev_translator_abs_translate_to_buttons(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int16_t value);
+static inline int32_t xinput_linux_evdev_translator_abs_calibrated(const struct xinput_linux_evdev_translator_abs_calibration* calibration, int32_t value)
+{
+    int32_t calibrated;
+
+    value = (value < calibration->minimum)?calibration->minimum:value;
+    value = (value > calibration->maximum)?calibration->maximum:value;
+
+    /* rounded to the nearest */
+
+    calibrated = calibration->base + (int32_t)((((int64_t)value - calibration->minimum) * calibration->scale + (((int64_t)1) << 31)) >> 32);
+
+    return ((value >= calibration->flat_low) && (value <= calibration->flat_high))?0:calibrated;
+}
+
+void xinput_linux_evdev_translator_abs_translate_nothing(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int32_t value);
+void xinput_linux_evdev_translator_abs_translate_to_axis(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int32_t value);
+void xinput_linux_evdev_translator_abs_translate_to_axis_reverse(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int32_t value);
+void xinput_linux_evdev_translator_abs_translate_to_trigger(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int32_t value);
+void xinput_linux_evdev_translator_abs_translate_to_buttons(const struct xinput_linux_evdev_translator_abs_translator_item* item, XINPUT_GAMEPAD_EX*, int32_t value);
 
 void xinput_gamepad_abs_set_axis(struct xinput_linux_evdev_translator_abs_translator *abs, int bit, ssize_t offs);
 void xinput_gamepad_abs_set_sixa(struct xinput_linux_evdev_translator_abs_translator *abs, int bit, ssize_t offs);
+void xinput_gamepad_abs_set_trig(struct xinput_linux_evdev_translator_abs_translator *abs, int bit, ssize_t offs);
 void xinput_gamepad_abs_set_bttn(struct xinput_linux_evdev_translator_abs_translator *abs, int bit, int16_t pos, int16_t neg);
 
 #define XINPUT_GAMEPAD_ABS_SET_AXIS(_abs, _bit, _field) xinput_gamepad_abs_set_axis((_abs),(_bit), offsetof(XINPUT_GAMEPAD_EX, _field))
 #define XINPUT_GAMEPAD_ABS_SET_SIXA(_abs, _bit, _field) xinput_gamepad_abs_set_sixa((_abs),(_bit), offsetof(XINPUT_GAMEPAD_EX, _field))
+#define XINPUT_GAMEPAD_ABS_SET_TRIG(_abs, _bit, _field) xinput_gamepad_abs_set_trig((_abs),(_bit), offsetof(XINPUT_GAMEPAD_EX, _field))
 #define XINPUT_GAMEPAD_ABS_SET_BTTN(_abs, _bit, _pos, _neg) xinput_gamepad_abs_set_bttn((_abs),(_bit), (_pos), (_neg))
 
+/*
+ * Computes the calibration of an axis from its absinfo, for the field the
+ * axis has been mapped to.
+ * Axes mapped to buttons or to nothing are left as they are.
+ */
+
+void xinput_linux_evdev_translator_abs_calibrate(struct xinput_linux_evdev_translator_abs_translator_item* item, const struct input_absinfo* absinfo);
+
 /*
  * Starts the table
  */
@@ -76,25 +149,31 @@ void xinput_gamepad_abs_set_bttn(struct xinput_linux_evdev_translator_abs_transl
  * Maps an absolute axis to a gamepad axis
  */
 
-#define XINPUT_GAMEPAD_ABS_AXIS(_debugname,_field) {&xinput_linux_evdev_translator_abs_translate_to_axis,offsetof(XINPUT_GAMEPAD_EX, _field),0,0},
+#define XINPUT_GAMEPAD_ABS_AXIS(_debugname,_field) {&xinput_linux_evdev_translator_abs_translate_to_axis,XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS,offsetof(XINPUT_GAMEPAD_EX, _field),0,0,XINPUT_GAMEPAD_ABS_CALIBRATION_AXIS},
 
 /*
  * Maps an absolute axis to a gamepad axis, in the opposite direction [-1; 1] => [1; -1]
  */
 
-#define XINPUT_GAMEPAD_ABS_SIXA(_debugname,_field) {&xinput_linux_evdev_translator_abs_translate_to_axis_reverse,offsetof(XINPUT_GAMEPAD_EX, _field),0,0},
+#define XINPUT_GAMEPAD_ABS_SIXA(_debugname,_field) {&xinput_linux_evdev_translator_abs_translate_to_axis_reverse,XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_AXIS_REVERSE,offsetof(XINPUT_GAMEPAD_EX, _field),0,0,XINPUT_GAMEPAD_ABS_CALIBRATION_SIXA},
+
+/*
+ * Maps an absolute axis to a gamepad trigger
+ */
+
+#define XINPUT_GAMEPAD_ABS_TRIG(_debugname,_field) {&xinput_linux_evdev_translator_abs_translate_to_trigger,XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_TRIGGER,offsetof(XINPUT_GAMEPAD_EX, _field),0,0,XINPUT_GAMEPAD_ABS_CALIBRATION_TRIG},
 
 /*
  * Maps an absolute axis to a gamepad button
  */
 
-#define XINPUT_GAMEPAD_ABS_BTTN(_debugname,_positive,_negative) {&xinput_linux_evdev_translator_abs_translate_to_buttons, 0,(_positive),(_negative)},
+#define XINPUT_GAMEPAD_ABS_BTTN(_debugname,_positive,_negative) {&xinput_linux_evdev_translator_abs_translate_to_buttons,XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_BUTTONS, 0,(_positive),(_negative),XINPUT_GAMEPAD_ABS_CALIBRATION_NONE},
 
 /*
  * Ignores an absolute axis
  */
 
-#define XINPUT_GAMEPAD_ABS_NOPE(_debugname) {&xinput_linux_evdev_translator_abs_translate_nothing,0,(_debugname),0},
+#define XINPUT_GAMEPAD_ABS_NOPE(_debugname) {&xinput_linux_evdev_translator_abs_translate_nothing,XINPUT_LINUX_EVDEV_TRANSLATOR_ABS_NOTHING,0,(_debugname),0,XINPUT_GAMEPAD_ABS_CALIBRATION_NONE},
 
 /*
  * Ends the table
@@ -134,6 +213,171 @@ void xinput_linux_evdev_translator_abs_input_event_to_gamepad(const struct xinpu
 
 void xinput_linux_evdev_translator_key_input_event_to_gamepad(const struct xinput_linux_evdev_translator_key_translator* translator, const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad);
 
+/*
+ * Reads the current state of every key and axis mapped by the translators
+ * from the device and updates the XINPUT_GAMEPAD_EX with it.
+ * Used to recover after the kernel dropped events (SYN_DROPPED).
+ */
+
+void xinput_linux_evdev_translator_resync(const struct xinput_linux_evdev_translator_abs_translator* abs, const struct xinput_linux_evdev_translator_key_translator* key, int fd, XINPUT_GAMEPAD_EX* gamepad);
+
+/*
+ * A translator compiled for one device.
+ *
+ * Only the axes and the keys actually mapped are kept, in dense arrays, and
+ * they are applied by an inlined switch instead of calls through the table.
+ * Under 1KB instead of the ~4.5KB of the tables it is compiled from.
+ */
+
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_OP_NONE       0
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_OP_AXIS       1   /* calibrated SHORT, reversed or not */
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_OP_TRIGGER    2   /* calibrated BYTE */
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_OP_BUTTONS    3
+
+#define XINPUT_LINUX_EVDEV_TRANSLATOR_KEY_NONE      0xffff  /* above KEY_MAX */
+
+struct xinput_linux_evdev_translator_op
+{
+    struct xinput_linux_evdev_translator_abs_calibration calibration;
+    uint16_t to;
+    uint16_t kind;
+    WORD positive;
+    WORD negative;
+};
+
+struct xinput_linux_evdev_translator_compiled
+{
+    uint8_t abs_op[ABS_CNT];            /* index in abs_ops, 0 for unmapped axes */
+    struct xinput_linux_evdev_translator_op abs_ops[XINPUT_EVDEV_TRANSLATOR_ABS_OPS + 1]; /* [0] does nothing */
+    uint16_t key_code[XINPUT_EVDEV_TRANSLATOR_KEY_OPS];    /* sorted, then KEY_NONE */
+    WORD key_buttons[XINPUT_EVDEV_TRANSLATOR_KEY_OPS];
+    int abs_count;
+    int key_count;
+};
+
+/*
+ * Compiles the tables of a device.
+ * The calibration of the axes is taken as it is at this point.
+ *
+ * @return 0 or ENOSPC if the tables map more than the compiled form can hold
+ */
+
+int xinput_linux_evdev_translator_compile(struct xinput_linux_evdev_translator_compiled* compiled, const struct xinput_linux_evdev_translator_abs_translator* abs, const struct xinput_linux_evdev_translator_key_translator* key);
+
+/*
+ * Returns the buttons a key is mapped to, or 0.
+ * Always the same number of steps, without branches to mispredict.
+ */
+
+static inline WORD xinput_linux_evdev_translator_compiled_key(const struct xinput_linux_evdev_translator_compiled* compiled, uint16_t code)
+{
+    const uint16_t* base = compiled->key_code;
+    size_t n = XINPUT_EVDEV_TRANSLATOR_KEY_OPS;
+
+    while(n > 1)
+    {
+        size_t half = n >> 1;
+        base = (base[half] <= code)?&base[half]:base;
+        n -= half;
+    }
+
+    return (*base == code)?compiled->key_buttons[base - compiled->key_code]:0;
+}
+
+/*
+ * Using the compiled translator, updates the XINPUT_GAMEPAD_EX with to the input_event
+ */
+
+static inline void xinput_linux_evdev_translator_compiled_input_event_to_gamepad(const struct xinput_linux_evdev_translator_compiled* compiled, const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad)
+{
+    switch(ie->type)
+    {
+        case EV_KEY:
+        {
+            WORD bit = xinput_linux_evdev_translator_compiled_key(compiled, ie->code);
+
+            if(ie->value != 0)
+            {
+                gamepad->wButtons |= bit;
+            }
+            else
+            {
+                gamepad->wButtons &= ~bit;
+            }
+            break;
+        }
+        case EV_ABS:
+        {
+            const struct xinput_linux_evdev_translator_op* op = &compiled->abs_ops[compiled->abs_op[ie->code & (ABS_CNT - 1)]];
+            char* base = ((char*)gamepad) + op->to;
+
+            switch(op->kind)
+            {
+                case XINPUT_LINUX_EVDEV_TRANSLATOR_OP_AXIS:
+                {
+                    *(SHORT*)base = (SHORT)xinput_linux_evdev_translator_abs_calibrated(&op->calibration, ie->value);
+                    break;
+                }
+                case XINPUT_LINUX_EVDEV_TRANSLATOR_OP_TRIGGER:
+                {
+                    *(BYTE*)base = (BYTE)xinput_linux_evdev_translator_abs_calibrated(&op->calibration, ie->value);
+                    break;
+                }
+                case XINPUT_LINUX_EVDEV_TRANSLATOR_OP_BUTTONS:
+                {
+                    WORD on = (ie->value > 0)?op->positive:((ie->value < 0)?op->negative:0);
+                    gamepad->wButtons = (gamepad->wButtons & ~(op->positive | op->negative)) | on;
+                    break;
+                }
+                default:
+                {
+                    break;
+                }
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * Reads the current state of every key and axis mapped by the compiled
+ * translator from the device and updates the XINPUT_GAMEPAD_EX with it.
+ * Used to recover after the kernel dropped events (SYN_DROPPED).
+ */
+
+void xinput_linux_evdev_translator_compiled_resync(const struct xinput_linux_evdev_translator_compiled* compiled, int fd, XINPUT_GAMEPAD_EX* gamepad);
+
+/*
+ * Asks the kernel to only send the keys and axes mapped by the compiled
+ * translator, and nothing of the other event types of the device, so the
+ * reader is not woken up for events it would drop.
+ * EV_SYN is always sent.
+ *
+ * @param compiled
+ * @param fd
+ * @param types the event types of the device, as given by EVIOCGBIT(0)
+ *
+ * @return 0 or an error code (ie: ENOTTY for a file, EINVAL before Linux 4.4)
+ */
+
+int xinput_linux_evdev_translator_compiled_mask(const struct xinput_linux_evdev_translator_compiled* compiled, int fd, const uint8_t* types);
+
+/*
+ * Tells how much the sticks and triggers mapped by the compiled translator
+ * jitter, from the fuzz of their axes, in the units of XINPUT_GAMEPAD.
+ * With XINPUT_EVDEV_NOISE_FUZZ, the axes without fuzz are given one first.
+ *
+ * @param compiled
+ * @param fd
+ * @param noise receives the noise, 0 for the controls of unknown noise
+ */
+
+void xinput_linux_evdev_translator_compiled_noise(const struct xinput_linux_evdev_translator_compiled* compiled, int fd, xinput_gamepad_device_noise* noise);
+
 #ifdef __cplusplus
 }
 #endif
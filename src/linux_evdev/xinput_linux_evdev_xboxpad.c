@@ -36,6 +36,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/ioctl.h>
 
 #if HAVE_WINE
 #include "wine/debug.h"
@@ -89,7 +90,7 @@ static int xinput_gamepad_translation2[4][2] =     /*  minus 0x2c0 */
  *
  */
 
-static void xinput_linux_evdev_xboxpad_input_event_to_gamepad(const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad)
+void xinput_linux_evdev_xboxpad_input_event_to_gamepad(const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad, int trigger_shift)
 {
     switch(ie->type)
     {
@@ -164,12 +165,12 @@ static void xinput_linux_evdev_xboxpad_input_event_to_gamepad(const struct input
                 }
                 case ABS_Z:
                 {
-                    gamepad->bLeftTrigger = (int8_t)ie->value;
+                    gamepad->bLeftTrigger = (BYTE)(ie->value >> trigger_shift);
                     break;
                 }
                 case ABS_RZ:
                 {
-                    gamepad->bRightTrigger = (int16_t)ie->value;
+                    gamepad->bRightTrigger = (BYTE)(ie->value >> trigger_shift);
                     break;
                 }
                 case ABS_HAT0X:
@@ -238,20 +239,107 @@ struct xinput_linux_evdev_xboxpad_data
 {
     XINPUT_GAMEPAD_EX gamepad;
     XINPUT_VIBRATION vibration;
-    int fd;
-    int effect_id;
+    xinput_linux_evdev_reader reader;
+    xinput_linux_evdev_rumbler rumbler;
+    int trigger_shift;          /* the xbox one pads report 0..1023 */
+    BOOL dropped;
+    xinput_gamepad_device_noise noise;
 };
 
 typedef struct xinput_linux_evdev_xboxpad_data xinput_linux_evdev_xboxpad_data;
 
+static const uint16_t xinput_linux_evdev_xboxpad_abs[] =
+{
+    ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ, ABS_HAT0X, ABS_HAT0Y
+};
+
+/*
+ * Reads back the state of the device, after the kernel dropped events.
+ */
+
+static void xinput_linux_evdev_xboxpad_resync(xinput_linux_evdev_xboxpad_data* data)
+{
+    struct input_event ie;
+    uint8_t key_state[KEY_CNT>>3];
+
+    memset(&ie, 0, sizeof(ie));
+
+    if(ioctl(data->reader.fd, EVIOCGKEY(sizeof(key_state)), key_state) >= 0)
+    {
+        ie.type = EV_KEY;
+
+        for(int i = 0; i < 16; ++i)
+        {
+            ie.code = xinput_gamepad_translation[i][0];
+            ie.value = bit_get(key_state, ie.code);
+            xinput_linux_evdev_xboxpad_input_event_to_gamepad(&ie, &data->gamepad, data->trigger_shift);
+        }
+
+        for(int i = 0; i < 4; ++i)
+        {
+            ie.code = xinput_gamepad_translation2[i][0];
+            ie.value = bit_get(key_state, ie.code);
+            xinput_linux_evdev_xboxpad_input_event_to_gamepad(&ie, &data->gamepad, data->trigger_shift);
+        }
+    }
+    else
+    {
+        TRACE("could not get keys state: %s\n", strerror(errno));
+    }
+
+    ie.type = EV_ABS;
+
+    for(size_t i = 0; i < sizeof(xinput_linux_evdev_xboxpad_abs) / sizeof(xinput_linux_evdev_xboxpad_abs[0]); ++i)
+    {
+        struct input_absinfo absinfo;
+
+        if(ioctl(data->reader.fd, EVIOCGABS(xinput_linux_evdev_xboxpad_abs[i]), &absinfo) >= 0)
+        {
+            ie.code = xinput_linux_evdev_xboxpad_abs[i];
+            ie.value = absinfo.value;
+            xinput_linux_evdev_xboxpad_input_event_to_gamepad(&ie, &data->gamepad, data->trigger_shift);
+        }
+    }
+}
+
+/*
+ * As the generic device: events are accumulated up to the SYN_REPORT, and
+ * the state is read back after a SYN_DROPPED.
+ */
+
 static int xinput_linux_evdev_xboxpad_read(struct xinput_gamepad_device* device)
 {
     xinput_linux_evdev_xboxpad_data* data = (xinput_linux_evdev_xboxpad_data*)device->data;
     struct input_event ie;
-    int ret = xinput_linux_evdev_read_next(data->fd, &ie);
-    if(ret == 0)
+    int ret;
+
+    while((ret = xinput_linux_evdev_read_next(&data->reader, &ie)) == 0)
     {
-        xinput_linux_evdev_xboxpad_input_event_to_gamepad(&ie, &data->gamepad);
+        if(ie.type == EV_SYN)
+        {
+            if(ie.code == SYN_REPORT)
+            {
+                if(data->dropped)
+                {
+                    xinput_linux_evdev_xboxpad_resync(data);
+                    data->dropped = FALSE;
+                }
+
+                /* the frame is complete */
+
+                return 0;
+            }
+            else if(ie.code == SYN_DROPPED)
+            {
+                TRACE("events dropped on %i\n", data->reader.fd);
+
+                data->dropped = TRUE;
+            }
+        }
+        else if(!data->dropped)
+        {
+            xinput_linux_evdev_xboxpad_input_event_to_gamepad(&ie, &data->gamepad, data->trigger_shift);
+        }
     }
 
     return ret;
@@ -274,14 +362,37 @@ static void xinput_linux_evdev_xboxpad_update(struct xinput_gamepad_device* devi
 static int xinput_linux_evdev_xboxpad_rumble(struct xinput_gamepad_device* device, const XINPUT_VIBRATION* vibration)
 {
     xinput_linux_evdev_xboxpad_data* data = (xinput_linux_evdev_xboxpad_data*)device->data;
-    int id;
-    id = xinput_linux_evdev_rumble(data->fd, data->effect_id, vibration->wLeftMotorSpeed, vibration->wRightMotorSpeed);
-    if(id >= 0)
-    {
-        data->effect_id = id;
-    }
 
-    return 0;
+    return xinput_linux_evdev_rumbler_set(&data->rumbler, data->reader.fd, vibration);
+}
+
+static void xinput_linux_evdev_xboxpad_statistics(struct xinput_gamepad_device* device, xinput_gamepad_device_statistics* stats)
+{
+    xinput_linux_evdev_xboxpad_data* data = (xinput_linux_evdev_xboxpad_data*)device->data;
+
+    xinput_linux_evdev_reader_statistics(&data->reader, stats);
+    xinput_linux_evdev_rumbler_statistics(&data->rumbler, stats);
+}
+
+static int xinput_linux_evdev_xboxpad_get_fd(struct xinput_gamepad_device* device)
+{
+    xinput_linux_evdev_xboxpad_data* data = (xinput_linux_evdev_xboxpad_data*)device->data;
+
+    return data->reader.fd;
+}
+
+static int64_t xinput_linux_evdev_xboxpad_get_event_us(struct xinput_gamepad_device* device)
+{
+    xinput_linux_evdev_xboxpad_data* data = (xinput_linux_evdev_xboxpad_data*)device->data;
+
+    return data->reader.frame_us;
+}
+
+static void xinput_linux_evdev_xboxpad_get_noise(struct xinput_gamepad_device* device, xinput_gamepad_device_noise* noise)
+{
+    xinput_linux_evdev_xboxpad_data* data = (xinput_linux_evdev_xboxpad_data*)device->data;
+
+    *noise = data->noise;
 }
 
 static void xinput_linux_evdev_xboxpad_release(struct xinput_gamepad_device* device)
@@ -290,14 +401,10 @@ static void xinput_linux_evdev_xboxpad_release(struct xinput_gamepad_device* dev
     
     TRACE("release %p", device);
 
-    if(data->effect_id >= 0)
-    {
-        xinput_linux_evdev_feedback_clear(data->fd, data->effect_id);
-        data->effect_id = -1;
-    }
+    xinput_linux_evdev_rumbler_release(&data->rumbler, data->reader.fd);
 
-    close_ex(data->fd);
-    data->fd = -1;
+    close_ex(data->reader.fd);
+    data->reader.fd = -1;
     free(data);
     device->data = NULL;
     device->vtbl = NULL;
@@ -308,18 +415,56 @@ static const xinput_gamepad_device_vtbl xinput_xboxpad_vtbl =
     &xinput_linux_evdev_xboxpad_read,
     &xinput_linux_evdev_xboxpad_update,
     &xinput_linux_evdev_xboxpad_rumble,
-    &xinput_linux_evdev_xboxpad_release
+    &xinput_linux_evdev_xboxpad_release,
+    &xinput_linux_evdev_xboxpad_statistics,
+    &xinput_linux_evdev_xboxpad_get_fd,
+    &xinput_linux_evdev_xboxpad_get_event_us,
+    &xinput_linux_evdev_xboxpad_get_noise
 };
 
 static void xinput_linux_evdev_xboxpad_init(struct xinput_gamepad_device* device, int fd)
 {
     xinput_linux_evdev_xboxpad_data* data = (xinput_linux_evdev_xboxpad_data*)malloc(sizeof(xinput_linux_evdev_xboxpad_data));
+    struct input_absinfo absinfo;
     
     TRACE("init %p with fd %i", device, fd);
     
     memset(data, 0, sizeof(xinput_linux_evdev_xboxpad_data));
-    data->fd = fd;
-    data->effect_id = -1;
+    xinput_linux_evdev_reader_init(&data->reader, fd);
+    xinput_linux_evdev_rumbler_init(&data->rumbler, XINPUT_EVDEV_RUMBLE_PERIOD_US);
+
+    /* the triggers are brought back to 0..255 with a shift */
+
+    if(ioctl(fd, EVIOCGABS(ABS_Z), &absinfo) >= 0)
+    {
+        while((absinfo.maximum >> data->trigger_shift) > 255)
+        {
+            ++data->trigger_shift;
+        }
+    }
+
+    /* the sticks are reported as they are, the triggers shifted */
+
+    for(int i = 0; i < 4; ++i)
+    {
+        static const uint16_t thumbs[4] = { ABS_X, ABS_Y, ABS_RX, ABS_RY };
+
+        if(ioctl(fd, EVIOCGABS(thumbs[i]), &absinfo) >= 0)
+        {
+            data->noise.thumb[i] = absinfo.fuzz;
+        }
+    }
+
+    for(int i = 0; i < 2; ++i)
+    {
+        static const uint16_t triggers[2] = { ABS_Z, ABS_RZ };
+
+        if(ioctl(fd, EVIOCGABS(triggers[i]), &absinfo) >= 0)
+        {
+            data->noise.trigger[i] = (absinfo.fuzz + (1 << data->trigger_shift) - 1) >> data->trigger_shift;
+        }
+    }
+
     device->data = data;
     device->vtbl = &xinput_xboxpad_vtbl;
 }
@@ -367,12 +512,16 @@ BOOL xinput_linux_evdev_xboxpad_can_translate(const struct xinput_linux_evdev_pr
 
 BOOL xinput_linux_evdev_xboxpad_new_instance(const struct xinput_linux_evdev_probe_s* probed, int fd, xinput_gamepad_device* instance)
 {
-    for(int i = 0; i < 4; ++i)
+    for(int i = 0; xboxpad_factories[i].vendor != 0; ++i)
     {
         if( (xboxpad_factories[i].vendor == probed->id.vendor) &&
             (xboxpad_factories[i].product == probed->id.product) )
         {
+            xinput_linux_evdev_xboxpad_data* data;
+
             xboxpad_factories[i].initialize(instance, fd);
+            data = (xinput_linux_evdev_xboxpad_data*)instance->data;
+            xinput_linux_evdev_rumbler_init(&data->rumbler, xinput_linux_evdev_rumbler_period(probed));
             return TRUE;
         }
     }
@@ -55,6 +55,17 @@ BOOL xinput_linux_evdev_xboxpad_can_translate(const struct xinput_linux_evdev_pr
 
 BOOL xinput_linux_evdev_xboxpad_new_instance(const struct xinput_linux_evdev_probe_s* probed, int fd, xinput_gamepad_device* instance);
 
+/**
+ * Updates the XINPUT_GAMEPAD_EX with to the input_event, the hand-written way.
+ * Exposed for the translator benchmark.
+ *
+ * @param ie
+ * @param gamepad
+ * @param trigger_shift brings the triggers back to 0..255
+ */
+
+void xinput_linux_evdev_xboxpad_input_event_to_gamepad(const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad, int trigger_shift);
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,20 +43,29 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+
+#if HAVE_WINE
+#include "wine/debug.h"
+#endif
 
 #include "xinput_gamepad.h"
 #include "xinput_linux_evdev.h"
 #include "xinput_linux_evdev_translator.h"
+#include "xinput_linux_evdev_xboxpad_2.h"
 #include "tools.h"
+#include "debug.h"
 #include "device_id.h"
 
+WINE_DEFAULT_DEBUG_CHANNEL(xinput);
+
 XINPUT_GAMEPAD_ABS_BEGIN(xbox360_abs)
 XINPUT_GAMEPAD_ABS_AXIS(ABS_X, sThumbLX)           /* 0x00 */
 XINPUT_GAMEPAD_ABS_SIXA(ABS_Y, sThumbLY)           /* 0x01 */
-XINPUT_GAMEPAD_ABS_AXIS(ABS_Z, bLeftTrigger)       /* 0x02 */
+XINPUT_GAMEPAD_ABS_TRIG(ABS_Z, bLeftTrigger)       /* 0x02 */
 XINPUT_GAMEPAD_ABS_AXIS(ABS_RX, sThumbRX)          /* 0x03 */
 XINPUT_GAMEPAD_ABS_SIXA(ABS_RY, sThumbRY)          /* 0x04 */
-XINPUT_GAMEPAD_ABS_AXIS(ABS_RZ, bRightTrigger)     /* 0x05 */
+XINPUT_GAMEPAD_ABS_TRIG(ABS_RZ, bRightTrigger)     /* 0x05 */
 XINPUT_GAMEPAD_ABS_NOPE(ABS_THROTTLE)              /* 0x06 */
 XINPUT_GAMEPAD_ABS_NOPE(ABS_RUDDER)                /* 0x07 */
 XINPUT_GAMEPAD_ABS_NOPE(ABS_WHEEL)                 /* 0x08 */
@@ -142,46 +151,57 @@ XINPUT_GAMEPAD_KEY_TRANSLATOR(xbox360_key_bis,
         XINPUT_GAMEPAD_DPAD_UP,
         XINPUT_GAMEPAD_DPAD_DOWN);
 
-static void xinput_linux_evdev_xboxpad2_input_event_to_gamepad(const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad)
-{
-    switch(ie->type)
-    {
-        case EV_KEY:
-        {
-            xinput_linux_evdev_translator_key_input_event_to_gamepad(&xbox360_key, ie, gamepad);
-            xinput_linux_evdev_translator_key_input_event_to_gamepad(&xbox360_key_bis, ie, gamepad);
-            break;
-        }
-        case EV_ABS:
-        {
-            xinput_linux_evdev_translator_abs_input_event_to_gamepad(&xbox360_abs, ie, gamepad);
-            break;
-        }
-        default:
-        {
-            /* does not handle anything else ... yet */
-            break;
-        }
-    }
-}
 struct xinput_linux_evdev_xboxpad2_data
 {
+    struct xinput_linux_evdev_translator_compiled translator;
     XINPUT_GAMEPAD_EX gamepad;
     XINPUT_VIBRATION vibration;
-    int fd;
-    int effect_id;
+    xinput_linux_evdev_reader reader;
+    xinput_linux_evdev_rumbler rumbler;
+    BOOL dropped;
+    xinput_gamepad_device_noise noise;
 };
 
 typedef struct xinput_linux_evdev_xboxpad2_data xinput_linux_evdev_xboxpad2_data;
 
+/*
+ * As the generic device: events are accumulated up to the SYN_REPORT, and
+ * the state is read back after a SYN_DROPPED.
+ */
+
 static int xinput_linux_evdev_xboxpad2_read(struct xinput_gamepad_device* device)
 {
     xinput_linux_evdev_xboxpad2_data* data = (xinput_linux_evdev_xboxpad2_data*)device->data;
     struct input_event ie;
-    int ret = xinput_linux_evdev_read_next(data->fd, &ie);
-    if(ret == 0)
+    int ret;
+
+    while((ret = xinput_linux_evdev_read_next(&data->reader, &ie)) == 0)
     {
-        xinput_linux_evdev_xboxpad2_input_event_to_gamepad(&ie, &data->gamepad);
+        if(ie.type == EV_SYN)
+        {
+            if(ie.code == SYN_REPORT)
+            {
+                if(data->dropped)
+                {
+                    xinput_linux_evdev_translator_compiled_resync(&data->translator, data->reader.fd, &data->gamepad);
+                    data->dropped = FALSE;
+                }
+
+                /* the frame is complete */
+
+                return 0;
+            }
+            else if(ie.code == SYN_DROPPED)
+            {
+                TRACE("events dropped on %i\n", data->reader.fd);
+
+                data->dropped = TRUE;
+            }
+        }
+        else if(!data->dropped)
+        {
+            xinput_linux_evdev_translator_compiled_input_event_to_gamepad(&data->translator, &ie, &data->gamepad);
+        }
     }
 
     return ret;
@@ -204,27 +224,49 @@ static void xinput_linux_evdev_xboxpad2_update(struct xinput_gamepad_device* dev
 static int xinput_linux_evdev_xboxpad2_rumble(struct xinput_gamepad_device* device, const XINPUT_VIBRATION* vibration)
 {
     xinput_linux_evdev_xboxpad2_data* data = (xinput_linux_evdev_xboxpad2_data*)device->data;
-    int id;
-    id = xinput_linux_evdev_rumble(data->fd, data->effect_id, vibration->wLeftMotorSpeed, vibration->wRightMotorSpeed);
-    if(id >= 0)
-    {
-        data->effect_id = id;
-    }
 
-    return 0;
+    return xinput_linux_evdev_rumbler_set(&data->rumbler, data->reader.fd, vibration);
+}
+
+static void xinput_linux_evdev_xboxpad2_statistics(struct xinput_gamepad_device* device, xinput_gamepad_device_statistics* stats)
+{
+    xinput_linux_evdev_xboxpad2_data* data = (xinput_linux_evdev_xboxpad2_data*)device->data;
+
+    xinput_linux_evdev_reader_statistics(&data->reader, stats);
+    xinput_linux_evdev_rumbler_statistics(&data->rumbler, stats);
+}
+
+static int xinput_linux_evdev_xboxpad2_get_fd(struct xinput_gamepad_device* device)
+{
+    xinput_linux_evdev_xboxpad2_data* data = (xinput_linux_evdev_xboxpad2_data*)device->data;
+
+    return data->reader.fd;
+}
+
+static int64_t xinput_linux_evdev_xboxpad2_get_event_us(struct xinput_gamepad_device* device)
+{
+    xinput_linux_evdev_xboxpad2_data* data = (xinput_linux_evdev_xboxpad2_data*)device->data;
+
+    return data->reader.frame_us;
+}
+
+static void xinput_linux_evdev_xboxpad2_get_noise(struct xinput_gamepad_device* device, xinput_gamepad_device_noise* noise)
+{
+    xinput_linux_evdev_xboxpad2_data* data = (xinput_linux_evdev_xboxpad2_data*)device->data;
+
+    *noise = data->noise;
 }
 
 static void xinput_linux_evdev_xboxpad2_release(struct xinput_gamepad_device* device)
 {
     xinput_linux_evdev_xboxpad2_data* data = (xinput_linux_evdev_xboxpad2_data*)device->data;
 
-    if(data->effect_id >= 0)
-    {
-        xinput_linux_evdev_feedback_clear(data->fd, data->effect_id);
-        data->effect_id = -1;
-    }
-    close_ex(data->fd);
-    data->fd = -1;
+    TRACE("release %p", device);
+
+    xinput_linux_evdev_rumbler_release(&data->rumbler, data->reader.fd);
+
+    close_ex(data->reader.fd);
+    data->reader.fd = -1;
     free(data);
     device->data = NULL;
     device->vtbl = NULL;
@@ -235,15 +277,55 @@ static const xinput_gamepad_device_vtbl xinput_xboxpad2_vtbl =
     &xinput_linux_evdev_xboxpad2_read,
     &xinput_linux_evdev_xboxpad2_update,
     &xinput_linux_evdev_xboxpad2_rumble,
-    &xinput_linux_evdev_xboxpad2_release
+    &xinput_linux_evdev_xboxpad2_release,
+    &xinput_linux_evdev_xboxpad2_statistics,
+    &xinput_linux_evdev_xboxpad2_get_fd,
+    &xinput_linux_evdev_xboxpad2_get_event_us,
+    &xinput_linux_evdev_xboxpad2_get_noise
 };
 
+/*
+ * The static tables are copied, calibrated with the ranges of the device,
+ * then compiled.
+ */
+
 static void xinput_linux_evdev_xboxpad2_init(struct xinput_gamepad_device* instance, int fd)
 {
     xinput_linux_evdev_xboxpad2_data* data = (xinput_linux_evdev_xboxpad2_data*)malloc(sizeof(xinput_linux_evdev_xboxpad2_data));
+    struct xinput_linux_evdev_translator_abs_translator abs;
+    SHORT key_buttons[KEY_CNT];
+    struct xinput_linux_evdev_translator_key_translator key = { 0, KEY_MAX, key_buttons };
+
+    TRACE("init %p with fd %i", instance, fd);
+
     memset(data, 0, sizeof(xinput_linux_evdev_xboxpad2_data));
-    data->fd = fd;
-    data->effect_id = -1;
+    memcpy(&abs, &xbox360_abs, sizeof(abs));
+    memset(key_buttons, 0, sizeof(key_buttons));
+
+    for(int code = 0; code < ABS_CNT; ++code)
+    {
+        struct input_absinfo absinfo;
+
+        if(ioctl(fd, EVIOCGABS(code), &absinfo) >= 0)
+        {
+            xinput_linux_evdev_translator_abs_calibrate(&abs._item[code], &absinfo);
+        }
+    }
+
+    for(int code = xbox360_key._first; code <= xbox360_key._last; ++code)
+    {
+        key_buttons[code] = xbox360_key._buttons[code - xbox360_key._first];
+    }
+
+    for(int code = xbox360_key_bis._first; code <= xbox360_key_bis._last; ++code)
+    {
+        key_buttons[code] = xbox360_key_bis._buttons[code - xbox360_key_bis._first];
+    }
+
+    xinput_linux_evdev_translator_compile(&data->translator, &abs, &key);
+    xinput_linux_evdev_translator_compiled_noise(&data->translator, fd, &data->noise);
+    xinput_linux_evdev_reader_init(&data->reader, fd);
+    xinput_linux_evdev_rumbler_init(&data->rumbler, XINPUT_EVDEV_RUMBLE_PERIOD_US);
     instance->data = data;
     instance->vtbl = &xinput_xboxpad2_vtbl;
 }
@@ -258,6 +340,10 @@ static struct xinput_driver_supported_device xboxpad_factories[] =
         "XBox360 Wireless Controller", xinput_linux_evdev_xboxpad2_init,
         MANUFACTURER_MICROSOFT, XBOX360_WIRELESS_CONTROLLER
     },
+    {
+        "XBox360 Wireless Controller", xinput_linux_evdev_xboxpad2_init,
+        MANUFACTURER_MICROSOFT, XBOX360_WIRELESS_CONTROLLER_EU
+    },
     {
         "XBoxOne Controller", xinput_linux_evdev_xboxpad2_init,
         MANUFACTURER_MICROSOFT, XBOXONE_CONTROLLER
@@ -287,12 +373,16 @@ BOOL xinput_linux_evdev_xboxpad2_can_translate(const struct xinput_linux_evdev_p
 
 BOOL xinput_linux_evdev_xboxpad2_new_instance(const struct xinput_linux_evdev_probe_s* probed, int fd, xinput_gamepad_device* instance)
 {
-    for(int i = 0; i < 4; ++i)
+    for(int i = 0; xboxpad_factories[i].vendor != 0; ++i)
     {
         if( (xboxpad_factories[i].vendor == probed->id.vendor) &&
             (xboxpad_factories[i].product == probed->id.product) )
         {
+            xinput_linux_evdev_xboxpad2_data* data;
+
             xboxpad_factories[i].initialize(instance, fd);
+            data = (xinput_linux_evdev_xboxpad2_data*)instance->data;
+            xinput_linux_evdev_rumbler_init(&data->rumbler, xinput_linux_evdev_rumbler_period(probed));
             return TRUE;
         }
     }
@@ -27,6 +27,10 @@
 #ifndef XINPUT_LINUX_EVDEV_XBOXPAD_2_H
 #define XINPUT_LINUX_EVDEV_XBOXPAD_2_H
 
+#include "xinput_gamepad.h"
+#include "xinput_linux_evdev.h"
+#include <linux/input.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -49,7 +53,7 @@ extern "C" {
  * @return
  */
 
-BOOL xinput_linux_evdev_xboxpad2_can_translate(const struct input_id* id);
+BOOL xinput_linux_evdev_xboxpad2_can_translate(const struct xinput_linux_evdev_probe_s* probed);
 
 /**
  * Initialises an instance of driver
@@ -60,7 +64,7 @@ BOOL xinput_linux_evdev_xboxpad2_can_translate(const struct input_id* id);
  * @return
  */
 
-BOOL xinput_linux_evdev_xboxpad2_new_instance(const struct input_id* id, int fd, xinput_gamepad_device* instance);
+BOOL xinput_linux_evdev_xboxpad2_new_instance(const struct xinput_linux_evdev_probe_s* probed, int fd, xinput_gamepad_device* instance);
 
 #ifdef __cplusplus
 }
@@ -26,15 +26,43 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "server.h"
+#include "xinput_service.h"
+#include "xinput_filter.h"
 
 /*
  * 
  */
 int main(int argc, char** argv)
 {
+    int opt;
+
     printf("%s built on " __DATE__, argv[0]);
+
+    while((opt = getopt(argc, argv, "rc:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'r':
+                /* single epoll thread for all the gamepads */
+                xinput_service_set_reactor(TRUE);
+                break;
+            case 'c':
+                /* dead zones and curves, instead of XINPUT_FILTER_FILE */
+                if(xinput_filter_set_file(optarg) != 0)
+                {
+                    /* it will be read once it is fixed */
+                    fprintf(stderr, "%s: cannot read %s\n", argv[0], optarg);
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-r] [-c filters.conf]\n", argv[0]);
+                return (EXIT_FAILURE);
+        }
+    }
+
     server(0);
     
     return (EXIT_SUCCESS);
@@ -28,10 +28,18 @@
 #include "xinput_settings.h"
 
 #include <stdint.h>
+#include <limits.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <errno.h>
 
+#if HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "tools.h"
+
 /**
  * Reads a file descriptor until the amount of bytes has been read.
  * Retries on EINTR
@@ -58,6 +66,10 @@ int read_fully(int fd, void* buffer_, size_t len)
             }
             return err;
         }
+        else if(n == 0)
+        {
+            return ENODATA; /* end of file */
+        }
         buffer += n;
         len -= n;
     }
@@ -132,3 +144,54 @@ int64_t timeus(void)
     now += tp.tv_usec;
     return now;
 }
+
+int futex_wait_us(volatile uint32_t* word, uint32_t value, int64_t timeout_us)
+{
+#if HAVE_LINUX_FUTEX_H
+    struct timespec ts;
+    struct timespec* tsp = NULL;
+
+    if(timeout_us >= 0)
+    {
+        ts.tv_sec = timeout_us / 1000000LL;
+        ts.tv_nsec = (timeout_us % 1000000LL) * 1000LL;
+        tsp = &ts;
+    }
+
+    /* not private: the word is usually shared with other processes */
+
+    for(;;)
+    {
+        if(syscall(SYS_futex, word, FUTEX_WAIT, value, tsp, NULL, 0) == 0)
+        {
+            return 0;
+        }
+
+        int err = errno;
+        if(err != EINTR)
+        {
+            return err;
+        }
+    }
+#else
+    /* no futex: just sleep a bit */
+
+    if(*word != value)
+    {
+        return EAGAIN;
+    }
+
+    usleep(((timeout_us >= 0) && (timeout_us < 1000))?timeout_us:1000);
+
+    return 0;
+#endif
+}
+
+void futex_wake_all(volatile uint32_t* word)
+{
+#if HAVE_LINUX_FUTEX_H
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
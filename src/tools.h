@@ -38,7 +38,7 @@ extern "C" {
 /**
  * Reads a file descriptor until the amount of bytes has been read.
  * Retries on EINTR
- * Stops trying on errors
+ * Stops trying on errors, and at the end of the file (ENODATA)
  *
  * @param fd
  * @param buffer_
@@ -79,6 +79,27 @@ void close_ex(int fd);
 
 int64_t timeus(void);
 
+/**
+ * Waits until the word is woken up, if it still contains the value.
+ * The word can be in memory shared between processes.
+ * Retries on EINTR
+ *
+ * @param word
+ * @param value the value the word is expected to have
+ * @param timeout_us the maximum wait, <0 for no limit
+ * @return 0, EAGAIN if the value was different, ETIMEDOUT or another error
+ */
+
+int futex_wait_us(volatile uint32_t* word, uint32_t value, int64_t timeout_us);
+
+/**
+ * Wakes every waiter on the word.
+ *
+ * @param word
+ */
+
+void futex_wake_all(volatile uint32_t* word);
+
 /**
  * Returns the nth bit of a byte array.
  * Bits are given from lsb to msb
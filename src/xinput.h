@@ -120,6 +120,8 @@
 #define ERROR_BAD_ARGUMENTS -1
 #define ERROR_DEVICE_NOT_CONNECTED -1
 #define ERROR_EMPTY -1
+#define ERROR_TIMEOUT 1460
+#define INFINITE 0xFFFFFFFF
 #endif
 
 #ifdef __cplusplus
@@ -194,6 +196,31 @@ typedef struct _XINPUT_STATE_EX {
   XINPUT_GAMEPAD_EX Gamepad;
 } XINPUT_STATE_EX, *PXINPUT_STATE_EX;
 
+/*
+ * The times are in microseconds since the epoch (gettimeofday).
+ * llEventTime is 0 if the device does not tell when it sent the state.
+ */
+
+typedef struct _XINPUT_STATE_TIMED {
+  DWORD          dwPacketNumber;
+  XINPUT_GAMEPAD_EX Gamepad;
+  LONGLONG       llEventTime;       /* the device reported the state */
+  LONGLONG       llPublishTime;     /* the service published it */
+} XINPUT_STATE_TIMED, *PXINPUT_STATE_TIMED;
+
+/*
+ * The states of all the slots, copied in one pass.
+ * Zero it before the first call, then give it back to each call: it is left
+ * as it is while nothing has been published, after a single load.
+ */
+
+typedef struct _XINPUT_STATE_BATCH {
+  DWORD          dwPublished;       /* the publications of the service seen by the last call */
+  DWORD          dwConnectedMask;   /* bit n for slot n */
+  DWORD          dwChangedMask;     /* the slots with a new packet number since the last call */
+  XINPUT_STATE_EX States[XUSER_MAX_COUNT];  /* the gamepads of the slots not connected are zeroed */
+} XINPUT_STATE_BATCH, *PXINPUT_STATE_BATCH;
+
 void WINAPI XInputEnable(BOOL enable);
 DWORD WINAPI XInputGetAudioDeviceIds(DWORD dwUserIndex, LPWSTR pRenderDeviceId, UINT* pRenderCount, LPWSTR pCaptureDeviceId, UINT* pCaptureCount);
 DWORD WINAPI XInputGetBatteryInformation(DWORD dwUserIndex, BYTE devType, XINPUT_BATTERY_INFORMATION* pBatteryInformation);
@@ -202,8 +229,17 @@ DWORD WINAPI XInputGetDSoundAudioDeviceGuids(DWORD dwUserIndex,GUID* pDSoundRend
 DWORD WINAPI XInputGetKeystroke(DWORD dwUserIndex,DWORD dwReserved,PXINPUT_KEYSTROKE pKeystroke);
 DWORD WINAPI XInputGetState(DWORD dwUserIndex, XINPUT_STATE* pState);
 DWORD WINAPI XInputGetStateEx(DWORD dwUserIndex, XINPUT_STATE_EX* pState);
+DWORD WINAPI XInputGetStateTimed(DWORD dwUserIndex, XINPUT_STATE_TIMED* pState);
+DWORD WINAPI XInputGetStateHistory(DWORD dwUserIndex, DWORD dwSincePacketNumber, XINPUT_STATE_TIMED* pStates, DWORD dwCount, DWORD* pdwReturned);
+DWORD WINAPI XInputGetStateBatch(XINPUT_STATE_BATCH* pBatch);
+DWORD WINAPI XInputWaitForStateEx(DWORD dwUserIndexMask, DWORD* pdwPacketNumbers, DWORD dwMilliseconds, DWORD* pdwChangedMask);
 DWORD WINAPI XInputSetState(DWORD dwUserIndex, XINPUT_VIBRATION* pVibration);
 
+/* for the event loops of the native applications, see XInputGetNotifyFd */
+
+int WINAPI XInputGetNotifyFd(DWORD dwUserIndexMask);
+void WINAPI XInputCloseNotifyFd(void);
+
 #ifdef __cplusplus
 }
 #endif
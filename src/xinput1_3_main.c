@@ -215,143 +215,203 @@ DWORD WINAPI DECLSPEC_HOTPATCH XInputGetStateEx(DWORD index, XINPUT_STATE_EX* st
 #endif
 }
 
-static DWORD xinputkeystroke_state[XUSER_MAX_COUNT] = {0, 0, 0, 0};
-static int xinputkeystroke_any_first = 0;
-
-#define XINPUTKEYSTROKE_VK_BUTTON_SIZE 33
-
-struct xinputkeystroke_mask_to_vk {
-    DWORD bits;
-    DWORD mask;
-    WORD value;
-};
-
-static struct xinputkeystroke_mask_to_vk xinputkeystroke_vk_button[XINPUTKEYSTROKE_VK_BUTTON_SIZE] ={
-    {XINPUT_GAMEPAD_DPAD_UP, XINPUT_GAMEPAD_DPAD_UP, VK_PAD_DPAD_UP}, /* 0 */
-    {XINPUT_GAMEPAD_DPAD_DOWN, XINPUT_GAMEPAD_DPAD_DOWN, VK_PAD_DPAD_DOWN},
-    {XINPUT_GAMEPAD_DPAD_LEFT, XINPUT_GAMEPAD_DPAD_LEFT, VK_PAD_DPAD_LEFT},
-    {XINPUT_GAMEPAD_DPAD_RIGHT, XINPUT_GAMEPAD_DPAD_RIGHT, VK_PAD_DPAD_RIGHT},
-
-    {XINPUT_GAMEPAD_START, XINPUT_GAMEPAD_START, VK_PAD_START}, /* 4 */
-    {XINPUT_GAMEPAD_BACK, XINPUT_GAMEPAD_BACK, VK_PAD_BACK},
-    {XINPUT_GAMEPAD_LEFT_THUMB, XINPUT_GAMEPAD_LEFT_THUMB, VK_PAD_LTHUMB_PRESS},
-    {XINPUT_GAMEPAD_RIGHT_THUMB, XINPUT_GAMEPAD_RIGHT_THUMB, VK_PAD_RTHUMB_PRESS},
-
-    {XINPUT_GAMEPAD_LEFT_SHOULDER, XINPUT_GAMEPAD_LEFT_SHOULDER, VK_PAD_LSHOULDER}, /* 8 */
-    {XINPUT_GAMEPAD_RIGHT_SHOULDER, XINPUT_GAMEPAD_RIGHT_SHOULDER, VK_PAD_RSHOULDER},
-
-    {XINPUT_GAMEPAD_A, XINPUT_GAMEPAD_A, VK_PAD_A},
-    {XINPUT_GAMEPAD_B, XINPUT_GAMEPAD_B, VK_PAD_B},
-    {XINPUT_GAMEPAD_X, XINPUT_GAMEPAD_X, VK_PAD_X}, /* 12 */
-    {XINPUT_GAMEPAD_Y, XINPUT_GAMEPAD_Y, VK_PAD_Y},
-
-    {XINPUT_GAMEPAD_LTRIGGER, XINPUT_GAMEPAD_LTRIGGER, VK_PAD_LTRIGGER},
-    {XINPUT_GAMEPAD_RTRIGGER, XINPUT_GAMEPAD_RTRIGGER, VK_PAD_RTRIGGER},
-
-    /* Do not change the order in a THUMB group */
-
-    {XINPUT_GAMEPAD_LTHUMB_UP | XINPUT_GAMEPAD_LTHUMB_LEFT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_UPLEFT}, /* 16 */
-    {XINPUT_GAMEPAD_LTHUMB_UP | XINPUT_GAMEPAD_LTHUMB_RIGHT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_UPRIGHT},
-    {XINPUT_GAMEPAD_LTHUMB_DOWN | XINPUT_GAMEPAD_LTHUMB_RIGHT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_DOWNRIGHT},
-    {XINPUT_GAMEPAD_LTHUMB_DOWN | XINPUT_GAMEPAD_LTHUMB_LEFT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_DOWNLEFT},
-    {XINPUT_GAMEPAD_LTHUMB_UP, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_UP},
-    {XINPUT_GAMEPAD_LTHUMB_DOWN, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_DOWN},
-    {XINPUT_GAMEPAD_LTHUMB_LEFT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_LEFT},
-    {XINPUT_GAMEPAD_LTHUMB_RIGHT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_RIGHT},
-
-    /* Do not change the order in a THUMB group */
-
-    {XINPUT_GAMEPAD_RTHUMB_UP | XINPUT_GAMEPAD_RTHUMB_LEFT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_UPLEFT}, /* 24 */
-    {XINPUT_GAMEPAD_RTHUMB_UP | XINPUT_GAMEPAD_RTHUMB_RIGHT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_UPRIGHT},
-    {XINPUT_GAMEPAD_RTHUMB_DOWN | XINPUT_GAMEPAD_RTHUMB_RIGHT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_DOWNRIGHT},
-    {XINPUT_GAMEPAD_RTHUMB_DOWN | XINPUT_GAMEPAD_RTHUMB_LEFT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_DOWNLEFT},
-    {XINPUT_GAMEPAD_RTHUMB_UP, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_UP},
-    {XINPUT_GAMEPAD_RTHUMB_DOWN, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_DOWN},
-    {XINPUT_GAMEPAD_RTHUMB_LEFT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_LEFT},
-    {XINPUT_GAMEPAD_RTHUMB_RIGHT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_RIGHT},
-
-    {XINPUT_GAMEPAD_GUIDE, XINPUT_GAMEPAD_GUIDE, VK_PAD_GUIDE} /* 32 */
-};
+/**
+ * XInputGetStateEx with the times of the state: when the device reported it
+ * and when the service published it, for latency compensation.
+ */
+
+DWORD WINAPI DECLSPEC_HOTPATCH XInputGetStateTimed(DWORD index, XINPUT_STATE_TIMED* state_timed) {
+#if XINPUT_SUPPORTED
+#if XINPUT_TRACE_INTERFACE_USE
+    TRACE("XInputGetStateTimed(%d, %p), pid=%i\n", index, state_timed, getpid());
+#endif
+
+    if (index >= XUSER_MAX_COUNT) {
+        return ERROR_BAD_ARGUMENTS;
+    }
+
+    if (!xinput_gamepad_connected(index)) {
+        return ERROR_DEVICE_NOT_CONNECTED;
+    }
+
+    xinput_gamepad_copy_state_timed(index, state_timed);
+
+    if (!XInputIsEnabled()) {
+        memset(&state_timed->Gamepad, 0, sizeof (state_timed->Gamepad));
+    }
+
+    return ERROR_SUCCESS;
+#else
+    FIXME("XInputGetStateTimed(%d, %p)\n", index, state_timed);
+    return ERROR_NOT_SUPPORTED;
+#endif
+}
 
 /**
- * Computes the diff from a set of pressed buttons to another
- * Only returns the first match
- * Always find the released buttons first
- * Sets the keystroke of the found diff
- * Returns -1 if nothing change was found
+ * Returns the states published after a packet number, oldest first, so that
+ * a caller polling slower than the gamepad still sees every change.
  *
- * @param index
- * @param from
- * @param to
- * @param next the new (intermediary) buttons state
- * @param keystroke
- * @return
+ * Only the last XINPUT_GAMEPAD_HISTORY_FRAMES states are kept: a gap in the
+ * packet numbers returned means some have been lost.
+ * If there are more states than dwCount, the oldest ones are returned and
+ * the caller asks again from the last packet number it got.
+ *
+ * @param dwUserIndex
+ * @param dwSincePacketNumber the last packet number seen by the caller
+ * @param pStates receives the states
+ * @param dwCount the size of pStates
+ * @param pdwReturned receives the number of states returned
+ *
+ * @return ERROR_SUCCESS, ERROR_BAD_ARGUMENTS or ERROR_DEVICE_NOT_CONNECTED
  */
 
-static int XInputGetNextKeyStroke(int index, DWORD from, DWORD to, DWORD* next, PXINPUT_KEYSTROKE keystroke) {
-    /* first, look for the released ones */
-    int i;
+DWORD WINAPI DECLSPEC_HOTPATCH XInputGetStateHistory(DWORD index, DWORD since, XINPUT_STATE_TIMED* states, DWORD count, DWORD* returned) {
+#if XINPUT_SUPPORTED
+#if XINPUT_TRACE_INTERFACE_USE
+    TRACE("XInputGetStateHistory(%d, %u, %p, %u, %p), pid=%i\n", index, since, states, count, returned, getpid());
+#endif
 
-    if (from == to) {
-        return -1;
+    if ((index >= XUSER_MAX_COUNT) || (states == NULL) || (returned == NULL)) {
+        return ERROR_BAD_ARGUMENTS;
     }
 
-    for (i = 0; i < XINPUTKEYSTROKE_VK_BUTTON_SIZE; ++i) {
-        DWORD bits = xinputkeystroke_vk_button[i].bits;
-        DWORD mask = xinputkeystroke_vk_button[i].mask;
+    *returned = 0;
 
-        BOOL is = (to & mask) == bits;
-
-        if (!is) {
-            BOOL was = (from & mask) == bits;
+    if (!xinput_gamepad_connected(index)) {
+        return ERROR_DEVICE_NOT_CONNECTED;
+    }
 
-            if (was != is) {
-                /* change */
+    *returned = xinput_gamepad_copy_history(index, since, states, count);
 
-                *next = from & ~mask;
-                keystroke->VirtualKey = xinputkeystroke_vk_button[i].value;
-                keystroke->Unicode = 0;
-                keystroke->Flags = XINPUT_KEYSTROKE_KEYUP;
-                keystroke->UserIndex = index;
-                keystroke->HidCode = 0;
-                return i;
-            }
+    if (!XInputIsEnabled()) {
+        for (DWORD i = 0; i < *returned; ++i) {
+            memset(&states[i].Gamepad, 0, sizeof (states[i].Gamepad));
         }
     }
 
-    /* then, look for the pressed ones */
+    return ERROR_SUCCESS;
+#else
+    FIXME("XInputGetStateHistory(%d, %u, %p, %u, %p)\n", index, since, states, count, returned);
+    return ERROR_NOT_SUPPORTED;
+#endif
+}
 
-    for (i = 0; i < XINPUTKEYSTROKE_VK_BUTTON_SIZE; ++i) {
-        DWORD bits = xinputkeystroke_vk_button[i].bits;
-        DWORD mask = xinputkeystroke_vk_button[i].mask;
+/**
+ * Returns the states of all the slots from a single pass over the shared
+ * memory, instead of one XInputGetState per slot.
+ *
+ * @param pBatch zeroed before the first call, then the batch of the previous
+ *               call: while nothing has been published it is left as it is,
+ *               dwChangedMask telling which slots have a new state
+ *
+ * @return ERROR_SUCCESS, ERROR_BAD_ARGUMENTS or ERROR_DEVICE_NOT_CONNECTED
+ *         if no slot is connected
+ */
 
-        BOOL is = (to & mask) == bits;
+DWORD WINAPI DECLSPEC_HOTPATCH XInputGetStateBatch(XINPUT_STATE_BATCH* batch) {
+#if XINPUT_SUPPORTED
+    DWORD ret;
+
+#if XINPUT_TRACE_INTERFACE_USE
+    TRACE("XInputGetStateBatch(%p), pid=%i\n", batch, getpid());
+#endif
 
-        if (is) {
-            BOOL was = (from & mask) == bits;
+    if (batch == NULL) {
+        return ERROR_BAD_ARGUMENTS;
+    }
 
-            if (was != is) {
-                /* change */
+    ret = xinput_gamepad_copy_states(batch);
 
-                *next = (from & ~mask) | bits;
-                keystroke->VirtualKey = xinputkeystroke_vk_button[i].value;
-                keystroke->Unicode = 0;
-                keystroke->Flags = XINPUT_KEYSTROKE_KEYDOWN;
-                keystroke->UserIndex = index;
-                keystroke->HidCode = 0;
-                return i;
-            }
+    if (!XInputIsEnabled()) {
+        for (int i = 0; i < XUSER_MAX_COUNT; ++i) {
+            memset(&batch->States[i].Gamepad, 0, sizeof (batch->States[i].Gamepad));
         }
+
+        /* copied again by the next call, in case it is enabled meanwhile */
+        batch->dwPublished = 0;
     }
 
-    /* no change */
+    return ret;
+#else
+    FIXME("XInputGetStateBatch(%p)\n", batch);
+    return ERROR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * Blocks until a new state has been published for one of the slots.
+ *
+ * @param dwUserIndexMask the slots to wait for, bit n for slot n
+ * @param pdwPacketNumbers XUSER_MAX_COUNT packet numbers: the last ones seen
+ *                         by the caller, updated with the current ones
+ * @param dwMilliseconds the maximum wait, INFINITE for no limit
+ * @param pdwChangedMask receives the slots with a new packet number
+ *
+ * @return ERROR_SUCCESS or ERROR_TIMEOUT
+ */
+
+DWORD WINAPI DECLSPEC_HOTPATCH XInputWaitForStateEx(DWORD mask, DWORD* packets, DWORD milliseconds, DWORD* changed) {
+#if XINPUT_SUPPORTED
+#if XINPUT_TRACE_INTERFACE_USE
+    TRACE("XInputWaitForStateEx(%x, %p, %u, %p), pid=%i\n", mask, packets, milliseconds, changed, getpid());
+#endif
+
+    if ((mask == 0) || (mask >= (1 << XUSER_MAX_COUNT)) || (packets == NULL) || (changed == NULL)) {
+        return ERROR_BAD_ARGUMENTS;
+    }
+
+    return xinput_gamepad_wait(mask, packets, milliseconds, changed);
+#else
+    FIXME("XInputWaitForStateEx(%x, %p, %u, %p)\n", mask, packets, milliseconds, changed);
+    return ERROR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * Returns a file descriptor that becomes readable when one of the slots
+ * publishes a new state, for the event loop of a native application.
+ * Read it (8 bytes) to rearm it, then read the states.
+ * Unix only: it means nothing to a Windows application.
+ *
+ * @param mask the slots to follow, bit n for slot n
+ *
+ * @return the file descriptor, or -1 (errno is set)
+ */
+
+int WINAPI XInputGetNotifyFd(DWORD mask) {
+#if XINPUT_SUPPORTED
+#if XINPUT_TRACE_INTERFACE_USE
+    TRACE("XInputGetNotifyFd(%x), pid=%i\n", mask, getpid());
+#endif
 
+    if ((mask == 0) || (mask >= (1 << XUSER_MAX_COUNT))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return xinput_gamepad_notify_fd(mask);
+#else
+    FIXME("XInputGetNotifyFd(%x)\n", mask);
+    errno = ENOTSUP;
     return -1;
+#endif
+}
+
+void WINAPI XInputCloseNotifyFd(void) {
+#if XINPUT_SUPPORTED
+#if XINPUT_TRACE_INTERFACE_USE
+    TRACE("XInputCloseNotifyFd(), pid=%i\n", getpid());
+#endif
+
+    xinput_gamepad_notify_close();
+#endif
 }
 
+static unsigned int xinputkeystroke_any_first = 0;
+
 /**
- * As no time/serial is required, this function determines the stroke with
- * diffs between states.
+ * The keystrokes are made by the service from the states it publishes, and
+ * queued in the shared memory for each slot.
  *
  * @param index
  * @param reserved
@@ -360,47 +420,34 @@ static int XInputGetNextKeyStroke(int index, DWORD from, DWORD to, DWORD* next,
  */
 
 DWORD WINAPI XInputGetKeystroke(DWORD index, DWORD reserved, PXINPUT_KEYSTROKE keystroke) {
-    DWORD buttons;
-
 #if XINPUT_SUPPORTED
 #if XINPUT_TRACE_INTERFACE_USE
     TRACE("XInputGetKeystroke(%d, %d, %p), pid=%i\n", index, reserved, keystroke, getpid());
 #endif
     (void) reserved;
 
+    if (keystroke == NULL) {
+        return ERROR_BAD_ARGUMENTS;
+    }
+
     if (index < XUSER_MAX_COUNT) {
         if (!xinput_gamepad_connected(index)) {
             return ERROR_DEVICE_NOT_CONNECTED;
         }
 
-        if (!xinput_gamepad_copy_buttons_state(index, &buttons)) {
-            return ERROR_EMPTY;
-        }
-
-        /* find the first bit of difference */
-
-        if (XInputGetNextKeyStroke(index, xinputkeystroke_state[index], buttons, &xinputkeystroke_state[index], keystroke) >= 0) {
-            return ERROR_SUCCESS;
-        }
-
-        return ERROR_EMPTY;
+        return xinput_gamepad_keystroke(index, keystroke);
     } else if (index == XUSER_INDEX_ANY) {
         /*
-         * for each device, look at the one that got the oldest unknown update
-         * loosely (a.k.a : without mutex) the first device checked in order
-         * to be a bit fair
+         * loosely (a.k.a : without mutex) rotate the first device checked in
+         * order to be a bit fair
          */
 
-        int index = xinputkeystroke_any_first++;
+        unsigned int first = xinputkeystroke_any_first++ % XUSER_MAX_COUNT;
 
-        for (int i = index; i < XUSER_MAX_COUNT; ++i) {
-            if (XInputGetKeystroke(index, reserved, keystroke) == ERROR_SUCCESS) {
-                return ERROR_SUCCESS;
-            }
-        }
+        for (unsigned int n = 0; n < XUSER_MAX_COUNT; ++n) {
+            unsigned int i = (first + n) % XUSER_MAX_COUNT;
 
-        for (int i = 0; i < index; ++i) {
-            if (XInputGetKeystroke(index, reserved, keystroke) == ERROR_SUCCESS) {
+            if (xinput_gamepad_connected(i) && (xinput_gamepad_keystroke(i, keystroke) == ERROR_SUCCESS)) {
                 return ERROR_SUCCESS;
             }
         }
@@ -409,8 +456,6 @@ DWORD WINAPI XInputGetKeystroke(DWORD index, DWORD reserved, PXINPUT_KEYSTROKE k
     } else {
         return ERROR_BAD_ARGUMENTS;
     }
-
-    return ERROR_NOT_SUPPORTED;
 #else
     TRACE("XInputGetKeystroke(%d, %d, %p)\n", index, reserved, keystroke);
     return ERROR_NOT_SUPPORTED;
@@ -0,0 +1,787 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+#include "xinput_settings.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+#if HAVE_WINE
+#include "wine/debug.h"
+#endif
+
+#include "xinput.h"
+#include "tools.h"
+#include "debug.h"
+#include "xinput_filter.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(xinput);
+
+static const xinput_filter_control_settings xinput_filter_stick_default = {0, XINPUT_FILTER_STICK_MAX, 0, 1.0, FALSE, XINPUT_FILTER_NOISE_DEVICE};
+static const xinput_filter_control_settings xinput_filter_trigger_default = {0, XINPUT_FILTER_TRIGGER_MAX, 0, 1.0, FALSE, XINPUT_FILTER_NOISE_DEVICE};
+
+void xinput_filter_settings_default(xinput_filter_settings* settings)
+{
+    settings->stick[0] = xinput_filter_stick_default;
+    settings->stick[1] = xinput_filter_stick_default;
+    settings->trigger[0] = xinput_filter_trigger_default;
+    settings->trigger[1] = xinput_filter_trigger_default;
+}
+
+static char* xinput_filter_trim(char* text)
+{
+    char* end;
+
+    while(isspace((unsigned char)*text))
+    {
+        ++text;
+    }
+
+    end = text + strlen(text);
+
+    while((end > text) && isspace((unsigned char)end[-1]))
+    {
+        *--end = '\0';
+    }
+
+    return text;
+}
+
+/**
+ * Sets a setting of a control.
+ *
+ * @return 0 or EINVAL
+ */
+
+static int xinput_filter_control_set(xinput_filter_control_settings* control, BOOL stick, const char* name, const char* value)
+{
+    char* end;
+
+    if(strcmp(name, "mode") == 0)
+    {
+        if(!stick)
+        {
+            return EINVAL;
+        }
+
+        if(strcmp(value, "radial") == 0)
+        {
+            control->radial = TRUE;
+        }
+        else if(strcmp(value, "axial") == 0)
+        {
+            control->radial = FALSE;
+        }
+        else
+        {
+            return EINVAL;
+        }
+
+        return 0;
+    }
+
+    if((strcmp(name, "noise") == 0) && (strcmp(value, "device") == 0))
+    {
+        control->noise = XINPUT_FILTER_NOISE_DEVICE;
+
+        return 0;
+    }
+
+    if(strcmp(name, "curve") == 0)
+    {
+        double curve = strtod(value, &end);
+
+        if((end == value) || (*end != '\0') || !(curve > 0))
+        {
+            return EINVAL;
+        }
+
+        control->curve = curve;
+
+        return 0;
+    }
+    else
+    {
+        long number = strtol(value, &end, 0);
+
+        if((end == value) || (*end != '\0') || (number < 0) || (number > (stick?XINPUT_FILTER_STICK_MAX:XINPUT_FILTER_TRIGGER_MAX)))
+        {
+            return EINVAL;
+        }
+
+        if(strcmp(name, "deadzone") == 0)
+        {
+            control->deadzone = number;
+        }
+        else if(strcmp(name, "outer") == 0)
+        {
+            control->outer = number;
+        }
+        else if(strcmp(name, "anti_deadzone") == 0)
+        {
+            control->anti_deadzone = number;
+        }
+        else if(strcmp(name, "noise") == 0)
+        {
+            control->noise = number;
+        }
+        else
+        {
+            return EINVAL;
+        }
+
+        return 0;
+    }
+}
+
+/**
+ * Applies a line of settings.
+ *
+ * @return 0 or EINVAL
+ */
+
+static int xinput_filter_settings_line(char* line, xinput_filter_settings* settings)
+{
+    static const struct
+    {
+        const char* name;
+        BOOL stick;
+        int first;
+        int last;
+    } controls[] =
+    {
+        {"left", TRUE, 0, 0},
+        {"right", TRUE, 1, 1},
+        {"sticks", TRUE, 0, 1},
+        {"left_trigger", FALSE, 0, 0},
+        {"right_trigger", FALSE, 1, 1},
+        {"triggers", FALSE, 0, 1}
+    };
+
+    char* key;
+    char* value;
+    char* setting;
+    int first_slot = 0;
+    int last_slot = XUSER_MAX_COUNT - 1;
+
+    if((value = strchr(line, '=')) == NULL)
+    {
+        return EINVAL;
+    }
+
+    *value++ = '\0';
+    key = xinput_filter_trim(line);
+    value = xinput_filter_trim(value);
+
+    if(isdigit((unsigned char)key[0]) && (key[1] == '.'))
+    {
+        first_slot = last_slot = key[0] - '0';
+
+        if(first_slot >= XUSER_MAX_COUNT)
+        {
+            return EINVAL;
+        }
+
+        key += 2;
+    }
+
+    if((setting = strrchr(key, '.')) == NULL)
+    {
+        return EINVAL;
+    }
+
+    *setting++ = '\0';
+
+    for(size_t i = 0; i < sizeof(controls) / sizeof(controls[0]); ++i)
+    {
+        if(strcmp(key, controls[i].name) == 0)
+        {
+            for(int slot = first_slot; slot <= last_slot; ++slot)
+            {
+                for(int side = controls[i].first; side <= controls[i].last; ++side)
+                {
+                    xinput_filter_control_settings* control = controls[i].stick?&settings[slot].stick[side]:&settings[slot].trigger[side];
+                    int ret;
+
+                    if((ret = xinput_filter_control_set(control, controls[i].stick, setting, value)) != 0)
+                    {
+                        return ret;
+                    }
+                }
+            }
+
+            return 0;
+        }
+    }
+
+    return EINVAL;
+}
+
+int xinput_filter_settings_load(const char* path, xinput_filter_settings* settings)
+{
+    FILE* f;
+    char line[256];
+    int line_number = 0;
+    int ret = 0;
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        xinput_filter_settings_default(&settings[slot]);
+    }
+
+    if((f = fopen(path, "re")) == NULL)
+    {
+        return errno;
+    }
+
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        char* comment;
+        char* text;
+
+        ++line_number;
+
+        if((comment = strchr(line, '#')) != NULL)
+        {
+            *comment = '\0';
+        }
+
+        text = xinput_filter_trim(line);
+
+        if(*text == '\0')
+        {
+            continue;
+        }
+
+        if((ret = xinput_filter_settings_line(text, settings)) != 0)
+        {
+            TRACE("%s:%i: cannot understand the line\n", path, line_number);
+            break;
+        }
+    }
+
+    fclose(f);
+
+    return ret;
+}
+
+static int32_t xinput_filter_clamp(int32_t value, int32_t low, int32_t high)
+{
+    return (value < low)?low:((value > high)?high:value);
+}
+
+/**
+ * The output of a control from its travel between the dead zones, 0 to 1.
+ */
+
+static double xinput_filter_curve(const xinput_filter_control_settings* settings, int32_t max, double travel)
+{
+    int32_t anti = xinput_filter_clamp(settings->anti_deadzone, 0, max);
+
+    return anti + (max - anti) * pow(travel, settings->curve);
+}
+
+/**
+ * Tells if the dead zones and curve of a control leave it as it is.
+ * The noise is applied by the gate, on its own.
+ */
+
+static BOOL xinput_filter_control_identity(const xinput_filter_control_settings* settings, const xinput_filter_control_settings* identity)
+{
+    return (settings->deadzone == identity->deadzone) &&
+           (settings->outer == identity->outer) &&
+           (settings->anti_deadzone == identity->anti_deadzone) &&
+           (settings->curve == identity->curve) &&
+           (settings->radial == identity->radial);
+}
+
+static void xinput_filter_stick_compile(xinput_filter_stick* stick, const xinput_filter_control_settings* settings)
+{
+    stick->identity = xinput_filter_control_identity(settings, &xinput_filter_stick_default);
+    stick->radial = settings->radial;
+    stick->deadzone = xinput_filter_clamp(settings->deadzone, 0, XINPUT_FILTER_STICK_MAX - 1);
+    stick->outer = xinput_filter_clamp(settings->outer, stick->deadzone + 1, XINPUT_FILTER_STICK_MAX);
+
+    for(int i = 0; i <= XINPUT_FILTER_STICK_LUT_SIZE; ++i)
+    {
+        double travel = (double)i / XINPUT_FILTER_STICK_LUT_SIZE;
+
+        stick->lut[i] = (uint16_t)lround(xinput_filter_curve(settings, XINPUT_FILTER_STICK_MAX, travel));
+    }
+}
+
+static void xinput_filter_trigger_compile(uint8_t* lut, const xinput_filter_control_settings* settings)
+{
+    int32_t deadzone = xinput_filter_clamp(settings->deadzone, 0, XINPUT_FILTER_TRIGGER_MAX - 1);
+    int32_t outer = xinput_filter_clamp(settings->outer, deadzone + 1, XINPUT_FILTER_TRIGGER_MAX);
+
+    for(int32_t value = 0; value <= XINPUT_FILTER_TRIGGER_MAX; ++value)
+    {
+        if(value <= deadzone)
+        {
+            lut[value] = 0;
+        }
+        else
+        {
+            double travel = (double)(xinput_filter_clamp(value, deadzone, outer) - deadzone) / (outer - deadzone);
+
+            lut[value] = (uint8_t)lround(xinput_filter_curve(settings, XINPUT_FILTER_TRIGGER_MAX, travel));
+        }
+    }
+}
+
+void xinput_filter_compile(xinput_filter* filter, const xinput_filter_settings* settings)
+{
+    filter->identity = TRUE;
+
+    for(int side = 0; side < 2; ++side)
+    {
+        xinput_filter_stick_compile(&filter->stick[side], &settings->stick[side]);
+        xinput_filter_trigger_compile(filter->trigger[side], &settings->trigger[side]);
+
+        filter->identity &= filter->stick[side].identity &&
+                            xinput_filter_control_identity(&settings->trigger[side], &xinput_filter_trigger_default);
+    }
+
+    filter->noise[XINPUT_FILTER_GATE_LX] = settings->stick[0].noise;
+    filter->noise[XINPUT_FILTER_GATE_LY] = settings->stick[0].noise;
+    filter->noise[XINPUT_FILTER_GATE_RX] = settings->stick[1].noise;
+    filter->noise[XINPUT_FILTER_GATE_RY] = settings->stick[1].noise;
+    filter->noise[XINPUT_FILTER_GATE_LT] = settings->trigger[0].noise;
+    filter->noise[XINPUT_FILTER_GATE_RT] = settings->trigger[1].noise;
+}
+
+static uint32_t xinput_filter_isqrt(uint32_t n)
+{
+    uint32_t root = 0;
+    uint32_t bit = 1U << 30;
+
+    while(bit > n)
+    {
+        bit >>= 2;
+    }
+
+    while(bit != 0)
+    {
+        if(n >= root + bit)
+        {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+/**
+ * The shaped distance of a stick out of its dead zone.
+ */
+
+static int32_t xinput_filter_stick_shape(const xinput_filter_stick* stick, int32_t distance)
+{
+    int32_t position;
+    int32_t index;
+    int32_t fraction;
+
+    if(distance >= stick->outer)
+    {
+        return stick->lut[XINPUT_FILTER_STICK_LUT_SIZE];
+    }
+
+    /* 8 bits of fraction between two points */
+
+    position = (int32_t)(((int64_t)(distance - stick->deadzone) * XINPUT_FILTER_STICK_LUT_SIZE * 256) / (stick->outer - stick->deadzone));
+    index = position >> 8;
+    fraction = position & 255;
+
+    return stick->lut[index] + (((stick->lut[index + 1] - stick->lut[index]) * fraction) >> 8);
+}
+
+static SHORT xinput_filter_axis_shape(const xinput_filter_stick* stick, int32_t value)
+{
+    int32_t distance = (value < 0)?-value:value;
+
+    if(distance <= stick->deadzone)
+    {
+        return 0;
+    }
+
+    distance = xinput_filter_stick_shape(stick, (distance > XINPUT_FILTER_STICK_MAX)?XINPUT_FILTER_STICK_MAX:distance);
+
+    return (SHORT)((value < 0)?-distance:distance);
+}
+
+static void xinput_filter_stick_apply(const xinput_filter_stick* stick, SHORT* x, SHORT* y)
+{
+    if(stick->identity)
+    {
+        return;
+    }
+
+    if(stick->radial)
+    {
+        int32_t sx = *x;
+        int32_t sy = *y;
+        uint32_t squared = (uint32_t)(sx * sx) + (uint32_t)(sy * sy);
+        int32_t distance;
+        int32_t shaped;
+
+        if(squared <= (uint32_t)(stick->deadzone * stick->deadzone))
+        {
+            *x = 0;
+            *y = 0;
+            return;
+        }
+
+        distance = xinput_filter_isqrt(squared);
+        shaped = xinput_filter_stick_shape(stick, distance);
+
+        *x = (SHORT)xinput_filter_clamp((int32_t)(((int64_t)sx * shaped) / distance), -XINPUT_FILTER_STICK_MAX - 1, XINPUT_FILTER_STICK_MAX);
+        *y = (SHORT)xinput_filter_clamp((int32_t)(((int64_t)sy * shaped) / distance), -XINPUT_FILTER_STICK_MAX - 1, XINPUT_FILTER_STICK_MAX);
+    }
+    else
+    {
+        *x = xinput_filter_axis_shape(stick, *x);
+        *y = xinput_filter_axis_shape(stick, *y);
+    }
+}
+
+void xinput_filter_apply(const xinput_filter* filter, XINPUT_GAMEPAD_EX* gamepad)
+{
+    if(filter->identity)
+    {
+        return;
+    }
+
+    xinput_filter_stick_apply(&filter->stick[0], &gamepad->sThumbLX, &gamepad->sThumbLY);
+    xinput_filter_stick_apply(&filter->stick[1], &gamepad->sThumbRX, &gamepad->sThumbRY);
+    gamepad->bLeftTrigger = filter->trigger[0][gamepad->bLeftTrigger];
+    gamepad->bRightTrigger = filter->trigger[1][gamepad->bRightTrigger];
+}
+
+/**
+ * The noise of a control of the gate, for a setting.
+ */
+
+static int32_t xinput_filter_gate_noise(const xinput_filter_gate* gate, int index, int32_t setting)
+{
+    const int32_t device[XINPUT_FILTER_GATE_COUNT] =
+    {
+        gate->device.thumb[0], gate->device.thumb[1], gate->device.thumb[2], gate->device.thumb[3],
+        gate->device.trigger[0], gate->device.trigger[1]
+    };
+
+    if(setting != XINPUT_FILTER_NOISE_DEVICE)
+    {
+        return setting;
+    }
+
+    if(device[index] > 0)
+    {
+        return device[index];
+    }
+
+    return (index < XINPUT_FILTER_GATE_LT)?XINPUT_FILTER_NOISE_STICK:XINPUT_FILTER_NOISE_TRIGGER;
+}
+
+void xinput_filter_gate_init(xinput_filter_gate* gate, const xinput_gamepad_device_noise* device)
+{
+    memset(gate, 0, sizeof(*gate));
+    gate->device = *device;
+
+    /* until the settings of the service are read (generation 0) */
+
+    for(int i = 0; i < XINPUT_FILTER_GATE_COUNT; ++i)
+    {
+        gate->noise[i] = xinput_filter_gate_noise(gate, i, XINPUT_FILTER_NOISE_DEVICE);
+    }
+}
+
+void xinput_filter_gate_set(xinput_filter_gate* gate, const xinput_filter* filter)
+{
+    for(int i = 0; i < XINPUT_FILTER_GATE_COUNT; ++i)
+    {
+        gate->noise[i] = xinput_filter_gate_noise(gate, i, filter->noise[i]);
+    }
+}
+
+/**
+ * Gates a control whose range is [low; high].
+ */
+
+static int32_t xinput_filter_gate_control(xinput_filter_gate* gate, int index, int32_t value, int32_t low, int32_t high, BOOL* held)
+{
+    int32_t delta = value - gate->held[index];
+
+    if((value == 0) || (value == low) || (value == high) || (delta > gate->noise[index]) || (delta < -gate->noise[index]))
+    {
+        gate->held[index] = value;
+    }
+    else if(delta != 0)
+    {
+        *held = TRUE;
+    }
+
+    return gate->held[index];
+}
+
+BOOL xinput_filter_gate_apply(xinput_filter_gate* gate, XINPUT_GAMEPAD_EX* gamepad)
+{
+    BOOL held = FALSE;
+
+    gamepad->sThumbLX = (SHORT)xinput_filter_gate_control(gate, XINPUT_FILTER_GATE_LX, gamepad->sThumbLX, -32768, 32767, &held);
+    gamepad->sThumbLY = (SHORT)xinput_filter_gate_control(gate, XINPUT_FILTER_GATE_LY, gamepad->sThumbLY, -32768, 32767, &held);
+    gamepad->sThumbRX = (SHORT)xinput_filter_gate_control(gate, XINPUT_FILTER_GATE_RX, gamepad->sThumbRX, -32768, 32767, &held);
+    gamepad->sThumbRY = (SHORT)xinput_filter_gate_control(gate, XINPUT_FILTER_GATE_RY, gamepad->sThumbRY, -32768, 32767, &held);
+    gamepad->bLeftTrigger = (BYTE)xinput_filter_gate_control(gate, XINPUT_FILTER_GATE_LT, gamepad->bLeftTrigger, 0, XINPUT_FILTER_TRIGGER_MAX, &held);
+    gamepad->bRightTrigger = (BYTE)xinput_filter_gate_control(gate, XINPUT_FILTER_GATE_RT, gamepad->bRightTrigger, 0, XINPUT_FILTER_TRIGGER_MAX, &held);
+
+    return held;
+}
+
+/*
+ * The filters of the service.
+ * The file is looked at again by the service at every probe period.
+ *
+ * The frames are filtered without a lock: the filters are protected by a
+ * seqlock, the lock only serializes their writers.
+ */
+
+static xinput_filter xinput_filters[XUSER_MAX_COUNT];
+static BOOL xinput_filters_enabled = FALSE;
+static uint32_t xinput_filters_generation = 0;  /* 0 until set, then odd */
+static volatile uint32_t xinput_filters_sequence = 0; /* odd while being written */
+static pthread_mutex_t xinput_filters_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static char* xinput_filter_file = NULL;
+static BOOL xinput_filter_file_set = FALSE;
+static struct stat xinput_filter_file_stat;
+
+static void xinput_filters_set(const xinput_filter_settings* settings)
+{
+    xinput_filter* filters;
+    BOOL enabled = FALSE;
+
+    if((filters = malloc(sizeof(xinput_filters))) == NULL)
+    {
+        return;
+    }
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        xinput_filter_compile(&filters[slot], &settings[slot]);
+        enabled |= !filters[slot].identity;
+    }
+
+    pthread_mutex_lock(&xinput_filters_mtx);
+    __atomic_store_n(&xinput_filters_sequence, xinput_filters_sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(xinput_filters, filters, sizeof(xinput_filters));
+    __atomic_store_n(&xinput_filters_sequence, xinput_filters_sequence + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&xinput_filters_enabled, enabled, __ATOMIC_RELEASE);
+    __atomic_store_n(&xinput_filters_generation, (xinput_filters_generation + 1) | 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&xinput_filters_mtx);
+
+    free(filters);
+}
+
+/**
+ * Reads the file and uses its settings.
+ * The lock of the file must be held.
+ */
+
+static int xinput_filter_file_load(void)
+{
+    xinput_filter_settings settings[XUSER_MAX_COUNT];
+    int ret;
+
+    if(xinput_filter_file == NULL)
+    {
+        return ENOENT;
+    }
+
+    if((ret = xinput_filter_settings_load(xinput_filter_file, settings)) == 0)
+    {
+        TRACE("filters read from %s\n", xinput_filter_file);
+        xinput_filters_set(settings);
+    }
+
+    return ret;
+}
+
+static pthread_mutex_t xinput_filter_file_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+int xinput_filter_set_file(const char* path)
+{
+    xinput_filter_settings settings[XUSER_MAX_COUNT];
+    int ret = ENOENT;
+
+    pthread_mutex_lock(&xinput_filter_file_mtx);
+
+    free(xinput_filter_file);
+    xinput_filter_file = (path != NULL)?strdup(path):NULL;
+    xinput_filter_file_set = TRUE;
+    memset(&xinput_filter_file_stat, 0, sizeof(xinput_filter_file_stat));
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        xinput_filter_settings_default(&settings[slot]);
+    }
+
+    xinput_filters_set(settings);
+
+    if((xinput_filter_file != NULL) && (stat(xinput_filter_file, &xinput_filter_file_stat) == 0))
+    {
+        ret = xinput_filter_file_load();
+    }
+
+    pthread_mutex_unlock(&xinput_filter_file_mtx);
+
+    return ret;
+}
+
+BOOL xinput_filter_reload(void)
+{
+    struct stat st;
+    BOOL changed = FALSE;
+
+    pthread_mutex_lock(&xinput_filter_file_mtx);
+
+    if(!xinput_filter_file_set)
+    {
+        xinput_filter_file = strdup(XINPUT_FILTER_FILE);
+        xinput_filter_file_set = TRUE;
+        memset(&xinput_filter_file_stat, 0, sizeof(xinput_filter_file_stat));
+    }
+
+    if(xinput_filter_file != NULL)
+    {
+        if(stat(xinput_filter_file, &st) == 0)
+        {
+            if((st.st_ino != xinput_filter_file_stat.st_ino) ||
+               (st.st_size != xinput_filter_file_stat.st_size) ||
+               (st.st_mtim.tv_sec != xinput_filter_file_stat.st_mtim.tv_sec) ||
+               (st.st_mtim.tv_nsec != xinput_filter_file_stat.st_mtim.tv_nsec))
+            {
+                xinput_filter_file_stat = st;
+                changed = xinput_filter_file_load() == 0;
+            }
+        }
+        else if(xinput_filter_file_stat.st_ino != 0)
+        {
+            /* the file is gone: back to the controls as they are */
+
+            xinput_filter_settings settings[XUSER_MAX_COUNT];
+
+            for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+            {
+                xinput_filter_settings_default(&settings[slot]);
+            }
+
+            TRACE("%s is gone\n", xinput_filter_file);
+
+            memset(&xinput_filter_file_stat, 0, sizeof(xinput_filter_file_stat));
+            xinput_filters_set(settings);
+            changed = TRUE;
+        }
+    }
+
+    pthread_mutex_unlock(&xinput_filter_file_mtx);
+
+    return changed;
+}
+
+void xinput_filter_gamepad(int slot, XINPUT_GAMEPAD_EX* gamepad)
+{
+    xinput_filter filter;
+
+    if(!__atomic_load_n(&xinput_filters_enabled, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    /*
+     * A filter copied in the middle of a reload mixes the old settings and
+     * the new ones (ie: an outer dead zone equal to the dead zone): it is
+     * only applied once the sequence tells it is whole.
+     */
+
+    for(;;)
+    {
+        uint32_t sequence = __atomic_load_n(&xinput_filters_sequence, __ATOMIC_ACQUIRE);
+
+        if((sequence & 1) == 0)
+        {
+            memcpy(&filter, &xinput_filters[slot], sizeof(filter));
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if(__atomic_load_n(&xinput_filters_sequence, __ATOMIC_RELAXED) == sequence)
+            {
+                break;
+            }
+        }
+        else
+        {
+            /* the writer may have been preempted in the middle of the copy */
+
+            sched_yield();
+        }
+    }
+
+    xinput_filter_apply(&filter, gamepad);
+}
+
+BOOL xinput_filter_gamepad_gate(int slot, xinput_filter_gate* gate, XINPUT_GAMEPAD_EX* gamepad)
+{
+    uint32_t generation = __atomic_load_n(&xinput_filters_generation, __ATOMIC_ACQUIRE);
+
+    /* the noise is only looked up again when the settings changed */
+
+    if(generation != gate->generation)
+    {
+        pthread_mutex_lock(&xinput_filters_mtx);
+        xinput_filter_gate_set(gate, &xinput_filters[slot]);
+        gate->generation = __atomic_load_n(&xinput_filters_generation, __ATOMIC_ACQUIRE);
+        pthread_mutex_unlock(&xinput_filters_mtx);
+    }
+
+    return xinput_filter_gate_apply(gate, gamepad);
+}
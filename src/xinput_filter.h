@@ -0,0 +1,270 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef XINPUT_FILTER_H
+#define XINPUT_FILTER_H
+
+#include <stdint.h>
+
+#include "xinput.h"
+#include "xinput_gamepad.h"
+
+#ifndef XUSER_MAX_COUNT
+#define XUSER_MAX_COUNT 4
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The service shapes the sticks and triggers of each slot before publishing
+ * them, so the clients do not have to:
+ *
+ *  - a dead zone, under which the control is at rest,
+ *  - an outer dead zone, over which it is at its maximum,
+ *  - an anti dead zone, where the control starts once out of the dead zone,
+ *    for the games applying their own dead zone,
+ *  - a response curve, the exponent of the travel between them.
+ *
+ * A stick dead zone is radial (on the distance from the center) or axial
+ * (on each axis on its own).
+ *
+ * Before that, a noise gate holds each axis where it has last been published
+ * until it moves by more than its noise, so the jitter of a resting pad
+ * does not make new states (see xinput_filter_gate).
+ */
+
+#define XINPUT_FILTER_STICK_MAX     32767
+#define XINPUT_FILTER_TRIGGER_MAX   255
+
+/**
+ * The points of the curve of a stick, interpolated between them.
+ */
+
+#define XINPUT_FILTER_STICK_LUT_SIZE 1024
+
+/**
+ * The noise of a control taken from the device (or XINPUT_FILTER_NOISE_STICK
+ * and XINPUT_FILTER_NOISE_TRIGGER if it does not tell).
+ */
+
+#define XINPUT_FILTER_NOISE_DEVICE  (-1)
+
+struct xinput_filter_control_settings
+{
+    int32_t deadzone;
+    int32_t outer;
+    int32_t anti_deadzone;
+    double curve;
+    BOOL radial;                /* sticks only */
+    int32_t noise;              /* 0 for no gate, or XINPUT_FILTER_NOISE_DEVICE */
+};
+
+typedef struct xinput_filter_control_settings xinput_filter_control_settings;
+
+struct xinput_filter_settings
+{
+    xinput_filter_control_settings stick[2];        /* left, right */
+    xinput_filter_control_settings trigger[2];      /* left, right */
+};
+
+typedef struct xinput_filter_settings xinput_filter_settings;
+
+struct xinput_filter_stick
+{
+    BOOL identity;
+    BOOL radial;
+    int32_t deadzone;
+    int32_t outer;
+    uint16_t lut[XINPUT_FILTER_STICK_LUT_SIZE + 1];
+};
+
+typedef struct xinput_filter_stick xinput_filter_stick;
+
+/*
+ * The controls of the noise gate
+ */
+
+#define XINPUT_FILTER_GATE_LX       0
+#define XINPUT_FILTER_GATE_LY       1
+#define XINPUT_FILTER_GATE_RX       2
+#define XINPUT_FILTER_GATE_RY       3
+#define XINPUT_FILTER_GATE_LT       4
+#define XINPUT_FILTER_GATE_RT       5
+#define XINPUT_FILTER_GATE_COUNT    6
+
+struct xinput_filter
+{
+    BOOL identity;              /* of the dead zones and curves, the gate aside */
+    xinput_filter_stick stick[2];
+    uint8_t trigger[2][XINPUT_FILTER_TRIGGER_MAX + 1];
+    int32_t noise[XINPUT_FILTER_GATE_COUNT];
+};
+
+typedef struct xinput_filter xinput_filter;
+
+/*
+ * The noise gate of a slot, kept by the service from one frame to the next.
+ * The rest and both ends of a control always get through, so a released
+ * stick is published centered.
+ */
+
+struct xinput_filter_gate
+{
+    int32_t noise[XINPUT_FILTER_GATE_COUNT];
+    int32_t held[XINPUT_FILTER_GATE_COUNT];
+    xinput_gamepad_device_noise device;
+    uint32_t generation;        /* of the service settings the noise comes from */
+};
+
+typedef struct xinput_filter_gate xinput_filter_gate;
+
+/**
+ * Sets the settings that leave the controls as they are.
+ *
+ * @param settings
+ */
+
+void xinput_filter_settings_default(xinput_filter_settings* settings);
+
+/**
+ * Reads the settings of every slot from a file of lines
+ *
+ *     [<slot>.]<control>.<setting> = <value>
+ *
+ * with <control> one of left, right, sticks, left_trigger, right_trigger,
+ * triggers and <setting> one of deadzone, outer, anti_deadzone, curve,
+ * noise (a number or device) and, for the sticks, mode (radial or axial).
+ * Without a slot, a line sets every slot.  '#' starts a comment.
+ *
+ * The slots not set keep the default settings.
+ *
+ * @param path
+ * @param settings receives the settings of the XUSER_MAX_COUNT slots
+ *
+ * @return 0 or an error code (EINVAL for a line that cannot be understood)
+ */
+
+int xinput_filter_settings_load(const char* path, xinput_filter_settings* settings);
+
+/**
+ * Computes the tables of a filter.
+ * Out of range settings are clamped.
+ *
+ * @param filter
+ * @param settings
+ */
+
+void xinput_filter_compile(xinput_filter* filter, const xinput_filter_settings* settings);
+
+/**
+ * Shapes the sticks and triggers of a gamepad.
+ *
+ * @param filter
+ * @param gamepad
+ */
+
+void xinput_filter_apply(const xinput_filter* filter, XINPUT_GAMEPAD_EX* gamepad);
+
+/**
+ * Starts the gate of a newly connected device, at rest.
+ *
+ * @param gate
+ * @param device the noise of the device
+ */
+
+void xinput_filter_gate_init(xinput_filter_gate* gate, const xinput_gamepad_device_noise* device);
+
+/**
+ * Takes the noise of each control from the settings of a filter, and from
+ * the device for the controls set to XINPUT_FILTER_NOISE_DEVICE.
+ *
+ * @param gate
+ * @param filter
+ */
+
+void xinput_filter_gate_set(xinput_filter_gate* gate, const xinput_filter* filter);
+
+/**
+ * Holds the sticks and triggers of a gamepad that did not move by more than
+ * their noise since they last got through.
+ *
+ * @param gate
+ * @param gamepad
+ *
+ * @return TRUE if a control has been held
+ */
+
+BOOL xinput_filter_gate_apply(xinput_filter_gate* gate, XINPUT_GAMEPAD_EX* gamepad);
+
+/**
+ * Sets the file of the settings used by the service, and reads it.
+ * XINPUT_FILTER_FILE by default, NULL for none.
+ *
+ * @param path
+ *
+ * @return 0 or an error code, the default settings being used then
+ */
+
+int xinput_filter_set_file(const char* path);
+
+/**
+ * Reads the file of the settings again if it changed since its last read.
+ * A file that cannot be read leaves the settings as they were.
+ *
+ * @return TRUE if the settings changed
+ */
+
+BOOL xinput_filter_reload(void);
+
+/**
+ * Shapes the sticks and triggers of a gamepad with the settings of its slot.
+ *
+ * @param slot
+ * @param gamepad
+ */
+
+void xinput_filter_gamepad(int slot, XINPUT_GAMEPAD_EX* gamepad);
+
+/**
+ * Gates the sticks and triggers of a gamepad with the settings of its slot,
+ * before xinput_filter_gamepad.
+ *
+ * @param slot
+ * @param gate the gate of the device of the slot
+ * @param gamepad
+ *
+ * @return TRUE if a control has been held
+ */
+
+BOOL xinput_filter_gamepad_gate(int slot, xinput_filter_gate* gate, XINPUT_GAMEPAD_EX* gamepad);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* XINPUT_FILTER_H */
@@ -37,14 +37,6 @@
 #include <semaphore.h>
 #endif
 
-#ifndef HAVE_MQ_OPEN
-#undef XINPUT_USES_MQUEUE
-#endif
-
-#if XINPUT_USES_MQUEUE
-#include <mqueue.h>
-#endif
-
 #if HAVE_WINE
 #include "wine/debug.h"
 #include "winerror.h"
@@ -60,6 +52,7 @@
 #include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "xinput.h"
 #include "xinput_gamepad.h"
@@ -78,17 +71,19 @@ static pthread_mutex_t xinput_gamepad_init_mtx = PTHREAD_MUTEX_INITIALIZER;
 static volatile int xinput_gamepad_init_done = 0;
 
 static xinput_shared_gamepad_state* client_shared = NULL;
+static xinput_shared_gamepad_state* client_retired_shared = NULL;
 static int client_fd = -1;
-static int64_t client_last_probe = 0;
+static pthread_t client_heartbeat_id = 0;
+static volatile BOOL client_active = FALSE;
+static BOOL client_incompatible = FALSE; /* the service cannot be used, and must not be started again */
+static volatile int client_doorbell_fd = -1; /* rings the reactor of the service, made at the first ring */
+
+static void xinput_gamepad_notify_heartbeat(void);
 
 #if XINPUT_USES_SEMAPHORE_MUTEX
 static sem_t*  client_sem = SEM_FAILED;
 #endif
 
-#if XINPUT_USES_MQUEUE
-static mqd_t client_mq = MQD_INVALID;
-#endif
-
 static BOOL xinput_gamepad_lock_open(void)
 {
 #if XINPUT_USES_SEMAPHORE_MUTEX
@@ -130,51 +125,61 @@ static void xinput_gamepad_unlock(void)
 #endif
 }
 
-#if XINPUT_USES_MQUEUE
-
-static BOOL xinput_gamepad_service_queue_open(void)
+static void xinput_gamepad_service_disconnect(void)
 {
-    mqd_t mq = mq_open(SERVICE_MSG_NAME, O_WRONLY);
-    if(mq == MQD_INVALID)
+    xinput_gamepad_lock_close();
+
+    if(client_shared != NULL)
     {
-        int ret = errno;
-        TRACE("could not open message queue: %s\n", strerror(ret));
-        return FALSE;
-    }
-    client_mq = mq;
+        TRACE("disconnecting\n");
 
-    return TRUE;
+        munmap(client_shared, sizeof(xinput_shared_gamepad_state));
+        client_shared = NULL;
+
+        close_ex(client_fd);
+        client_fd = -1;
+    }
 }
 
-static void xinput_gamepad_service_queue_close(void)
+static void xinput_gamepad_service_release_retired(void)
 {
-    if(client_mq != MQD_INVALID)
+    if(client_retired_shared != NULL)
     {
-        mq_close(client_mq);
-        client_mq = MQD_INVALID;
+        munmap(client_retired_shared, sizeof(xinput_shared_gamepad_state));
+        client_retired_shared = NULL;
     }
 }
 
-#endif
+/**
+ * Disconnects from the service, but keeps the shared memory mapped for the
+ * threads that may still be reading it.
+ * It is unmapped by xinput_gamepad_service_release_retired.
+ */
 
-static void xinput_gamepad_service_disconnect(void)
+static void xinput_gamepad_service_retire(void)
 {
-#if XINPUT_USES_MQUEUE
-    xinput_gamepad_service_queue_close();
-#endif
+    xinput_shared_gamepad_state* shared = client_shared;
+
+    if(shared == NULL)
+    {
+        xinput_gamepad_service_disconnect();
+        return;
+    }
+
+    TRACE("retiring\n");
+
+    __atomic_store_n(&client_shared, NULL, __ATOMIC_RELEASE);
 
     xinput_gamepad_lock_close();
 
-    if(client_shared != NULL)
-    {
-        TRACE("disconnecting\n");
+    close_ex(client_fd);
+    client_fd = -1;
 
-        munmap(client_shared, sizeof(xinput_shared_gamepad_state));
-        client_shared = NULL;
+    /* only one is kept: the readers have had a whole period to let go of an older one */
 
-        close_ex(client_fd);
-        client_fd = -1;
-    }
+    xinput_gamepad_service_release_retired();
+
+    client_retired_shared = shared;
 }
 
 /**
@@ -192,15 +197,11 @@ static int xinput_gamepad_service_is_alive(void)
 
     if(xinput_service_self())
     {
-        client_shared->poke_us = timeus();
-        
         //TRACE("alive (self)\n");
         return 0;
     }
 #endif
 
-    /*  wait until the pid is set, or assumed to be broken */
-
     TRACE("fetching master pid, shared@%p\n", client_shared);
     
     if(client_shared == NULL)
@@ -208,24 +209,9 @@ static int xinput_gamepad_service_is_alive(void)
         return -1;
     }
 
-    /* give 5 tries to get the master */
-
-    for(int i = 5; i >= 0; --i)
-    {
-        pid = client_shared->master_pid;
-
-        /* if the pid is 0, the shared memory has not been set yet */
+    /* the memory is only connected once the pid is set, see xinput_gamepad_service_connect */
 
-        if(pid != 0)
-        {
-            TRACE("owned by pid %i\n", pid);
-            break;
-        }
-
-        /*  this will only happen if the DLL has been loaded twice "at the same time" */
-
-        usleep(XINPUT_OWNER_PROBE_PERIOD_US);
-    }
+    pid = client_shared->header.master_pid;
 
     if(pid != 0)
     {
@@ -261,17 +247,75 @@ static int xinput_gamepad_service_is_alive(void)
     }
     else
     {
-        client_shared->poke_us = timeus();
-
         TRACE("alive\n");
         /*  alive */
         return 0;
     }
 }
 
+/**
+ * Waits until the service has made its first probe, so that the first
+ * states read are the ones of the gamepads already plugged.
+ *
+ * @param state the mapped shared memory
+ * @param timeout_us the maximum wait
+ *
+ * @return 0, ETIMEDOUT, or ESRCH if the service is gone
+ */
+
+static int xinput_gamepad_service_wait_ready(xinput_shared_gamepad_state* state, int64_t timeout_us)
+{
+    int64_t deadline = timeus() + timeout_us;
+
+    for(;;)
+    {
+        pid_t pid = state->header.master_pid;
+        int64_t wait_us;
+
+        /* left behind by a service that died: it may be ready */
+
+        if((pid == XINPUT_OWNER_BROKEN) || ((pid != 0) && (kill(pid, 0) < 0)))
+        {
+            return ESRCH;
+        }
+
+        if(__atomic_load_n(&state->header.ready, __ATOMIC_ACQUIRE) != 0)
+        {
+            return 0;
+        }
+
+        if((wait_us = deadline - timeus()) <= 0)
+        {
+            return ETIMEDOUT;
+        }
+
+        /* wake up regularly anyway, to see a service dying before being ready */
+
+        if(wait_us > XINPUT_OWNER_PROBE_PERIOD_US)
+        {
+            wait_us = XINPUT_OWNER_PROBE_PERIOD_US;
+        }
+
+        futex_wait_us(&state->header.ready, 0, wait_us);
+    }
+}
+
+/**
+ * Maps the shared memory of the service and opens its IPCs, once the
+ * service is ready.
+ *
+ * @return ERROR_SUCCESS,
+ *         ENOENT if there is no service,
+ *         EAGAIN if the service has not finished its initialisation,
+ *         ESRCH if the service is gone,
+ *         EPROTO if the service is not compatible with this client,
+ *         or another error
+ */
+
 static int xinput_gamepad_service_connect(void)
 {
     xinput_shared_gamepad_state* state;
+    struct stat st;
     int ret;
     int fd;
 
@@ -288,6 +332,29 @@ static int xinput_gamepad_service_connect(void)
 
     fd = ret;
 
+    /* a smaller memory would make the mapping fault */
+
+    if(fstat(fd, &st) < 0)
+    {
+        ret = errno;
+        close_ex(fd);
+        TRACE("could not stat: %s\n", strerror(ret));
+        return ret;
+    }
+
+    if((size_t)st.st_size < sizeof(xinput_shared_gamepad_state))
+    {
+        close_ex(fd);
+
+        if(st.st_size == 0)
+        {
+            return EAGAIN; /* not sized yet */
+        }
+
+        TRACE("incompatible service: shared memory of %lli bytes instead of %i\n", (long long)st.st_size, (int)sizeof(xinput_shared_gamepad_state));
+        return EPROTO;
+    }
+
     TRACE("mapping\n");
 
     state = (xinput_shared_gamepad_state*)mmap(
@@ -297,7 +364,7 @@ static int xinput_gamepad_service_connect(void)
                 fd,
                 0);
 
-    if(state == NULL)
+    if(state == MAP_FAILED)
     {
         ret = errno;
         close_ex(fd);
@@ -307,28 +374,49 @@ static int xinput_gamepad_service_connect(void)
 
     memdump(state, sizeof(xinput_shared_gamepad_state));
 
-    client_shared = state;
-    client_fd = fd;
+    if((ret = xinput_shared_header_check(&state->header, st.st_size)) != 0)
+    {
+        if(ret == EPROTO)
+        {
+            TRACE("incompatible service: version %u, %u bytes, %u states of %u bytes, expected version %u, %u bytes, %u states of %u bytes\n",
+                    state->header.version, state->header.size, state->header.state_count, state->header.state_size,
+                    XINPUT_SHARED_VERSION, (unsigned int)sizeof(xinput_shared_gamepad_state), XUSER_MAX_COUNT, (unsigned int)sizeof(xinput_gamepad_state));
+        }
 
-    if(!xinput_gamepad_lock_open())
+        munmap(state, sizeof(xinput_shared_gamepad_state));
+        close_ex(fd);
+        return ret;
+    }
+
+    /* the readers may use it as soon as it is set: no dead service, no empty states */
+
+    if((ret = xinput_gamepad_service_wait_ready(state, XINPUT_OWNER_STARTUP_TIMEOUT_US)) != 0)
     {
-        TRACE("error opening lock\n");
+        /* a service with a lot of devices to probe is still better than none */
 
-        xinput_gamepad_service_disconnect();
+        if((ret != ETIMEDOUT) || (state->header.master_pid == 0))
+        {
+            TRACE("service not ready: %s\n", strerror(ret));
 
-        return -1;  /* do not return ENOENT */
+            munmap(state, sizeof(xinput_shared_gamepad_state));
+            close_ex(fd);
+            return (ret == ESRCH)?ESRCH:EAGAIN;
+        }
+
+        TRACE("service slow to probe, connecting anyway\n");
     }
 
-#if XINPUT_USES_MQUEUE
-    if(!xinput_gamepad_service_queue_open())
+    __atomic_store_n(&client_shared, state, __ATOMIC_RELEASE);
+    client_fd = fd;
+
+    if(!xinput_gamepad_lock_open())
     {
-        TRACE("error opening queue\n");
+        TRACE("error opening lock\n");
 
         xinput_gamepad_service_disconnect();
 
-        return -2;  /* do not return ENOENT */
+        return -1;  /* do not return ENOENT */
     }
-#endif
 
     client_shared->poke_us = timeus();
 
@@ -337,40 +425,154 @@ static int xinput_gamepad_service_connect(void)
     return ERROR_SUCCESS;
 }
 
-static void xinput_gamepad_service_probe(void)
-{
-    int64_t now;
+/**
+ * Starts the service and connects to it as soon as it is ready.
+ * The service is started again if it does not show up in time.
+ *
+ * @param timeout_us the maximum time to try, <0 for no limit
+ *
+ * @return ERROR_SUCCESS, EPROTO if the service is not compatible with this
+ *         client, or the last error
+ */
 
-    xinput_gamepad_init();
+static int xinput_gamepad_service_start(int64_t timeout_us)
+{
+    int64_t spawned_us = timeus();
+    int64_t deadline = (timeout_us < 0)?INT64_MAX:spawned_us + timeout_us;
+    int64_t retry_us = XINPUT_OWNER_CONNECT_RETRY_MIN_US;
 
-    now = timeus();
+    TRACE("starting server\n");
+    xinput_service_rundll();
 
-    if(now - client_last_probe > XINPUT_OWNER_REPROBE_PERIOD_US)
+    for(;;)
     {
-        if(xinput_gamepad_service_is_alive() < 0)
+        int64_t now;
+        int ret = xinput_gamepad_service_connect();
+
+        if((ret == ERROR_SUCCESS) || (ret == EPROTO))
+        {
+            return ret;
+        }
+
+        if(ret < 0)
+        {
+            TRACE("could not connect to IPCs: %i\n", ret);
+        }
+        else if((ret != ENOENT) && (ret != EAGAIN) && (ret != ESRCH))
+        {
+            TRACE("failed to connect: %s\n", strerror(ret));
+        }
+
+        if((now = timeus()) >= deadline)
         {
-            /* spawn the server and wait for a bit */
+            return ret;
+        }
 
-            xinput_gamepad_service_disconnect();
+        /* the one started did not make it */
 
+        if(now - spawned_us >= XINPUT_OWNER_STARTUP_TIMEOUT_US)
+        {
+            TRACE("starting server again\n");
             xinput_service_rundll();
-            sleep(1);
+            spawned_us = now;
+            retry_us = XINPUT_OWNER_CONNECT_RETRY_MIN_US;
+        }
 
-            xinput_gamepad_service_connect();
+        usleep(retry_us);
+
+        if((retry_us <<= 1) > XINPUT_OWNER_CONNECT_RETRY_MAX_US)
+        {
+            retry_us = XINPUT_OWNER_CONNECT_RETRY_MAX_US;
         }
-        client_last_probe = now;
     }
-    else
+}
+
+/**
+ * Checks the service is still alive, restarts it if needed, and tells it
+ * this process is still using it.
+ * Done once per period by a thread so that reading a state is only a read.
+ */
+
+static void xinput_gamepad_service_heartbeat(void)
+{
+    /* the readers have had a whole period to let go of the old memory */
+
+    xinput_gamepad_service_release_retired();
+
+    /* starting another one would only find the same service */
+
+    if(client_incompatible)
+    {
+        return;
+    }
+
+    if(xinput_gamepad_service_is_alive() < 0)
     {
+        /* spawn the server and wait for a bit */
+
+        xinput_gamepad_service_retire();
+
+        if(xinput_gamepad_service_start(XINPUT_OWNER_STARTUP_TIMEOUT_US) == EPROTO)
+        {
+            TRACE("incompatible service, giving up\n");
+            client_incompatible = TRUE;
+        }
+    }
+    else if(client_active)
+    {
+        client_active = FALSE;
+
         if(client_shared != NULL)
         {
             client_shared->poke_us = timeus();
         }
     }
+
+    xinput_gamepad_notify_heartbeat();
+}
+
+static void* xinput_gamepad_heartbeat_thread(void* args)
+{
+    (void)args;
+
+    for(;;)
+    {
+        usleep(XINPUT_OWNER_REPROBE_PERIOD_US);
+
+        xinput_gamepad_service_heartbeat();
+    }
+
+    return NULL;
+}
+
+/**
+ * Initialises the client if needed and returns the shared memory.
+ * This is on the path of every call: no lock, no clock, no shared write.
+ *
+ * @return the shared memory, or NULL if the service is being restarted
+ */
+
+static inline xinput_shared_gamepad_state* xinput_gamepad_service_get(void)
+{
+    if(__atomic_load_n(&xinput_gamepad_init_done, __ATOMIC_ACQUIRE) == 0)
+    {
+        xinput_gamepad_init();
+    }
+
+    if(!client_active)
+    {
+        client_active = TRUE;
+    }
+
+    return __atomic_load_n(&client_shared, __ATOMIC_ACQUIRE);
 }
 
 void xinput_gamepad_init(void)
 {
+    int ret;
+
+    /* the other threads wait until the connection is made */
+
     pthread_mutex_lock(&xinput_gamepad_init_mtx);
     if(xinput_gamepad_init_done != 0)
     {
@@ -378,59 +580,31 @@ void xinput_gamepad_init(void)
         return;
     }
 
-    xinput_gamepad_init_done = 1;
-    pthread_mutex_unlock(&xinput_gamepad_init_mtx);
-
     TRACE("initializing\n");
 
-    xinput_service_rundll();
+    /* the connection is only made once the service has probed the devices */
 
-    for(;;)
+    if(xinput_gamepad_service_start(-1) == EPROTO)
     {
-        int ret = xinput_gamepad_service_connect();
-
-        if(ret == 0)
-        {
-            /*
-             * The IPCs are set, but there may be nobody on the
-             * other side
-             */
+        /* reading its memory would return garbage: no gamepad */
 
-            if(xinput_gamepad_service_is_alive() >= 0)
-            {
-                break;
-            }
-            else
-            {
-                /*  the server is dead : retry */
-
-                xinput_gamepad_service_disconnect();
-
-                xinput_service_rundll();
-                sleep(1);
+        TRACE("incompatible service, giving up\n");
+        client_incompatible = TRUE;
+    }
 
-                continue;
-            }
-        }
+    client_active = TRUE;
 
-        if(ret == ENOENT)
-        {
-            TRACE("starting server\n");
-            xinput_service_rundll();
-            sleep(1);
-        }
-        else if(ret < 0)
-        {
-            TRACE("could not connect to IPCs: %i", ret);
-        }
-        else
-        {
-            TRACE("failed to connect: %s\n", strerror(ret));
-        }
+    ret = pthread_create(&client_heartbeat_id, NULL, xinput_gamepad_heartbeat_thread, NULL);
 
-        usleep(100000);
+    if(ret != 0)
+    {
+        TRACE("could not start the heartbeat: %s\n", strerror(ret));
+        client_heartbeat_id = 0;
     }
 
+    __atomic_store_n(&xinput_gamepad_init_done, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&xinput_gamepad_init_mtx);
+
     TRACE("initialized\n");
 }
 
@@ -445,30 +619,51 @@ void xinput_gamepad_finalize(void)
         return;
     }
 
-    xinput_gamepad_init_done = 0;
-    pthread_mutex_unlock(&xinput_gamepad_init_mtx);
-
     TRACE("finalizing\n");
 
+    /* the service forgets the eventfd */
+
+    xinput_gamepad_notify_close();
+
+    if(client_heartbeat_id != 0)
+    {
+        pthread_cancel(client_heartbeat_id);
+        pthread_join(client_heartbeat_id, NULL);
+        client_heartbeat_id = 0;
+    }
+
     xinput_gamepad_service_disconnect();
+    xinput_gamepad_service_release_retired();
+
+    /* the next initialization may find another service */
+
+    client_incompatible = FALSE;
+
+    if(client_doorbell_fd >= 0)
+    {
+        close_ex(client_doorbell_fd);
+        client_doorbell_fd = -1;
+    }
+
+    __atomic_store_n(&xinput_gamepad_init_done, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&xinput_gamepad_init_mtx);
 
     TRACE("finalized\n");
 }
 
 BOOL xinput_gamepad_connected(int index)
 {
+    xinput_shared_gamepad_state* shared;
     xinput_gamepad_state* xgs;
     BOOL ret = FALSE;
 
-    xinput_gamepad_service_probe();
-
-    if(client_shared == NULL)
+    if((shared = xinput_gamepad_service_get()) == NULL)
     {
         TRACE("shared memory not mapped, initialised=%i\n", xinput_gamepad_init_done);
         return ret;
     }
 
-    xgs = &client_shared->state[index];
+    xgs = &shared->state[index];
 
     if(xinput_gamepad_lock())
     {
@@ -495,42 +690,104 @@ static DWORD xinput_gamepad_axis_to_buttons(SHORT value, DWORD negative, DWORD p
     }
 }
 
-BOOL xinput_gamepad_copy_buttons_state(int index, DWORD* out_buttons)
+DWORD xinput_gamepad_buttons_ex(const XINPUT_GAMEPAD_EX* gamepad)
 {
-    xinput_gamepad_state* xgs;
-    XINPUT_GAMEPAD gamepad;
-    DWORD buttons;
+    DWORD buttons = gamepad->wButtons;
 
-    if(out_buttons == NULL)
+    buttons |= xinput_gamepad_axis_to_buttons(gamepad->sThumbLX, XINPUT_GAMEPAD_LTHUMB_LEFT, XINPUT_GAMEPAD_LTHUMB_RIGHT);
+    buttons |= xinput_gamepad_axis_to_buttons(gamepad->sThumbLY, XINPUT_GAMEPAD_LTHUMB_DOWN, XINPUT_GAMEPAD_LTHUMB_UP);
+    buttons |= xinput_gamepad_axis_to_buttons(gamepad->sThumbRX, XINPUT_GAMEPAD_RTHUMB_LEFT, XINPUT_GAMEPAD_RTHUMB_RIGHT);
+    buttons |= xinput_gamepad_axis_to_buttons(gamepad->sThumbRY, XINPUT_GAMEPAD_RTHUMB_DOWN, XINPUT_GAMEPAD_RTHUMB_UP);
+
+    if(gamepad->bLeftTrigger > TRIGGER_TO_BUTTONS_THRESHOLD)
     {
-        return FALSE;
+        buttons |= XINPUT_GAMEPAD_LTRIGGER;
+    }
+    if(gamepad->bRightTrigger > TRIGGER_TO_BUTTONS_THRESHOLD)
+    {
+        buttons |= XINPUT_GAMEPAD_RTRIGGER;
     }
 
-    xinput_gamepad_service_probe();
-    xgs = &client_shared->state[index];
+    return buttons;
+}
 
-    if(xinput_gamepad_lock())
-    {
-        memcpy(&gamepad, &xgs->gamepad, sizeof(XINPUT_GAMEPAD));
+/**
+ * The sector key of a thumb from its directions: up, right, down, left from
+ * bit 0 to 3, like XINPUT_GAMEPAD_LTHUMB_UP to XINPUT_GAMEPAD_LTHUMB_LEFT.
+ */
 
-        xinput_gamepad_unlock();
+static const uint8_t xinput_gamepad_thumb_sectors[16] =
+{
+    0,          /* centered */
+    0x01,       /* up */
+    0x04,       /* right */
+    0x20,       /* up right */
+    0x02,       /* down */
+    0,
+    0x40,       /* down right */
+    0,
+    0x08,       /* left */
+    0x10,       /* up left */
+    0,
+    0,
+    0x80,       /* down left */
+    0,
+    0,
+    0
+};
+
+static inline uint64_t xinput_gamepad_thumb_keys(SHORT x, SHORT y, int shift)
+{
+    unsigned int directions = (y > THUMB_TO_BUTTONS_THRESHOLD) |
+                              ((x > THUMB_TO_BUTTONS_THRESHOLD) << 1) |
+                              ((y < -THUMB_TO_BUTTONS_THRESHOLD) << 2) |
+                              ((x < -THUMB_TO_BUTTONS_THRESHOLD) << 3);
 
-        buttons = gamepad.wButtons;
-        buttons |= xinput_gamepad_axis_to_buttons(gamepad.sThumbLX, XINPUT_GAMEPAD_LTHUMB_LEFT, XINPUT_GAMEPAD_LTHUMB_RIGHT);
-        buttons |= xinput_gamepad_axis_to_buttons(gamepad.sThumbLY, XINPUT_GAMEPAD_LTHUMB_DOWN, XINPUT_GAMEPAD_LTHUMB_UP);
-        buttons |= xinput_gamepad_axis_to_buttons(gamepad.sThumbRX, XINPUT_GAMEPAD_RTHUMB_LEFT, XINPUT_GAMEPAD_RTHUMB_RIGHT);
-        buttons |= xinput_gamepad_axis_to_buttons(gamepad.sThumbRY, XINPUT_GAMEPAD_RTHUMB_DOWN, XINPUT_GAMEPAD_RTHUMB_UP);
+    return (uint64_t)xinput_gamepad_thumb_sectors[directions] << shift;
+}
 
-        if(gamepad.bLeftTrigger > TRIGGER_TO_BUTTONS_THRESHOLD)
-        {
-            buttons |= XINPUT_GAMEPAD_LTRIGGER;
-        }
-        if(gamepad.bRightTrigger > TRIGGER_TO_BUTTONS_THRESHOLD)
-        {
-            buttons |= XINPUT_GAMEPAD_RTRIGGER;
-        }
+uint64_t xinput_gamepad_keys(const XINPUT_GAMEPAD_EX* gamepad)
+{
+    uint64_t keys = gamepad->wButtons;
 
-        *out_buttons = buttons;
+    keys |= (uint64_t)(gamepad->bLeftTrigger > TRIGGER_TO_BUTTONS_THRESHOLD) << 16;
+    keys |= (uint64_t)(gamepad->bRightTrigger > TRIGGER_TO_BUTTONS_THRESHOLD) << 17;
+    keys |= xinput_gamepad_thumb_keys(gamepad->sThumbLX, gamepad->sThumbLY, XINPUT_GAMEPAD_KEYS_LTHUMB_SHIFT);
+    keys |= xinput_gamepad_thumb_keys(gamepad->sThumbRX, gamepad->sThumbRY, XINPUT_GAMEPAD_KEYS_RTHUMB_SHIFT);
+
+    return keys;
+}
+
+BOOL xinput_gamepad_copy_buttons_state(int index, DWORD* out_buttons)
+{
+    xinput_shared_gamepad_state* shared;
+    xinput_gamepad_state* xgs;
+    XINPUT_GAMEPAD_EX gamepad;
+
+    if(out_buttons == NULL)
+    {
+        return FALSE;
+    }
+
+    if((shared = xinput_gamepad_service_get()) == NULL)
+    {
+        return FALSE;
+    }
+
+    xgs = &shared->state[index];
+
+    if(xinput_gamepad_lock())
+    {
+        BOOL consistent = xinput_gamepad_state_snapshot(xgs, &gamepad, NULL);
+
+        xinput_gamepad_unlock();
+
+        if(!consistent)
+        {
+            return FALSE;
+        }
+
+        *out_buttons = xinput_gamepad_buttons_ex(&gamepad);
 
         return TRUE;
     }
@@ -540,17 +797,117 @@ BOOL xinput_gamepad_copy_buttons_state(int index, DWORD* out_buttons)
     }
 }
 
+struct xinput_gamepad_keystroke_reader
+{
+    DWORD next;             /* the serial of the next keystroke in the shared queue */
+    WORD repeat_vk;         /* the last key pressed, 0 once released */
+    int64_t repeat_us;      /* when it repeats next */
+};
+
+typedef struct xinput_gamepad_keystroke_reader xinput_gamepad_keystroke_reader;
+
+static xinput_gamepad_keystroke_reader xinput_gamepad_keystroke_readers[XUSER_MAX_COUNT];
+static pthread_mutex_t xinput_gamepad_keystroke_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int64_t xinput_gamepad_keystroke_repeat_delay_us = XINPUT_KEYSTROKE_REPEAT_DELAY_US;
+static int64_t xinput_gamepad_keystroke_repeat_period_us = XINPUT_KEYSTROKE_REPEAT_PERIOD_US;
+
+void xinput_gamepad_set_keystroke_repeat(int64_t delay_us, int64_t period_us)
+{
+    pthread_mutex_lock(&xinput_gamepad_keystroke_mtx);
+    xinput_gamepad_keystroke_repeat_delay_us = delay_us;
+    xinput_gamepad_keystroke_repeat_period_us = period_us;
+    pthread_mutex_unlock(&xinput_gamepad_keystroke_mtx);
+}
+
+DWORD xinput_gamepad_keystroke(int index, XINPUT_KEYSTROKE* out_keystroke)
+{
+    xinput_shared_gamepad_state* shared;
+    xinput_gamepad_keystroke_reader* reader;
+    int64_t time_us;
+    DWORD ret = ERROR_EMPTY;
+
+    if((shared = xinput_gamepad_service_get()) == NULL)
+    {
+        return ERROR_EMPTY;
+    }
+
+    reader = &xinput_gamepad_keystroke_readers[index];
+
+    pthread_mutex_lock(&xinput_gamepad_keystroke_mtx);
+
+    if(xinput_keystroke_queue_pop(shared, index, &reader->next, out_keystroke, &time_us))
+    {
+        if(out_keystroke->Flags & XINPUT_KEYSTROKE_KEYDOWN)
+        {
+            reader->repeat_vk = out_keystroke->VirtualKey;
+            reader->repeat_us = time_us + xinput_gamepad_keystroke_repeat_delay_us;
+        }
+        else if(out_keystroke->VirtualKey == reader->repeat_vk)
+        {
+            reader->repeat_vk = 0;
+        }
+
+        ret = ERROR_SUCCESS;
+    }
+    else if((reader->repeat_vk != 0) && (xinput_gamepad_keystroke_repeat_period_us > 0))
+    {
+        /* the queue is empty so the key is still held */
+
+        int64_t now = timeus();
+
+        if(now >= reader->repeat_us)
+        {
+            out_keystroke->VirtualKey = reader->repeat_vk;
+            out_keystroke->Unicode = 0;
+            out_keystroke->Flags = XINPUT_KEYSTROKE_KEYDOWN | XINPUT_KEYSTROKE_REPEAT;
+            out_keystroke->UserIndex = index;
+            out_keystroke->HidCode = 0;
+
+            /* a late caller gets one repeat, not a burst */
+
+            reader->repeat_us += xinput_gamepad_keystroke_repeat_period_us;
+
+            if(reader->repeat_us <= now)
+            {
+                reader->repeat_us = now + xinput_gamepad_keystroke_repeat_period_us;
+            }
+
+            ret = ERROR_SUCCESS;
+        }
+    }
+
+    pthread_mutex_unlock(&xinput_gamepad_keystroke_mtx);
+
+    return ret;
+}
+
+/*
+ * A state the service left torn (it died in the middle of an update) is not
+ * copied: the caller keeps the state it has, as when the lock is taken.
+ */
+
 void xinput_gamepad_copy_state(int index, XINPUT_STATE* out_state)
 {
+    xinput_shared_gamepad_state* shared;
     xinput_gamepad_state* xgs;
+    XINPUT_GAMEPAD_EX gamepad;
+    DWORD packet;
+
+    if((shared = xinput_gamepad_service_get()) == NULL)
+    {
+        memset(out_state, 0, sizeof(*out_state));
+        return;
+    }
 
-    xinput_gamepad_service_probe();
-    xgs = &client_shared->state[index];
+    xgs = &shared->state[index];
 
     if(xinput_gamepad_lock())
     {
-        memcpy(&out_state->Gamepad, &xgs->gamepad, sizeof(XINPUT_GAMEPAD));
-        out_state->dwPacketNumber = xgs->dwPacketNumber;
+        if(xinput_gamepad_state_snapshot(xgs, &gamepad, &packet))
+        {
+            out_state->dwPacketNumber = packet;
+            memcpy(&out_state->Gamepad, &gamepad, sizeof(XINPUT_GAMEPAD));
+        }
         xinput_gamepad_unlock();
     }
     /*  If you say so ... : */
@@ -561,49 +918,472 @@ void xinput_gamepad_copy_state(int index, XINPUT_STATE* out_state)
 
 void xinput_gamepad_copy_state_ex(int index, XINPUT_STATE_EX* out_state)
 {
+    xinput_shared_gamepad_state* shared;
     xinput_gamepad_state* xgs;
+    XINPUT_GAMEPAD_EX gamepad;
+    DWORD packet;
+
+    if((shared = xinput_gamepad_service_get()) == NULL)
+    {
+        memset(out_state, 0, sizeof(*out_state));
+        return;
+    }
 
-    xinput_gamepad_service_probe();
-    xgs = &client_shared->state[index];
+    xgs = &shared->state[index];
 
     if(xinput_gamepad_lock())
     {
-        memcpy(&out_state->Gamepad, &xgs->gamepad, sizeof(XINPUT_GAMEPAD));
-        out_state->dwPacketNumber = xgs->dwPacketNumber;
+        if(xinput_gamepad_state_snapshot(xgs, &gamepad, &packet))
+        {
+            out_state->Gamepad = gamepad;
+            out_state->dwPacketNumber = packet;
+        }
         xinput_gamepad_unlock();
     }
 }
 
-void xinput_gamepad_rumble(int index, const XINPUT_VIBRATION *vibration)
+void xinput_gamepad_copy_state_timed(int index, XINPUT_STATE_TIMED* out_state)
 {
-#if XINPUT_USES_MQUEUE
-    xinput_gamepad_vibration vibration_message;
+    xinput_shared_gamepad_state* shared;
+    xinput_gamepad_state* xgs;
+    XINPUT_GAMEPAD_EX gamepad;
+    DWORD packet;
+    int64_t event_us;
+    int64_t publish_us;
 
-    if(vibration == NULL)
+    if((shared = xinput_gamepad_service_get()) == NULL)
     {
+        memset(out_state, 0, sizeof(*out_state));
         return;
     }
 
-    xinput_gamepad_service_probe();
+    xgs = &shared->state[index];
+
+    if(xinput_gamepad_lock())
+    {
+        if(xinput_gamepad_state_snapshot_timed(xgs, &gamepad, &packet, &event_us, &publish_us))
+        {
+            out_state->Gamepad = gamepad;
+            out_state->dwPacketNumber = packet;
+            out_state->llEventTime = event_us;
+            out_state->llPublishTime = publish_us;
+        }
+        xinput_gamepad_unlock();
+    }
+}
+
+DWORD xinput_gamepad_copy_history(int index, DWORD since, XINPUT_STATE_TIMED* out_states, DWORD count)
+{
+    xinput_shared_gamepad_state* shared;
+    xinput_gamepad_history_frame frames[XINPUT_GAMEPAD_HISTORY_FRAMES];
+    DWORD copied = 0;
+
+    if((shared = xinput_gamepad_service_get()) == NULL)
+    {
+        return 0;
+    }
+
+    if(count > XINPUT_GAMEPAD_HISTORY_FRAMES)
+    {
+        count = XINPUT_GAMEPAD_HISTORY_FRAMES;
+    }
+
+    if(xinput_gamepad_lock())
+    {
+        copied = xinput_gamepad_history_read(shared, index, since, frames, count);
+        xinput_gamepad_unlock();
+    }
+
+    for(DWORD i = 0; i < copied; ++i)
+    {
+        out_states[i].dwPacketNumber = frames[i].dwPacketNumber;
+        memcpy(&out_states[i].Gamepad, &frames[i].gamepad, sizeof(out_states[i].Gamepad));
+        out_states[i].llEventTime = frames[i].event_us;
+        out_states[i].llPublishTime = frames[i].publish_us;
+    }
+
+    return copied;
+}
+
+DWORD xinput_gamepad_copy_states(XINPUT_STATE_BATCH* batch)
+{
+    xinput_shared_gamepad_state* shared;
+
+    if((shared = xinput_gamepad_service_get()) == NULL)
+    {
+        memset(batch, 0, sizeof(*batch));
+        return ERROR_DEVICE_NOT_CONNECTED;
+    }
+
+    if(xinput_gamepad_lock())
+    {
+        xinput_gamepad_states_snapshot(shared, batch);
+        xinput_gamepad_unlock();
+    }
+
+    return (batch->dwConnectedMask != 0)?ERROR_SUCCESS:ERROR_DEVICE_NOT_CONNECTED;
+}
 
-    vibration_message.index = index;
-    vibration_message.vibration = *vibration;
+DWORD xinput_gamepad_wait(DWORD mask, DWORD* packets, DWORD timeout_ms, DWORD* out_changed)
+{
+    int64_t now = timeus();
+    int64_t deadline = (timeout_ms == INFINITE)?INT64_MAX:now + timeout_ms * 1000LL;
 
     for(;;)
     {
-        if(mq_send(client_mq, (const char*)&vibration_message, sizeof(xinput_gamepad_vibration), 0) == 0)
+        xinput_shared_gamepad_state* shared;
+        uint32_t published;
+        int64_t wait_us;
+        DWORD changed = 0;
+
+        /* the service may have been restarted meanwhile */
+
+        if((shared = xinput_gamepad_service_get()) == NULL)
         {
-            break;
+            return ERROR_DEVICE_NOT_CONNECTED;
         }
-        else
-        {
-            int err = errno;
 
-            if((err == EINTR) && (err != EAGAIN))
+        /* read the futex before the states so no publish can be missed */
+
+        published = __atomic_load_n(&shared->published, __ATOMIC_SEQ_CST);
+
+        for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+        {
+            if(mask & (1 << slot))
             {
-                break;
+                DWORD packet = __atomic_load_n(&shared->state[slot].dwPacketNumber, __ATOMIC_ACQUIRE);
+
+                if(packet != packets[slot])
+                {
+                    packets[slot] = packet;
+                    changed |= 1 << slot;
+                }
             }
         }
+
+        if(changed != 0)
+        {
+            *out_changed = changed;
+            return ERROR_SUCCESS;
+        }
+
+        if(now >= deadline)
+        {
+            *out_changed = 0;
+            return ERROR_TIMEOUT;
+        }
+
+        /*
+         * Wake up regularly anyway to follow a restart of the service.
+         * The memory of a dead service is unmapped one heartbeat after it has
+         * been retired: do not hold it longer than that.
+         */
+
+        wait_us = deadline - now;
+
+        if(wait_us > XINPUT_OWNER_REPROBE_PERIOD_US / 2)
+        {
+            wait_us = XINPUT_OWNER_REPROBE_PERIOD_US / 2;
+        }
+
+        __atomic_add_fetch(&shared->published_waiters, 1, __ATOMIC_SEQ_CST);
+        futex_wait_us(&shared->published, published, wait_us);
+        __atomic_sub_fetch(&shared->published_waiters, 1, __ATOMIC_SEQ_CST);
+
+        now = timeus();
+    }
+}
+
+/*
+ * A futex cannot be watched by the event loop of an application: the
+ * eventfd of the process is passed to the service, which writes to it, see
+ * xinput_notify_address.
+ * The eventfd is made here so that it outlives the service: the heartbeat
+ * passes it again to the next one.
+ */
+
+static pthread_mutex_t xinput_gamepad_notify_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int xinput_gamepad_notify_efd = -1;
+static int xinput_gamepad_notify_sock = -1; /* the connection to the service */
+static DWORD xinput_gamepad_notify_mask = 0;
+
+/**
+ * Sends the mask to the service, with the eventfd the first time.
+ * Called with xinput_gamepad_notify_mtx locked.
+ */
+
+static BOOL xinput_gamepad_notify_send(BOOL with_fd)
+{
+    union
+    {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    uint32_t mask = xinput_gamepad_notify_mask;
+    struct msghdr msg;
+    struct iovec iov;
+
+    iov.iov_base = &mask;
+    iov.iov_len = sizeof(mask);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if(with_fd)
+    {
+        struct cmsghdr* cmsg;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &xinput_gamepad_notify_efd, sizeof(int));
+    }
+
+    if(sendmsg(xinput_gamepad_notify_sock, &msg, MSG_NOSIGNAL|MSG_DONTWAIT) != (ssize_t)sizeof(mask))
+    {
+        int err = errno;
+        TRACE("could not send the notification mask: %s\n", strerror(err));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Passes the eventfd to the service if it does not have it, else sends it
+ * the new mask.
+ * Called with xinput_gamepad_notify_mtx locked.
+ */
+
+static void xinput_gamepad_notify_subscribe(void)
+{
+    static const uint64_t one = 1;
+    struct sockaddr_un address;
+    socklen_t address_size;
+
+    if(xinput_gamepad_notify_sock >= 0)
+    {
+        if(xinput_gamepad_notify_send(FALSE))
+        {
+            return;
+        }
+
+        close_ex(xinput_gamepad_notify_sock);
+        xinput_gamepad_notify_sock = -1;
+    }
+
+    /* the protocol of another version is unknown */
+
+    if(client_incompatible || (__atomic_load_n(&client_shared, __ATOMIC_ACQUIRE) == NULL))
+    {
+        return;
+    }
+
+    if((xinput_gamepad_notify_sock = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0)
+    {
+        int err = errno;
+        TRACE("could not make the notification socket: %s\n", strerror(err));
+        return;
+    }
+
+    address_size = xinput_notify_address(&address);
+
+    if((connect(xinput_gamepad_notify_sock, (struct sockaddr*)&address, address_size) < 0) || !xinput_gamepad_notify_send(TRUE))
+    {
+        int err = errno;
+        TRACE("could not subscribe: %s\n", strerror(err));
+        close_ex(xinput_gamepad_notify_sock);
+        xinput_gamepad_notify_sock = -1;
+        return;
+    }
+
+    /* the states may have changed while nobody was writing to it */
+
+    if(write(xinput_gamepad_notify_efd, &one, sizeof(one)) < 0)
+    {
+        int err = errno;
+        TRACE("could not notify: %s\n", strerror(err));
+    }
+}
+
+/**
+ * Subscribes again once the connection to the service has been lost (ie: it
+ * has been restarted, or it had no room for this process).
+ * Done by the heartbeat.
+ */
+
+static void xinput_gamepad_notify_heartbeat(void)
+{
+    int state;
+
+    /* cancelled with the mutex held, the heartbeat would leave it locked */
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    pthread_mutex_lock(&xinput_gamepad_notify_mtx);
+
+    if(xinput_gamepad_notify_efd >= 0)
+    {
+        char c;
+
+        /* the service never writes: readable means closed */
+
+        if((xinput_gamepad_notify_sock >= 0) &&
+           ((recv(xinput_gamepad_notify_sock, &c, sizeof(c), MSG_DONTWAIT|MSG_PEEK) >= 0) || (errno != EAGAIN)))
+        {
+            TRACE("notification connection lost\n");
+            close_ex(xinput_gamepad_notify_sock);
+            xinput_gamepad_notify_sock = -1;
+        }
+
+        if(xinput_gamepad_notify_sock < 0)
+        {
+            xinput_gamepad_notify_subscribe();
+        }
+    }
+
+    pthread_mutex_unlock(&xinput_gamepad_notify_mtx);
+    pthread_setcancelstate(state, NULL);
+}
+
+int xinput_gamepad_notify_fd(DWORD mask)
+{
+    int ret;
+
+    /* starts the service */
+
+    xinput_gamepad_service_get();
+
+    pthread_mutex_lock(&xinput_gamepad_notify_mtx);
+
+    xinput_gamepad_notify_mask = mask;
+
+    if(xinput_gamepad_notify_efd < 0)
+    {
+        if((xinput_gamepad_notify_efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0)
+        {
+            int err = errno;
+            pthread_mutex_unlock(&xinput_gamepad_notify_mtx);
+            errno = err;
+            return -1;
+        }
+    }
+
+    /* if the service cannot be reached now, the heartbeat tries again */
+
+    xinput_gamepad_notify_subscribe();
+
+    ret = xinput_gamepad_notify_efd;
+
+    pthread_mutex_unlock(&xinput_gamepad_notify_mtx);
+
+    return ret;
+}
+
+void xinput_gamepad_notify_close(void)
+{
+    pthread_mutex_lock(&xinput_gamepad_notify_mtx);
+
+    /* the service closes its copy of the eventfd */
+
+    if(xinput_gamepad_notify_sock >= 0)
+    {
+        close_ex(xinput_gamepad_notify_sock);
+        xinput_gamepad_notify_sock = -1;
+    }
+
+    if(xinput_gamepad_notify_efd >= 0)
+    {
+        close_ex(xinput_gamepad_notify_efd);
+        xinput_gamepad_notify_efd = -1;
+    }
+
+    pthread_mutex_unlock(&xinput_gamepad_notify_mtx);
+}
+
+static void xinput_gamepad_rumble_ring(void)
+{
+    static const char bell = 0;
+    struct sockaddr_un address;
+    socklen_t address_size;
+    int fd = __atomic_load_n(&client_doorbell_fd, __ATOMIC_ACQUIRE);
+
+    if(fd < 0)
+    {
+        int expected = -1;
+
+        if((fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0)
+        {
+            int err = errno;
+            TRACE("could not make the doorbell: %s\n", strerror(err));
+            return;
+        }
+
+        /* another thread may have made one meanwhile */
+
+        if(!__atomic_compare_exchange_n(&client_doorbell_fd, &expected, fd, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            close_ex(fd);
+            fd = expected;
+        }
+    }
+
+    address_size = xinput_rumble_doorbell_address(&address);
+
+    /* a full queue has already rung */
+
+    if((sendto(fd, &bell, sizeof(bell), 0, (struct sockaddr*)&address, address_size) < 0) && (errno != EAGAIN))
+    {
+        int err = errno;
+        TRACE("could not ring the doorbell: %s\n", strerror(err));
+    }
+}
+
+void xinput_gamepad_rumble(int index, const XINPUT_VIBRATION *vibration)
+{
+    xinput_shared_gamepad_state* shared;
+    uint32_t motors;
+
+    if(vibration == NULL)
+    {
+        return;
+    }
+
+    if((shared = xinput_gamepad_service_get()) == NULL)
+    {
+        return;
+    }
+
+    /* games tend to set the same vibration every frame */
+
+    motors = xinput_rumble_pack(vibration);
+
+    if(__atomic_load_n(&shared->rumble[index], __ATOMIC_RELAXED) == motors)
+    {
+        return;
+    }
+
+    __atomic_store_n(&shared->rumble[index], motors, __ATOMIC_RELEASE);
+
+    /* the futex syscall is only made if the service sleeps */
+
+    __atomic_add_fetch(&shared->rumble_posted, 1, __ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(&shared->rumble_waiters, __ATOMIC_SEQ_CST) != 0)
+    {
+        futex_wake_all(&shared->rumble_posted);
+    }
+
+    /* the reactor of the service sleeps on a socket: only the first post rings it */
+
+    if((__atomic_load_n(&shared->rumble_doorbell, __ATOMIC_SEQ_CST) != 0) &&
+       (__atomic_exchange_n(&shared->rumble_doorbell, 0, __ATOMIC_SEQ_CST) != 0))
+    {
+        xinput_gamepad_rumble_ring();
     }
-#endif
 }
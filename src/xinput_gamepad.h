@@ -27,6 +27,7 @@
 #ifndef XINPUT_GAMEPAD_H
 #define XINPUT_GAMEPAD_H
 
+#include <stdint.h>
 #include "xinput.h"
 
 #define XINPUT_GAMEPAD_LTRIGGER             0x00010000
@@ -51,18 +52,88 @@
                                              XINPUT_GAMEPAD_RTHUMB_DOWN|  \
                                              XINPUT_GAMEPAD_RTHUMB_LEFT)
 
+/*
+ * The keys of a gamepad, one bit for each virtual key of XInputGetKeystroke:
+ *  - the buttons, on the bits of wButtons,
+ *  - the triggers, on XINPUT_GAMEPAD_LTRIGGER and XINPUT_GAMEPAD_RTRIGGER,
+ *  - the eight sectors of each thumb from XINPUT_GAMEPAD_KEYS_LTHUMB_SHIFT
+ *    and XINPUT_GAMEPAD_KEYS_RTHUMB_SHIFT, in the order of their VK_PAD_
+ *    codes (UP, DOWN, RIGHT, LEFT, UPLEFT, UPRIGHT, DOWNRIGHT, DOWNLEFT).
+ *
+ * 33 keys: they do not fit in 32 bits.
+ */
+
+#define XINPUT_GAMEPAD_KEYS_LTHUMB_SHIFT    32
+#define XINPUT_GAMEPAD_KEYS_RTHUMB_SHIFT    40
+#define XINPUT_GAMEPAD_KEYS_COUNT           48
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct xinput_gamepad_device;
 
+/**
+ * Counters maintained by a device, for diagnostic.
+ */
+
+struct xinput_gamepad_device_statistics
+{
+    uint64_t reads;             /* system calls made to read the device */
+    uint64_t events;            /* events received */
+    uint64_t events_unmapped;   /* events received but mapped to nothing */
+    uint64_t codes_masked;      /* keys and axes of the device the kernel does not send (EVIOCSMASK) */
+    uint64_t frames;            /* complete frames received */
+    uint64_t rumbles;           /* vibrations asked */
+    uint64_t uploads;           /* effects uploaded to the device */
+    uint64_t uploads_avoided;   /* vibrations that did not need an upload */
+    uint64_t rumbles_deferred;  /* vibrations refused by the rate limit */
+};
+
+typedef struct xinput_gamepad_device_statistics xinput_gamepad_device_statistics;
+
+/**
+ * How much the sticks and triggers of a device move on their own, in the
+ * units of XINPUT_GAMEPAD (ie: from the fuzz of the evdev axes).
+ * 0 when the device does not tell.
+ */
+
+struct xinput_gamepad_device_noise
+{
+    int32_t thumb[4];           /* LX, LY, RX, RY */
+    int32_t trigger[2];         /* left, right */
+};
+
+typedef struct xinput_gamepad_device_noise xinput_gamepad_device_noise;
+
 struct xinput_gamepad_device_vtbl
 {
+    /*
+     * Reads the device until a complete frame has been received.
+     * Returns 0 when the state is ready to be published, else an error code.
+     */
     int (*read)(struct xinput_gamepad_device* device);
     void (*update)(struct xinput_gamepad_device* device, XINPUT_GAMEPAD_EX* gamepad, XINPUT_VIBRATION* vibration);
+    /*
+     * Returns 0, EAGAIN if the device cannot be updated yet (the caller retries
+     * later with the latest vibration), or an error code.
+     */
     int (*rumble)(struct xinput_gamepad_device* device, const XINPUT_VIBRATION* vibration);
     void (*release)(struct xinput_gamepad_device* device);
+    void (*statistics)(struct xinput_gamepad_device* device, xinput_gamepad_device_statistics* stats);
+    /*
+     * Returns the file descriptor the device is read from.
+     */
+    int (*get_fd)(struct xinput_gamepad_device* device);
+    /*
+     * Returns the time the device reported the last frame read, in
+     * microseconds on the clock of timeus(), or 0 if it does not tell.
+     */
+    int64_t (*get_event_us)(struct xinput_gamepad_device* device);
+    /*
+     * Tells how much the controls of the device jitter.
+     */
+    void (*get_noise)(struct xinput_gamepad_device* device, xinput_gamepad_device_noise* noise);
 };
 
 typedef struct xinput_gamepad_device_vtbl xinput_gamepad_device_vtbl;
@@ -94,9 +165,118 @@ void xinput_gamepad_init(void);
 void xinput_gamepad_finalize(void);
 
 BOOL xinput_gamepad_connected(int index);
+/**
+ * The buttons of a gamepad, with the thumbs and triggers pushed far enough
+ * as buttons too (XINPUT_GAMEPAD_LTHUMB_UP, XINPUT_GAMEPAD_LTRIGGER, ...)
+ *
+ * @param gamepad
+ * @return the buttons
+ */
+
+DWORD xinput_gamepad_buttons_ex(const XINPUT_GAMEPAD_EX* gamepad);
+
+/**
+ * The keys of a gamepad, see XINPUT_GAMEPAD_KEYS_LTHUMB_SHIFT.
+ * A thumb is in one sector at most.
+ *
+ * @param gamepad
+ * @return the keys
+ */
+
+uint64_t xinput_gamepad_keys(const XINPUT_GAMEPAD_EX* gamepad);
+
 BOOL xinput_gamepad_copy_buttons_state(int index, DWORD* out_buttons);
+
+/**
+ * Takes the next keystroke of a slot from the queue filled by the service.
+ * Once the queue is empty, the last key pressed and still held repeats.
+ *
+ * Only the keystrokes queued after the first call are seen.
+ *
+ * @param index the slot
+ * @param out_keystroke receives the keystroke
+ *
+ * @return ERROR_SUCCESS or ERROR_EMPTY
+ */
+
+DWORD xinput_gamepad_keystroke(int index, XINPUT_KEYSTROKE* out_keystroke);
+
+/**
+ * Sets when a held key repeats, XINPUT_KEYSTROKE_REPEAT_DELAY_US and
+ * XINPUT_KEYSTROKE_REPEAT_PERIOD_US by default.
+ *
+ * @param delay_us the time from the press to the first repeat
+ * @param period_us the time between two repeats, 0 to disable them
+ */
+
+void xinput_gamepad_set_keystroke_repeat(int64_t delay_us, int64_t period_us);
 void xinput_gamepad_copy_state(int index, XINPUT_STATE* out_state);
 void xinput_gamepad_copy_state_ex(int index, XINPUT_STATE_EX* out_state);
+void xinput_gamepad_copy_state_timed(int index, XINPUT_STATE_TIMED* out_state);
+
+/**
+ * Copies the states of a slot published after a packet number, oldest first.
+ *
+ * @param index the slot
+ * @param since the last packet number seen by the caller
+ * @param out_states receives the states
+ * @param count the size of out_states
+ *
+ * @return the number of states copied
+ */
+
+DWORD xinput_gamepad_copy_history(int index, DWORD since, XINPUT_STATE_TIMED* out_states, DWORD count);
+
+/**
+ * Copies the states of all the slots at once, see XINPUT_STATE_BATCH.
+ *
+ * @param batch the batch of the previous call, zeroed for the first one
+ *
+ * @return ERROR_SUCCESS, or ERROR_DEVICE_NOT_CONNECTED if no slot is connected
+ */
+
+DWORD xinput_gamepad_copy_states(XINPUT_STATE_BATCH* batch);
+
+/**
+ * Waits until the packet number of one of the slots changes.
+ *
+ * @param mask the slots to look at
+ * @param packets the last packet numbers seen for each slot, updated with the current ones
+ * @param timeout_ms the maximum wait in milliseconds, INFINITE for no limit
+ * @param out_changed receives the mask of the slots that changed
+ *
+ * @return ERROR_SUCCESS, ERROR_TIMEOUT or ERROR_DEVICE_NOT_CONNECTED if the service is not available
+ */
+
+DWORD xinput_gamepad_wait(DWORD mask, DWORD* packets, DWORD timeout_ms, DWORD* out_changed);
+
+/**
+ * Returns an eventfd that becomes readable when one of the slots of a mask
+ * publishes a new state, for the event loop of the application (epoll,
+ * poll, GLib, wxWidgets, ...) instead of polling the states on a timer.
+ *
+ * Read it (8 bytes) to rearm it, then read the states, ie: with
+ * xinput_gamepad_copy_states.  The connections and disconnections of the
+ * slots make it readable too.
+ *
+ * There is one per process, owned by the library and written by the
+ * service, no thread is involved: a later call returns the same one, now
+ * following the new mask.  It is readable once after the service restarted.
+ *
+ * @param mask the slots to follow, bit n for slot n
+ *
+ * @return the file descriptor, or -1 (errno is set)
+ */
+
+int xinput_gamepad_notify_fd(DWORD mask);
+
+/**
+ * Closes the eventfd of xinput_gamepad_notify_fd.
+ * Done by xinput_gamepad_finalize too.
+ */
+
+void xinput_gamepad_notify_close(void);
+
 void xinput_gamepad_rumble(int index, const XINPUT_VIBRATION *vibration);
 
 #ifdef __cplusplus
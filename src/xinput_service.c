@@ -35,6 +35,7 @@
 #include "tools.h"
 #include "xinput_service.h"
 #include "xinput_gamepad.h"
+#include "xinput_filter.h"
 
 #if XINPUT_USES_SEMAPHORE_MUTEX
 #include <fcntl.h>           /* For O_* constants */
@@ -42,12 +43,12 @@
 #include <semaphore.h>
 #endif
 
-#ifndef HAVE_MQ_OPEN
-#undef XINPUT_USES_MQUEUE
-#endif
-
-#if XINPUT_USES_MQUEUE
-#include <mqueue.h>
+#if HAVE_SYS_EPOLL_H && HAVE_SYS_TIMERFD_H
+#define XINPUT_SERVICE_REACTOR_SUPPORTED 1
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#define XINPUT_SERVICE_REACTOR_SUPPORTED 0
 #endif
 
 #if HAVE_WINE
@@ -69,6 +70,7 @@
 #include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
 
 
 #if HAVE_LINUX_INPUT_H
@@ -77,6 +79,9 @@
 /* no supported driver */
 #define xinput_driver_initialize()
 #define xinput_driver_probe() 0
+#define xinput_driver_hotplug_start() -1
+#define xinput_driver_hotplug_probe() 0
+#define xinput_driver_hotplug_stop()
 #define xinput_driver_get_device(a) NULL
 #define xinput_driver_device_close(a)
 #define xinput_driver_finalize()
@@ -92,6 +97,10 @@ struct xinput_service_thread_args
     xinput_gamepad_device* device;
     pthread_t tid;
     int slot;
+    xinput_filter_gate gate;
+    uint64_t frames_published;
+    uint64_t frames_unchanged;  /* nothing visible changed */
+    uint64_t frames_gated;      /* unchanged because the noise gate held a control */
 };
 
 typedef struct xinput_service_thread_args xinput_service_thread_args;
@@ -102,6 +111,12 @@ static xinput_shared_gamepad_state* service_shared = NULL;
 
 static volatile int xinput_service_idle_strikes = XINPUT_IDLE_CLIENT_STRIKES;
 
+#if XINPUT_SERVICE_REACTOR_SUPPORTED
+static BOOL xinput_service_reactor_mode = XINPUT_SERVICE_REACTOR;
+#else
+#define xinput_service_reactor_mode FALSE
+#endif
+
 #if !XINPUT_RUNDLL
 static pthread_t service_thread_id = 0;
 #endif
@@ -111,111 +126,130 @@ static sem_t*  service_sem = SEM_FAILED;
 #endif
 
 
-#if XINPUT_USES_MQUEUE
-
-static mqd_t service_mq = MQD_INVALID;
 static pthread_t xinput_service_rumble_thread_id = 0;
+static volatile BOOL xinput_service_rumble_thread_stopping = FALSE;
 
 /*
  * Rumble is handled almost entierely separately
+ *
+ * The clients write the vibration of a slot in its mailbox and increment
+ * rumble_posted.  The service applies the mailboxes that changed since the
+ * last time, then sleeps on rumble_posted.
  */
 
-static BOOL xinput_service_queue_create(void)
+static uint32_t xinput_service_rumble_applied[XUSER_MAX_COUNT];
+
+/**
+ * Sends the mailboxes that changed to their device.
+ *
+ * @return the mask of the slots whose device asked to retry later
+ */
+
+static uint32_t xinput_service_rumble_apply(void)
 {
-    mqd_t mq;
-    struct mq_attr attr;
-    memset(&attr, 0, sizeof(attr));
-    attr.mq_flags = 0;
-    attr.mq_maxmsg = 10;
-    attr.mq_msgsize = sizeof(xinput_gamepad_vibration);
+    uint32_t deferred = 0;
 
-    mq = mq_open(SERVICE_MSG_NAME, O_RDWR|O_CREAT|O_EXCL, 0666, &attr);
-    if(mq == MQD_INVALID)
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
     {
-        int err = errno;
-        if(err != EEXIST)
-        {
-            return FALSE;
-        }
+        uint32_t motors = __atomic_load_n(&service_shared->rumble[slot], __ATOMIC_ACQUIRE);
 
-        mq_unlink(SERVICE_MSG_NAME);
-        mq = mq_open(SERVICE_MSG_NAME, O_RDONLY|O_CREAT|O_EXCL, 0666, &attr);
-        if(mq == MQD_INVALID)
+        if(motors != __atomic_load_n(&xinput_service_rumble_applied[slot], __ATOMIC_RELAXED))
         {
-            err = errno;
-            TRACE("could not create message queue: %s\n", strerror(err));
+            xinput_gamepad_device* device;
+            XINPUT_VIBRATION vibration;
 
-            return FALSE;
+            xinput_rumble_unpack(motors, &vibration);
+
+            /*
+             * send rumble
+             */
+
+            if((device = xinput_driver_get_device(slot)) != NULL)
+            {
+                if(device->vtbl->rumble(device, &vibration) == EAGAIN)
+                {
+                    /* rate limited: the latest value will be tried again */
+
+                    deferred |= 1 << slot;
+                    continue;
+                }
+            }
+
+            TRACE("rumble %i: [%4x, %4x]\n", slot, vibration.wLeftMotorSpeed, vibration.wRightMotorSpeed);
+
+            __atomic_store_n(&xinput_service_rumble_applied[slot], motors, __ATOMIC_RELAXED);
         }
     }
 
-    mq_getattr(mq, &attr);
+    return deferred;
+}
 
-    service_mq = mq;
+/**
+ * Waits until a client changes a mailbox.
+ *
+ * @param posted the value of rumble_posted before the mailboxes were looked at
+ * @param timeout_us the maximum wait, <0 for no limit
+ */
 
-    return TRUE;
+static void xinput_service_rumble_wait(uint32_t posted, int64_t timeout_us)
+{
+    __atomic_add_fetch(&service_shared->rumble_waiters, 1, __ATOMIC_SEQ_CST);
+    futex_wait_us(&service_shared->rumble_posted, posted, timeout_us);
+    __atomic_sub_fetch(&service_shared->rumble_waiters, 1, __ATOMIC_SEQ_CST);
 }
 
-static void xinput_service_queue_destroy(void)
+/**
+ * Stops the rumble thread, which may be sleeping on the futex.
+ */
+
+static void xinput_service_rumble_thread_stop(void)
 {
-    if(service_mq != MQD_INVALID)
+    if(xinput_service_rumble_thread_id != 0)
     {
-        mq_close(service_mq);
-        service_mq = MQD_INVALID;
-        mq_unlink(SERVICE_MSG_NAME);
+        __atomic_store_n(&xinput_service_rumble_thread_stopping, TRUE, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&service_shared->rumble_posted, 1, __ATOMIC_SEQ_CST);
+        futex_wake_all(&service_shared->rumble_posted);
+        pthread_join(xinput_service_rumble_thread_id, NULL);
+        xinput_service_rumble_thread_id = 0;
+        __atomic_store_n(&xinput_service_rumble_thread_stopping, FALSE, __ATOMIC_SEQ_CST);
     }
 }
 
+/**
+ * Makes a new gamepad start still, whatever was asked to the previous one.
+ *
+ * @param slot
+ */
+
+static void xinput_service_rumble_reset(int slot)
+{
+    __atomic_store_n(&service_shared->rumble[slot], 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&xinput_service_rumble_applied[slot], 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&service_shared->rumble_posted, 1, __ATOMIC_SEQ_CST);
+    futex_wake_all(&service_shared->rumble_posted);
+}
+
 static void* xinput_service_rumble_thread(void* args_)
 {
-    xinput_gamepad_device* device;
-    xinput_gamepad_vibration vibration_message;
-    unsigned int priority = 0;
     (void)args_;
 
-    for(;;)
+    while(!__atomic_load_n(&xinput_service_rumble_thread_stopping, __ATOMIC_SEQ_CST))
     {
-        ssize_t len = mq_receive(service_mq, (char*)&vibration_message, sizeof(vibration_message), &priority);
-        if(len == -1)
-        {
-            int err = errno;
-            switch(err)
-            {
-                case EINTR:
-                case EAGAIN:
-                /*case ETIMEDOUT:*/
-                    continue;
-                default:
-                    break;
-            }
-
-            TRACE("receive returned an error: %s\n", strerror(err));
-
-            /**
-             * TODO: restart the service
-             */
+        uint32_t posted = __atomic_load_n(&service_shared->rumble_posted, __ATOMIC_SEQ_CST);
 
-            break;
+        if(xinput_service_rumble_apply() != 0)
+        {
+            xinput_service_rumble_wait(posted, XINPUT_SERVICE_RUMBLE_RETRY_US);
         }
-
-        TRACE("rumble %i: [%4x, %4x]\n", vibration_message.index,
-                vibration_message.vibration.wLeftMotorSpeed,
-                vibration_message.vibration.wRightMotorSpeed);
-
-        /*
-         * send rumble
-         */
-
-        if((device = xinput_linux_evdev_get_device(vibration_message.index)) != NULL)
+        else
         {
-            device->vtbl->rumble(device, &vibration_message.vibration);
+            xinput_service_rumble_wait(posted, -1);
         }
     }
+
     return NULL;
 }
 
-#endif
-
 static BOOL xinput_service_lock_create(void)
 {
 #if XINPUT_USES_SEMAPHORE_MUTEX
@@ -265,230 +299,1190 @@ static BOOL xinput_service_lock(void)
     int64_t until = timeus() + 1000000LL;
 #endif
 
-    for(;;)
+    for(;;)
+    {
+#ifdef __USE_XOPEN2K
+        int64_t now = timeus();
+        now += 1000000LL;
+        to.tv_sec = now / 1000000LL;
+        to.tv_nsec = (now % 1000000LL) *1000LL;
+
+        if(sem_timedwait(service_sem, &to) == 0)
+        {
+            return TRUE;
+        }
+#else
+        if(sem_trywait(service_sem) == 0)
+        {
+            return TRUE;
+        }
+        else if(timeus() < until)
+        {
+            usleep(500);   /* 0.5 ms sleep */
+        }
+#endif
+        else
+        {
+            int err = errno;
+
+            if(err != EINTR)
+            {
+                /*
+                 * ETIMEOUT
+                 * starvation or a client died keeping the lock
+                 *
+                 * TODO: destroy the service, including the semaphore,
+                 * and let it restart
+                 */
+
+                TRACE("semaphore seems stuck\n");
+
+                return FALSE;
+            }
+        }
+    }
+#else
+    return TRUE;
+#endif
+}
+
+static void xinput_service_unlock(void)
+{
+#if XINPUT_USES_SEMAPHORE_MUTEX
+    sem_post(service_sem);
+#endif
+}
+
+#if XINPUT_TRACE_DEVICE_STATISTICS
+static void xinput_service_trace_statistics(xinput_service_thread_args* args)
+{
+    xinput_gamepad_device* device = args->device;
+    int slot = args->slot;
+    xinput_gamepad_device_statistics stats;
+    uint64_t reads_per_frame_x100;
+
+    memset(&stats, 0, sizeof(stats));
+    device->vtbl->statistics(device, &stats);
+
+    reads_per_frame_x100 = (stats.frames > 0) ? (stats.reads * 100) / stats.frames : 0;
+
+    TRACE("device %i: %llu reads, %llu events, %llu frames, %llu.%02llu reads per frame\n",
+            slot,
+            (unsigned long long)stats.reads,
+            (unsigned long long)stats.events,
+            (unsigned long long)stats.frames,
+            (unsigned long long)(reads_per_frame_x100 / 100),
+            (unsigned long long)(reads_per_frame_x100 % 100));
+    TRACE("device %i: %llu events unmapped, %llu codes masked\n",
+            slot,
+            (unsigned long long)stats.events_unmapped,
+            (unsigned long long)stats.codes_masked);
+    TRACE("device %i: %llu rumbles, %llu uploads, %llu uploads avoided, %llu deferred\n",
+            slot,
+            (unsigned long long)stats.rumbles,
+            (unsigned long long)stats.uploads,
+            (unsigned long long)stats.uploads_avoided,
+            (unsigned long long)stats.rumbles_deferred);
+    TRACE("device %i: %llu frames published, %llu unchanged, %llu of them held by the noise gate\n",
+            slot,
+            (unsigned long long)args->frames_published,
+            (unsigned long long)args->frames_unchanged,
+            (unsigned long long)args->frames_gated);
+}
+#endif
+
+/*
+ * The clients that follow slots through an eventfd, see xinput_notify_address.
+ *
+ * The connections are handled by the thread of the service, the eventfds are
+ * written by the publishers, which only read the masks and the eventfds.
+ *
+ * A publisher keeps the counter of its slot odd while it writes: a dropped
+ * client has its mask cleared, then its eventfd is only closed once every
+ * publisher seen writing has moved on, see xinput_service_notify_quiesce.
+ */
+
+typedef struct
+{
+    int fd;                     /* the connection, -1 if none */
+    volatile int efd;           /* the eventfd of the client, -1 if none */
+    volatile uint32_t mask;     /* the slots followed, bit n for slot n */
+} xinput_service_notify_client;
+
+static xinput_service_notify_client xinput_service_notify_clients[XINPUT_SERVICE_NOTIFY_CLIENTS_MAX];
+static volatile uint32_t xinput_service_notify_slots = 0; /* the slots followed by anyone */
+static volatile uint32_t xinput_service_notify_writing[XUSER_MAX_COUNT]; /* odd while the publisher of the slot writes */
+static int xinput_service_notify_fd = -1;
+
+static void xinput_service_notify_init(void)
+{
+    for(int i = 0; i < XINPUT_SERVICE_NOTIFY_CLIENTS_MAX; ++i)
+    {
+        xinput_service_notify_clients[i].fd = -1;
+        xinput_service_notify_clients[i].efd = -1;
+        xinput_service_notify_clients[i].mask = 0;
+    }
+
+    xinput_service_notify_slots = 0;
+
+    memset((void*)xinput_service_notify_writing, 0, sizeof(xinput_service_notify_writing));
+}
+
+static void xinput_service_notify_slots_update(void)
+{
+    uint32_t slots = 0;
+
+    for(int i = 0; i < XINPUT_SERVICE_NOTIFY_CLIENTS_MAX; ++i)
+    {
+        slots |= xinput_service_notify_clients[i].mask;
+    }
+
+    __atomic_store_n(&xinput_service_notify_slots, slots, __ATOMIC_RELEASE);
+}
+
+static int xinput_service_notify_open(void)
+{
+    struct sockaddr_un address;
+    socklen_t address_size = xinput_notify_address(&address);
+    int fd;
+
+    if((fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0)
+    {
+        return -1;
+    }
+
+    if((bind(fd, (struct sockaddr*)&address, address_size) < 0) || (listen(fd, XINPUT_SERVICE_NOTIFY_CLIENTS_MAX) < 0))
+    {
+        int err = errno;
+        close_ex(fd);
+        errno = err;
+        return -1;
+    }
+
+    xinput_service_notify_fd = fd;
+
+    return fd;
+}
+
+/**
+ * Accepts a connection on the notification socket.
+ *
+ * @return the index of the client, or -1
+ */
+
+static int xinput_service_notify_accept(void)
+{
+    int fd;
+
+    if((fd = accept(xinput_service_notify_fd, NULL, NULL)) < 0)
+    {
+        return -1;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    for(int i = 0; i < XINPUT_SERVICE_NOTIFY_CLIENTS_MAX; ++i)
+    {
+        xinput_service_notify_client* client = &xinput_service_notify_clients[i];
+
+        if(client->fd < 0)
+        {
+            client->fd = fd;
+            return i;
+        }
+    }
+
+    TRACE("too many clients to notify\n");
+
+    close_ex(fd);
+
+    return -1;
+}
+
+/**
+ * Waits for the publishers that may have seen a mask before it was cleared.
+ * The writes do not block: the wait is short.
+ */
+
+static void xinput_service_notify_quiesce(void)
+{
+    uint32_t writing[XUSER_MAX_COUNT];
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        writing[slot] = __atomic_load_n(&xinput_service_notify_writing[slot], __ATOMIC_SEQ_CST);
+    }
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        if((writing[slot] & 1) != 0)
+        {
+            while(__atomic_load_n(&xinput_service_notify_writing[slot], __ATOMIC_ACQUIRE) == writing[slot])
+            {
+                sched_yield();
+            }
+        }
+    }
+}
+
+static void xinput_service_notify_drop(int index)
+{
+    xinput_service_notify_client* client = &xinput_service_notify_clients[index];
+    int efd;
+
+    __atomic_store_n(&client->mask, 0, __ATOMIC_SEQ_CST);
+    xinput_service_notify_slots_update();
+
+    if((efd = __atomic_load_n(&client->efd, __ATOMIC_RELAXED)) >= 0)
+    {
+        xinput_service_notify_quiesce();
+
+        __atomic_store_n(&client->efd, -1, __ATOMIC_RELAXED);
+        close_ex(efd);
+    }
+
+    /* closing the fd removes it from the epoll set */
+
+    close_ex(client->fd);
+    client->fd = -1;
+}
+
+/**
+ * Reads the masks sent by a client, the first one with its eventfd.
+ */
+
+static void xinput_service_notify_read(int index)
+{
+    xinput_service_notify_client* client = &xinput_service_notify_clients[index];
+
+    if(client->fd < 0)
+    {
+        return;
+    }
+
+    for(;;)
+    {
+        union
+        {
+            struct cmsghdr header;
+            char buffer[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr msg;
+        struct iovec iov;
+        struct cmsghdr* cmsg;
+        uint32_t mask;
+        ssize_t n;
+
+        iov.iov_base = &mask;
+        iov.iov_len = sizeof(mask);
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        if((n = recvmsg(client->fd, &msg, MSG_DONTWAIT|MSG_CMSG_CLOEXEC)) < 0)
+        {
+            if((errno == EAGAIN) || (errno == EINTR))
+            {
+                return;
+            }
+
+            xinput_service_notify_drop(index);
+            return;
+        }
+
+        if(((cmsg = CMSG_FIRSTHDR(&msg)) != NULL) &&
+           (cmsg->cmsg_level == SOL_SOCKET) &&
+           (cmsg->cmsg_type == SCM_RIGHTS) &&
+           (cmsg->cmsg_len == CMSG_LEN(sizeof(int))))
+        {
+            int efd;
+
+            memcpy(&efd, CMSG_DATA(cmsg), sizeof(efd));
+
+            if(__atomic_load_n(&client->efd, __ATOMIC_RELAXED) < 0)
+            {
+                /* a publisher must never block on it */
+
+                int flags = fcntl(efd, F_GETFL);
+
+                if((flags >= 0) && (fcntl(efd, F_SETFL, flags | O_NONBLOCK) >= 0))
+                {
+                    /* set before the mask that lets the publishers use it */
+
+                    __atomic_store_n(&client->efd, efd, __ATOMIC_RELEASE);
+                }
+                else
+                {
+                    close_ex(efd);
+                }
+            }
+            else
+            {
+                close_ex(efd);
+            }
+        }
+
+        /* closed, or not following the protocol */
+
+        if((n != sizeof(mask)) || (__atomic_load_n(&client->efd, __ATOMIC_RELAXED) < 0))
+        {
+            xinput_service_notify_drop(index);
+            return;
+        }
+
+        __atomic_store_n(&client->mask, mask & ((1U << XUSER_MAX_COUNT) - 1), __ATOMIC_RELEASE);
+        xinput_service_notify_slots_update();
+    }
+}
+
+static void xinput_service_notify_stop(void)
+{
+    for(int i = 0; i < XINPUT_SERVICE_NOTIFY_CLIENTS_MAX; ++i)
+    {
+        if(xinput_service_notify_clients[i].fd >= 0)
+        {
+            xinput_service_notify_drop(i);
+        }
+    }
+
+    if(xinput_service_notify_fd >= 0)
+    {
+        close_ex(xinput_service_notify_fd);
+        xinput_service_notify_fd = -1;
+    }
+}
+
+/**
+ * Wakes the clients waiting for a new state of a slot.
+ * The futex syscall is only made if somebody waits, the eventfds are only
+ * written if somebody follows the slot.
+ *
+ * @param slot the slot that published
+ */
+
+static void xinput_service_gamepad_notify(int slot)
+{
+    static const uint64_t one = 1;
+    int state;
+
+    __atomic_add_fetch(&service_shared->published, 1, __ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(&service_shared->published_waiters, __ATOMIC_SEQ_CST) != 0)
+    {
+        futex_wake_all(&service_shared->published);
+    }
+
+    if((__atomic_load_n(&xinput_service_notify_slots, __ATOMIC_ACQUIRE) & (1U << slot)) == 0)
+    {
+        return;
+    }
+
+    /* cancelled while writing, the counter would stay odd */
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    __atomic_add_fetch(&xinput_service_notify_writing[slot], 1, __ATOMIC_SEQ_CST);
+
+    for(int i = 0; i < XINPUT_SERVICE_NOTIFY_CLIENTS_MAX; ++i)
+    {
+        xinput_service_notify_client* client = &xinput_service_notify_clients[i];
+
+        if((__atomic_load_n(&client->mask, __ATOMIC_SEQ_CST) & (1U << slot)) != 0)
+        {
+            /* a full counter is readable anyway */
+
+            if((write(__atomic_load_n(&client->efd, __ATOMIC_ACQUIRE), &one, sizeof(one)) < 0) && (errno != EAGAIN))
+            {
+                int err = errno;
+                TRACE("could not notify %i: %s\n", i, strerror(err));
+            }
+        }
+    }
+
+    __atomic_add_fetch(&xinput_service_notify_writing[slot], 1, __ATOMIC_RELEASE);
+    pthread_setcancelstate(state, NULL);
+}
+
+/**
+ * Appends the state of a slot to its history.
+ * Every packet number goes in, so that the clients can tell when they lost some.
+ */
+
+static void xinput_service_gamepad_history_push(xinput_gamepad_state* xgs)
+{
+    int slot = xgs - &service_shared->state[0];
+
+    xinput_gamepad_history_push(service_shared, slot, &xgs->gamepad, xgs->dwPacketNumber, xgs->event_us, xgs->publish_us);
+}
+
+/**
+ * The virtual key of each bit of the keys, see xinput_gamepad_keys.
+ */
+
+static const WORD xinput_service_keystroke_vk[XINPUT_GAMEPAD_KEYS_COUNT] =
+{
+    VK_PAD_DPAD_UP, VK_PAD_DPAD_DOWN, VK_PAD_DPAD_LEFT, VK_PAD_DPAD_RIGHT,              /* 0 */
+    VK_PAD_START, VK_PAD_BACK, VK_PAD_LTHUMB_PRESS, VK_PAD_RTHUMB_PRESS,                /* 4 */
+    VK_PAD_LSHOULDER, VK_PAD_RSHOULDER, VK_PAD_GUIDE, 0,                                /* 8 */
+    VK_PAD_A, VK_PAD_B, VK_PAD_X, VK_PAD_Y,                                             /* 12 */
+    VK_PAD_LTRIGGER, VK_PAD_RTRIGGER, 0, 0,                                             /* 16 */
+    0, 0, 0, 0,
+    0, 0, 0, 0,
+    0, 0, 0, 0,
+    VK_PAD_LTHUMB_UP, VK_PAD_LTHUMB_DOWN, VK_PAD_LTHUMB_RIGHT, VK_PAD_LTHUMB_LEFT,      /* 32 */
+    VK_PAD_LTHUMB_UPLEFT, VK_PAD_LTHUMB_UPRIGHT, VK_PAD_LTHUMB_DOWNRIGHT, VK_PAD_LTHUMB_DOWNLEFT,
+    VK_PAD_RTHUMB_UP, VK_PAD_RTHUMB_DOWN, VK_PAD_RTHUMB_RIGHT, VK_PAD_RTHUMB_LEFT,      /* 40 */
+    VK_PAD_RTHUMB_UPLEFT, VK_PAD_RTHUMB_UPRIGHT, VK_PAD_RTHUMB_DOWNRIGHT, VK_PAD_RTHUMB_DOWNLEFT
+};
+
+static void xinput_service_keystrokes_push_keys(xinput_shared_gamepad_state* shared, int slot, uint64_t keys, WORD flags, int64_t time_us)
+{
+    XINPUT_KEYSTROKE keystroke;
+
+    keystroke.Unicode = 0;
+    keystroke.Flags = flags;
+    keystroke.UserIndex = slot;
+    keystroke.HidCode = 0;
+
+    while(keys != 0)
+    {
+        keystroke.VirtualKey = xinput_service_keystroke_vk[__builtin_ctzll(keys)];
+        keys &= keys - 1;
+
+        xinput_keystroke_queue_push(shared, slot, &keystroke, time_us);
+    }
+}
+
+void xinput_service_keystrokes_push(xinput_shared_gamepad_state* shared, int slot, uint64_t from, uint64_t to, int64_t time_us)
+{
+    uint64_t changed = from ^ to;
+
+    if(changed == 0)
+    {
+        return;
+    }
+
+    xinput_service_keystrokes_push_keys(shared, slot, changed & from, XINPUT_KEYSTROKE_KEYUP, time_us);
+    xinput_service_keystrokes_push_keys(shared, slot, changed & to, XINPUT_KEYSTROKE_KEYDOWN, time_us);
+}
+
+/**
+ * The keys of each slot, as of their last keystrokes.
+ * Only changed by the thread serving the slot.
+ */
+
+static uint64_t xinput_service_keystroke_keys[XUSER_MAX_COUNT];
+
+/**
+ * Queues the keystrokes of the new state of a slot.
+ * The service lock must be held.
+ */
+
+static void xinput_service_gamepad_keystrokes_push(xinput_gamepad_state* xgs, uint64_t keys)
+{
+    int slot = xgs - &service_shared->state[0];
+
+    if(keys != xinput_service_keystroke_keys[slot])
+    {
+        xinput_service_keystrokes_push(service_shared, slot, xinput_service_keystroke_keys[slot], keys, (xgs->event_us != 0)?xgs->event_us:xgs->publish_us);
+        xinput_service_keystroke_keys[slot] = keys;
+    }
+}
+
+static void xinput_service_gamepad_set_connected(xinput_gamepad_state* xgs, BOOL connected)
+{
+    if(xinput_service_lock())
+    {
+        /* a connection change is a state change too */
+        xinput_gamepad_state_write_begin(xgs);
+        xgs->connected = connected;
+        xgs->publish_us = timeus();
+        ++xgs->dwPacketNumber;
+        xinput_gamepad_state_write_end(xgs);
+        xinput_service_gamepad_history_push(xgs);
+        if(!connected)
+        {
+            /* releases whatever the gamepad held */
+            xinput_service_gamepad_keystrokes_push(xgs, 0);
+        }
+        xinput_service_unlock();
+
+        xinput_service_gamepad_notify(xgs - &service_shared->state[0]);
+    }
+}
+
+static void xinput_service_gamepad_publish(xinput_service_thread_args* args)
+{
+    xinput_gamepad_state* xgs = args->xgs;
+    XINPUT_GAMEPAD_EX gamepad;
+    XINPUT_VIBRATION vibration;
+    BOOL gated;
+
+    args->device->vtbl->update(args->device, &gamepad, &vibration);
+    gated = xinput_filter_gamepad_gate(args->slot, &args->gate, &gamepad);
+    xinput_filter_gamepad(args->slot, &gamepad);
+
+    /* only the service writes the state: it can be read without the seqlock */
+
+    if((memcmp(&gamepad, &xgs->gamepad, sizeof(gamepad)) == 0) &&
+       (memcmp(&vibration, &xgs->vibration, sizeof(vibration)) == 0))
+    {
+        /* nothing the clients can see changed (ie: a stick jittering at rest) */
+        ++args->frames_unchanged;
+        args->frames_gated += gated;
+        return;
+    }
+
+    ++args->frames_published;
+
+    if(xinput_service_lock())
+    {
+        /* copy the data */
+        xinput_gamepad_state_write_begin(xgs);
+        memcpy(&xgs->gamepad, &gamepad, sizeof(gamepad));
+        memcpy(&xgs->vibration, &vibration, sizeof(vibration));
+        xgs->event_us = args->device->vtbl->get_event_us(args->device);
+        xgs->publish_us = timeus();
+        ++xgs->dwPacketNumber;
+        xinput_gamepad_state_write_end(xgs);
+        xinput_service_gamepad_history_push(xgs);
+        xinput_service_gamepad_keystrokes_push(xgs, xinput_gamepad_keys(&xgs->gamepad));
+        xinput_service_unlock();
+
+        xinput_service_gamepad_notify(args->slot);
+    }
+    else
+    {
+        /* semaphore stuck ... ? */
+    }
+
+#if XINPUT_TRACE_DEVICE_STATISTICS
+    if((xgs->dwPacketNumber & (XINPUT_DEVICE_STATISTICS_PERIOD - 1)) == 0)
+    {
+        xinput_service_trace_statistics(args);
+    }
+#endif
+#if XINPUT_TRACE_DEVICE_READER_THREAD
+    TRACE("%6i | %9i | %04hx,%04hx %04hx,%04hx %02hhx %02hhx %04hx\n",
+            args->slot,
+            xgs->dwPacketNumber,
+            xgs->gamepad.sThumbLX,
+            xgs->gamepad.sThumbLY,
+            xgs->gamepad.sThumbRX,
+            xgs->gamepad.sThumbRY,
+            xgs->gamepad.bLeftTrigger,
+            xgs->gamepad.bRightTrigger,
+            xgs->gamepad.wButtons
+            );
+#endif
+}
+
+/**
+ * Starts serving the device of a slot.
+ */
+
+static void xinput_service_gamepad_open(xinput_service_thread_args* args)
+{
+    xinput_gamepad_device_noise noise;
+
+    args->device->vtbl->get_noise(args->device, &noise);
+    xinput_filter_gate_init(&args->gate, &noise);
+    args->frames_published = 0;
+    args->frames_unchanged = 0;
+    args->frames_gated = 0;
+
+    TRACE("device %i: noise %i %i %i %i, %i %i\n", args->slot,
+            noise.thumb[0], noise.thumb[1], noise.thumb[2], noise.thumb[3],
+            noise.trigger[0], noise.trigger[1]);
+
+    xinput_service_gamepad_set_connected(args->xgs, TRUE);
+}
+
+static void xinput_service_gamepad_close(xinput_service_thread_args* args)
+{
+#if XINPUT_TRACE_DEVICE_STATISTICS
+    xinput_service_trace_statistics(args);
+#endif
+
+    xinput_driver_device_close(args->slot);
+    args->device = NULL;
+
+    xinput_service_gamepad_set_connected(args->xgs, FALSE);
+}
+
+static void* xinput_service_gamepad_reader_thread(void* args_)
+{
+    xinput_service_thread_args* args = (xinput_service_thread_args*)args_;
+
+    int err;
+    pid_t pid = getpid();
+
+    TRACE("BEGIN %i ==========================================\n", args->slot);
+
+    xinput_service_gamepad_open(args);
+
+    for(;;)
+    {
+        if((err = args->device->vtbl->read(args->device)) == 0)
+        {
+            xinput_service_gamepad_publish(args);
+        }
+        else
+        {
+            /* ENODEV ... or something */
+            TRACE("%6i: failed to read %i: %i: %s\n", pid, args->slot, err, strerror(err));
+
+            break;
+        }
+    } /*  for */
+
+    xinput_service_gamepad_close(args);
+
+    TRACE("END %i ============================================\n", args->slot);
+
+    return NULL;
+}
+
+#if XINPUT_SERVICE_REACTOR_SUPPORTED
+
+/*
+ * Reactor mode: a single thread waits on all the devices, the rumble queue
+ * and a periodic timer with epoll.
+ *
+ * Devices are non-blocking: read returns EAGAIN until a frame is complete.
+ */
+
+#define XINPUT_SERVICE_REACTOR_TIMER    0x100
+#define XINPUT_SERVICE_REACTOR_RUMBLE   0x101
+#define XINPUT_SERVICE_REACTOR_HOTPLUG  0x102
+#define XINPUT_SERVICE_REACTOR_NOTIFY   0x103
+#define XINPUT_SERVICE_REACTOR_NOTIFY_CLIENT 0x200 /* + the index of the client */
+
+#define XINPUT_SERVICE_REACTOR_EVENTS   8
+
+static int xinput_service_reactor_fd = -1;
+
+static BOOL xinput_service_reactor_watch(int fd, uint32_t tag)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = tag;
+
+    if(epoll_ctl(xinput_service_reactor_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        int err = errno;
+        TRACE("could not watch %i: %s\n", fd, strerror(err));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL xinput_service_reactor_gamepad_add(int slot)
+{
+    xinput_service_thread_args* args = &xinput_service_thread_parameter[slot];
+    int fd = args->device->vtbl->get_fd(args->device);
+    int flags = fcntl(fd, F_GETFL);
+
+    if((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+    {
+        int err = errno;
+        TRACE("could not set device %i non-blocking: %s\n", slot, strerror(err));
+        return FALSE;
+    }
+
+    if(!xinput_service_reactor_watch(fd, slot))
+    {
+        return FALSE;
+    }
+
+    xinput_service_gamepad_open(args);
+
+    return TRUE;
+}
+
+static void xinput_service_reactor_gamepad_read(int slot)
+{
+    xinput_service_thread_args* args = &xinput_service_thread_parameter[slot];
+    int err;
+
+    if(args->device == NULL)
+    {
+        return;
+    }
+
+    /* publish every frame received until the device would block */
+
+    while((err = args->device->vtbl->read(args->device)) == 0)
+    {
+        xinput_service_gamepad_publish(args);
+    }
+
+    if(err != EAGAIN)
+    {
+        TRACE("failed to read %i: %i: %s\n", slot, err, strerror(err));
+
+        /* closing the fd removes it from the epoll set */
+
+        xinput_service_gamepad_close(args);
+    }
+}
+
+/*
+ * A futex cannot be watched by epoll: the clients ring the doorbell socket
+ * instead, see xinput_rumble_doorbell_address.
+ */
+
+static int xinput_service_reactor_rumble_fd = -1;
+
+static uint32_t xinput_service_reactor_rumble_deferred = 0;
+
+static int xinput_service_reactor_doorbell_open(void)
+{
+    struct sockaddr_un address;
+    socklen_t address_size = xinput_rumble_doorbell_address(&address);
+    int fd;
+
+    if((fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0)
+    {
+        return -1;
+    }
+
+    if(bind(fd, (struct sockaddr*)&address, address_size) < 0)
+    {
+        int err = errno;
+        close_ex(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Asks the clients to ring the doorbell at their next post, then applies
+ * what they posted before.
+ * Armed first, so no post can be missed.
+ */
+
+static void xinput_service_reactor_rumble_arm(void)
+{
+    __atomic_store_n(&service_shared->rumble_doorbell, 1, __ATOMIC_SEQ_CST);
+
+    xinput_service_reactor_rumble_deferred = xinput_service_rumble_apply();
+}
+
+static void xinput_service_reactor_rumble(void)
+{
+    char bell;
+
+    while(recv(xinput_service_reactor_rumble_fd, &bell, sizeof(bell), 0) >= 0)
+    {
+    }
+
+    /* rung: disarmed by the client */
+
+    if(__atomic_load_n(&service_shared->rumble_doorbell, __ATOMIC_SEQ_CST) == 0)
+    {
+        xinput_service_reactor_rumble_arm();
+    }
+}
+
+#endif
+
+/**
+ * Starts serving the newly found gamepads.
+ *
+ * @param mask the slots of the new gamepads
+ */
+
+static void xinput_service_gamepad_start(uint32_t mask)
+{
+    if(mask == 0)
+    {
+        return;
+    }
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        if(mask & (1 << slot))
+        {
+            int ret;
+
+            /* new gamepad */
+
+            xinput_gamepad_device* device = xinput_driver_get_device(slot);
+            xinput_gamepad_state* xgs = &service_shared->state[slot];
+
+            xinput_service_thread_parameter[slot].device = device;
+            xinput_service_thread_parameter[slot].slot = slot;
+            xinput_service_thread_parameter[slot].xgs = xgs;
+
+            xinput_service_rumble_reset(slot);
+
+#if XINPUT_SERVICE_REACTOR_SUPPORTED
+            if(xinput_service_reactor_mode)
+            {
+                TRACE("watching gamepad %i\n", slot);
+
+                if(!xinput_service_reactor_gamepad_add(slot))
+                {
+                    xinput_driver_device_close(slot);
+                    xinput_service_thread_parameter[slot].device = NULL;
+                }
+
+                continue;
+            }
+#endif
+            TRACE("starting thread for gamepad %i\n", slot);
+
+            TRACE("create\n");
+
+            ret = pthread_create(&xinput_service_thread_parameter[slot].tid, NULL, xinput_service_gamepad_reader_thread, &xinput_service_thread_parameter[slot]);
+
+            if(ret != 0)
+            {
+                xinput_driver_device_close(slot);
+                xinput_service_thread_parameter[slot].device = NULL;
+
+                TRACE("pthread_create returned %i: %s\n", ret, strerror(ret));
+            }
+        }
+    }
+}
+
+static void xinput_service_gamepad_probe(void)
+{
+    xinput_service_gamepad_start(xinput_driver_probe());
+}
+
+/**
+ * Tells the clients waiting for the service to start that the gamepads
+ * already plugged are in the shared memory.
+ * Done after the first probe.
+ */
+
+static void xinput_service_ready(void)
+{
+    if(__atomic_exchange_n(&service_shared->header.ready, 1, __ATOMIC_RELEASE) == 0)
+    {
+        TRACE("ready\n");
+        futex_wake_all(&service_shared->header.ready);
+    }
+}
+
+/**
+ * Looks for signs of life from the clients.
+ *
+ * @param allalone the count of consecutive checks without activity
+ * @return FALSE if the service should stop
+ */
+
+static BOOL xinput_service_clients_active(int* allalone)
+{
+    if(xinput_service_idle_strikes > 0)
     {
-#ifdef __USE_XOPEN2K
         int64_t now = timeus();
-        now += 1000000LL;
-        to.tv_sec = now / 1000000LL;
-        to.tv_nsec = (now % 1000000LL) *1000LL;
 
-        if(sem_timedwait(service_sem, &to) == 0)
-        {
-            return TRUE;
-        }
-#else
-        if(sem_trywait(service_sem) == 0)
-        {
-            return TRUE;
-        }
-        else if(timeus() < until)
-        {
-            usleep(500);   /* 0.5 ms sleep */
-        }
-#endif
-        else
+        if(now >= service_shared->poke_us)
         {
-            int err = errno;
-
-            if(err != EINTR)
+            if((now - service_shared->poke_us) <= (XINPUT_DEVICE_PROBE_PERIOD_S * 1000000LL))
             {
-                /*
-                 * ETIMEOUT
-                 * starvation or a client died keeping the lock
-                 *
-                 * TODO: destroy the service, including the semaphore,
-                 * and let it restart
-                 */
+                int dt = (int)(now - service_shared->poke_us);
+                TRACE("client was active %ius ago\n", dt);
+                service_shared->poke_us = now;
+                *allalone = 0;
+            }
+            else
+            {
+                int dt = (int)(now - service_shared->poke_us);
 
-                TRACE("semaphore seems stuck\n");
+                ++*allalone;
 
-                return FALSE;
+                TRACE("client has not been active for %ius (strike %i)\n", dt, *allalone);
+
+                if(*allalone >= xinput_service_idle_strikes)
+                {
+                    TRACE("no active client\n");
+                    /* no sign of life for a while : give up */
+                    return FALSE;
+                }
             }
         }
+        else
+        {
+            TRACE("weird clock value\n");
+            /* weird, let's reset it */
+            service_shared->poke_us = now;
+        }
     }
-#else
+
     return TRUE;
-#endif
 }
 
-static void xinput_service_unlock(void)
-{
-#if XINPUT_USES_SEMAPHORE_MUTEX
-    sem_post(service_sem);
-#endif
-}
+/* the fds polled by the thread of the service, the negative ones are ignored */
 
-static void* xinput_service_gamepad_reader_thread(void* args_)
+#define XINPUT_SERVICE_POLL_HOTPLUG 0
+#define XINPUT_SERVICE_POLL_NOTIFY  1
+#define XINPUT_SERVICE_POLL_CLIENTS 2
+
+static void* xinput_service_thread(void* args_)
 {
-    xinput_service_thread_args* args = (xinput_service_thread_args*)args_;
+    struct pollfd fds[XINPUT_SERVICE_POLL_CLIENTS + XINPUT_SERVICE_NOTIFY_CLIENTS_MAX];
+    struct pollfd* hotplug = &fds[XINPUT_SERVICE_POLL_HOTPLUG];
+    int allalone = 0;
+    int64_t next_check = 0;
+    (void)args_;
 
-    xinput_gamepad_state* xgs = args->xgs;
+    memset(fds, 0, sizeof(fds));
 
-    int err;
-    pid_t pid = getpid();
+    for(int i = 0; i < XINPUT_SERVICE_POLL_CLIENTS + XINPUT_SERVICE_NOTIFY_CLIENTS_MAX; ++i)
+    {
+        fds[i].events = POLLIN;
+    }
 
-    TRACE("BEGIN %i ==========================================\n", args->slot);
+    hotplug->fd = xinput_driver_hotplug_start();
 
-    if(xinput_service_lock())
+    if((fds[XINPUT_SERVICE_POLL_NOTIFY].fd = xinput_service_notify_open()) < 0)
     {
-        xgs->connected = TRUE;
-        xinput_service_unlock();
+        int err = errno;
+        TRACE("could not create the notification socket: %s\n", strerror(err));
     }
 
     for(;;)
     {
-        if((err = args->device->vtbl->read(args->device)) == 0)
+        int64_t now = timeus();
+
+        if(now >= next_check)
         {
-            if(xinput_service_lock())
+            if(!xinput_service_clients_active(&allalone))
             {
-                /* copy the data */
-                args->device->vtbl->update(args->device, &xgs->gamepad, &xgs->vibration);
-                ++xgs->dwPacketNumber;
-                xinput_service_unlock();
+                break;
             }
-            else
+
+            xinput_filter_reload();
+
+            /* without hotplug detection, keep scanning */
+
+            if((hotplug->fd < 0) || (next_check == 0))
             {
-                /* semaphore stuck ... ? */
+                xinput_service_gamepad_probe();
             }
+
+            xinput_service_ready();
+
+            next_check = now + XINPUT_DEVICE_PROBE_PERIOD_S * 1000000LL;
         }
         else
         {
-            /* ENODEV ... or something */
-            TRACE("%6i: failed to read %i: %i: %s\n", pid, args->slot, err, strerror(err));
+            int timeout_ms = (int)((next_check - now + 999) / 1000);
 
-            break;
-        }
-#if XINPUT_TRACE_DEVICE_READER_THREAD
-        TRACE("%6i | %9i | %04hx,%04hx %04hx,%04hx %02hhx %02hhx %04hx\n",
-                pid,
-                xgs->dwPacketNumber,
-                xgs->gamepad.sThumbLX,
-                xgs->gamepad.sThumbLY,
-                xgs->gamepad.sThumbRX,
-                xgs->gamepad.sThumbRY,
-                xgs->gamepad.bLeftTrigger,
-                xgs->gamepad.bRightTrigger,
-                xgs->gamepad.wButtons
-                );
-#endif
-    } /*  for */
+            for(int i = 0; i < XINPUT_SERVICE_NOTIFY_CLIENTS_MAX; ++i)
+            {
+                fds[XINPUT_SERVICE_POLL_CLIENTS + i].fd = xinput_service_notify_clients[i].fd;
+            }
 
-    xinput_driver_device_close(args->slot);
-    args->device = NULL;
+            if(poll(fds, XINPUT_SERVICE_POLL_CLIENTS + XINPUT_SERVICE_NOTIFY_CLIENTS_MAX, timeout_ms) > 0)
+            {
+                if(hotplug->revents != 0)
+                {
+                    xinput_service_gamepad_start(xinput_driver_hotplug_probe());
+                }
 
-    if(xinput_service_lock())
-    {
-        xgs->connected = FALSE;
-        xinput_service_unlock();
+                if(fds[XINPUT_SERVICE_POLL_NOTIFY].revents != 0)
+                {
+                    xinput_service_notify_accept();
+                }
+
+                for(int i = 0; i < XINPUT_SERVICE_NOTIFY_CLIENTS_MAX; ++i)
+                {
+                    if(fds[XINPUT_SERVICE_POLL_CLIENTS + i].revents != 0)
+                    {
+                        xinput_service_notify_read(i);
+                    }
+                }
+            }
+        }
     }
 
-    TRACE("END %i ============================================\n", args->slot);
+    xinput_driver_hotplug_stop();
 
     return NULL;
 }
 
-static void xinput_service_gamepad_probe(void)
+#if XINPUT_SERVICE_REACTOR_SUPPORTED
+static void xinput_service_reactor(void)
 {
-    uint32_t mask = xinput_driver_probe();
+    struct epoll_event events[XINPUT_SERVICE_REACTOR_EVENTS];
+    struct itimerspec period;
+    int timer_fd;
+    int hotplug_fd;
+    int allalone = 0;
 
-    if(mask == 0)
+    xinput_service_reactor_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if(xinput_service_reactor_fd < 0)
     {
+        int err = errno;
+        TRACE("could not create epoll: %s\n", strerror(err));
         return;
     }
 
-    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
-    {
-        if(mask & (1 << slot))
-        {
-            int ret;
-
-            /* new gamepad */
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
 
-            xinput_gamepad_device* device = xinput_driver_get_device(slot);
-            xinput_gamepad_state* xgs = &service_shared->state[slot];
+    if(timer_fd < 0)
+    {
+        int err = errno;
+        TRACE("could not create timer: %s\n", strerror(err));
+        close_ex(xinput_service_reactor_fd);
+        xinput_service_reactor_fd = -1;
+        return;
+    }
 
-            TRACE("starting thread for gamepad %i\n", slot);
+    memset(&period, 0, sizeof(period));
+    period.it_interval.tv_sec = XINPUT_DEVICE_PROBE_PERIOD_S;
+    period.it_value.tv_sec = XINPUT_DEVICE_PROBE_PERIOD_S;
+    timerfd_settime(timer_fd, 0, &period, NULL);
 
-            xinput_service_thread_parameter[slot].device = device;
-            xinput_service_thread_parameter[slot].slot = slot;
-            xinput_service_thread_parameter[slot].xgs = xgs;
+    xinput_service_reactor_watch(timer_fd, XINPUT_SERVICE_REACTOR_TIMER);
 
-            TRACE("create\n");
+    /* without a doorbell, the mailboxes are looked at regularly */
 
-            ret = pthread_create(&xinput_service_thread_parameter[slot].tid, NULL, xinput_service_gamepad_reader_thread, &xinput_service_thread_parameter[slot]);
+    if((xinput_service_reactor_rumble_fd = xinput_service_reactor_doorbell_open()) >= 0)
+    {
+        xinput_service_reactor_watch(xinput_service_reactor_rumble_fd, XINPUT_SERVICE_REACTOR_RUMBLE);
+        xinput_service_reactor_rumble_arm();
+    }
+    else
+    {
+        int err = errno;
+        TRACE("could not create the rumble doorbell: %s\n", strerror(err));
+    }
 
-            if(ret != 0)
-            {
-                xinput_driver_device_close(slot);
+    if((hotplug_fd = xinput_driver_hotplug_start()) >= 0)
+    {
+        xinput_service_reactor_watch(hotplug_fd, XINPUT_SERVICE_REACTOR_HOTPLUG);
+    }
 
-                TRACE("pthread_create returned %i: %s\n", ret, strerror(ret));
-            }
-        }
+    if(xinput_service_notify_open() >= 0)
+    {
+        xinput_service_reactor_watch(xinput_service_notify_fd, XINPUT_SERVICE_REACTOR_NOTIFY);
+    }
+    else
+    {
+        int err = errno;
+        TRACE("could not create the notification socket: %s\n", strerror(err));
     }
 
-#if XINPUT_TRACE_DEVICE_DETECTION
-    TRACE("devices probed\n");
-#endif
-}
+    xinput_filter_reload();
+    xinput_service_gamepad_probe();
+    xinput_service_ready();
 
-static void* xinput_service_thread(void* args_)
-{
-    int allalone = 0;
-    (void)args_;
     for(;;)
     {
-        if(xinput_service_idle_strikes > 0)
+        /* come back for the rumbles refused by their device */
+
+        int timeout_ms = ((xinput_service_reactor_rumble_deferred != 0) || (xinput_service_reactor_rumble_fd < 0))?(int)((XINPUT_SERVICE_RUMBLE_RETRY_US + 999) / 1000):-1;
+        int n = epoll_wait(xinput_service_reactor_fd, events, XINPUT_SERVICE_REACTOR_EVENTS, timeout_ms);
+
+        if(n < 0)
         {
-            int64_t now = timeus();
+            int err = errno;
+
+            if(err == EINTR)
+            {
+                continue;
+            }
+
+            TRACE("epoll_wait failed: %s\n", strerror(err));
+            break;
+        }
+
+        for(int i = 0; i < n; ++i)
+        {
+            uint32_t tag = events[i].data.u32;
 
-            if(now >= service_shared->poke_us)
+            if(tag < XUSER_MAX_COUNT)
+            {
+                xinput_service_reactor_gamepad_read(tag);
+            }
+            else if(tag == XINPUT_SERVICE_REACTOR_TIMER)
             {
-                if((now - service_shared->poke_us) <= (XINPUT_DEVICE_PROBE_PERIOD_S * 1000000LL))
+                uint64_t expirations;
+
+                if(read(timer_fd, &expirations, sizeof(expirations)) < 0)
                 {
-                    int dt = (int)(now - service_shared->poke_us);
-                    TRACE("client was active %ius ago\n", dt);
-                    service_shared->poke_us = now;
-                    allalone = 0;
+                    continue;
                 }
-                else
+
+                if(!xinput_service_clients_active(&allalone))
                 {
-                    int dt = (int)(now - service_shared->poke_us);
+                    goto xinput_service_reactor_stop;
+                }
 
-                    ++allalone;
+                xinput_filter_reload();
+    
+                /* without hotplug detection, keep scanning */
 
-                    TRACE("client has not been active for %ius (strike %i)\n", dt, allalone);
+                if(hotplug_fd < 0)
+                {
+                    xinput_service_gamepad_probe();
+                }
+            }
+            else if(tag == XINPUT_SERVICE_REACTOR_HOTPLUG)
+            {
+                xinput_service_gamepad_start(xinput_driver_hotplug_probe());
+            }
+            else if(tag == XINPUT_SERVICE_REACTOR_RUMBLE)
+            {
+                xinput_service_reactor_rumble();
+            }
+            else if(tag == XINPUT_SERVICE_REACTOR_NOTIFY)
+            {
+                int index = xinput_service_notify_accept();
 
-                    if(allalone >= xinput_service_idle_strikes)
-                    {
-                        TRACE("no active client\n");
-                        /* no sign of life for a while : give up */
-                        break;
-                    }
+                if((index >= 0) && !xinput_service_reactor_watch(xinput_service_notify_clients[index].fd, XINPUT_SERVICE_REACTOR_NOTIFY_CLIENT + index))
+                {
+                    xinput_service_notify_drop(index);
                 }
             }
-            else
+            else if(tag >= XINPUT_SERVICE_REACTOR_NOTIFY_CLIENT)
             {
-                TRACE("weird clock value\n");
-                /* weird, let's reset it */
-                service_shared->poke_us = now;
+                xinput_service_notify_read(tag - XINPUT_SERVICE_REACTOR_NOTIFY_CLIENT);
             }
         }
 
-        xinput_service_gamepad_probe();
-        sleep(XINPUT_DEVICE_PROBE_PERIOD_S);
+        if((xinput_service_reactor_rumble_deferred != 0) || (xinput_service_reactor_rumble_fd < 0))
+        {
+            xinput_service_reactor_rumble_deferred = xinput_service_rumble_apply();
+        }
+    }
+
+xinput_service_reactor_stop:
+
+    __atomic_store_n(&service_shared->rumble_doorbell, 0, __ATOMIC_SEQ_CST);
+
+    if(xinput_service_reactor_rumble_fd >= 0)
+    {
+        close_ex(xinput_service_reactor_rumble_fd);
+        xinput_service_reactor_rumble_fd = -1;
     }
-    return NULL;
+
+    xinput_driver_hotplug_stop();
+    close_ex(timer_fd);
+    close_ex(xinput_service_reactor_fd);
+    xinput_service_reactor_fd = -1;
 }
+#endif
 
 void xinput_service_destroy(void)
 {
     TRACE("destroying\n");
 
-#if XINPUT_USES_MQUEUE
-    xinput_service_queue_destroy();
-#endif
-
     xinput_service_lock_destroy();
 
     if(service_shared != NULL)
@@ -512,15 +1506,20 @@ void xinput_service_destroy(void)
             }
         }
 
-#if XINPUT_USES_MQUEUE
-        if(xinput_service_rumble_thread_id != 0)
-        {
-            pthread_cancel(xinput_service_rumble_thread_id);
-            xinput_service_rumble_thread_id = 0;
-        }
-#endif
+        xinput_driver_hotplug_stop();
+
+        xinput_service_rumble_thread_stop();
+
+        /* the clients see their connection closed */
+
+        xinput_service_notify_stop();
+
+        service_shared->header.master_pid = XINPUT_OWNER_BROKEN;
+
+        /* the clients waiting for it to be ready see it is gone */
+
+        futex_wake_all(&service_shared->header.ready);
 
-        service_shared->master_pid = XINPUT_OWNER_BROKEN;
         TRACE("destroying '%s'\n", SERVICE_SHM_NAME);
         shm_unlink(SERVICE_SHM_NAME);
 
@@ -540,7 +1539,8 @@ void xinput_service_destroy(void)
 int xinput_service_poke(void)
 {
     xinput_shared_gamepad_state* state;
-    pid_t pid;
+    struct stat st;
+    pid_t pid = 0;
     int ret;
     int fd;
     BOOL dead;
@@ -557,6 +1557,28 @@ int xinput_service_poke(void)
 
     fd = ret;
 
+    if(fstat(fd, &st) < 0)
+    {
+        ret = errno;
+        close_ex(fd);
+        TRACE("could not stat: %s\n", strerror(ret));
+        return ret;
+    }
+
+    if((size_t)st.st_size < sizeof(xinput_shared_gamepad_state))
+    {
+        /*
+         * Made by an older service, or by one that died while creating it.
+         * As the system-wide lock is held, its owner cannot be running.
+         */
+
+        TRACE("shared memory of %lli bytes instead of %i\n", (long long)st.st_size, (int)sizeof(xinput_shared_gamepad_state));
+        TRACE("destroying '%s'\n", SERVICE_SHM_NAME);
+        shm_unlink(SERVICE_SHM_NAME);
+        close_ex(fd);
+        return ENOENT;
+    }
+
     state = (xinput_shared_gamepad_state*)mmap(
                 NULL,
                 sizeof(xinput_shared_gamepad_state),
@@ -564,7 +1586,7 @@ int xinput_service_poke(void)
                 fd,
                 0);
 
-    if(state == NULL)
+    if(state == MAP_FAILED)
     {
         ret = errno;
         close_ex(fd);
@@ -576,7 +1598,19 @@ int xinput_service_poke(void)
     {
         memdump(state, sizeof(xinput_shared_gamepad_state));
 
-        pid = state->master_pid;
+        if((ret = xinput_shared_header_check(&state->header, st.st_size)) != EAGAIN)
+        {
+            if(ret == 0)
+            {
+                pid = state->header.master_pid;
+            }
+            else
+            {
+                TRACE("incompatible shared memory (version %u)\n", state->header.version);
+                pid = XINPUT_OWNER_BROKEN;
+            }
+        }
+
         if(pid != 0)
         {
             TRACE("owned by pid %i\n", pid);
@@ -606,11 +1640,9 @@ int xinput_service_poke(void)
 
         /*  dead */
         /*  mark it as dead, delete it, close it restart it */
-        state->master_pid = XINPUT_OWNER_BROKEN; /*  mark broken */
+        state->header.master_pid = XINPUT_OWNER_BROKEN; /*  mark broken */
+        futex_wake_all(&state->header.ready);
         TRACE("destroying '%s'\n", SERVICE_SHM_NAME);
-#if XINPUT_USES_MQUEUE
-        mq_unlink(SERVICE_MSG_NAME);
-#endif
 #if XINPUT_USES_SEMAPHORE_MUTEX
         sem_unlink(SERVICE_SEM_NAME);
 #endif
@@ -682,7 +1714,7 @@ int xinput_service_create(void)
                     fd,
                     0);
 
-    if(state == NULL)
+    if(state == MAP_FAILED)
     {
         ret = errno;
 
@@ -697,8 +1729,12 @@ int xinput_service_create(void)
 
     memset(state, 0, sizeof(xinput_shared_gamepad_state));
 
+    xinput_shared_header_init(&state->header);
+
     memset(xinput_service_thread_parameter, 0, sizeof(xinput_service_thread_parameter));;
 
+    xinput_service_notify_init();
+
     //state->poke_us = timeus();
 
     /* from this point, there should be no race/conflict creating the resources */
@@ -712,13 +1748,7 @@ int xinput_service_create(void)
     memset(&xinput_service_thread_parameter, 0, sizeof(xinput_service_thread_parameter));
     xinput_driver_initialize();
 
-#if XINPUT_USES_MQUEUE
-    if(!xinput_service_queue_create())
-    {
-        xinput_service_destroy();
-        return -1;
-    }
-#endif
+    memset(xinput_service_rumble_applied, 0, sizeof(xinput_service_rumble_applied));
 
     /* everything is ready, set the pid */
 
@@ -734,15 +1764,21 @@ int xinput_service_create(void)
 
 int xinput_service_run(void)
 {
-#if XINPUT_USES_MQUEUE
     pthread_t tid;
     int ret;
-#endif
 
-    service_shared->master_pid = getpid();
-    TRACE("owner set to %i\n", service_shared->master_pid);
+    service_shared->header.master_pid = getpid();
+    TRACE("owner set to %i\n", service_shared->header.master_pid);
+
+#if XINPUT_SERVICE_REACTOR_SUPPORTED
+    if(xinput_service_reactor_mode)
+    {
+        TRACE("running the reactor\n");
+        xinput_service_reactor();
+        return 0;
+    }
+#endif
 
-#if XINPUT_USES_MQUEUE
     ret = pthread_create(&tid, NULL, xinput_service_rumble_thread, NULL);
 
     if(ret == 0)
@@ -756,7 +1792,6 @@ int xinput_service_run(void)
         xinput_service_destroy();
         return -1;
     }
-#endif
 
     xinput_service_thread(NULL);
     return 0;
@@ -945,3 +1980,15 @@ void xinput_service_set_autoshutdown(int strikes)
 {
     xinput_service_idle_strikes = strikes;
 }
+
+void xinput_service_set_reactor(BOOL enable)
+{
+#if XINPUT_SERVICE_REACTOR_SUPPORTED
+    xinput_service_reactor_mode = enable;
+#else
+    if(enable)
+    {
+        TRACE("reactor mode not supported\n");
+    }
+#endif
+}
@@ -28,7 +28,14 @@
 #define XINPUT_SERVICE_H
 
 #include "xinput.h"
+#include "xinput_settings.h"
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #ifndef XUSER_MAX_COUNT
 #define XUSER_MAX_COUNT 4
@@ -40,49 +47,641 @@
 #define SERVICE_NAME "/xinput"
 #define SERVICE_SHM_NAME SERVICE_NAME "shm"
 #define SERVICE_SEM_NAME SERVICE_NAME "mtx"
-#define SERVICE_MSG_NAME SERVICE_NAME "msg"
 #define SERVICE_LCK_NAME SERVICE_NAME "lck"
+#define SERVICE_BELL_NAME SERVICE_NAME "bell"
+#define SERVICE_NOTIFY_NAME SERVICE_NAME "notify"
 
 #define XINPUT_OWNER_BROKEN ((pid_t)~0)
 
-#if XINPUT_USES_MQUEUE
-#define MQD_INVALID ((mqd_t)-1)
-#endif
-
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * The layout of the shared memory is part of the ABI between the service and
+ * its clients, which may be 32 or 64 bits processes built from another version.
+ *
+ * Every block is padded explicitly to XINPUT_SHARED_LINE_SIZE bytes so that:
+ *  - the offsets are the same for 32 and 64 bits processes,
+ *  - the reader of a slot never invalidates the line of another slot,
+ *  - the fields written by the clients never share a line with the ones
+ *    written by the service.
+ *
+ * 128 bytes rather than 64 because of the adjacent line prefetcher.
+ *
+ * Any change of the layout must increase XINPUT_SHARED_VERSION.
+ */
+
+#define XINPUT_SHARED_LINE_SIZE 128
+
+#define XINPUT_SHARED_MAGIC     0x504e4958  /* "XINP" */
+#define XINPUT_SHARED_VERSION   8
+
+/**
+ * Describes the shared memory.
+ * Written by the service before it sets its pid, never changed after, but
+ * for the ready word.
+ */
+
+struct xinput_shared_header
+{
+    volatile uint32_t magic;            /* XINPUT_SHARED_MAGIC, set last */
+    uint32_t version;                   /* XINPUT_SHARED_VERSION */
+    uint32_t size;                      /* sizeof(xinput_shared_gamepad_state) */
+    uint32_t header_size;               /* sizeof(xinput_shared_header) */
+    uint32_t state_size;                /* sizeof(xinput_gamepad_state) */
+    uint32_t state_count;               /* XUSER_MAX_COUNT */
+    volatile DWORD master_pid;          /* the pid of the service, set when it runs */
+    volatile uint32_t ready;            /* futex, set to 1 once the first probe is done */
+    char _padding_reserved[XINPUT_SHARED_LINE_SIZE - 32];
+};
+
+typedef struct xinput_shared_header xinput_shared_header;
+
+/**
+ * Written by the service only.
+ */
+
 struct xinput_gamepad_state
 {
     XINPUT_GAMEPAD_EX gamepad;          /* 16 bytes */
     XINPUT_VIBRATION vibration;        /* 4 bytes  */
     volatile DWORD dwPacketNumber;      /* 4 bytes  */
     volatile BOOL connected;           /* 4 bytes  */
-    DWORD _padding_reserved_0;          /* 4 bytes  */
-    /* 32 bytes mark, a reasonable size for a L1 line (half, or equal) */
+    volatile DWORD sequence;            /* 4 bytes, odd while being written */
+    int64_t event_us;                   /* 8 bytes, when the device reported the state, 0 if unknown */
+    int64_t publish_us;                 /* 8 bytes, when the service published it */
+    char _padding_reserved[XINPUT_SHARED_LINE_SIZE - 48];
 };
 
 typedef struct xinput_gamepad_state xinput_gamepad_state;
 
+/**
+ * After this many retries, a reader accepts the snapshot it has.
+ * This only happens if the service died in the middle of an update.
+ */
+
+#define XINPUT_GAMEPAD_STATE_READ_RETRIES 65536
+
+/*
+ * The gamepad states are protected by a seqlock.
+ *
+ * The service is the only writer of a slot: it makes the sequence odd before
+ * changing the state and even again after.
+ * Readers copy the state and retry if the sequence was odd or has changed
+ * meanwhile.
+ *
+ * Only aligned 32 bits atomics are used so 32 and 64 bits processes can share
+ * the same memory. (Unlike POSIX semaphores.)
+ */
+
+static inline void xinput_gamepad_state_write_begin(xinput_gamepad_state* xgs)
+{
+    __atomic_store_n(&xgs->sequence, xgs->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void xinput_gamepad_state_write_end(xinput_gamepad_state* xgs)
+{
+    __atomic_store_n(&xgs->sequence, xgs->sequence + 1, __ATOMIC_RELEASE);
+}
+
+static inline DWORD xinput_gamepad_state_read_begin(const xinput_gamepad_state* xgs)
+{
+    return __atomic_load_n(&xgs->sequence, __ATOMIC_ACQUIRE);
+}
+
+static inline BOOL xinput_gamepad_state_read_retry(const xinput_gamepad_state* xgs, DWORD sequence)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return ((sequence & 1) != 0) || (__atomic_load_n(&xgs->sequence, __ATOMIC_RELAXED) != sequence);
+}
+
+/**
+ * Takes a consistent snapshot of a gamepad state and of its times.
+ *
+ * @param xgs the shared state
+ * @param gamepad receives the gamepad, can be NULL
+ * @param packet receives the packet number, can be NULL
+ * @param event_us receives the time the device reported the state, can be NULL
+ * @param publish_us receives the time the service published it, can be NULL
+ *
+ * @return TRUE if the snapshot is consistent, FALSE if it had to give up
+ */
+
+static inline BOOL xinput_gamepad_state_snapshot_timed(const xinput_gamepad_state* xgs, XINPUT_GAMEPAD_EX* gamepad, DWORD* packet, int64_t* event_us, int64_t* publish_us)
+{
+    for(int tries = XINPUT_GAMEPAD_STATE_READ_RETRIES; tries > 0; --tries)
+    {
+        DWORD sequence = xinput_gamepad_state_read_begin(xgs);
+
+        if(gamepad != NULL)
+        {
+            memcpy(gamepad, (const void*)&xgs->gamepad, sizeof(*gamepad));
+        }
+        if(packet != NULL)
+        {
+            *packet = xgs->dwPacketNumber;
+        }
+        if(event_us != NULL)
+        {
+            *event_us = xgs->event_us;
+        }
+        if(publish_us != NULL)
+        {
+            *publish_us = xgs->publish_us;
+        }
+
+        if(!xinput_gamepad_state_read_retry(xgs, sequence))
+        {
+            return TRUE;
+        }
+
+        if((tries & 63) == 0)
+        {
+            /* the writer may have been preempted in the middle of an update */
+            sched_yield();
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * Takes a consistent snapshot of a gamepad state.
+ *
+ * @param xgs the shared state
+ * @param gamepad receives the gamepad, can be NULL
+ * @param packet receives the packet number, can be NULL
+ *
+ * @return TRUE if the snapshot is consistent, FALSE if it had to give up
+ */
+
+static inline BOOL xinput_gamepad_state_snapshot(const xinput_gamepad_state* xgs, XINPUT_GAMEPAD_EX* gamepad, DWORD* packet)
+{
+    return xinput_gamepad_state_snapshot_timed(xgs, gamepad, packet, NULL, NULL);
+}
+
+/**
+ * A frame of the history of a slot.
+ * Written by the service only, each frame has its own seqlock.
+ */
+
+struct xinput_gamepad_history_frame
+{
+    XINPUT_GAMEPAD_EX gamepad;          /* 16 bytes */
+    volatile DWORD dwPacketNumber;      /* 4 bytes, the packet number of the state */
+    volatile DWORD sequence;            /* 4 bytes, odd while being written */
+    int64_t event_us;                   /* 8 bytes */
+    int64_t publish_us;                 /* 8 bytes */
+    char _padding_reserved[XINPUT_SHARED_LINE_SIZE / 2 - 40];
+};
+
+typedef struct xinput_gamepad_history_frame xinput_gamepad_history_frame;
+
+/**
+ * A keystroke in the queue of a slot.
+ * Written by the service only, each entry has its own seqlock.
+ */
+
+struct xinput_keystroke_entry
+{
+    volatile DWORD sequence;            /* 4 bytes, odd while being written */
+    volatile DWORD serial;              /* 4 bytes, the number of the keystroke in its queue, from 1 */
+    XINPUT_KEYSTROKE keystroke;         /* 8 bytes */
+    int64_t time_us;                    /* 8 bytes, the time of the state that made it */
+    char _padding_reserved[XINPUT_SHARED_LINE_SIZE / 4 - 24];
+};
+
+typedef struct xinput_keystroke_entry xinput_keystroke_entry;
+
 struct xinput_shared_gamepad_state
 {
-    xinput_gamepad_state state[XUSER_MAX_COUNT]; // 128 bytes
-    volatile DWORD master_pid;
-    char _padding_reserved_0[60];
+    xinput_shared_header header;
+
+    xinput_gamepad_state state[XUSER_MAX_COUNT];
+
+    /* written by the service */
+
+    volatile uint32_t published;        /* futex, incremented after each publish */
+    volatile uint32_t rumble_waiters;   /* the service is waiting on rumble_posted */
+    volatile DWORD history_head[XUSER_MAX_COUNT]; /* the packet number of the last frame of each history */
+    volatile DWORD keystroke_head[XUSER_MAX_COUNT]; /* the serial of the last keystroke of each queue */
+    char _padding_reserved_0[XINPUT_SHARED_LINE_SIZE - 8 - 8 * XUSER_MAX_COUNT];
+
+    /* written by the clients */
+
     volatile int64_t poke_us;
-    char _padding_reserved_1[56];
+    volatile uint32_t published_waiters;/* clients waiting on the futex */
+    char _padding_reserved_1[XINPUT_SHARED_LINE_SIZE - 12];
+
+    /* rumble mailboxes, written by the clients */
+
+    volatile uint32_t rumble[XUSER_MAX_COUNT]; /* see xinput_rumble_pack, the latest value wins */
+    volatile uint32_t rumble_posted;    /* futex, incremented after a mailbox changed */
+    volatile uint32_t rumble_doorbell;  /* set by the reactor, cleared by the client that rings it */
+    char _padding_reserved_2[XINPUT_SHARED_LINE_SIZE - 4 * XUSER_MAX_COUNT - 8];
+
+    /* the last frames of each slot, written by the service */
+
+    xinput_gamepad_history_frame history[XUSER_MAX_COUNT][XINPUT_GAMEPAD_HISTORY_FRAMES];
+
+    /* the keystrokes of each slot, written by the service */
+
+    xinput_keystroke_entry keystrokes[XUSER_MAX_COUNT][XINPUT_KEYSTROKE_QUEUE_SIZE];
 };
 
 typedef struct xinput_shared_gamepad_state xinput_shared_gamepad_state;
 
-struct xinput_gamepad_vibration
+_Static_assert(sizeof(xinput_shared_header) == XINPUT_SHARED_LINE_SIZE, "header size");
+_Static_assert(sizeof(xinput_gamepad_state) == XINPUT_SHARED_LINE_SIZE, "gamepad state size");
+_Static_assert(offsetof(xinput_gamepad_state, event_us) == 32, "gamepad state times offset"); /* 8-aligned for 32 bits processes too */
+_Static_assert(offsetof(xinput_shared_gamepad_state, state) == XINPUT_SHARED_LINE_SIZE, "gamepad states offset");
+_Static_assert(offsetof(xinput_shared_gamepad_state, published) == XINPUT_SHARED_LINE_SIZE * (1 + XUSER_MAX_COUNT), "published offset");
+_Static_assert(offsetof(xinput_shared_gamepad_state, poke_us) == XINPUT_SHARED_LINE_SIZE * (2 + XUSER_MAX_COUNT), "clients offset");
+_Static_assert(offsetof(xinput_shared_gamepad_state, rumble) == XINPUT_SHARED_LINE_SIZE * (3 + XUSER_MAX_COUNT), "rumble offset");
+_Static_assert(offsetof(xinput_shared_gamepad_state, history) == XINPUT_SHARED_LINE_SIZE * (4 + XUSER_MAX_COUNT), "history offset");
+_Static_assert(sizeof(xinput_gamepad_history_frame) == XINPUT_SHARED_LINE_SIZE / 2, "history frame size");
+_Static_assert((XINPUT_GAMEPAD_HISTORY_FRAMES & (XINPUT_GAMEPAD_HISTORY_FRAMES - 1)) == 0, "history frames count");
+_Static_assert(offsetof(xinput_shared_gamepad_state, keystrokes) == XINPUT_SHARED_LINE_SIZE * (4 + XUSER_MAX_COUNT) + sizeof(xinput_gamepad_history_frame) * XUSER_MAX_COUNT * XINPUT_GAMEPAD_HISTORY_FRAMES, "keystrokes offset");
+_Static_assert(sizeof(xinput_keystroke_entry) == XINPUT_SHARED_LINE_SIZE / 4, "keystroke entry size");
+_Static_assert(offsetof(xinput_keystroke_entry, time_us) == 16, "keystroke entry time offset"); /* 8-aligned for 32 bits processes too */
+_Static_assert((XINPUT_KEYSTROKE_QUEUE_SIZE & (XINPUT_KEYSTROKE_QUEUE_SIZE - 1)) == 0, "keystroke queue size");
+_Static_assert(sizeof(xinput_shared_gamepad_state) == XINPUT_SHARED_LINE_SIZE * (4 + XUSER_MAX_COUNT) + sizeof(xinput_gamepad_history_frame) * XUSER_MAX_COUNT * XINPUT_GAMEPAD_HISTORY_FRAMES + sizeof(xinput_keystroke_entry) * XUSER_MAX_COUNT * XINPUT_KEYSTROKE_QUEUE_SIZE, "shared memory size");
+
+/**
+ * Fills the header of a new shared memory.
+ * The magic is set last: a client seeing it can trust the rest.
+ */
+
+static inline void xinput_shared_header_init(xinput_shared_header* header)
 {
-    XINPUT_VIBRATION vibration;
-    int index;
-};
+    header->version = XINPUT_SHARED_VERSION;
+    header->size = sizeof(xinput_shared_gamepad_state);
+    header->header_size = sizeof(xinput_shared_header);
+    header->state_size = sizeof(xinput_gamepad_state);
+    header->state_count = XUSER_MAX_COUNT;
+    __atomic_store_n(&header->magic, XINPUT_SHARED_MAGIC, __ATOMIC_RELEASE);
+}
+
+/**
+ * Checks the shared memory has been made by a compatible service.
+ *
+ * @param header the header of the mapped memory
+ * @param size the size of the shared memory object
+ *
+ * @return 0 if compatible, EAGAIN if the service has not initialised it yet,
+ *         EPROTO if it has been made by an incompatible service
+ */
+
+static inline int xinput_shared_header_check(const xinput_shared_header* header, size_t size)
+{
+    uint32_t magic;
+
+    if(size < sizeof(xinput_shared_header))
+    {
+        return (size == 0)?EAGAIN:EPROTO;
+    }
 
-typedef struct xinput_gamepad_vibration xinput_gamepad_vibration;
+    magic = __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE);
+
+    if(magic == 0)
+    {
+        return EAGAIN;
+    }
+
+    if((magic != XINPUT_SHARED_MAGIC) ||
+       (header->version != XINPUT_SHARED_VERSION) ||
+       (header->size != sizeof(xinput_shared_gamepad_state)) ||
+       (header->header_size != sizeof(xinput_shared_header)) ||
+       (header->state_size != sizeof(xinput_gamepad_state)) ||
+       (header->state_count != XUSER_MAX_COUNT) ||
+       (size < sizeof(xinput_shared_gamepad_state)))
+    {
+        return EPROTO;
+    }
+
+    return 0;
+}
+
+/**
+ * A batch is copied again this many times at most while the service
+ * publishes during the copy.
+ */
+
+#define XINPUT_GAMEPAD_BATCH_RETRIES 4
+
+/**
+ * Copies the states of all the slots, see XINPUT_STATE_BATCH.
+ *
+ * Nothing is copied while the publication counter is the one of the batch.
+ * Otherwise, the copy is done again if something is published meanwhile, so
+ * that the states are from the same point in time (unless the service keeps
+ * publishing).  The changed slots are the ones whose packet number differs
+ * from the one in the batch.
+ *
+ * @param shared
+ * @param batch the previous batch, updated
+ *
+ * @return TRUE if the batch has been copied again
+ */
+
+static inline BOOL xinput_gamepad_states_snapshot(const xinput_shared_gamepad_state* shared, XINPUT_STATE_BATCH* batch)
+{
+    XINPUT_STATE_EX states[XUSER_MAX_COUNT];
+    DWORD published = __atomic_load_n(&shared->published, __ATOMIC_ACQUIRE);
+    DWORD connected;
+    DWORD changed = 0;
+
+    if(published == batch->dwPublished)
+    {
+        batch->dwChangedMask = 0;
+        return FALSE;
+    }
+
+    for(int tries = XINPUT_GAMEPAD_BATCH_RETRIES; ; --tries)
+    {
+        DWORD again;
+
+        connected = 0;
+
+        for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+        {
+            const xinput_gamepad_state* xgs = &shared->state[slot];
+
+            /* a torn state is not published: the slot keeps its previous one */
+
+            if(!xinput_gamepad_state_snapshot(xgs, &states[slot].Gamepad, &states[slot].dwPacketNumber))
+            {
+                states[slot] = batch->States[slot];
+            }
+
+            if(__atomic_load_n(&xgs->connected, __ATOMIC_ACQUIRE))
+            {
+                connected |= 1 << slot;
+            }
+            else
+            {
+                memset(&states[slot].Gamepad, 0, sizeof(states[slot].Gamepad));
+            }
+        }
+
+        again = __atomic_load_n(&shared->published, __ATOMIC_ACQUIRE);
+
+        if((again == published) || (tries == 1))
+        {
+            break;
+        }
+
+        published = again;
+    }
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        if(states[slot].dwPacketNumber != batch->States[slot].dwPacketNumber)
+        {
+            changed |= 1 << slot;
+        }
+    }
+
+    memcpy(batch->States, states, sizeof(batch->States));
+    batch->dwPublished = published;
+    batch->dwConnectedMask = connected;
+    batch->dwChangedMask = changed;
+
+    return TRUE;
+}
+
+/*
+ * The history of a slot is a ring of its last XINPUT_GAMEPAD_HISTORY_FRAMES
+ * states, indexed by their packet number.
+ *
+ * The service writes a frame, then moves the head to its packet number.
+ * A reader copies the frames between the packet it knows and the head; a
+ * frame overwritten meanwhile has another packet number and is dropped.
+ */
+
+static inline void xinput_gamepad_history_push(xinput_shared_gamepad_state* shared, int slot, const XINPUT_GAMEPAD_EX* gamepad, DWORD packet, int64_t event_us, int64_t publish_us)
+{
+    xinput_gamepad_history_frame* frame = &shared->history[slot][packet & (XINPUT_GAMEPAD_HISTORY_FRAMES - 1)];
+
+    __atomic_store_n(&frame->sequence, frame->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&frame->gamepad, gamepad, sizeof(frame->gamepad));
+    frame->dwPacketNumber = packet;
+    frame->event_us = event_us;
+    frame->publish_us = publish_us;
+    __atomic_store_n(&frame->sequence, frame->sequence + 1, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&shared->history_head[slot], packet, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copies the frames of a slot newer than a packet number, oldest first.
+ *
+ * Frames are lost if the history has been overwritten since that packet:
+ * the packet numbers of the frames copied tell.
+ *
+ * @param shared
+ * @param slot
+ * @param since the last packet number known by the caller
+ * @param frames receives the frames
+ * @param count the size of frames
+ *
+ * @return the number of frames copied
+ */
+
+static inline DWORD xinput_gamepad_history_read(const xinput_shared_gamepad_state* shared, int slot, DWORD since, xinput_gamepad_history_frame* frames, DWORD count)
+{
+    DWORD head = __atomic_load_n(&shared->history_head[slot], __ATOMIC_ACQUIRE);
+    DWORD available = head - since;
+    DWORD copied = 0;
+    DWORD packet;
+
+    /* the history only goes that far back, and since may come from a previous service */
+
+    if(available > XINPUT_GAMEPAD_HISTORY_FRAMES)
+    {
+        available = XINPUT_GAMEPAD_HISTORY_FRAMES;
+    }
+
+    for(packet = head - available + 1; (available > 0) && (copied < count); ++packet, --available)
+    {
+        const xinput_gamepad_history_frame* frame = &shared->history[slot][packet & (XINPUT_GAMEPAD_HISTORY_FRAMES - 1)];
+        xinput_gamepad_history_frame* copy = &frames[copied];
+        DWORD sequence = __atomic_load_n(&frame->sequence, __ATOMIC_ACQUIRE);
+
+        memcpy(copy, (const void*)frame, offsetof(xinput_gamepad_history_frame, _padding_reserved));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if(((sequence & 1) != 0) || (__atomic_load_n(&frame->sequence, __ATOMIC_RELAXED) != sequence) || (copy->dwPacketNumber != packet))
+        {
+            /* being overwritten by a newer frame: this one is lost */
+
+            continue;
+        }
+
+        ++copied;
+    }
+
+    return copied;
+}
+
+/*
+ * The keystrokes of a slot go through a ring of XINPUT_KEYSTROKE_QUEUE_SIZE
+ * entries, indexed by their serial.
+ *
+ * The service writes an entry, then moves the head to its serial.
+ * Each client keeps the serial of the next keystroke it wants: a dequeue is a
+ * single copy.  A client more than a ring behind loses the oldest keystrokes.
+ */
+
+static inline void xinput_keystroke_queue_push(xinput_shared_gamepad_state* shared, int slot, const XINPUT_KEYSTROKE* keystroke, int64_t time_us)
+{
+    DWORD serial = shared->keystroke_head[slot] + 1;
+    xinput_keystroke_entry* entry = &shared->keystrokes[slot][serial & (XINPUT_KEYSTROKE_QUEUE_SIZE - 1)];
+
+    __atomic_store_n(&entry->sequence, entry->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    entry->serial = serial;
+    memcpy(&entry->keystroke, keystroke, sizeof(entry->keystroke));
+    entry->time_us = time_us;
+    __atomic_store_n(&entry->sequence, entry->sequence + 1, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&shared->keystroke_head[slot], serial, __ATOMIC_RELEASE);
+}
+
+/**
+ * Takes the next keystroke of a slot.
+ *
+ * @param shared
+ * @param slot
+ * @param next the serial of the next keystroke for the caller, updated.
+ *             0 to start with the keystrokes queued from now on.
+ * @param keystroke receives the keystroke
+ * @param time_us receives the time of the state that made it, can be NULL
+ *
+ * @return TRUE if a keystroke has been taken, FALSE if the queue is empty
+ */
+
+static inline BOOL xinput_keystroke_queue_pop(const xinput_shared_gamepad_state* shared, int slot, DWORD* next, XINPUT_KEYSTROKE* keystroke, int64_t* time_us)
+{
+    DWORD head = __atomic_load_n(&shared->keystroke_head[slot], __ATOMIC_ACQUIRE);
+
+    /* next may also come from a previous service */
+
+    if((*next == 0) || ((int32_t)(head + 1 - *next) < 0))
+    {
+        *next = head + 1;
+    }
+
+    while((int32_t)(head - *next) >= 0)
+    {
+        const xinput_keystroke_entry* entry;
+        DWORD sequence;
+        DWORD serial;
+        int64_t time;
+
+        if(head - *next >= XINPUT_KEYSTROKE_QUEUE_SIZE)
+        {
+            /* overwritten: lost */
+            *next = head - XINPUT_KEYSTROKE_QUEUE_SIZE + 1;
+        }
+
+        entry = &shared->keystrokes[slot][*next & (XINPUT_KEYSTROKE_QUEUE_SIZE - 1)];
+        sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+        serial = entry->serial;
+        memcpy(keystroke, (const void*)&entry->keystroke, sizeof(*keystroke));
+        time = entry->time_us;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if(((sequence & 1) != 0) || (__atomic_load_n(&entry->sequence, __ATOMIC_RELAXED) != sequence) || (serial != *next))
+        {
+            /* being overwritten by a newer keystroke: this one is lost */
+            ++*next;
+            head = __atomic_load_n(&shared->keystroke_head[slot], __ATOMIC_ACQUIRE);
+            continue;
+        }
+
+        if(time_us != NULL)
+        {
+            *time_us = time;
+        }
+
+        ++*next;
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Rumble goes through one 32 bits mailbox per slot holding both motors.
+ * A client only stores the new value and, if the service sleeps, wakes it.
+ * The values the service had no time to apply are simply overwritten.
+ */
+
+static inline uint32_t xinput_rumble_pack(const XINPUT_VIBRATION* vibration)
+{
+    return ((uint32_t)vibration->wLeftMotorSpeed << 16) | vibration->wRightMotorSpeed;
+}
+
+static inline void xinput_rumble_unpack(uint32_t motors, XINPUT_VIBRATION* vibration)
+{
+    vibration->wLeftMotorSpeed = (WORD)(motors >> 16);
+    vibration->wRightMotorSpeed = (WORD)motors;
+}
+
+/**
+ * Makes the address of a unix socket of the service in the abstract namespace.
+ *
+ * @param address receives the address
+ * @param name one of the SERVICE_*_NAME
+ *
+ * @return the size of the address
+ */
+
+static inline socklen_t xinput_service_socket_address(struct sockaddr_un* address, const char* name)
+{
+    size_t name_size = strlen(name);
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    /* sun_path[0] = 0: abstract, nothing to clean up */
+
+    memcpy(&address->sun_path[1], name, name_size);
+
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + name_size);
+}
+
+/*
+ * The reactor of the service cannot sleep on a futex: it watches a datagram
+ * socket in the abstract namespace instead, the doorbell.
+ * It sets rumble_doorbell when it wants to be rung, and the first client to
+ * post a vibration after that clears it and sends a datagram.
+ */
+
+static inline socklen_t xinput_rumble_doorbell_address(struct sockaddr_un* address)
+{
+    return xinput_service_socket_address(address, SERVICE_BELL_NAME);
+}
+
+/*
+ * An event loop cannot watch a futex either: a client that wants to be
+ * woken connects a seqpacket socket to SERVICE_NOTIFY_NAME and sends the
+ * slots it follows (a uint32_t mask) with its eventfd (SCM_RIGHTS).
+ * The service adds 1 to that eventfd at each publish of one of the slots,
+ * until the connection is closed.  A later mask replaces the first one.
+ */
+
+static inline socklen_t xinput_notify_address(struct sockaddr_un* address)
+{
+    return xinput_service_socket_address(address, SERVICE_NOTIFY_NAME);
+}
 
 BOOL xinput_service_self(void);
 
@@ -112,6 +711,28 @@ int xinput_service_poke(void);
 
 void xinput_service_set_autoshutdown(int strikes);
 
+/**
+ * Serve all the gamepads from a single epoll thread instead of one thread
+ * per gamepad.  Must be called before the service is started.
+ *
+ * @param enable
+ */
+
+void xinput_service_set_reactor(BOOL enable);
+
+/**
+ * Queues the keystrokes going from a set of keys to another: the releases
+ * first, then the presses.
+ *
+ * @param shared
+ * @param slot
+ * @param from the previous keys, see xinput_gamepad_keys
+ * @param to the current keys
+ * @param time_us the time of the state
+ */
+
+void xinput_service_keystrokes_push(xinput_shared_gamepad_state* shared, int slot, uint64_t from, uint64_t to, int64_t time_us);
+
 #ifdef __cplusplus
 }
 #endif
@@ -52,10 +52,96 @@
 
 #define XINPUT_DEVICE_PROBE_PERIOD_S 5
 
+/**
+ * Where the evdev devices are looked for.
+ * New nodes are detected with inotify, the periodic probe is only used if
+ * inotify is not available.
+ */
+
+#define XINPUT_EVDEV_DEVICE_DIRECTORY "/dev/input/by-path"
+
+/**
+ * Serve all the gamepads, the rumble and the probes from a single
+ * epoll loop instead of one thread per gamepad.
+ * Can be changed at runtime with xinput_service_set_reactor.
+ */
+
+#define XINPUT_SERVICE_REACTOR 0
+
+/**
+ * The maximum number of input events fetched from a device by one read()
+ */
+
+#define XINPUT_EVDEV_READ_EVENTS 64
+
+/**
+ * The Microsoft pads are served by a dedicated driver rather than by the
+ * generic one.  0 for the hand-written one (xinput_linux_evdev_xboxpad),
+ * 1 for the one compiled from static tables (xinput_linux_evdev_xboxpad_2).
+ */
+
+#define XINPUT_EVDEV_XBOXPAD_TABLES 0
+
+/**
+ * The maximum number of axes and of keys a compiled translator maps.
+ * The keys are looked up with a fixed number of steps: keep it a power of two.
+ */
+
+#define XINPUT_EVDEV_TRANSLATOR_ABS_OPS 16
+#define XINPUT_EVDEV_TRANSLATOR_KEY_OPS 32
+
+/**
+ * The minimum time between two rumble updates sent to a device, in
+ * microseconds.  The vibrations asked meanwhile are coalesced.
+ */
+
+#define XINPUT_EVDEV_RUMBLE_PERIOD_US 4000LL
+
+#define XINPUT_EVDEV_RUMBLE_BLUETOOTH_PERIOD_US 20000LL
+
+/**
+ * When a device refused a vibration because of its rate, the service
+ * retries after this many microseconds.
+ */
+
+#define XINPUT_SERVICE_RUMBLE_RETRY_US 5000LL
+
+/**
+ * The processes the service can notify through an eventfd at the same time,
+ * see xinput_gamepad_notify_fd.
+ */
+
+#define XINPUT_SERVICE_NOTIFY_CLIENTS_MAX 16
+
+/**
+ * TRACE the devices statistics (reads, events, frames, ...) every
+ * XINPUT_DEVICE_STATISTICS_PERIOD frames (a power of two) and when the
+ * device is closed.
+ */
+
+#define XINPUT_TRACE_DEVICE_STATISTICS 1
+
+#define XINPUT_DEVICE_STATISTICS_PERIOD 4096
+
 #define XINPUT_OWNER_PROBE_PERIOD_US 200000LL
 
 #define XINPUT_OWNER_REPROBE_PERIOD_US 1000000LL
 
+/**
+ * A client waits this long at most for the service it started to be ready,
+ * ie: its shared memory made and its first probe done, before starting it
+ * again.
+ * Until the shared memory exists, the client tries to map it again after
+ * XINPUT_OWNER_CONNECT_RETRY_MIN_US, doubled after each try up to
+ * XINPUT_OWNER_CONNECT_RETRY_MAX_US.
+ */
+
+#define XINPUT_OWNER_STARTUP_TIMEOUT_US 2000000LL
+
+#define XINPUT_OWNER_CONNECT_RETRY_MIN_US 500LL
+
+#define XINPUT_OWNER_CONNECT_RETRY_MAX_US 20000LL
+
 /**
  * For the debug functions
  */
@@ -72,21 +158,12 @@
  * Do not enable this on 64/32 bits systems as it is not supported by POSIX.
  * Cannot properly be shared in a 32/64 environment)
  *
- * Given the nature of the shared data, not using a lock should be
- * of little consequence.
+ * The gamepad states are protected by a seqlock instead.
+ * (see xinput_gamepad_state_snapshot in xinput_service.h)
  */
 
 #define XINPUT_USES_SEMAPHORE_MUTEX 0 /* KEEP TO 0 */
 
-/**
- * Rumble queries are sent this way.
- * This feature can be disabled but then of course no rumble will be available.
- *
- * Looks like OSX is not fully POSIX so it will need a slightly different way.
- */
-
-#define XINPUT_USES_MQUEUE 1
-
 /**
  * Set to 0, the first instance of the DLL will double as a server
  * If the program containing the server stops, another instance will take
@@ -115,6 +192,57 @@
 
 #define XINPUT_IDLE_CLIENT_STRIKES  3
 
+/**
+ * The frames kept per slot in the history of the shared memory, for the
+ * clients polling slower than the gamepads report.
+ * A power of two: a client reading the history less often than this many
+ * frames loses the oldest ones.
+ */
+
+#define XINPUT_GAMEPAD_HISTORY_FRAMES 64
+
+/**
+ * The keystrokes kept per slot in the shared memory.
+ * A power of two: a client reading them less often loses the oldest ones.
+ */
+
+#define XINPUT_KEYSTROKE_QUEUE_SIZE 64
+
+/**
+ * A button held this long starts repeating, every period.
+ * See xinput_gamepad_set_keystroke_repeat.
+ */
+
+#define XINPUT_KEYSTROKE_REPEAT_DELAY_US    400000
+#define XINPUT_KEYSTROKE_REPEAT_PERIOD_US   100000
+
+/**
+ * The dead zones and response curves of the sticks and triggers, applied by
+ * the service.  See xinput_filter_settings_load for the format.
+ * The file is read again when it changes, at the probe period.
+ */
+
+#define XINPUT_FILTER_FILE "/etc/xinputd.conf"
+
+/**
+ * A stick or trigger moving by no more than its noise from its last published
+ * position is held there, so a resting pad does not publish new states.
+ * The noise is the fuzz of the device axis, or this much if it has none.
+ * See the noise setting of xinput_filter_settings_load.
+ */
+
+#define XINPUT_FILTER_NOISE_STICK   128
+#define XINPUT_FILTER_NOISE_TRIGGER 1
+
+/**
+ * Set to 1, the evdev axes with no fuzz are given the noise above as fuzz
+ * (EVIOCSABS), so the kernel drops the jitter before waking the service.
+ * The fuzz of the device is changed for all its readers, until it is
+ * plugged again.
+ */
+
+#define XINPUT_EVDEV_NOISE_FUZZ 0
+
 #if !HAVE_WINE
 #undef XINPUT_RUNDLL
 #define XINPUT_RUNDLL 0
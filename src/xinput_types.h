@@ -41,6 +41,7 @@ typedef uint16_t WORD;
 typedef int16_t SHORT;
 typedef uint32_t DWORD;
 typedef uint64_t DWORDLONG;
+typedef int64_t LONGLONG;
 typedef int16_t WCHAR;
 typedef int32_t BOOL;
 typedef unsigned int UINT;
@@ -0,0 +1,253 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Batch of states test.
+ *
+ * Checks the connected and changed slots of a batch, that a batch is left
+ * as it is while nothing is published, and that the slots not connected
+ * are zeroed.
+ *
+ * Then a writer thread publishes every slot in turn while a reader keeps
+ * copying batches: every state must be whole and the packet numbers must
+ * never go back; the batches mixing two rounds of the writer are only
+ * counted.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xinput_service.h"
+#include "tools.h"
+#include "xinput-check.h"
+
+static xinput_shared_gamepad_state* shared = NULL;
+static volatile int stop = 0;
+static int failures = 0;
+
+/**
+ * Publishes a state the way the service does.
+ */
+
+static void batch_publish(int slot, DWORD n, BOOL connected)
+{
+    xinput_gamepad_state* xgs = &shared->state[slot];
+
+    xinput_gamepad_state_write_begin(xgs);
+    xinput_check_gamepad_make(&xgs->gamepad, slot, n);
+    xgs->connected = connected;
+    xgs->dwPacketNumber = n;
+    xinput_gamepad_state_write_end(xgs);
+
+    __atomic_add_fetch(&shared->published, 1, __ATOMIC_SEQ_CST);
+}
+
+static void batch_expect(const char* name, const XINPUT_STATE_BATCH* batch, BOOL copied, BOOL expected_copied, DWORD connected, DWORD changed)
+{
+    if(copied != expected_copied)
+    {
+        printf("%s: %s instead of %s\n", name, copied?"copied":"kept", expected_copied?"copied":"kept");
+        ++failures;
+    }
+
+    if((batch->dwConnectedMask != connected) || (batch->dwChangedMask != changed))
+    {
+        printf("%s: connected %x changed %x instead of %x %x\n", name, batch->dwConnectedMask, batch->dwChangedMask, connected, changed);
+        ++failures;
+    }
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        XINPUT_GAMEPAD_EX expected;
+
+        if(connected & (1 << slot))
+        {
+            xinput_check_gamepad_make(&expected, slot, batch->States[slot].dwPacketNumber);
+        }
+        else
+        {
+            memset(&expected, 0, sizeof(expected));
+        }
+
+        if(memcmp(&batch->States[slot].Gamepad, &expected, sizeof(expected)) != 0)
+        {
+            printf("%s: wrong gamepad for slot %i, packet %u\n", name, slot, batch->States[slot].dwPacketNumber);
+            ++failures;
+        }
+    }
+}
+
+static void batch_check_masks(void)
+{
+    XINPUT_STATE_BATCH batch;
+    BOOL copied;
+
+    memset(&batch, 0, sizeof(batch));
+
+    copied = xinput_gamepad_states_snapshot(shared, &batch);
+    batch_expect("nothing published", &batch, copied, FALSE, 0, 0);
+
+    batch_publish(0, 1, TRUE);
+    batch_publish(2, 1, TRUE);
+
+    copied = xinput_gamepad_states_snapshot(shared, &batch);
+    batch_expect("two connected", &batch, copied, TRUE, 0x5, 0x5);
+
+    copied = xinput_gamepad_states_snapshot(shared, &batch);
+    batch_expect("no change", &batch, copied, FALSE, 0x5, 0);
+
+    batch_publish(2, 2, TRUE);
+
+    copied = xinput_gamepad_states_snapshot(shared, &batch);
+    batch_expect("one change", &batch, copied, TRUE, 0x5, 0x4);
+
+    batch_publish(0, 2, FALSE);
+
+    copied = xinput_gamepad_states_snapshot(shared, &batch);
+    batch_expect("one disconnected", &batch, copied, TRUE, 0x4, 0x1);
+
+    /* the counter moved, but no packet number did */
+
+    __atomic_add_fetch(&shared->published, 1, __ATOMIC_SEQ_CST);
+
+    copied = xinput_gamepad_states_snapshot(shared, &batch);
+    batch_expect("published but same packets", &batch, copied, TRUE, 0x4, 0);
+}
+
+static void batch_round(DWORD* n)
+{
+    ++*n;
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        batch_publish(slot, *n, TRUE);
+    }
+}
+
+static void batch_check_concurrent(void)
+{
+    XINPUT_STATE_BATCH batch;
+    xinput_check_writer writer;
+    int64_t start;
+    uint64_t batches = 0;
+    uint64_t kept = 0;
+    uint64_t mixed = 0;
+
+    memset(&batch, 0, sizeof(batch));
+
+    if(xinput_check_writer_start(&writer, &stop, batch_round, 2, 20) != 0)
+    {
+        printf("cannot create the writer thread\n");
+        ++failures;
+        return;
+    }
+
+    start = timeus();
+
+    while(timeus() - start < XINPUT_CHECK_DURATION_US)
+    {
+        DWORD previous[XUSER_MAX_COUNT];
+
+        for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+        {
+            previous[slot] = batch.States[slot].dwPacketNumber;
+        }
+
+        if(!xinput_gamepad_states_snapshot(shared, &batch))
+        {
+            ++kept;
+            continue;
+        }
+
+        ++batches;
+
+        for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+        {
+            if((batch.dwConnectedMask & (1 << slot)) == 0)
+            {
+                /* not published by the writer yet */
+                continue;
+            }
+
+            if(!xinput_check_gamepad_is(&batch.States[slot].Gamepad, slot, batch.States[slot].dwPacketNumber))
+            {
+                printf("slot %i: torn state at packet %u\n", slot, batch.States[slot].dwPacketNumber);
+                ++failures;
+            }
+
+            if((int32_t)(batch.States[slot].dwPacketNumber - previous[slot]) < 0)
+            {
+                printf("slot %i: packet %u after %u\n", slot, batch.States[slot].dwPacketNumber, previous[slot]);
+                ++failures;
+            }
+
+            if(batch.States[slot].dwPacketNumber != batch.States[0].dwPacketNumber)
+            {
+                ++mixed;
+                break;
+            }
+        }
+    }
+
+    xinput_check_writer_stop(&writer);
+
+    printf("%llu batches copied, %llu kept, %llu mixing two rounds\n",
+            (unsigned long long)batches, (unsigned long long)kept, (unsigned long long)mixed);
+
+    if(batches == 0)
+    {
+        printf("no batch has been copied\n");
+        ++failures;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    shared = (xinput_shared_gamepad_state*)calloc(1, sizeof(xinput_shared_gamepad_state));
+
+    if(shared == NULL)
+    {
+        printf("cannot allocate the shared memory\n");
+        return EXIT_FAILURE;
+    }
+
+    batch_check_masks();
+    batch_check_concurrent();
+
+    free(shared);
+
+    printf("%i failure(s)\n", failures);
+
+    return (failures == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
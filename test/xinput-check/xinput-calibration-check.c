@@ -0,0 +1,193 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Axis calibration test.
+ *
+ * Feeds the ranges gamepads commonly report through the calibration and
+ * checks that both ends land on the ends of the XInput ranges, that the flat
+ * zone gives 0 and that a trigger does not spill over its neighbour.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xinput.h"
+#include "linux_evdev/xinput_linux_evdev_translator.h"
+
+static int failures = 0;
+
+static void calibration_expect(const char* name, int32_t value, int32_t got, int32_t expected)
+{
+    if(got != expected)
+    {
+        printf("%s: %i gave %i instead of %i\n", name, value, got, expected);
+        ++failures;
+    }
+}
+
+static void calibration_setup(struct xinput_linux_evdev_translator_abs_translator* abs, int code, int32_t minimum, int32_t maximum, int32_t flat)
+{
+    struct input_absinfo absinfo;
+
+    memset(&absinfo, 0, sizeof(absinfo));
+    absinfo.minimum = minimum;
+    absinfo.maximum = maximum;
+    absinfo.flat = flat;
+
+    xinput_linux_evdev_translator_abs_calibrate(&abs->_item[code], &absinfo);
+}
+
+static void calibration_feed(struct xinput_linux_evdev_translator_abs_translator* abs, int code, int32_t value, XINPUT_GAMEPAD_EX* gamepad)
+{
+    struct input_event ie;
+
+    memset(&ie, 0, sizeof(ie));
+    ie.type = EV_ABS;
+    ie.code = code;
+    ie.value = value;
+
+    xinput_linux_evdev_translator_abs_input_event_to_gamepad(abs, &ie, gamepad);
+}
+
+static void calibration_check_stick(int32_t minimum, int32_t maximum, int32_t flat)
+{
+    struct xinput_linux_evdev_translator_abs_translator abs;
+    XINPUT_GAMEPAD_EX gamepad;
+    char name[64];
+
+    snprintf(name, sizeof(name), "stick [%i; %i] flat %i", minimum, maximum, flat);
+
+    memset(&abs, 0, sizeof(abs));
+    memset(&gamepad, 0, sizeof(gamepad));
+    XINPUT_GAMEPAD_ABS_SET_AXIS(&abs, ABS_X, sThumbLX);
+    XINPUT_GAMEPAD_ABS_SET_SIXA(&abs, ABS_Y, sThumbLY);
+    calibration_setup(&abs, ABS_X, minimum, maximum, flat);
+    calibration_setup(&abs, ABS_Y, minimum, maximum, flat);
+
+    calibration_feed(&abs, ABS_X, minimum, &gamepad);
+    calibration_feed(&abs, ABS_Y, minimum, &gamepad);
+    calibration_expect(name, minimum, gamepad.sThumbLX, -32768);
+    calibration_expect(name, minimum, gamepad.sThumbLY, 32767);
+
+    calibration_feed(&abs, ABS_X, maximum, &gamepad);
+    calibration_feed(&abs, ABS_Y, maximum, &gamepad);
+    calibration_expect(name, maximum, gamepad.sThumbLX, 32767);
+    calibration_expect(name, maximum, gamepad.sThumbLY, -32768);
+
+    /* out of range values are clamped */
+
+    if((maximum < INT32_MAX - 100) && (minimum > INT32_MIN + 100))
+    {
+        calibration_feed(&abs, ABS_X, maximum + 100, &gamepad);
+        calibration_expect(name, maximum + 100, gamepad.sThumbLX, 32767);
+        calibration_feed(&abs, ABS_X, minimum - 100, &gamepad);
+        calibration_expect(name, minimum - 100, gamepad.sThumbLX, -32768);
+    }
+
+    if(flat > 0)
+    {
+        int32_t center = minimum + (maximum - minimum) / 2;
+
+        calibration_feed(&abs, ABS_X, center + flat, &gamepad);
+        calibration_feed(&abs, ABS_Y, center - flat, &gamepad);
+        calibration_expect(name, center + flat, gamepad.sThumbLX, 0);
+        calibration_expect(name, center - flat, gamepad.sThumbLY, 0);
+    }
+}
+
+static void calibration_check_trigger(int32_t minimum, int32_t maximum)
+{
+    struct xinput_linux_evdev_translator_abs_translator abs;
+    XINPUT_GAMEPAD_EX gamepad;
+    char name[64];
+
+    snprintf(name, sizeof(name), "trigger [%i; %i]", minimum, maximum);
+
+    memset(&abs, 0, sizeof(abs));
+    memset(&gamepad, 0, sizeof(gamepad));
+    XINPUT_GAMEPAD_ABS_SET_TRIG(&abs, ABS_Z, bLeftTrigger);
+    calibration_setup(&abs, ABS_Z, minimum, maximum, 0);
+
+    gamepad.bRightTrigger = 42;
+
+    calibration_feed(&abs, ABS_Z, minimum, &gamepad);
+    calibration_expect(name, minimum, gamepad.bLeftTrigger, 0);
+
+    calibration_feed(&abs, ABS_Z, minimum + (maximum - minimum) / 2, &gamepad);
+    calibration_expect(name, minimum + (maximum - minimum) / 2, gamepad.bLeftTrigger, 127);
+
+    calibration_feed(&abs, ABS_Z, maximum, &gamepad);
+    calibration_expect(name, maximum, gamepad.bLeftTrigger, 255);
+
+    /* the neighbour is untouched */
+
+    calibration_expect(name, maximum, gamepad.bRightTrigger, 42);
+}
+
+int main(int argc, char** argv)
+{
+    XINPUT_GAMEPAD_EX gamepad;
+    (void)argc;
+    (void)argv;
+
+    calibration_check_stick(-32768, 32767, 0);
+    calibration_check_stick(-32768, 32767, 128);
+    calibration_check_stick(0, 255, 0);
+    calibration_check_stick(0, 255, 15);
+    calibration_check_stick(0, 1023, 0);
+    calibration_check_stick(-512, 511, 16);
+    calibration_check_stick(INT32_MIN, INT32_MAX, 0);
+
+    calibration_check_trigger(0, 255);
+    calibration_check_trigger(0, 1023);
+    calibration_check_trigger(-128, 127);
+
+    /* the static tables keep the xpad ranges: the values go through as they are */
+
+    XINPUT_GAMEPAD_ABS_BEGIN(xpad_abs)
+    XINPUT_GAMEPAD_ABS_AXIS(ABS_X, sThumbLX)
+    XINPUT_GAMEPAD_ABS_SIXA(ABS_Y, sThumbLY)
+    XINPUT_GAMEPAD_ABS_TRIG(ABS_Z, bLeftTrigger)
+    XINPUT_GAMEPAD_ABS_END(xpad_abs)
+
+    memset(&gamepad, 0, sizeof(gamepad));
+    calibration_feed(&xpad_abs, ABS_X, 1234, &gamepad);
+    calibration_feed(&xpad_abs, ABS_Y, 1234, &gamepad);
+    calibration_feed(&xpad_abs, ABS_Z, 200, &gamepad);
+    calibration_expect("xpad", 1234, gamepad.sThumbLX, 1234);
+    calibration_expect("xpad", 1234, gamepad.sThumbLY, ~1234);
+    calibration_expect("xpad", 200, gamepad.bLeftTrigger, 200);
+
+    printf("%i failure(s)\n", failures);
+
+    return (failures == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
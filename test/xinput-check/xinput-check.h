@@ -0,0 +1,123 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Fixture shared by the checks racing a writer against readers of the shared
+ * gamepad states.
+ */
+
+#ifndef XINPUT_CHECK_H
+#define XINPUT_CHECK_H
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xinput.h"
+
+#define XINPUT_CHECK_DURATION_US 1000000LL
+
+/**
+ * Makes the gamepad published as the packet n of a slot.
+ * Every field depends on n, so a copy mixing two packets matches neither.
+ */
+
+static inline void xinput_check_gamepad_make(XINPUT_GAMEPAD_EX* gamepad, int slot, DWORD n)
+{
+    gamepad->wButtons = (WORD)(n * 7 + slot);
+    gamepad->bLeftTrigger = (BYTE)n;
+    gamepad->bRightTrigger = (BYTE)~n;
+    gamepad->sThumbLX = (SHORT)n;
+    gamepad->sThumbLY = (SHORT)~n;
+    gamepad->sThumbRX = (SHORT)(n >> 3);
+    gamepad->sThumbRY = (SHORT)(n * 3 + slot * 1000);
+    gamepad->reserved = n;
+}
+
+static inline BOOL xinput_check_gamepad_is(const XINPUT_GAMEPAD_EX* gamepad, int slot, DWORD n)
+{
+    XINPUT_GAMEPAD_EX expected;
+
+    xinput_check_gamepad_make(&expected, slot, n);
+
+    return memcmp(gamepad, &expected, sizeof(expected)) == 0;
+}
+
+/**
+ * A thread calling round until *stop is set, pausing between two rounds.
+ * round moves the packet number n forward for every packet it publishes.
+ */
+
+struct xinput_check_writer
+{
+    pthread_t tid;
+    volatile int* stop;
+    void (*round)(DWORD* n);
+    DWORD n;
+    unsigned int pause_us;
+};
+
+typedef struct xinput_check_writer xinput_check_writer;
+
+static void* xinput_check_writer_thread(void* args)
+{
+    xinput_check_writer* writer = (xinput_check_writer*)args;
+
+    while(!*writer->stop)
+    {
+        writer->round(&writer->n);
+
+        if(writer->pause_us > 0)
+        {
+            usleep(writer->pause_us);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts the writer after the packet n.
+ * Returns 0 or the error of pthread_create.
+ */
+
+static inline int xinput_check_writer_start(xinput_check_writer* writer, volatile int* stop, void (*round)(DWORD* n), DWORD n, unsigned int pause_us)
+{
+    writer->stop = stop;
+    writer->round = round;
+    writer->n = n;
+    writer->pause_us = pause_us;
+
+    return pthread_create(&writer->tid, NULL, xinput_check_writer_thread, writer);
+}
+
+static inline void xinput_check_writer_stop(xinput_check_writer* writer)
+{
+    *writer->stop = 1;
+    pthread_join(writer->tid, NULL);
+}
+
+#endif /* XINPUT_CHECK_H */
@@ -0,0 +1,598 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Dead zones and curves test.
+ *
+ * Checks the default settings leave the gamepad as it is, then the radial
+ * and axial dead zones, the outer and anti dead zones, the curves and the
+ * triggers.
+ *
+ * Checks the noise gate holds the jitter of a resting stick, and counts the
+ * states an idle pad would publish with and without it.
+ *
+ * Then reads settings from a file, with a line for one slot only, checks a
+ * wrong line is refused, and that the service settings follow the file
+ * when it changes or disappears.
+ *
+ * Finally reloads the file over and over while another thread filters the
+ * frames of the service, which must always come out of one of the settings
+ * and never of a mix of both.
+ */
+
+#include "config.h"
+#include "xinput_settings.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "xinput_filter.h"
+
+static int failures = 0;
+
+static void filter_expect(const char* name, int value, int low, int high)
+{
+    if((value < low) || (value > high))
+    {
+        printf("%s: %i instead of [%i; %i]\n", name, value, low, high);
+        ++failures;
+    }
+}
+
+static void filter_stick(const xinput_filter* filter, SHORT x, SHORT y, SHORT* out_x, SHORT* out_y)
+{
+    XINPUT_GAMEPAD_EX gamepad;
+
+    memset(&gamepad, 0, sizeof(gamepad));
+    gamepad.sThumbLX = x;
+    gamepad.sThumbLY = y;
+    xinput_filter_apply(filter, &gamepad);
+    *out_x = gamepad.sThumbLX;
+    *out_y = gamepad.sThumbLY;
+}
+
+static void filter_check_identity(void)
+{
+    xinput_filter_settings settings;
+    xinput_filter filter;
+    uint32_t r = 1;
+
+    xinput_filter_settings_default(&settings);
+    xinput_filter_compile(&filter, &settings);
+
+    for(int i = 0; i < 10000; ++i)
+    {
+        XINPUT_GAMEPAD_EX gamepad;
+        XINPUT_GAMEPAD_EX filtered;
+
+        r = r * 1103515245 + 12345;
+        gamepad.wButtons = (WORD)r;
+        gamepad.bLeftTrigger = (BYTE)(r >> 8);
+        gamepad.bRightTrigger = (BYTE)(r >> 16);
+        gamepad.sThumbLX = (SHORT)(r >> 3);
+        gamepad.sThumbLY = (SHORT)(r >> 11);
+        gamepad.sThumbRX = (SHORT)(r >> 7);
+        gamepad.sThumbRY = (SHORT)(r >> 15);
+        gamepad.reserved = r;
+        filtered = gamepad;
+
+        xinput_filter_apply(&filter, &filtered);
+
+        if(memcmp(&gamepad, &filtered, sizeof(gamepad)) != 0)
+        {
+            printf("identity: the gamepad changed\n");
+            ++failures;
+            break;
+        }
+    }
+}
+
+static void filter_check_radial(void)
+{
+    xinput_filter_settings settings;
+    xinput_filter filter;
+    SHORT x;
+    SHORT y;
+    SHORT previous = 0;
+
+    xinput_filter_settings_default(&settings);
+    settings.stick[0].radial = TRUE;
+    settings.stick[0].deadzone = 8000;
+    settings.stick[0].outer = 30000;
+    xinput_filter_compile(&filter, &settings);
+
+    filter_stick(&filter, 5000, -6000, &x, &y);  /* 7810 from the center */
+    filter_expect("radial dead zone x", x, 0, 0);
+    filter_expect("radial dead zone y", y, 0, 0);
+
+    filter_stick(&filter, 30000, 0, &x, &y);
+    filter_expect("radial outer x", x, 32767, 32767);
+    filter_expect("radial outer y", y, 0, 0);
+
+    filter_stick(&filter, -32768, -32768, &x, &y);
+    filter_expect("radial diagonal x", x, -23200, -23140);
+    filter_expect("radial diagonal y", y, -23200, -23140);
+
+    filter_stick(&filter, 19000, 0, &x, &y);   /* half way */
+    filter_expect("radial linear", x, 16300, 16470);
+
+    for(int value = 8001; value <= 32767; value += 97)
+    {
+        filter_stick(&filter, 0, value, &x, &y);
+
+        if(y < previous)
+        {
+            printf("radial: %i gives %i, less than before (%i)\n", value, y, previous);
+            ++failures;
+            break;
+        }
+
+        previous = y;
+    }
+
+    /* the direction is kept */
+
+    filter_stick(&filter, 12000, 9000, &x, &y);
+    filter_expect("radial direction", (int)(((int64_t)x * 3) - ((int64_t)y * 4)), -8, 8);
+
+    /* anti dead zone and curve */
+
+    settings.stick[0].anti_deadzone = 6000;
+    settings.stick[0].curve = 2.0;
+    xinput_filter_compile(&filter, &settings);
+
+    filter_stick(&filter, 8010, 0, &x, &y);
+    filter_expect("anti dead zone", x, 6000, 6010);
+
+    filter_stick(&filter, 19000, 0, &x, &y);   /* 6000 + 26767 / 4 */
+    filter_expect("curve", x, 12600, 12780);
+}
+
+static void filter_check_axial(void)
+{
+    xinput_filter_settings settings;
+    xinput_filter filter;
+    SHORT x;
+    SHORT y;
+
+    xinput_filter_settings_default(&settings);
+    settings.stick[0].deadzone = 4000;
+    xinput_filter_compile(&filter, &settings);
+
+    filter_stick(&filter, 3999, -32768, &x, &y);
+    filter_expect("axial dead zone", x, 0, 0);
+    filter_expect("axial other axis", y, -32767, -32767);
+
+    filter_stick(&filter, -4001, 32767, &x, &y);
+    filter_expect("axial edge", x, -40, 0);
+    filter_expect("axial full", y, 32767, 32767);
+}
+
+static void filter_check_triggers(void)
+{
+    xinput_filter_settings settings;
+    xinput_filter filter;
+    XINPUT_GAMEPAD_EX gamepad;
+
+    xinput_filter_settings_default(&settings);
+    settings.trigger[0].deadzone = 30;
+    settings.trigger[1].outer = 200;
+    xinput_filter_compile(&filter, &settings);
+
+    memset(&gamepad, 0, sizeof(gamepad));
+    gamepad.bLeftTrigger = 30;
+    gamepad.bRightTrigger = 200;
+    xinput_filter_apply(&filter, &gamepad);
+    filter_expect("trigger dead zone", gamepad.bLeftTrigger, 0, 0);
+    filter_expect("trigger outer", gamepad.bRightTrigger, 255, 255);
+
+    gamepad.bLeftTrigger = 255;
+    gamepad.bRightTrigger = 100;
+    xinput_filter_apply(&filter, &gamepad);
+    filter_expect("trigger full", gamepad.bLeftTrigger, 255, 255);
+    filter_expect("trigger middle", gamepad.bRightTrigger, 127, 128);
+}
+
+static int filter_file_write(const char* path, const char* text, time_t mtime)
+{
+    struct timespec times[2];
+    FILE* f;
+
+    if((f = fopen(path, "w")) == NULL)
+    {
+        return errno;
+    }
+
+    fputs(text, f);
+    fclose(f);
+
+    /* the file must look changed, even within the same second */
+
+    times[0].tv_sec = mtime;
+    times[0].tv_nsec = 0;
+    times[1] = times[0];
+
+    return (utimensat(AT_FDCWD, path, times, 0) == 0)?0:errno;
+}
+
+#define GATE_IDLE_FRAMES 1000
+
+static void filter_check_gate(void)
+{
+    xinput_filter_settings settings;
+    xinput_filter filter;
+    xinput_filter_gate gate;
+    xinput_gamepad_device_noise noise;
+    XINPUT_GAMEPAD_EX gamepad;
+    XINPUT_GAMEPAD_EX previous_raw;
+    XINPUT_GAMEPAD_EX previous;
+    uint32_t seed = 1;
+    int changes = 0;
+    int published = 0;
+
+    memset(&noise, 0, sizeof(noise));
+    noise.thumb[0] = 16;
+    noise.thumb[1] = 16;
+
+    xinput_filter_settings_default(&settings);
+    xinput_filter_compile(&filter, &settings);
+    xinput_filter_gate_init(&gate, &noise);
+    xinput_filter_gate_set(&gate, &filter);
+
+    filter_expect("gate device noise", gate.noise[XINPUT_FILTER_GATE_LX], 16, 16);
+    filter_expect("gate default noise", gate.noise[XINPUT_FILTER_GATE_RX], XINPUT_FILTER_NOISE_STICK, XINPUT_FILTER_NOISE_STICK);
+    filter_expect("gate trigger noise", gate.noise[XINPUT_FILTER_GATE_LT], XINPUT_FILTER_NOISE_TRIGGER, XINPUT_FILTER_NOISE_TRIGGER);
+
+    /* sticks resting off center, jittering by less than their noise */
+
+    memset(&previous_raw, 0, sizeof(previous_raw));
+    memset(&previous, 0, sizeof(previous));
+
+    for(int n = 0; n < GATE_IDLE_FRAMES; ++n)
+    {
+        XINPUT_GAMEPAD_EX raw;
+
+        memset(&gamepad, 0, sizeof(gamepad));
+        seed = seed * 1103515245 + 12345;
+        gamepad.sThumbLX = 3000 + (int)((seed >> 16) % 17) - 8;
+        seed = seed * 1103515245 + 12345;
+        gamepad.sThumbLY = -2000 + (int)((seed >> 16) % 17) - 8;
+        seed = seed * 1103515245 + 12345;
+        gamepad.sThumbRX = 500 + (int)((seed >> 16) % 121) - 60;
+        raw = gamepad;
+
+        xinput_filter_gate_apply(&gate, &gamepad);
+
+        changes += memcmp(&raw, &previous_raw, sizeof(raw)) != 0;
+        published += memcmp(&gamepad, &previous, sizeof(gamepad)) != 0;
+        previous_raw = raw;
+        previous = gamepad;
+    }
+
+    printf("idle pad: %i states changed in %i frames, %i published through the gate\n", changes, GATE_IDLE_FRAMES, published);
+
+    filter_expect("gate idle publications", published, 1, 1);
+
+    /* moving further than the noise gets through */
+
+    gamepad.sThumbLX = 3100;
+    filter_expect("gate moving", xinput_filter_gate_apply(&gate, &gamepad), FALSE, FALSE);
+    filter_expect("gate moved", gamepad.sThumbLX, 3100, 3100);
+    gamepad.sThumbLX = 3110;
+    filter_expect("gate jitter", xinput_filter_gate_apply(&gate, &gamepad), TRUE, TRUE);
+    filter_expect("gate held", gamepad.sThumbLX, 3100, 3100);
+
+    /* the rest and the ends always get through */
+
+    gamepad.sThumbLX = 0;
+    xinput_filter_gate_apply(&gate, &gamepad);
+    filter_expect("gate rest", gamepad.sThumbLX, 0, 0);
+    gamepad.sThumbLX = 8;
+    xinput_filter_gate_apply(&gate, &gamepad);
+    filter_expect("gate held at rest", gamepad.sThumbLX, 0, 0);
+    gamepad.sThumbLX = 32755;
+    xinput_filter_gate_apply(&gate, &gamepad);
+    gamepad.sThumbLX = 32767;
+    xinput_filter_gate_apply(&gate, &gamepad);
+    filter_expect("gate end", gamepad.sThumbLX, 32767, 32767);
+    gamepad.bLeftTrigger = 254;
+    xinput_filter_gate_apply(&gate, &gamepad);
+    gamepad.bLeftTrigger = 255;
+    xinput_filter_gate_apply(&gate, &gamepad);
+    filter_expect("gate trigger end", gamepad.bLeftTrigger, 255, 255);
+
+    /* a noise of 0 lets everything through */
+
+    settings.stick[0].noise = 0;
+    xinput_filter_compile(&filter, &settings);
+    xinput_filter_gate_set(&gate, &filter);
+    gamepad.sThumbLX = 1000;
+    xinput_filter_gate_apply(&gate, &gamepad);
+    gamepad.sThumbLX = 1001;
+    filter_expect("gate disabled", xinput_filter_gate_apply(&gate, &gamepad), FALSE, FALSE);
+    filter_expect("gate disabled value", gamepad.sThumbLX, 1001, 1001);
+}
+
+static void filter_check_file(void)
+{
+    xinput_filter_settings settings[XUSER_MAX_COUNT];
+    XINPUT_GAMEPAD_EX gamepad;
+    char path[] = "/tmp/xinput-filter-check-XXXXXX";
+    int fd;
+    int ret;
+
+    if((fd = mkstemp(path)) < 0)
+    {
+        printf("cannot create a file\n");
+        ++failures;
+        return;
+    }
+
+    close(fd);
+
+    filter_file_write(path,
+            "# every slot\n"
+            "sticks.deadzone = 7849   # the usual one\n"
+            "right.mode = radial\n"
+            "\n"
+            "triggers.deadzone = 30\n"
+            "2.left.curve = 1.5\n"
+            "2.left_trigger.anti_deadzone = 0x10\n"
+            "left.noise = 0\n"
+            "right.noise = 200\n", 1000000000);
+
+    if((ret = xinput_filter_settings_load(path, settings)) != 0)
+    {
+        printf("load: %s\n", strerror(ret));
+        ++failures;
+    }
+    else
+    {
+        for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+        {
+            filter_expect("file left dead zone", settings[slot].stick[0].deadzone, 7849, 7849);
+            filter_expect("file right dead zone", settings[slot].stick[1].deadzone, 7849, 7849);
+            filter_expect("file left mode", settings[slot].stick[0].radial, FALSE, FALSE);
+            filter_expect("file right mode", settings[slot].stick[1].radial, TRUE, TRUE);
+            filter_expect("file trigger dead zone", settings[slot].trigger[1].deadzone, 30, 30);
+            filter_expect("file curve", (int)(settings[slot].stick[0].curve * 10), (slot == 2)?15:10, (slot == 2)?15:10);
+            filter_expect("file anti dead zone", settings[slot].trigger[0].anti_deadzone, (slot == 2)?16:0, (slot == 2)?16:0);
+            filter_expect("file outer", settings[slot].stick[0].outer, 32767, 32767);
+            filter_expect("file left noise", settings[slot].stick[0].noise, 0, 0);
+            filter_expect("file right noise", settings[slot].stick[1].noise, 200, 200);
+            filter_expect("file trigger noise", settings[slot].trigger[0].noise, XINPUT_FILTER_NOISE_DEVICE, XINPUT_FILTER_NOISE_DEVICE);
+        }
+    }
+
+    filter_file_write(path, "sticks.deadzone = 7849\nleft.wobble = 3\n", 1000000001);
+
+    if(xinput_filter_settings_load(path, settings) != EINVAL)
+    {
+        printf("load: a wrong line has been accepted\n");
+        ++failures;
+    }
+
+    filter_file_write(path, "9.left.deadzone = 100\n", 1000000002);
+
+    if(xinput_filter_settings_load(path, settings) != EINVAL)
+    {
+        printf("load: a wrong slot has been accepted\n");
+        ++failures;
+    }
+
+    /* the settings of the service follow the file */
+
+    filter_file_write(path, "1.left_trigger.deadzone = 100\n", 1000000003);
+
+    if((ret = xinput_filter_set_file(path)) != 0)
+    {
+        printf("set file: %s\n", strerror(ret));
+        ++failures;
+    }
+
+    memset(&gamepad, 0, sizeof(gamepad));
+    gamepad.bLeftTrigger = 90;
+    xinput_filter_gamepad(1, &gamepad);
+    filter_expect("service dead zone", gamepad.bLeftTrigger, 0, 0);
+    gamepad.bLeftTrigger = 90;
+    xinput_filter_gamepad(0, &gamepad);
+    filter_expect("service other slot", gamepad.bLeftTrigger, 90, 90);
+
+    if(xinput_filter_reload())
+    {
+        printf("reload: nothing changed but the settings did\n");
+        ++failures;
+    }
+
+    filter_file_write(path, "1.left_trigger.deadzone = 50\n", 1000000004);
+
+    if(!xinput_filter_reload())
+    {
+        printf("reload: the change has not been seen\n");
+        ++failures;
+    }
+
+    gamepad.bLeftTrigger = 90;
+    xinput_filter_gamepad(1, &gamepad);
+    filter_expect("service reloaded", gamepad.bLeftTrigger, 1, 89);
+
+    unlink(path);
+
+    if(!xinput_filter_reload())
+    {
+        printf("reload: the removal has not been seen\n");
+        ++failures;
+    }
+
+    gamepad.bLeftTrigger = 90;
+    xinput_filter_gamepad(1, &gamepad);
+    filter_expect("service without file", gamepad.bLeftTrigger, 90, 90);
+
+    xinput_filter_set_file(NULL);
+}
+
+#define RELOAD_COUNT 2000
+
+/*
+ * The two settings reloaded in turn: the dead zone of one equals the outer
+ * dead zone of the other, a mix of both would divide by zero.
+ */
+
+static const char* const filter_reload_text[2] =
+{
+    "sticks.mode = axial\nsticks.deadzone = 10000\nsticks.outer = 20000\ntriggers.deadzone = 20\ntriggers.outer = 100\n",
+    "sticks.mode = axial\nsticks.deadzone = 20000\nsticks.outer = 30000\ntriggers.deadzone = 100\ntriggers.outer = 200\n"
+};
+
+static XINPUT_GAMEPAD_EX filter_reload_input;
+static XINPUT_GAMEPAD_EX filter_reload_expected[2];
+static volatile int filter_reload_stop = 0;
+static volatile int filter_reload_mixed = 0;
+static volatile int filter_reload_frames = 0;
+
+static void* filter_reload_reader_thread(void* args)
+{
+    (void)args;
+
+    while(!__atomic_load_n(&filter_reload_stop, __ATOMIC_ACQUIRE))
+    {
+        XINPUT_GAMEPAD_EX gamepad = filter_reload_input;
+
+        xinput_filter_gamepad(0, &gamepad);
+
+        if((memcmp(&gamepad, &filter_reload_expected[0], sizeof(gamepad)) != 0) &&
+           (memcmp(&gamepad, &filter_reload_expected[1], sizeof(gamepad)) != 0))
+        {
+            ++filter_reload_mixed;
+        }
+
+        ++filter_reload_frames;
+    }
+
+    return NULL;
+}
+
+static void filter_check_reload_race(void)
+{
+    char path[] = "/tmp/xinput-filter-check-XXXXXX";
+    pthread_t tid;
+    int fd;
+    int ret;
+
+    if((fd = mkstemp(path)) < 0)
+    {
+        printf("cannot create a file\n");
+        ++failures;
+        return;
+    }
+
+    close(fd);
+
+    memset(&filter_reload_input, 0, sizeof(filter_reload_input));
+    filter_reload_input.sThumbLX = 25000;
+    filter_reload_input.sThumbLY = -15000;
+    filter_reload_input.bLeftTrigger = 150;
+    filter_reload_input.bRightTrigger = 60;
+
+    /* what each of the settings makes of the frame */
+
+    for(int i = 0; i < 2; ++i)
+    {
+        xinput_filter_settings settings[XUSER_MAX_COUNT];
+        xinput_filter filter;
+
+        filter_file_write(path, filter_reload_text[i], 1000000100 + i);
+
+        if((ret = xinput_filter_settings_load(path, settings)) != 0)
+        {
+            printf("reload load: %s\n", strerror(ret));
+            ++failures;
+            unlink(path);
+            return;
+        }
+
+        xinput_filter_compile(&filter, &settings[0]);
+        filter_reload_expected[i] = filter_reload_input;
+        xinput_filter_apply(&filter, &filter_reload_expected[i]);
+    }
+
+    if(xinput_filter_set_file(path) != 0)
+    {
+        printf("reload set file failed\n");
+        ++failures;
+        unlink(path);
+        return;
+    }
+
+    if((ret = pthread_create(&tid, NULL, filter_reload_reader_thread, NULL)) != 0)
+    {
+        printf("pthread_create: %s\n", strerror(ret));
+        ++failures;
+        xinput_filter_set_file(NULL);
+        unlink(path);
+        return;
+    }
+
+    for(int i = 0; i < RELOAD_COUNT; ++i)
+    {
+        filter_file_write(path, filter_reload_text[i & 1], 1000000200 + i);
+        xinput_filter_reload();
+    }
+
+    __atomic_store_n(&filter_reload_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(tid, NULL);
+
+    printf("%i frames filtered during %i reloads\n", filter_reload_frames, RELOAD_COUNT);
+
+    filter_expect("frames filtered with mixed settings", filter_reload_mixed, 0, 0);
+
+    xinput_filter_set_file(NULL);
+    unlink(path);
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    filter_check_identity();
+    filter_check_radial();
+    filter_check_axial();
+    filter_check_triggers();
+    filter_check_gate();
+    filter_check_file();
+    filter_check_reload_race();
+
+    printf("%i failure(s)\n", failures);
+
+    return (failures == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
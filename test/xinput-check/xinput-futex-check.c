@@ -0,0 +1,138 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Futex wait/wake test.
+ *
+ * A child process waits on a word of shared memory the way clients wait for
+ * the next state: it must time out when nothing is published and wake up
+ * promptly when the parent publishes.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "xinput.h"
+#include "tools.h"
+#include "xinput_service.h"
+
+#define TIMEOUT_US 50000LL
+#define WAKE_MAX_US 100000LL
+
+static xinput_shared_gamepad_state* shared = NULL;
+
+static int futex_waiter(void)
+{
+    uint32_t published = __atomic_load_n(&shared->published, __ATOMIC_SEQ_CST);
+    int64_t start = timeus();
+    int64_t elapsed;
+    int err;
+
+    /* nothing is published yet: it times out */
+
+    err = futex_wait_us(&shared->published, published, TIMEOUT_US);
+    elapsed = timeus() - start;
+
+    printf("timed out: %s after %lli us\n", strerror(err), (long long)elapsed);
+
+    if((err != ETIMEDOUT) || (elapsed < TIMEOUT_US / 2))
+    {
+        return EXIT_FAILURE;
+    }
+
+    /* tell the parent to publish, then wait for it */
+
+    __atomic_add_fetch(&shared->published_waiters, 1, __ATOMIC_SEQ_CST);
+
+    while(__atomic_load_n(&shared->published, __ATOMIC_SEQ_CST) == published)
+    {
+        futex_wait_us(&shared->published, published, WAKE_MAX_US * 10);
+    }
+
+    elapsed = timeus() - __atomic_load_n(&shared->poke_us, __ATOMIC_SEQ_CST);
+
+    printf("woken up %lli us after the publish\n", (long long)elapsed);
+
+    return (elapsed < WAKE_MAX_US)?EXIT_SUCCESS:EXIT_FAILURE;
+}
+
+int main(int argc, char** argv)
+{
+    pid_t pid;
+    int status;
+    (void)argc;
+    (void)argv;
+
+    shared = (xinput_shared_gamepad_state*)mmap(NULL, sizeof(xinput_shared_gamepad_state), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+
+    if(shared == MAP_FAILED)
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    memset(shared, 0, sizeof(xinput_shared_gamepad_state));
+
+    if((pid = fork()) == 0)
+    {
+        int ret = futex_waiter();
+        fflush(stdout);
+        _exit(ret);
+    }
+    else if(pid < 0)
+    {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+
+    while(__atomic_load_n(&shared->published_waiters, __ATOMIC_SEQ_CST) == 0)
+    {
+        usleep(1000);
+    }
+
+    /* give it time to go to sleep */
+
+    usleep(10000);
+
+    __atomic_store_n(&shared->poke_us, timeus(), __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&shared->published, 1, __ATOMIC_SEQ_CST);
+    futex_wake_all(&shared->published);
+
+    if(waitpid(pid, &status, 0) < 0)
+    {
+        perror("waitpid");
+        return EXIT_FAILURE;
+    }
+
+    return (WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS))?EXIT_SUCCESS:EXIT_FAILURE;
+}
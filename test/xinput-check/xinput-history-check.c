@@ -0,0 +1,211 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Gamepad history test.
+ *
+ * Checks that the history returns the frames after a packet number in order,
+ * that it only goes XINPUT_GAMEPAD_HISTORY_FRAMES back and that a short
+ * buffer gets the oldest frames first.
+ *
+ * Then a writer thread pushes bursts of frames while a reader keeps
+ * reading what is new: every frame read must be whole and the packet numbers
+ * must keep increasing; the frames lost when the reader falls behind are
+ * only counted.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xinput_service.h"
+#include "tools.h"
+#include "xinput-check.h"
+
+#define SLOT 2
+
+static xinput_shared_gamepad_state* shared = NULL;
+static volatile int stop = 0;
+static int failures = 0;
+
+static BOOL history_frame_check(const xinput_gamepad_history_frame* frame)
+{
+    return xinput_check_gamepad_is(&frame->gamepad, SLOT, frame->dwPacketNumber) &&
+           (frame->event_us == (int64_t)frame->dwPacketNumber * 1000) &&
+           (frame->publish_us == (int64_t)frame->dwPacketNumber * 1000 + 1);
+}
+
+static void history_push(DWORD n)
+{
+    XINPUT_GAMEPAD_EX gamepad;
+
+    xinput_check_gamepad_make(&gamepad, SLOT, n);
+    xinput_gamepad_history_push(shared, SLOT, &gamepad, n, (int64_t)n * 1000, (int64_t)n * 1000 + 1);
+}
+
+static void history_expect(const char* name, DWORD since, DWORD count, DWORD first, DWORD expected_count)
+{
+    xinput_gamepad_history_frame frames[XINPUT_GAMEPAD_HISTORY_FRAMES];
+    DWORD copied = xinput_gamepad_history_read(shared, SLOT, since, frames, count);
+
+    if(copied != expected_count)
+    {
+        printf("%s: %u frames instead of %u\n", name, copied, expected_count);
+        ++failures;
+        return;
+    }
+
+    for(DWORD i = 0; i < copied; ++i)
+    {
+        if((frames[i].dwPacketNumber != first + i) || !history_frame_check(&frames[i]))
+        {
+            printf("%s: frame %u is packet %u instead of %u\n", name, i, frames[i].dwPacketNumber, first + i);
+            ++failures;
+            return;
+        }
+    }
+}
+
+static void history_round(DWORD* n)
+{
+    /* bursts faster than any device, so the reader sometimes falls behind */
+
+    for(int burst = 0; burst < XINPUT_GAMEPAD_HISTORY_FRAMES / 2; ++burst)
+    {
+        history_push(++*n);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    xinput_gamepad_history_frame frames[XINPUT_GAMEPAD_HISTORY_FRAMES];
+    xinput_check_writer writer;
+    DWORD n = 0;
+    DWORD since;
+    int64_t start;
+    int64_t reads = 0;
+    int64_t frames_read = 0;
+    int64_t lost = 0;
+    int ret;
+
+    (void)argc;
+    (void)argv;
+
+    shared = (xinput_shared_gamepad_state*)calloc(1, sizeof(xinput_shared_gamepad_state));
+
+    /* in order, from the packet after since */
+
+    history_expect("empty", 0, XINPUT_GAMEPAD_HISTORY_FRAMES, 1, 0);
+
+    while(n < 10)
+    {
+        history_push(++n);
+    }
+
+    history_expect("first frames", 0, XINPUT_GAMEPAD_HISTORY_FRAMES, 1, 10);
+    history_expect("up to date", 10, XINPUT_GAMEPAD_HISTORY_FRAMES, 11, 0);
+    history_expect("last frames", 7, XINPUT_GAMEPAD_HISTORY_FRAMES, 8, 3);
+
+    /* not further back than the ring */
+
+    while(n < 10 + XINPUT_GAMEPAD_HISTORY_FRAMES + 36)
+    {
+        history_push(++n);
+    }
+
+    history_expect("overwritten", 10, XINPUT_GAMEPAD_HISTORY_FRAMES, n - XINPUT_GAMEPAD_HISTORY_FRAMES + 1, XINPUT_GAMEPAD_HISTORY_FRAMES);
+
+    /* the oldest first when the buffer is short */
+
+    history_expect("short buffer", n - 20, 5, n - 19, 5);
+
+    /* a packet number from before a restart of the service */
+
+    history_expect("from the future", n + 1000, XINPUT_GAMEPAD_HISTORY_FRAMES, n - XINPUT_GAMEPAD_HISTORY_FRAMES + 1, XINPUT_GAMEPAD_HISTORY_FRAMES);
+
+    /* concurrently */
+
+    if((ret = xinput_check_writer_start(&writer, &stop, history_round, n, 50)) != 0)
+    {
+        printf("pthread_create: %s\n", strerror(ret));
+        return EXIT_FAILURE;
+    }
+
+    since = n;
+    start = timeus();
+
+    while(timeus() - start < XINPUT_CHECK_DURATION_US)
+    {
+        DWORD copied = xinput_gamepad_history_read(shared, SLOT, since, frames, XINPUT_GAMEPAD_HISTORY_FRAMES);
+
+        ++reads;
+
+        for(DWORD i = 0; i < copied; ++i)
+        {
+            if(!history_frame_check(&frames[i]))
+            {
+                printf("torn frame %u\n", frames[i].dwPacketNumber);
+                ++failures;
+            }
+
+            if((int32_t)(frames[i].dwPacketNumber - since) <= 0)
+            {
+                printf("packet %u after %u\n", frames[i].dwPacketNumber, since);
+                ++failures;
+            }
+
+            lost += frames[i].dwPacketNumber - since - 1;
+            since = frames[i].dwPacketNumber;
+        }
+
+        frames_read += copied;
+
+        if(failures > 10)
+        {
+            break;
+        }
+    }
+
+    xinput_check_writer_stop(&writer);
+
+    printf("%lli reads, %lli frames read, %lli lost while behind\n", (long long)reads, (long long)frames_read, (long long)lost);
+
+    if(frames_read == 0)
+    {
+        printf("nothing read\n");
+        ++failures;
+    }
+
+    free(shared);
+
+    printf("%i failure(s)\n", failures);
+
+    return (failures == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
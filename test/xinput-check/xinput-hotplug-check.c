@@ -0,0 +1,256 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Hotplug detection test.
+ *
+ * Plays the role of udev in a temporary directory: creates the device
+ * directory after the watch has been set, then adds nodes to it and checks
+ * that only the joystick ones are reported, each within 100ms.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "xinput.h"
+#include "tools.h"
+#include "linux_evdev/xinput_linux_evdev_hotplug.h"
+
+#define EVENT_JOYSTICK "-event-joystick"
+#define LATENCY_MAX_MS 100
+
+struct hotplug_found
+{
+    int count;
+    char last[PATH_MAX];
+};
+
+typedef struct hotplug_found hotplug_found;
+
+static char root[PATH_MAX];
+static char directory[PATH_MAX];
+static int failures = 0;
+static int64_t created_us = 0;
+
+/**
+ * Makes the path of an entry of a directory.
+ *
+ * @return 0, or ENAMETOOLONG, counted as a failure
+ */
+
+static int hotplug_path(char* path, size_t size, const char* parent, const char* name)
+{
+    int n = snprintf(path, size, "%s/%s", parent, name);
+
+    if((n < 0) || ((size_t)n >= size))
+    {
+        fprintf(stderr, "%s/%s: path too long\n", parent, name);
+        ++failures;
+        return ENAMETOOLONG;
+    }
+
+    return 0;
+}
+
+static void hotplug_callback(const char* path, void* args)
+{
+    hotplug_found* found = (hotplug_found*)args;
+
+    ++found->count;
+    strncpy(found->last, path, sizeof(found->last) - 1);
+}
+
+static void hotplug_touch(const char* name)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    if(hotplug_path(path, sizeof(path), directory, name) != 0)
+    {
+        return;
+    }
+
+    created_us = timeus();
+
+    if((fd = open(path, O_CREAT|O_WRONLY, 0600)) >= 0)
+    {
+        close(fd);
+    }
+    else
+    {
+        perror(path);
+        ++failures;
+    }
+}
+
+/**
+ * Waits for the watcher to be readable then collects what it reports.
+ */
+
+static void hotplug_expect(xinput_linux_evdev_hotplug* hotplug, const char* name, int expected_count)
+{
+    struct pollfd pfd = {hotplug->fd, POLLIN, 0};
+    hotplug_found found;
+    char path[PATH_MAX];
+    int64_t latency;
+    int err;
+
+    memset(&found, 0, sizeof(found));
+
+    if(poll(&pfd, 1, (expected_count > 0)?LATENCY_MAX_MS:10) < 0)
+    {
+        perror("poll");
+    }
+
+    if((err = xinput_linux_evdev_hotplug_read(hotplug, hotplug_callback, &found)) != 0)
+    {
+        fprintf(stderr, "read: %s\n", strerror(err));
+        ++failures;
+    }
+
+    latency = timeus() - created_us;
+
+    if(found.count != expected_count)
+    {
+        fprintf(stderr, "%s: %i reported, %i expected\n", name, found.count, expected_count);
+        ++failures;
+        return;
+    }
+
+    if(expected_count == 0)
+    {
+        printf("%s: ignored\n", name);
+        return;
+    }
+
+    if(hotplug_path(path, sizeof(path), directory, name) != 0)
+    {
+        return;
+    }
+
+    if(strcmp(found.last, path) != 0)
+    {
+        fprintf(stderr, "%s: reported as %s\n", name, found.last);
+        ++failures;
+    }
+
+    printf("%s: reported after %lli us\n", name, (long long)latency);
+
+    if(latency > LATENCY_MAX_MS * 1000LL)
+    {
+        ++failures;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    xinput_linux_evdev_hotplug hotplug;
+    char from[PATH_MAX];
+    char to[PATH_MAX];
+    int err;
+    (void)argc;
+    (void)argv;
+
+    if(hotplug_path(root, sizeof(root), (getenv("TMPDIR") != NULL)?getenv("TMPDIR"):"/tmp", "xinput-hotplug-XXXXXX") != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    if(mkdtemp(root) == NULL)
+    {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    if(hotplug_path(directory, sizeof(directory), root, "by-path") != 0)
+    {
+        rmdir(root);
+        return EXIT_FAILURE;
+    }
+
+    /* the directory does not exist yet: its parent is watched */
+
+    if((err = xinput_linux_evdev_hotplug_open(&hotplug, directory, EVENT_JOYSTICK)) != 0)
+    {
+        fprintf(stderr, "open: %s\n", strerror(err));
+        rmdir(root);
+        return (err == ENOSYS)?77:EXIT_FAILURE;
+    }
+
+    /* nodes created along with the directory are found by the rescan */
+
+    mkdir(directory, 0700);
+    hotplug_touch("pci-0000:00:14.0-usb-0:1:1.0-event-joystick");
+    hotplug_expect(&hotplug, "pci-0000:00:14.0-usb-0:1:1.0-event-joystick", 1);
+
+    hotplug_touch("pci-0000:00:14.0-usb-0:2:1.0-event-kbd");
+    hotplug_expect(&hotplug, "pci-0000:00:14.0-usb-0:2:1.0-event-kbd", 0);
+
+    hotplug_touch("pci-0000:00:14.0-usb-0:3:1.0-event-joystick");
+    hotplug_expect(&hotplug, "pci-0000:00:14.0-usb-0:3:1.0-event-joystick", 1);
+
+    /* links are usually renamed into place */
+
+    hotplug_path(from, sizeof(from), directory, "pci-0000:00:14.0-usb-0:2:1.0-event-kbd");
+    hotplug_path(to, sizeof(to), directory, "pci-0000:00:14.0-usb-0:4:1.0-event-joystick");
+    created_us = timeus();
+    rename(from, to);
+    hotplug_expect(&hotplug, "pci-0000:00:14.0-usb-0:4:1.0-event-joystick", 1);
+
+    /* the directory goes away with the last device and comes back later */
+
+    unlink(to);
+    hotplug_path(to, sizeof(to), directory, "pci-0000:00:14.0-usb-0:1:1.0-event-joystick");
+    unlink(to);
+    hotplug_path(to, sizeof(to), directory, "pci-0000:00:14.0-usb-0:3:1.0-event-joystick");
+    unlink(to);
+    rmdir(directory);
+    hotplug_expect(&hotplug, "by-path", 0);
+
+    mkdir(directory, 0700);
+    hotplug_touch("pci-0000:00:14.0-usb-0:5:1.0-event-joystick");
+    hotplug_expect(&hotplug, "pci-0000:00:14.0-usb-0:5:1.0-event-joystick", 1);
+
+    xinput_linux_evdev_hotplug_close(&hotplug);
+
+    unlink(to);
+    hotplug_path(to, sizeof(to), directory, "pci-0000:00:14.0-usb-0:5:1.0-event-joystick");
+    unlink(to);
+    rmdir(directory);
+    rmdir(root);
+
+    printf("%i failures\n", failures);
+
+    return (failures == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
@@ -0,0 +1,329 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Keystroke benchmark.
+ *
+ * Runs the same frames of four slots, shaped like what a player does (sticks
+ * moving every frame, buttons and triggers now and then), through two ways
+ * of making the keystrokes of a frame:
+ *
+ *  - the buttons with the thumbs and triggers as buttons, and a walk of the
+ *    33 keys with a mask compare each (what the service did before),
+ *  - the keys word of xinput_gamepad_keys, its changes iterated with ctz.
+ *
+ * The two must queue the same keystrokes for every frame.
+ * The time they take per frame is reported, but does not fail the test.
+ *
+ * Usage: xinput-keystroke-bench [repeats]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "xinput_service.h"
+#include "xinput_gamepad.h"
+#include "tools.h"
+
+#define BENCH_FRAMES 16384
+#define REPEATS_DEFAULT 8
+#define BENCH_ROUNDS 5
+
+struct bench_mask_to_vk
+{
+    DWORD bits;
+    DWORD mask;
+    WORD value;
+};
+
+static const struct bench_mask_to_vk bench_vk_button[] =
+{
+    {XINPUT_GAMEPAD_DPAD_UP, XINPUT_GAMEPAD_DPAD_UP, VK_PAD_DPAD_UP},
+    {XINPUT_GAMEPAD_DPAD_DOWN, XINPUT_GAMEPAD_DPAD_DOWN, VK_PAD_DPAD_DOWN},
+    {XINPUT_GAMEPAD_DPAD_LEFT, XINPUT_GAMEPAD_DPAD_LEFT, VK_PAD_DPAD_LEFT},
+    {XINPUT_GAMEPAD_DPAD_RIGHT, XINPUT_GAMEPAD_DPAD_RIGHT, VK_PAD_DPAD_RIGHT},
+    {XINPUT_GAMEPAD_START, XINPUT_GAMEPAD_START, VK_PAD_START},
+    {XINPUT_GAMEPAD_BACK, XINPUT_GAMEPAD_BACK, VK_PAD_BACK},
+    {XINPUT_GAMEPAD_LEFT_THUMB, XINPUT_GAMEPAD_LEFT_THUMB, VK_PAD_LTHUMB_PRESS},
+    {XINPUT_GAMEPAD_RIGHT_THUMB, XINPUT_GAMEPAD_RIGHT_THUMB, VK_PAD_RTHUMB_PRESS},
+    {XINPUT_GAMEPAD_LEFT_SHOULDER, XINPUT_GAMEPAD_LEFT_SHOULDER, VK_PAD_LSHOULDER},
+    {XINPUT_GAMEPAD_RIGHT_SHOULDER, XINPUT_GAMEPAD_RIGHT_SHOULDER, VK_PAD_RSHOULDER},
+    {XINPUT_GAMEPAD_A, XINPUT_GAMEPAD_A, VK_PAD_A},
+    {XINPUT_GAMEPAD_B, XINPUT_GAMEPAD_B, VK_PAD_B},
+    {XINPUT_GAMEPAD_X, XINPUT_GAMEPAD_X, VK_PAD_X},
+    {XINPUT_GAMEPAD_Y, XINPUT_GAMEPAD_Y, VK_PAD_Y},
+    {XINPUT_GAMEPAD_LTRIGGER, XINPUT_GAMEPAD_LTRIGGER, VK_PAD_LTRIGGER},
+    {XINPUT_GAMEPAD_RTRIGGER, XINPUT_GAMEPAD_RTRIGGER, VK_PAD_RTRIGGER},
+    {XINPUT_GAMEPAD_LTHUMB_UP | XINPUT_GAMEPAD_LTHUMB_LEFT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_UPLEFT},
+    {XINPUT_GAMEPAD_LTHUMB_UP | XINPUT_GAMEPAD_LTHUMB_RIGHT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_UPRIGHT},
+    {XINPUT_GAMEPAD_LTHUMB_DOWN | XINPUT_GAMEPAD_LTHUMB_RIGHT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_DOWNRIGHT},
+    {XINPUT_GAMEPAD_LTHUMB_DOWN | XINPUT_GAMEPAD_LTHUMB_LEFT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_DOWNLEFT},
+    {XINPUT_GAMEPAD_LTHUMB_UP, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_UP},
+    {XINPUT_GAMEPAD_LTHUMB_DOWN, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_DOWN},
+    {XINPUT_GAMEPAD_LTHUMB_LEFT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_LEFT},
+    {XINPUT_GAMEPAD_LTHUMB_RIGHT, XINPUT_GAMEPAD_LTHUMB_MASK, VK_PAD_LTHUMB_RIGHT},
+    {XINPUT_GAMEPAD_RTHUMB_UP | XINPUT_GAMEPAD_RTHUMB_LEFT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_UPLEFT},
+    {XINPUT_GAMEPAD_RTHUMB_UP | XINPUT_GAMEPAD_RTHUMB_RIGHT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_UPRIGHT},
+    {XINPUT_GAMEPAD_RTHUMB_DOWN | XINPUT_GAMEPAD_RTHUMB_RIGHT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_DOWNRIGHT},
+    {XINPUT_GAMEPAD_RTHUMB_DOWN | XINPUT_GAMEPAD_RTHUMB_LEFT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_DOWNLEFT},
+    {XINPUT_GAMEPAD_RTHUMB_UP, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_UP},
+    {XINPUT_GAMEPAD_RTHUMB_DOWN, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_DOWN},
+    {XINPUT_GAMEPAD_RTHUMB_LEFT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_LEFT},
+    {XINPUT_GAMEPAD_RTHUMB_RIGHT, XINPUT_GAMEPAD_RTHUMB_MASK, VK_PAD_RTHUMB_RIGHT},
+    {XINPUT_GAMEPAD_GUIDE, XINPUT_GAMEPAD_GUIDE, VK_PAD_GUIDE}
+};
+
+#define BENCH_VK_BUTTON_SIZE (sizeof(bench_vk_button) / sizeof(bench_vk_button[0]))
+
+static const WORD bench_buttons[] =
+{
+    XINPUT_GAMEPAD_A, XINPUT_GAMEPAD_B, XINPUT_GAMEPAD_X, XINPUT_GAMEPAD_Y,
+    XINPUT_GAMEPAD_LEFT_SHOULDER, XINPUT_GAMEPAD_RIGHT_SHOULDER,
+    XINPUT_GAMEPAD_BACK, XINPUT_GAMEPAD_START, XINPUT_GAMEPAD_GUIDE,
+    XINPUT_GAMEPAD_DPAD_UP, XINPUT_GAMEPAD_DPAD_DOWN, XINPUT_GAMEPAD_DPAD_LEFT, XINPUT_GAMEPAD_DPAD_RIGHT
+};
+
+static XINPUT_GAMEPAD_EX frames[XUSER_MAX_COUNT][BENCH_FRAMES];
+static xinput_shared_gamepad_state* shared = NULL;
+static uint32_t random_state = 1;
+
+static uint32_t bench_random(void)
+{
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 8;
+}
+
+static void bench_frames_make(void)
+{
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        XINPUT_GAMEPAD_EX gamepad;
+        int32_t phase = slot * 7919;
+
+        memset(&gamepad, 0, sizeof(gamepad));
+
+        for(int n = 0; n < BENCH_FRAMES; ++n)
+        {
+            uint32_t r = bench_random();
+
+            /* the left stick moves all the time, the rest from time to time */
+
+            phase += 997;
+            gamepad.sThumbLX = (int16_t)phase;
+            gamepad.sThumbLY = (int16_t)(phase * 3);
+
+            if((r & 3) == 0)
+            {
+                gamepad.sThumbRX = (int16_t)(r >> 8);
+                gamepad.sThumbRY = (int16_t)(r >> 4);
+            }
+
+            if((r & 12) == 0)
+            {
+                if((r >> 20) & 1)
+                {
+                    gamepad.bLeftTrigger = (r >> 12) & 0xff;
+                }
+                else
+                {
+                    gamepad.bRightTrigger = (r >> 12) & 0xff;
+                }
+            }
+
+            if((r & 0x70) == 0)
+            {
+                gamepad.wButtons ^= bench_buttons[(r >> 16) % (sizeof(bench_buttons) / sizeof(bench_buttons[0]))];
+            }
+
+            frames[slot][n] = gamepad;
+        }
+    }
+}
+
+static void bench_table_push(int slot, DWORD from, DWORD to, BOOL pressed, int64_t time_us)
+{
+    XINPUT_KEYSTROKE keystroke;
+
+    keystroke.Unicode = 0;
+    keystroke.Flags = pressed?XINPUT_KEYSTROKE_KEYDOWN:XINPUT_KEYSTROKE_KEYUP;
+    keystroke.UserIndex = slot;
+    keystroke.HidCode = 0;
+
+    for(size_t i = 0; i < BENCH_VK_BUTTON_SIZE; ++i)
+    {
+        BOOL is = (to & bench_vk_button[i].mask) == bench_vk_button[i].bits;
+        BOOL was = (from & bench_vk_button[i].mask) == bench_vk_button[i].bits;
+
+        if((is == pressed) && (was != is))
+        {
+            keystroke.VirtualKey = bench_vk_button[i].value;
+            xinput_keystroke_queue_push(shared, slot, &keystroke, time_us);
+        }
+    }
+}
+
+static uint64_t bench_table(int slot, const XINPUT_GAMEPAD_EX* gamepad, uint64_t previous, int64_t time_us)
+{
+    DWORD buttons = xinput_gamepad_buttons_ex(gamepad);
+
+    if(buttons != (DWORD)previous)
+    {
+        bench_table_push(slot, (DWORD)previous, buttons, FALSE, time_us);
+        bench_table_push(slot, (DWORD)previous, buttons, TRUE, time_us);
+    }
+
+    return buttons;
+}
+
+static uint64_t bench_bits(int slot, const XINPUT_GAMEPAD_EX* gamepad, uint64_t previous, int64_t time_us)
+{
+    uint64_t keys = xinput_gamepad_keys(gamepad);
+
+    xinput_service_keystrokes_push(shared, slot, previous, keys, time_us);
+
+    return keys;
+}
+
+/*
+ * A digest of the keystrokes queued since the last call, that does not
+ * depend on their order within a frame.
+ */
+
+static uint64_t bench_digest(DWORD* next, int slot, uint64_t* count)
+{
+    XINPUT_KEYSTROKE keystroke;
+    int64_t time_us;
+    uint64_t digest = 0;
+
+    while(xinput_keystroke_queue_pop(shared, slot, next, &keystroke, &time_us))
+    {
+        uint64_t key = ((uint64_t)time_us << 24) | ((uint64_t)keystroke.VirtualKey << 8) | (keystroke.Flags << 4) | keystroke.UserIndex;
+
+        digest += key * 0x9e3779b97f4a7c15ULL;
+        ++*count;
+    }
+
+    return digest;
+}
+
+/*
+ * The frames of the four slots are interleaved, like the service gets them.
+ * The best of BENCH_ROUNDS rounds is kept, the others being disturbed.
+ */
+
+#define BENCH_RUN(_name, _keystrokes, _repeats)                                 \
+    {                                                                           \
+        int64_t best = INT64_MAX;                                               \
+        for(int round = 0; round < BENCH_ROUNDS; ++round)                       \
+        {                                                                       \
+            uint64_t previous[XUSER_MAX_COUNT] = {0};                           \
+            int64_t start = timeus();                                           \
+            int64_t elapsed;                                                    \
+            for(int repeat = 0; repeat < (_repeats); ++repeat)                  \
+            {                                                                   \
+                for(int n = 0; n < BENCH_FRAMES; ++n)                           \
+                {                                                               \
+                    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)           \
+                    {                                                           \
+                        previous[slot] = _keystrokes(slot, &frames[slot][n], previous[slot], n); \
+                    }                                                           \
+                }                                                               \
+            }                                                                   \
+            elapsed = timeus() - start;                                         \
+            best = (elapsed < best)?elapsed:best;                               \
+        }                                                                       \
+        printf("%-10s %8.2f ns/frame, %8.2f ns for the %i slots\n", (_name),   \
+                (best * 1000.0) / ((double)BENCH_FRAMES * XUSER_MAX_COUNT * (_repeats)), \
+                (best * 1000.0) / ((double)BENCH_FRAMES * (_repeats)), XUSER_MAX_COUNT); \
+    }
+
+int main(int argc, char** argv)
+{
+    uint64_t previous_table[XUSER_MAX_COUNT] = {0};
+    uint64_t previous_bits[XUSER_MAX_COUNT] = {0};
+    DWORD next[XUSER_MAX_COUNT] = {0};
+    uint64_t keystrokes[2] = {0, 0};
+    int repeats = REPEATS_DEFAULT;
+    int mismatches = 0;
+
+    if(argc > 1)
+    {
+        repeats = atoi(argv[1]);
+    }
+
+    if((shared = calloc(1, sizeof(*shared))) == NULL)
+    {
+        return 99;
+    }
+
+    bench_frames_make();
+
+    /* the two must agree */
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        bench_digest(&next[slot], slot, &keystrokes[0]);
+    }
+
+    for(int n = 0; n < BENCH_FRAMES; ++n)
+    {
+        for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+        {
+            uint64_t by_table;
+            uint64_t by_bits;
+
+            previous_table[slot] = bench_table(slot, &frames[slot][n], previous_table[slot], n);
+            by_table = bench_digest(&next[slot], slot, &keystrokes[0]);
+            previous_bits[slot] = bench_bits(slot, &frames[slot][n], previous_bits[slot], n);
+            by_bits = bench_digest(&next[slot], slot, &keystrokes[1]);
+
+            if((by_table != by_bits) && (mismatches++ == 0))
+            {
+                printf("slot %i frame %i: keystrokes differ, buttons %08x keys %012llx\n", slot, n,
+                        (unsigned int)previous_table[slot], (unsigned long long)previous_bits[slot]);
+            }
+        }
+    }
+
+    printf("%i frames, %llu keystrokes, %i mismatches\n", BENCH_FRAMES * XUSER_MAX_COUNT, (unsigned long long)keystrokes[1], mismatches);
+
+    if(keystrokes[0] != keystrokes[1])
+    {
+        printf("%llu keystrokes by the table, %llu by the bits\n", (unsigned long long)keystrokes[0], (unsigned long long)keystrokes[1]);
+        ++mismatches;
+    }
+
+    BENCH_RUN("table", bench_table, repeats);
+    BENCH_RUN("bits", bench_bits, repeats);
+
+    free(shared);
+
+    return (mismatches == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
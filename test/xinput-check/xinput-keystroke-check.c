@@ -0,0 +1,235 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Keystroke queue test.
+ *
+ * Checks the keystrokes queued from button changes: releases before presses,
+ * the eight sectors of the thumbs as keys of their own, one keystroke per
+ * edge.
+ *
+ * Then checks a reader only sees what has been queued after its first read,
+ * that a reader more than XINPUT_KEYSTROKE_QUEUE_SIZE behind gets the newest
+ * keystrokes in order and that a reader left from a previous service starts
+ * over.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xinput_service.h"
+#include "xinput_gamepad.h"
+
+#define SLOT 1
+
+struct keystroke_thumb_sector
+{
+    SHORT x;
+    SHORT y;
+    WORD lvk;
+    WORD rvk;
+};
+
+static const struct keystroke_thumb_sector thumb_sectors[] =
+{
+    {0, 32767, VK_PAD_LTHUMB_UP, VK_PAD_RTHUMB_UP},
+    {0, -32768, VK_PAD_LTHUMB_DOWN, VK_PAD_RTHUMB_DOWN},
+    {32767, 0, VK_PAD_LTHUMB_RIGHT, VK_PAD_RTHUMB_RIGHT},
+    {-32768, 0, VK_PAD_LTHUMB_LEFT, VK_PAD_RTHUMB_LEFT},
+    {-32768, 32767, VK_PAD_LTHUMB_UPLEFT, VK_PAD_RTHUMB_UPLEFT},
+    {32767, 32767, VK_PAD_LTHUMB_UPRIGHT, VK_PAD_RTHUMB_UPRIGHT},
+    {32767, -32768, VK_PAD_LTHUMB_DOWNRIGHT, VK_PAD_RTHUMB_DOWNRIGHT},
+    {-32768, -32768, VK_PAD_LTHUMB_DOWNLEFT, VK_PAD_RTHUMB_DOWNLEFT}
+};
+
+static xinput_shared_gamepad_state* shared = NULL;
+static int failures = 0;
+
+static void keystroke_expect(const char* name, DWORD* next, WORD vk, WORD flags, int64_t time_us)
+{
+    XINPUT_KEYSTROKE keystroke;
+    int64_t keystroke_us;
+
+    if(!xinput_keystroke_queue_pop(shared, SLOT, next, &keystroke, &keystroke_us))
+    {
+        printf("%s: expected %04x %i, got nothing\n", name, vk, flags);
+        ++failures;
+        return;
+    }
+
+    if((keystroke.VirtualKey != vk) || (keystroke.Flags != flags) || (keystroke.UserIndex != SLOT) || (keystroke_us != time_us))
+    {
+        printf("%s: expected %04x %i %i %lli, got %04x %i %i %lli\n", name,
+                vk, flags, SLOT, (long long)time_us,
+                keystroke.VirtualKey, keystroke.Flags, keystroke.UserIndex, (long long)keystroke_us);
+        ++failures;
+    }
+}
+
+static void keystroke_expect_empty(const char* name, DWORD* next)
+{
+    XINPUT_KEYSTROKE keystroke;
+
+    if(xinput_keystroke_queue_pop(shared, SLOT, next, &keystroke, NULL))
+    {
+        printf("%s: expected nothing, got %04x %i\n", name, keystroke.VirtualKey, keystroke.Flags);
+        ++failures;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    XINPUT_GAMEPAD_EX gamepad;
+    DWORD next = 0;
+    DWORD late = 0;
+    DWORD stale;
+    uint64_t buttons;
+
+    (void)argc;
+    (void)argv;
+
+    if((shared = calloc(1, sizeof(*shared))) == NULL)
+    {
+        return 99;
+    }
+
+    keystroke_expect_empty("empty", &next);
+
+    /* edges */
+
+    xinput_service_keystrokes_push(shared, SLOT, 0, XINPUT_GAMEPAD_A, 10);
+    keystroke_expect("press", &next, VK_PAD_A, XINPUT_KEYSTROKE_KEYDOWN, 10);
+    keystroke_expect_empty("press", &next);
+
+    xinput_service_keystrokes_push(shared, SLOT, XINPUT_GAMEPAD_A, XINPUT_GAMEPAD_A, 11);
+    keystroke_expect_empty("held", &next);
+
+    xinput_service_keystrokes_push(shared, SLOT, XINPUT_GAMEPAD_A, XINPUT_GAMEPAD_A | XINPUT_GAMEPAD_B, 20);
+    xinput_service_keystrokes_push(shared, SLOT, XINPUT_GAMEPAD_A | XINPUT_GAMEPAD_B, XINPUT_GAMEPAD_B | XINPUT_GAMEPAD_X, 30);
+    keystroke_expect("second press", &next, VK_PAD_B, XINPUT_KEYSTROKE_KEYDOWN, 20);
+    keystroke_expect("release first", &next, VK_PAD_A, XINPUT_KEYSTROKE_KEYUP, 30);
+    keystroke_expect("then press", &next, VK_PAD_X, XINPUT_KEYSTROKE_KEYDOWN, 30);
+    keystroke_expect_empty("then press", &next);
+
+    xinput_service_keystrokes_push(shared, SLOT, XINPUT_GAMEPAD_B | XINPUT_GAMEPAD_X, 0, 40);
+    keystroke_expect("release", &next, VK_PAD_B, XINPUT_KEYSTROKE_KEYUP, 40);
+    keystroke_expect("release", &next, VK_PAD_X, XINPUT_KEYSTROKE_KEYUP, 40);
+    keystroke_expect_empty("release", &next);
+
+    /* thumbs and triggers, from the gamepad */
+
+    memset(&gamepad, 0, sizeof(gamepad));
+    gamepad.sThumbLY = 32767;
+    gamepad.bRightTrigger = 255;
+    buttons = xinput_gamepad_keys(&gamepad);
+    xinput_service_keystrokes_push(shared, SLOT, 0, buttons, 50);
+    keystroke_expect("thumb", &next, VK_PAD_RTRIGGER, XINPUT_KEYSTROKE_KEYDOWN, 50);
+    keystroke_expect("thumb", &next, VK_PAD_LTHUMB_UP, XINPUT_KEYSTROKE_KEYDOWN, 50);
+
+    gamepad.sThumbLX = -32768;
+    xinput_service_keystrokes_push(shared, SLOT, buttons, xinput_gamepad_keys(&gamepad), 60);
+    keystroke_expect("diagonal", &next, VK_PAD_LTHUMB_UP, XINPUT_KEYSTROKE_KEYUP, 60);
+    keystroke_expect("diagonal", &next, VK_PAD_LTHUMB_UPLEFT, XINPUT_KEYSTROKE_KEYDOWN, 60);
+    keystroke_expect_empty("diagonal", &next);
+    buttons = xinput_gamepad_keys(&gamepad);
+
+    gamepad.sThumbLY = THUMB_TO_BUTTONS_THRESHOLD;  /* not past it */
+    xinput_service_keystrokes_push(shared, SLOT, buttons, xinput_gamepad_keys(&gamepad), 70);
+    keystroke_expect("threshold", &next, VK_PAD_LTHUMB_UPLEFT, XINPUT_KEYSTROKE_KEYUP, 70);
+    keystroke_expect("threshold", &next, VK_PAD_LTHUMB_LEFT, XINPUT_KEYSTROKE_KEYDOWN, 70);
+    keystroke_expect_empty("threshold", &next);
+    xinput_service_keystrokes_push(shared, SLOT, xinput_gamepad_keys(&gamepad), 0, 80);
+    keystroke_expect("threshold", &next, VK_PAD_RTRIGGER, XINPUT_KEYSTROKE_KEYUP, 80);
+    keystroke_expect("threshold", &next, VK_PAD_LTHUMB_LEFT, XINPUT_KEYSTROKE_KEYUP, 80);
+
+    /* every sector of both thumbs */
+
+    for(size_t i = 0; i < sizeof(thumb_sectors) / sizeof(thumb_sectors[0]); ++i)
+    {
+        const struct keystroke_thumb_sector* sector = &thumb_sectors[i];
+
+        memset(&gamepad, 0, sizeof(gamepad));
+        gamepad.sThumbLX = sector->x;
+        gamepad.sThumbLY = sector->y;
+        gamepad.sThumbRX = sector->x;
+        gamepad.sThumbRY = sector->y;
+        buttons = xinput_gamepad_keys(&gamepad);
+        xinput_service_keystrokes_push(shared, SLOT, 0, buttons, 100 + i);
+        keystroke_expect("sector", &next, sector->lvk, XINPUT_KEYSTROKE_KEYDOWN, 100 + i);
+        keystroke_expect("sector", &next, sector->rvk, XINPUT_KEYSTROKE_KEYDOWN, 100 + i);
+        xinput_service_keystrokes_push(shared, SLOT, buttons, 0, 100 + i);
+        keystroke_expect("sector", &next, sector->lvk, XINPUT_KEYSTROKE_KEYUP, 100 + i);
+        keystroke_expect("sector", &next, sector->rvk, XINPUT_KEYSTROKE_KEYUP, 100 + i);
+    }
+    keystroke_expect_empty("sector", &next);
+
+    /* a new reader only gets what comes next */
+
+    keystroke_expect_empty("late reader", &late);
+    xinput_service_keystrokes_push(shared, SLOT, 0, XINPUT_GAMEPAD_GUIDE, 90);
+    keystroke_expect("late reader", &late, VK_PAD_GUIDE, XINPUT_KEYSTROKE_KEYDOWN, 90);
+    keystroke_expect("late reader", &next, VK_PAD_GUIDE, XINPUT_KEYSTROKE_KEYDOWN, 90);
+
+    /* a reader too far behind keeps the newest */
+
+    for(int i = 0; i < XINPUT_KEYSTROKE_QUEUE_SIZE + 5; ++i)
+    {
+        xinput_service_keystrokes_push(shared, SLOT, XINPUT_GAMEPAD_GUIDE, 0, 1000 + i);
+        xinput_service_keystrokes_push(shared, SLOT, 0, XINPUT_GAMEPAD_GUIDE, 1000 + i);
+    }
+
+    for(int i = 0; i < XINPUT_KEYSTROKE_QUEUE_SIZE; i += 2)
+    {
+        int64_t time_us = 1000 + 5 + XINPUT_KEYSTROKE_QUEUE_SIZE / 2 + i / 2;
+
+        keystroke_expect("overflow", &next, VK_PAD_GUIDE, XINPUT_KEYSTROKE_KEYUP, time_us);
+        keystroke_expect("overflow", &next, VK_PAD_GUIDE, XINPUT_KEYSTROKE_KEYDOWN, time_us);
+
+        if(failures > 10)
+        {
+            break;
+        }
+    }
+    keystroke_expect_empty("overflow", &next);
+
+    /* a reader from a previous service */
+
+    stale = next;
+    memset(shared, 0, sizeof(*shared));
+    xinput_service_keystrokes_push(shared, SLOT, 0, XINPUT_GAMEPAD_Y, 2000);
+    keystroke_expect_empty("new service", &stale);
+    xinput_service_keystrokes_push(shared, SLOT, XINPUT_GAMEPAD_Y, 0, 2010);
+    keystroke_expect("new service", &stale, VK_PAD_Y, XINPUT_KEYSTROKE_KEYUP, 2010);
+
+    free(shared);
+
+    printf("%i failure(s)\n", failures);
+
+    return (failures == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
@@ -0,0 +1,791 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * End-to-end latency test.
+ *
+ * Creates virtual pads with uinput, shaped like an XBox 360 pad, a DualShock 4
+ * and a generic HID joystick, and runs the service in a child process with
+ * its device directory pointing to them.
+ * This process then plays the client: it moves the left stick of a pad from
+ * one end to the other, notes the time it wrote the event, and waits through
+ * XInputWaitForStateEx until XInputGetStateEx shows the new position.
+ * The moves are then done again, this time waiting in poll on the eventfd of
+ * xinput_gamepad_notify_fd, as the event loop of an application would.
+ *
+ * The latencies are reported as a histogram with their p50, p99 and max,
+ * followed by the part of it between the kernel and the shared memory, as
+ * told by XInputGetStateTimed.
+ * The test fails if a move is never seen or if the p99 goes over
+ * LATENCY_P99_MAX_US.
+ * It is skipped without /dev/uinput, or if a service is already running.
+ *
+ * Usage: xinput-latency-check [samples [profile ...]]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "xinput.h"
+#include "xinput_settings.h"
+#include "tools.h"
+#include "device_id.h"
+#include "server.h"
+#include "xinput_service.h"
+#include "xinput_gamepad.h"
+#include "linux_evdev/xinput_linux_evdev.h"
+
+#define TEST_SKIPPED            77
+
+#define SAMPLES_DEFAULT         200
+#define SAMPLE_PERIOD_US        2000
+#define SAMPLE_TIMEOUT_MS       1000
+#define STARTUP_TIMEOUT_US      5000000LL
+#define LATENCY_P99_MAX_US      20000LL
+#define HISTOGRAM_BUCKETS       16
+
+#define EVENT_JOYSTICK "-event-joystick"
+
+struct latency_abs
+{
+    int code;
+    int32_t minimum;
+    int32_t maximum;
+    int32_t flat;
+};
+
+typedef struct latency_abs latency_abs;
+
+struct latency_profile
+{
+    const char* name;
+    uint16_t vendor;
+    uint16_t product;
+    const int* keys;            /* 0 terminated */
+    const latency_abs* abs;     /* ABS_MAX terminated */
+};
+
+typedef struct latency_profile latency_profile;
+
+struct latency_pad
+{
+    const latency_profile* profile;
+    int fd;                     /* uinput */
+    int slot;
+    int32_t stick_minimum;
+    int32_t stick_maximum;
+    char node[PATH_MAX];
+};
+
+typedef struct latency_pad latency_pad;
+
+/* xpad */
+
+static const int xbox360_keys[] =
+{
+    BTN_A, BTN_B, BTN_X, BTN_Y, BTN_TL, BTN_TR, BTN_SELECT, BTN_START, BTN_MODE, BTN_THUMBL, BTN_THUMBR, 0
+};
+
+static const latency_abs xbox360_abs[] =
+{
+    {ABS_X, -32768, 32767, 128},
+    {ABS_Y, -32768, 32767, 128},
+    {ABS_RX, -32768, 32767, 128},
+    {ABS_RY, -32768, 32767, 128},
+    {ABS_Z, 0, 255, 0},
+    {ABS_RZ, 0, 255, 0},
+    {ABS_HAT0X, -1, 1, 0},
+    {ABS_HAT0Y, -1, 1, 0},
+    {ABS_MAX, 0, 0, 0}
+};
+
+/* hid-sony */
+
+static const int dualshock4_keys[] =
+{
+    BTN_SOUTH, BTN_EAST, BTN_NORTH, BTN_WEST, BTN_TL, BTN_TR, BTN_TL2, BTN_TR2, BTN_SELECT, BTN_START, BTN_MODE, BTN_THUMBL, BTN_THUMBR, 0
+};
+
+static const latency_abs dualshock4_abs[] =
+{
+    {ABS_X, 0, 255, 0},
+    {ABS_Y, 0, 255, 0},
+    {ABS_Z, 0, 255, 0},
+    {ABS_RX, 0, 255, 0},
+    {ABS_RY, 0, 255, 0},
+    {ABS_RZ, 0, 255, 0},
+    {ABS_HAT0X, -1, 1, 0},
+    {ABS_HAT0Y, -1, 1, 0},
+    {ABS_MAX, 0, 0, 0}
+};
+
+/* hid-generic, a twelve buttons joystick */
+
+static const int generic_keys[] =
+{
+    BTN_TRIGGER, BTN_THUMB, BTN_THUMB2, BTN_TOP, BTN_TOP2, BTN_PINKIE, BTN_BASE, BTN_BASE2, BTN_BASE3, BTN_BASE4, BTN_BASE5, BTN_BASE6, 0
+};
+
+static const latency_abs generic_abs[] =
+{
+    {ABS_X, 0, 1023, 15},
+    {ABS_Y, 0, 1023, 15},
+    {ABS_Z, 0, 255, 0},
+    {ABS_RZ, 0, 255, 0},
+    {ABS_THROTTLE, 0, 255, 0},
+    {ABS_RUDDER, 0, 255, 0},
+    {ABS_HAT0X, -1, 1, 0},
+    {ABS_HAT0Y, -1, 1, 0},
+    {ABS_MAX, 0, 0, 0}
+};
+
+static const latency_profile latency_profiles[] =
+{
+    {"xbox360", MANUFACTURER_MICROSOFT, XBOX360_CONTROLLER, xbox360_keys, xbox360_abs},
+    {"dualshock4", 0x054c, 0x05c4, dualshock4_keys, dualshock4_abs},
+    {"generic", 0x0079, 0x0006, generic_keys, generic_abs},
+    {NULL, 0, 0, NULL, NULL}
+};
+
+static latency_pad pads[XUSER_MAX_COUNT];
+static int pad_count = 0;
+static char directory[64];
+static int failures = 0;
+
+static int latency_pad_node(latency_pad* pad)
+{
+    char sysname[64];
+    char path[PATH_MAX];
+    char dev[32];
+    struct dirent* entry;
+    DIR* dir;
+    unsigned int major_number;
+    unsigned int minor_number;
+    int fd;
+    int n;
+
+#ifdef UI_GET_SYSNAME
+    if(ioctl(pad->fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0)
+    {
+        return errno;
+    }
+#else
+    return ENOTSUP;
+#endif
+
+    snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+
+    /* the event node may take a moment to be registered */
+
+    for(int tries = 0;; ++tries)
+    {
+        if((dir = opendir(path)) == NULL)
+        {
+            return errno;
+        }
+
+        while((entry = readdir(dir)) != NULL)
+        {
+            if(memcmp(entry->d_name, "event", 5) == 0)
+            {
+                break;
+            }
+        }
+
+        if(entry != NULL)
+        {
+            break;
+        }
+
+        closedir(dir);
+
+        if(tries == 100)
+        {
+            return ENOENT;
+        }
+
+        usleep(10000);
+    }
+
+    snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s/%s/dev", sysname, entry->d_name);
+    snprintf(pad->node, sizeof(pad->node), "%s/latency-%s%s", directory, pad->profile->name, EVENT_JOYSTICK);
+
+    if((fd = open(path, O_RDONLY|O_CLOEXEC)) < 0)
+    {
+        closedir(dir);
+        return errno;
+    }
+
+    n = read(fd, dev, sizeof(dev) - 1);
+    close_ex(fd);
+
+    if((n <= 0) || (dev[n] = '\0', sscanf(dev, "%u:%u", &major_number, &minor_number) != 2))
+    {
+        closedir(dir);
+        return EINVAL;
+    }
+
+    /* udev may not be there to make /dev/input/eventN: make the node */
+
+    if(mknod(pad->node, S_IFCHR|0600, makedev(major_number, minor_number)) < 0)
+    {
+        snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
+
+        if(symlink(path, pad->node) < 0)
+        {
+            closedir(dir);
+            return errno;
+        }
+    }
+
+    closedir(dir);
+
+    return 0;
+}
+
+static int latency_pad_create(latency_pad* pad, const latency_profile* profile)
+{
+    struct uinput_user_dev uud;
+    int err;
+
+    memset(pad, 0, sizeof(*pad));
+    pad->profile = profile;
+    pad->slot = -1;
+
+    if((pad->fd = open("/dev/uinput", O_WRONLY|O_NONBLOCK|O_CLOEXEC)) < 0)
+    {
+        return errno;
+    }
+
+    memset(&uud, 0, sizeof(uud));
+    snprintf(uud.name, sizeof(uud.name), "latency check %s", profile->name);
+    uud.id.bustype = BUS_USB;
+    uud.id.vendor = profile->vendor;
+    uud.id.product = profile->product;
+    uud.id.version = 1;
+
+    ioctl(pad->fd, UI_SET_EVBIT, EV_SYN);
+    ioctl(pad->fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(pad->fd, UI_SET_EVBIT, EV_ABS);
+
+    for(int index = 0; profile->keys[index] != 0; ++index)
+    {
+        ioctl(pad->fd, UI_SET_KEYBIT, profile->keys[index]);
+    }
+
+    for(int index = 0; profile->abs[index].code != ABS_MAX; ++index)
+    {
+        const latency_abs* abs = &profile->abs[index];
+
+        ioctl(pad->fd, UI_SET_ABSBIT, abs->code);
+        uud.absmin[abs->code] = abs->minimum;
+        uud.absmax[abs->code] = abs->maximum;
+        uud.absflat[abs->code] = abs->flat;
+
+        if(abs->code == ABS_X)
+        {
+            pad->stick_minimum = abs->minimum;
+            pad->stick_maximum = abs->maximum;
+        }
+    }
+
+    if((write(pad->fd, &uud, sizeof(uud)) != sizeof(uud)) || (ioctl(pad->fd, UI_DEV_CREATE) < 0))
+    {
+        err = errno;
+        close_ex(pad->fd);
+        return err;
+    }
+
+    if((err = latency_pad_node(pad)) != 0)
+    {
+        ioctl(pad->fd, UI_DEV_DESTROY);
+        close_ex(pad->fd);
+        return err;
+    }
+
+    return 0;
+}
+
+static void latency_pad_destroy(latency_pad* pad)
+{
+    unlink(pad->node);
+    ioctl(pad->fd, UI_DEV_DESTROY);
+    close_ex(pad->fd);
+}
+
+static int latency_pad_move(latency_pad* pad, BOOL high)
+{
+    struct input_event frame[2];
+
+    memset(frame, 0, sizeof(frame));
+    frame[0].type = EV_ABS;
+    frame[0].code = ABS_X;
+    frame[0].value = high?pad->stick_maximum:pad->stick_minimum;
+    frame[1].type = EV_SYN;
+    frame[1].code = SYN_REPORT;
+
+    return write_fully(pad->fd, frame, sizeof(frame));
+}
+
+/*
+ * Waits until the left stick of the slot shows the expected end.
+ * With a notification fd, waits in poll on it instead of in
+ * XInputWaitForStateEx.
+ *
+ * @return 0, or ETIMEDOUT
+ */
+
+static int latency_wait_stick(int slot, SHORT expected, DWORD* packets, int notify_fd)
+{
+    int64_t until = timeus() + SAMPLE_TIMEOUT_MS * 1000LL;
+    XINPUT_STATE_EX state;
+    DWORD changed;
+
+    for(;;)
+    {
+        if((XInputGetStateEx(slot, &state) == ERROR_SUCCESS) && (state.Gamepad.sThumbLX == expected))
+        {
+            return 0;
+        }
+
+        if(timeus() >= until)
+        {
+            return ETIMEDOUT;
+        }
+
+        if(notify_fd >= 0)
+        {
+            struct pollfd pfd = {notify_fd, POLLIN, 0};
+            uint64_t count;
+
+            /* reading it rearms it */
+
+            if((poll(&pfd, 1, SAMPLE_TIMEOUT_MS) > 0) && (read(notify_fd, &count, sizeof(count)) != sizeof(count)))
+            {
+                usleep(1000);
+            }
+        }
+        else
+        {
+            XInputWaitForStateEx(1 << slot, packets, SAMPLE_TIMEOUT_MS, &changed);
+        }
+    }
+}
+
+/*
+ * Finds the slot the service gave to the pad: the first one not yet taken
+ * to show the stick at its maximum once the pad has sent it.
+ */
+
+static int latency_pad_find_slot(latency_pad* pad)
+{
+    int64_t until = timeus() + STARTUP_TIMEOUT_US;
+    XINPUT_STATE_EX state;
+
+    while(timeus() < until)
+    {
+        latency_pad_move(pad, TRUE);
+
+        for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+        {
+            BOOL taken = FALSE;
+
+            for(int index = 0; index < pad_count; ++index)
+            {
+                taken |= (pads[index].slot == slot);
+            }
+
+            if(!taken && (XInputGetStateEx(slot, &state) == ERROR_SUCCESS) && (state.Gamepad.sThumbLX == 32767))
+            {
+                pad->slot = slot;
+                return 0;
+            }
+        }
+
+        usleep(10000);
+    }
+
+    return ETIMEDOUT;
+}
+
+static int latency_compare(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+static void latency_report(const char* name, int64_t* samples, int count)
+{
+    int histogram[HISTOGRAM_BUCKETS];
+    int64_t p50;
+    int64_t p99;
+    int64_t max;
+
+    qsort(samples, count, sizeof(samples[0]), latency_compare);
+
+    p50 = samples[count / 2];
+    p99 = samples[(count * 99) / 100];
+    max = samples[count - 1];
+
+    /* bucket n holds [2^n; 2^(n+1)[ us, the last one everything above */
+
+    memset(histogram, 0, sizeof(histogram));
+
+    for(int index = 0; index < count; ++index)
+    {
+        int bucket = 0;
+
+        while((bucket < HISTOGRAM_BUCKETS - 1) && (samples[index] >= (2LL << bucket)))
+        {
+            ++bucket;
+        }
+
+        ++histogram[bucket];
+    }
+
+    printf("%s: %i samples, p50 %lli us, p99 %lli us, max %lli us\n", name, count, (long long)p50, (long long)p99, (long long)max);
+
+    for(int bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket)
+    {
+        if(histogram[bucket] > 0)
+        {
+            printf("    < %7lli us: %5i ", 2LL << bucket, histogram[bucket]);
+
+            for(int bar = 0; bar < (histogram[bucket] * 50 + count - 1) / count; ++bar)
+            {
+                putchar('#');
+            }
+
+            putchar('\n');
+        }
+    }
+
+    if(p99 > LATENCY_P99_MAX_US)
+    {
+        printf("%s: p99 over %lli us\n", name, LATENCY_P99_MAX_US);
+        ++failures;
+    }
+}
+
+static void latency_measure(latency_pad* pad, int count, int notify_fd)
+{
+    DWORD packets[XUSER_MAX_COUNT] = {0, 0, 0, 0};
+    int64_t* samples = (int64_t*)malloc(count * sizeof(int64_t));
+    int64_t* published = (int64_t*)malloc(count * sizeof(int64_t));
+    XINPUT_STATE_TIMED timed;
+    char name[64];
+    int measured = 0;
+    int stamped = 0;
+
+    for(int index = 0; index < count; ++index)
+    {
+        /* the stick has been left at its maximum by latency_pad_find_slot */
+
+        BOOL high = (index & 1) != 0;
+        int64_t sent;
+
+        /* leave the service idle for a bit, as a player would */
+
+        usleep(SAMPLE_PERIOD_US);
+
+        sent = timeus();
+
+        if(latency_pad_move(pad, high) != 0)
+        {
+            printf("%s: cannot write to uinput: %s\n", pad->profile->name, strerror(errno));
+            ++failures;
+            break;
+        }
+
+        if(latency_wait_stick(pad->slot, high?32767:-32768, packets, notify_fd) != 0)
+        {
+            printf("%s: move %i not seen after %i ms\n", pad->profile->name, index, SAMPLE_TIMEOUT_MS);
+            ++failures;
+            break;
+        }
+
+        samples[measured++] = timeus() - sent;
+
+        /* the part spent between the kernel and the shared memory */
+
+        if((XInputGetStateTimed(pad->slot, &timed) == ERROR_SUCCESS) && (timed.llEventTime != 0))
+        {
+            published[stamped++] = timed.llPublishTime - timed.llEventTime;
+        }
+    }
+
+    if(measured > 0)
+    {
+        snprintf(name, sizeof(name), "%s%s", pad->profile->name, (notify_fd >= 0)?" through the notification fd":"");
+        latency_report(name, samples, measured);
+    }
+
+    if((stamped > 0) && (notify_fd < 0))
+    {
+        snprintf(name, sizeof(name), "%s kernel to publish", pad->profile->name);
+        latency_report(name, published, stamped);
+    }
+
+    free(published);
+    free(samples);
+}
+
+/*
+ * @return TRUE if another service holds the lock
+ */
+
+static BOOL latency_service_running(void)
+{
+    int fd = open(XINPUT_SYSTEM_WIDE_LOCK_FILE, O_CREAT|O_RDWR, 0666);
+    BOOL running = FALSE;
+
+    if(fd >= 0)
+    {
+        if(flock(fd, LOCK_EX|LOCK_NB) < 0)
+        {
+            running = (errno == EWOULDBLOCK);
+        }
+
+        close_ex(fd);
+    }
+
+    return running;
+}
+
+static int latency_service_wait(void)
+{
+    int64_t until = timeus() + STARTUP_TIMEOUT_US;
+
+    while(timeus() < until)
+    {
+        int fd = shm_open(SERVICE_SHM_NAME, O_RDONLY, 0666);
+
+        if(fd >= 0)
+        {
+            close_ex(fd);
+            return 0;
+        }
+
+        usleep(10000);
+    }
+
+    return ETIMEDOUT;
+}
+
+static const latency_profile* latency_profile_get(const char* name)
+{
+    for(int index = 0; latency_profiles[index].name != NULL; ++index)
+    {
+        if(strcmp(latency_profiles[index].name, name) == 0)
+        {
+            return &latency_profiles[index];
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    int samples = SAMPLES_DEFAULT;
+    pid_t service;
+    int err;
+
+    if(argc > 1)
+    {
+        samples = atoi(argv[1]);
+
+        if(samples <= 0)
+        {
+            samples = SAMPLES_DEFAULT;
+        }
+    }
+
+    if(access("/dev/uinput", W_OK) < 0)
+    {
+        printf("/dev/uinput: %s, skipped\n", strerror(errno));
+        return TEST_SKIPPED;
+    }
+
+    if(latency_service_running())
+    {
+        printf("a service is already running, skipped\n");
+        return TEST_SKIPPED;
+    }
+
+    snprintf(directory, sizeof(directory), "/tmp/xinput-latency-check-XXXXXX");
+
+    if(mkdtemp(directory) == NULL)
+    {
+        printf("mkdtemp: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    /* the pads are made before the service starts, so its first scan finds them */
+
+    for(int index = 0; index < XUSER_MAX_COUNT; ++index)
+    {
+        const latency_profile* profile;
+
+        if(argc > 2)
+        {
+            if(index + 2 >= argc)
+            {
+                break;
+            }
+
+            if((profile = latency_profile_get(argv[index + 2])) == NULL)
+            {
+                printf("%s: unknown profile\n", argv[index + 2]);
+                continue;
+            }
+        }
+        else if((profile = &latency_profiles[index])->name == NULL)
+        {
+            break;
+        }
+
+        if((err = latency_pad_create(&pads[pad_count], profile)) != 0)
+        {
+            printf("%s: cannot create the pad: %s\n", profile->name, strerror(err));
+
+            if(pad_count == 0)
+            {
+                rmdir(directory);
+                return TEST_SKIPPED;
+            }
+
+            continue;
+        }
+
+        ++pad_count;
+    }
+
+    if((service = fork()) == 0)
+    {
+        xinput_linux_evdev_set_device_directory(directory);
+        server(0);
+        _exit(EXIT_SUCCESS);
+    }
+    else if(service < 0)
+    {
+        printf("fork: %s\n", strerror(errno));
+        ++failures;
+    }
+    else if((err = latency_service_wait()) != 0)
+    {
+        printf("the service did not start: %s\n", strerror(err));
+        ++failures;
+    }
+    else
+    {
+        for(int index = 0; index < pad_count; ++index)
+        {
+            latency_pad* pad = &pads[index];
+
+            if(latency_pad_find_slot(pad) != 0)
+            {
+                printf("%s: not picked up by the service\n", pad->profile->name);
+                ++failures;
+                continue;
+            }
+
+            printf("%s: slot %i\n", pad->profile->name, pad->slot);
+        }
+
+        for(int index = 0; index < pad_count; ++index)
+        {
+            if(pads[index].slot >= 0)
+            {
+                latency_measure(&pads[index], samples, -1);
+            }
+        }
+
+        for(int index = 0; index < pad_count; ++index)
+        {
+            int notify_fd;
+
+            if(pads[index].slot < 0)
+            {
+                continue;
+            }
+
+            if((notify_fd = xinput_gamepad_notify_fd(1 << pads[index].slot)) < 0)
+            {
+                printf("%s: no notification fd: %s\n", pads[index].profile->name, strerror(errno));
+                ++failures;
+                continue;
+            }
+
+            latency_measure(&pads[index], samples, notify_fd);
+        }
+    }
+
+    xinput_gamepad_finalize();
+
+    if(service > 0)
+    {
+        kill(service, SIGTERM);
+        waitpid(service, NULL, 0);
+
+        /* it may not have had a chance to clean up */
+
+        shm_unlink(SERVICE_SHM_NAME);
+        sem_unlink(SERVICE_SEM_NAME);
+    }
+
+    for(int index = 0; index < pad_count; ++index)
+    {
+        latency_pad_destroy(&pads[index]);
+    }
+
+    rmdir(directory);
+
+    printf("%i failure(s)\n", failures);
+
+    return (failures == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
@@ -0,0 +1,347 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Record/replay test.
+ *
+ * Writes a recording of a made-up gamepad, whose frames push every control to
+ * either end of its range, then replays it through the generic device and
+ * compares the gamepad after every frame with the one expected.
+ * The time of every frame must be the one recorded.
+ * The replay is done at max speed, then in real time, which must take about
+ * the time between the first and the last frame recorded.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "xinput.h"
+#include "tools.h"
+#include "linux_evdev/xinput_linux_evdev.h"
+#include "linux_evdev/xinput_linux_evdev_record.h"
+
+#define REPLAY_FRAMES       50
+#define REPLAY_PERIOD_US    2000
+#define REPLAY_START_US     1500000000000000LL
+
+static const struct
+{
+    int code;
+    WORD button;
+} replay_keys[] =
+{
+    {BTN_A, XINPUT_GAMEPAD_A},
+    {BTN_B, XINPUT_GAMEPAD_B},
+    {BTN_X, XINPUT_GAMEPAD_X},
+    {BTN_Y, XINPUT_GAMEPAD_Y},
+    {BTN_TL, XINPUT_GAMEPAD_LEFT_SHOULDER},
+    {BTN_TR, XINPUT_GAMEPAD_RIGHT_SHOULDER},
+    {BTN_SELECT, XINPUT_GAMEPAD_BACK},
+    {BTN_START, XINPUT_GAMEPAD_START},
+    {BTN_MODE, XINPUT_GAMEPAD_GUIDE},
+    {BTN_THUMBL, XINPUT_GAMEPAD_LEFT_THUMB},
+    {BTN_THUMBR, XINPUT_GAMEPAD_RIGHT_THUMB},
+    {0, 0}
+};
+
+static XINPUT_GAMEPAD_EX expected[REPLAY_FRAMES];
+static uint64_t replayed_frames = 0;
+static int failures = 0;
+
+static void replay_probe_abs(struct xinput_linux_evdev_probe_s* probed, int code, int32_t minimum, int32_t maximum)
+{
+    bit_set(probed->ev_abs, code);
+    probed->absinfo[code].minimum = minimum;
+    probed->absinfo[code].maximum = maximum;
+    ++probed->abs_count;
+}
+
+static void replay_probe_make(struct xinput_linux_evdev_probe_s* probed)
+{
+    memset(probed, 0, sizeof(*probed));
+    strcpy(probed->device_name, "replay check pad");
+    probed->id.bustype = BUS_VIRTUAL;
+
+    bit_set(probed->ev_all, EV_SYN);
+    bit_set(probed->ev_all, EV_KEY);
+    bit_set(probed->ev_all, EV_ABS);
+    bit_set(probed->ev_all, EV_MSC);
+
+    for(int index = 0; replay_keys[index].code != 0; ++index)
+    {
+        bit_set(probed->ev_key, replay_keys[index].code);
+        ++probed->key_count;
+    }
+
+    replay_probe_abs(probed, ABS_X, -32768, 32767);
+    replay_probe_abs(probed, ABS_Y, -32768, 32767);
+    replay_probe_abs(probed, ABS_RX, -32768, 32767);
+    replay_probe_abs(probed, ABS_RY, -32768, 32767);
+    replay_probe_abs(probed, ABS_Z, 0, 1023);
+    replay_probe_abs(probed, ABS_RZ, 0, 1023);
+    replay_probe_abs(probed, ABS_HAT0X, -1, 1);
+    replay_probe_abs(probed, ABS_HAT0Y, -1, 1);
+}
+
+static int replay_event(struct input_event* frame, int count, int64_t at_us, uint16_t type, uint16_t code, int32_t value)
+{
+    struct input_event* ie = &frame[count];
+
+    memset(ie, 0, sizeof(*ie));
+    ie->input_event_sec = at_us / 1000000;
+    ie->input_event_usec = at_us % 1000000;
+    ie->type = type;
+    ie->code = code;
+    ie->value = value;
+
+    return count + 1;
+}
+
+/*
+ * Frame n presses the key n and releases the previous one, sends the axes to
+ * the minimum on even frames and to the maximum on odd ones, and pushes the
+ * hat around.
+ */
+
+static int replay_record_make(const char* path)
+{
+    struct xinput_linux_evdev_probe_s probed;
+    struct input_event frame[16];
+    XINPUT_GAMEPAD_EX gamepad;
+    int fd;
+    int err = 0;
+
+    replay_probe_make(&probed);
+
+    if((fd = xinput_linux_evdev_record_create(path, &probed)) < 0)
+    {
+        return errno;
+    }
+
+    memset(&gamepad, 0, sizeof(gamepad));
+
+    for(int n = 0; n < REPLAY_FRAMES; ++n)
+    {
+        int64_t at_us = REPLAY_START_US + n * REPLAY_PERIOD_US;
+        int key = n % 11;
+        BOOL high = (n & 1) != 0;
+        int hat = (n % 3) - 1;
+        int count = 0;
+
+        if(n > 0)
+        {
+            int previous = (n - 1) % 11;
+            count = replay_event(frame, count, at_us, EV_KEY, replay_keys[previous].code, 0);
+            gamepad.wButtons &= ~replay_keys[previous].button;
+        }
+
+        /* like a HID pad, the scan code before the key, mapped to nothing */
+
+        count = replay_event(frame, count, at_us, EV_MSC, MSC_SCAN, 0x90001 + key);
+        count = replay_event(frame, count, at_us, EV_KEY, replay_keys[key].code, 1);
+        gamepad.wButtons |= replay_keys[key].button;
+
+        count = replay_event(frame, count, at_us, EV_ABS, ABS_X, high?32767:-32768);
+        count = replay_event(frame, count, at_us, EV_ABS, ABS_Y, high?32767:-32768);
+        count = replay_event(frame, count, at_us, EV_ABS, ABS_RX, high?-32768:32767);
+        count = replay_event(frame, count, at_us, EV_ABS, ABS_RY, high?-32768:32767);
+        count = replay_event(frame, count, at_us, EV_ABS, ABS_Z, high?1023:0);
+        count = replay_event(frame, count, at_us, EV_ABS, ABS_RZ, high?0:1023);
+        count = replay_event(frame, count, at_us, EV_ABS, ABS_HAT0X, hat);
+        count = replay_event(frame, count, at_us, EV_ABS, ABS_HAT0Y, -hat);
+        count = replay_event(frame, count, at_us, EV_SYN, SYN_REPORT, 0);
+
+        gamepad.sThumbLX = high?32767:-32768;
+        gamepad.sThumbLY = high?-32768:32767;   /* up is negative on evdev */
+        gamepad.sThumbRX = high?-32768:32767;
+        gamepad.sThumbRY = high?32767:-32768;
+        gamepad.bLeftTrigger = high?255:0;
+        gamepad.bRightTrigger = high?0:255;
+        gamepad.wButtons &= ~(XINPUT_GAMEPAD_DPAD_RIGHT|XINPUT_GAMEPAD_DPAD_LEFT|XINPUT_GAMEPAD_DPAD_DOWN|XINPUT_GAMEPAD_DPAD_UP);
+        gamepad.wButtons |= (hat > 0)?(XINPUT_GAMEPAD_DPAD_RIGHT|XINPUT_GAMEPAD_DPAD_UP):0;
+        gamepad.wButtons |= (hat < 0)?(XINPUT_GAMEPAD_DPAD_LEFT|XINPUT_GAMEPAD_DPAD_DOWN):0;
+
+        expected[n] = gamepad;
+
+        if((err = xinput_linux_evdev_record_write(fd, frame, count)) != 0)
+        {
+            break;
+        }
+    }
+
+    close_ex(fd);
+
+    return err;
+}
+
+static void replay_check_frame(uint64_t frame, const XINPUT_GAMEPAD_EX* gamepad, int64_t event_us, void* args)
+{
+    const char* name = (const char*)args;
+    int64_t recorded_us;
+
+    replayed_frames = frame;
+
+    if(frame > REPLAY_FRAMES)
+    {
+        return;
+    }
+
+    /* the time of the frame comes from its events */
+
+    recorded_us = REPLAY_START_US + (frame - 1) * REPLAY_PERIOD_US;
+
+    if(event_us != recorded_us)
+    {
+        printf("%s: frame %llu: time %lli instead of %lli\n", name, (unsigned long long)frame, (long long)event_us, (long long)recorded_us);
+        ++failures;
+    }
+
+    if(memcmp(gamepad, &expected[frame - 1], sizeof(*gamepad)) != 0)
+    {
+        const XINPUT_GAMEPAD_EX* e = &expected[frame - 1];
+
+        printf("%s: frame %llu: %04hx %hhu %hhu %hi %hi %hi %hi instead of %04hx %hhu %hhu %hi %hi %hi %hi\n",
+                name, (unsigned long long)frame,
+                gamepad->wButtons, gamepad->bLeftTrigger, gamepad->bRightTrigger,
+                gamepad->sThumbLX, gamepad->sThumbLY, gamepad->sThumbRX, gamepad->sThumbRY,
+                e->wButtons, e->bLeftTrigger, e->bRightTrigger,
+                e->sThumbLX, e->sThumbLY, e->sThumbRX, e->sThumbRY);
+        ++failures;
+    }
+}
+
+static void replay_check(const char* path, BOOL realtime)
+{
+    const char* name = realtime?"real time":"max speed";
+    xinput_linux_evdev_replay_report report;
+    int err;
+
+    replayed_frames = 0;
+
+    if((err = xinput_linux_evdev_replay(path, realtime, replay_check_frame, (void*)name, &report)) != 0)
+    {
+        printf("%s: replay failed: %s\n", name, strerror(err));
+        ++failures;
+        return;
+    }
+
+    printf("%s: %llu frames, %llu events (%llu unmapped), %llu reads in %lli us\n", name,
+            (unsigned long long)report.frames, (unsigned long long)report.events,
+            (unsigned long long)report.events_unmapped,
+            (unsigned long long)report.reads, (long long)report.elapsed_us);
+
+    if((report.frames != REPLAY_FRAMES) || (replayed_frames != REPLAY_FRAMES))
+    {
+        printf("%s: %llu frames replayed instead of %i\n", name, (unsigned long long)report.frames, REPLAY_FRAMES);
+        ++failures;
+    }
+
+    /* a recording cannot be masked by the kernel, every scan code gets through */
+
+    if(report.events_unmapped != REPLAY_FRAMES)
+    {
+        printf("%s: %llu events unmapped instead of %i\n", name, (unsigned long long)report.events_unmapped, REPLAY_FRAMES);
+        ++failures;
+    }
+
+    if(realtime)
+    {
+        /* the frames are spread over (REPLAY_FRAMES - 1) periods */
+
+        int64_t spread_us = (REPLAY_FRAMES - 1) * REPLAY_PERIOD_US;
+
+        if(report.elapsed_us < spread_us - REPLAY_PERIOD_US)
+        {
+            printf("%s: replayed in %lli us, faster than the %lli us recorded\n", name, (long long)report.elapsed_us, (long long)spread_us);
+            ++failures;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    char path[] = "/tmp/xinput-replay-check-XXXXXX";
+    struct xinput_linux_evdev_probe_s probed;
+    char garbage[64];
+    int fd;
+    int err;
+
+    (void)argc;
+    (void)argv;
+
+    if((fd = mkstemp(path)) < 0)
+    {
+        printf("mkstemp: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    close_ex(fd);
+
+    if((err = replay_record_make(path)) != 0)
+    {
+        printf("%s: %s\n", path, strerror(err));
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    replay_check(path, FALSE);
+    replay_check(path, TRUE);
+
+    /* not a recording */
+
+    memset(garbage, 0x55, sizeof(garbage));
+
+    if((fd = open(path, O_WRONLY|O_TRUNC)) >= 0)
+    {
+        write_fully(fd, garbage, sizeof(garbage));
+        close_ex(fd);
+    }
+
+    if((fd = xinput_linux_evdev_record_open(path, &probed)) >= 0)
+    {
+        printf("garbage opened as a recording\n");
+        close_ex(fd);
+        ++failures;
+    }
+    else if(errno != EPROTO)
+    {
+        printf("garbage: %s instead of %s\n", strerror(errno), strerror(EPROTO));
+        ++failures;
+    }
+
+    unlink(path);
+
+    printf("%i failure(s)\n", failures);
+
+    return (failures == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
@@ -0,0 +1,203 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Seqlock stress test.
+ *
+ * A writer thread keeps updating the four gamepad slots of a shared memory
+ * while reader processes take snapshots and check their consistency.
+ *
+ * Every field written is derived from the same counter, so a reader seeing
+ * fields from two different updates has made a torn read.
+ *
+ * The test fails if any torn read is seen through the seqlock.
+ * With -u the readers copy without the seqlock, to show that torn reads happen.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "xinput_service.h"
+#include "xinput-check.h"
+
+#define READERS_COUNT 3
+
+struct stress_results
+{
+    volatile int stop;
+    volatile int64_t reads[READERS_COUNT];
+    volatile int64_t torn[READERS_COUNT];
+    volatile int64_t given_up[READERS_COUNT];
+};
+
+typedef struct stress_results stress_results;
+
+static xinput_shared_gamepad_state* shared = NULL;
+static stress_results* results = NULL;
+
+static void stress_round(DWORD* n)
+{
+    ++*n;
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        xinput_gamepad_state* xgs = &shared->state[slot];
+
+        xinput_gamepad_state_write_begin(xgs);
+
+        /* field by field, on purpose */
+
+        xinput_check_gamepad_make(&xgs->gamepad, slot, *n);
+        xgs->dwPacketNumber = *n;
+
+        xinput_gamepad_state_write_end(xgs);
+    }
+}
+
+static void stress_reader(int index, BOOL unsynchronized)
+{
+    XINPUT_GAMEPAD_EX gamepad;
+    DWORD packet;
+    int64_t reads = 0;
+    int64_t torn = 0;
+    int64_t given_up = 0;
+
+    while(!results->stop)
+    {
+        for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+        {
+            const xinput_gamepad_state* xgs = &shared->state[slot];
+
+            if(unsynchronized)
+            {
+                memcpy(&gamepad, (const void*)&xgs->gamepad, sizeof(gamepad));
+                packet = xgs->dwPacketNumber;
+            }
+            else if(!xinput_gamepad_state_snapshot(xgs, &gamepad, &packet))
+            {
+                ++given_up;
+                continue;
+            }
+
+            if(!xinput_check_gamepad_is(&gamepad, slot, packet))
+            {
+                ++torn;
+            }
+
+            ++reads;
+        }
+    }
+
+    results->reads[index] = reads;
+    results->torn[index] = torn;
+    results->given_up[index] = given_up;
+}
+
+int main(int argc, char** argv)
+{
+    xinput_check_writer writer;
+    pid_t readers[READERS_COUNT];
+    BOOL unsynchronized = (argc > 1) && (strcmp(argv[1], "-u") == 0);
+    int64_t reads = 0;
+    int64_t torn = 0;
+    int64_t given_up = 0;
+    int ret;
+
+    shared = (xinput_shared_gamepad_state*)mmap(NULL, sizeof(xinput_shared_gamepad_state), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    results = (stress_results*)mmap(NULL, sizeof(stress_results), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+
+    if((shared == MAP_FAILED) || (results == MAP_FAILED))
+    {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+
+    memset(shared, 0, sizeof(xinput_shared_gamepad_state));
+    memset(results, 0, sizeof(stress_results));
+
+    for(int slot = 0; slot < XUSER_MAX_COUNT; ++slot)
+    {
+        xinput_check_gamepad_make(&shared->state[slot].gamepad, slot, 0);
+    }
+
+    for(int i = 0; i < READERS_COUNT; ++i)
+    {
+        readers[i] = fork();
+
+        if(readers[i] == 0)
+        {
+            stress_reader(i, unsynchronized);
+            _exit(EXIT_SUCCESS);
+        }
+        else if(readers[i] < 0)
+        {
+            perror("fork");
+            results->stop = 1;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if((ret = xinput_check_writer_start(&writer, &results->stop, stress_round, 0, 0)) != 0)
+    {
+        fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+        results->stop = 1;
+        return EXIT_FAILURE;
+    }
+
+    usleep(2 * XINPUT_CHECK_DURATION_US);
+
+    xinput_check_writer_stop(&writer);
+
+    for(int i = 0; i < READERS_COUNT; ++i)
+    {
+        waitpid(readers[i], NULL, 0);
+
+        reads += results->reads[i];
+        torn += results->torn[i];
+        given_up += results->given_up[i];
+    }
+
+    printf("%s: %lli reads, %lli torn, %lli given up, %u updates per slot\n",
+            unsynchronized ? "unsynchronized" : "seqlock",
+            (long long)reads, (long long)torn, (long long)given_up,
+            shared->state[0].dwPacketNumber);
+
+    if(unsynchronized)
+    {
+        return EXIT_SUCCESS;
+    }
+
+    return ((torn == 0) && (reads > 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
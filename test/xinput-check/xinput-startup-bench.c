@@ -0,0 +1,253 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Startup benchmark.
+ *
+ * Measures the time to the first valid state: a child process, with no
+ * service running, calls XInputGetStateEx for the first time, which starts
+ * the service and waits until it is ready before answering.
+ * The service looks at an empty device directory, so the answer has to be
+ * ERROR_DEVICE_NOT_CONNECTED.
+ *
+ * The times are reported with their p50 and max.
+ * The test fails if a first call gives another answer, or takes longer than
+ * XINPUT_OWNER_STARTUP_TIMEOUT_US (the service would have been started
+ * again).
+ * It is skipped if a service is already running.
+ *
+ * Usage: xinput-startup-bench [runs]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "xinput.h"
+#include "xinput_settings.h"
+#include "tools.h"
+#include "debug.h"
+#include "xinput_service.h"
+#include "xinput_gamepad.h"
+#include "linux_evdev/xinput_linux_evdev.h"
+
+#define TEST_SKIPPED            77
+
+#define RUNS_DEFAULT            20
+
+struct startup_sample
+{
+    int64_t elapsed_us;
+    DWORD ret;
+};
+
+typedef struct startup_sample startup_sample;
+
+static char directory[64];
+
+/*
+ * @return TRUE if another service holds the lock
+ */
+
+static BOOL startup_service_running(void)
+{
+    int fd = open(XINPUT_SYSTEM_WIDE_LOCK_FILE, O_CREAT|O_RDWR, 0666);
+    BOOL running = FALSE;
+
+    if(fd >= 0)
+    {
+        if(flock(fd, LOCK_EX|LOCK_NB) < 0)
+        {
+            running = (errno == EWOULDBLOCK);
+        }
+
+        close_ex(fd);
+    }
+
+    return running;
+}
+
+/*
+ * The traces of the service (memory dumps included) would be measured too.
+ */
+
+static void startup_trace(const char* text, ...)
+{
+    (void)text;
+}
+
+/*
+ * The child: the first call of the process, as a game would make it.
+ * The service runs in its threads and dies with it.
+ */
+
+static void startup_child(int fd)
+{
+    startup_sample sample;
+    XINPUT_STATE_EX state;
+    int64_t start;
+
+    trace_printf = startup_trace;
+    xinput_linux_evdev_set_device_directory(directory);
+
+    start = timeus();
+    sample.ret = XInputGetStateEx(0, &state);
+    sample.elapsed_us = timeus() - start;
+
+    if(write(fd, &sample, sizeof(sample)) != sizeof(sample))
+    {
+        _exit(EXIT_FAILURE);
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+static int startup_compare(const void* a, const void* b)
+{
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv)
+{
+    int runs = RUNS_DEFAULT;
+    int64_t* samples;
+    int measured = 0;
+    int failures = 0;
+
+    if(argc > 1)
+    {
+        runs = atoi(argv[1]);
+
+        if(runs <= 0)
+        {
+            runs = RUNS_DEFAULT;
+        }
+    }
+
+    if(startup_service_running())
+    {
+        printf("a service is already running, skipped\n");
+        return TEST_SKIPPED;
+    }
+
+    snprintf(directory, sizeof(directory), "/tmp/xinput-startup-bench-XXXXXX");
+
+    if(mkdtemp(directory) == NULL)
+    {
+        printf("mkdtemp: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    samples = (int64_t*)malloc(runs * sizeof(int64_t));
+
+    for(int run = 0; run < runs; ++run)
+    {
+        startup_sample sample;
+        int fds[2];
+        pid_t child;
+        int status;
+
+        if(pipe(fds) < 0)
+        {
+            printf("pipe: %s\n", strerror(errno));
+            ++failures;
+            break;
+        }
+
+        if((child = fork()) == 0)
+        {
+            close_ex(fds[0]);
+            startup_child(fds[1]);
+        }
+
+        close_ex(fds[1]);
+
+        if(child < 0)
+        {
+            printf("fork: %s\n", strerror(errno));
+            close_ex(fds[0]);
+            ++failures;
+            break;
+        }
+
+        if(read_fully(fds[0], &sample, sizeof(sample)) != 0)
+        {
+            printf("run %i: no answer from the child\n", run);
+            ++failures;
+        }
+        else if(sample.ret != (DWORD)ERROR_DEVICE_NOT_CONNECTED)
+        {
+            printf("run %i: first call returned %u\n", run, (unsigned int)sample.ret);
+            ++failures;
+        }
+        else
+        {
+            if(sample.elapsed_us > XINPUT_OWNER_STARTUP_TIMEOUT_US)
+            {
+                printf("run %i: first state after %lli us\n", run, (long long)sample.elapsed_us);
+                ++failures;
+            }
+
+            samples[measured++] = sample.elapsed_us;
+        }
+
+        close_ex(fds[0]);
+        waitpid(child, &status, 0);
+
+        /* it had no chance to clean up */
+
+        shm_unlink(SERVICE_SHM_NAME);
+        sem_unlink(SERVICE_SEM_NAME);
+    }
+
+    if(measured > 0)
+    {
+        qsort(samples, measured, sizeof(samples[0]), startup_compare);
+
+        printf("first state: %i runs, p50 %lli us, max %lli us\n", measured,
+                (long long)samples[measured / 2], (long long)samples[measured - 1]);
+    }
+
+    free(samples);
+    rmdir(directory);
+
+    printf("%i failure(s)\n", failures);
+
+    return (failures == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
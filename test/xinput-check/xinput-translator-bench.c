@@ -0,0 +1,345 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Translator benchmark.
+ *
+ * Runs the same stream of events, shaped like what an xpad reports (sticks
+ * moving every frame, triggers and buttons now and then), through the three
+ * ways of translating events:
+ *
+ *  - the tables with a callback per axis,
+ *  - the hand-written switch of xinput_linux_evdev_xboxpad.c,
+ *  - the compiled translator.
+ *
+ * The three must give the same gamepad at the end of every frame.
+ * The time they take is reported, but does not fail the test.
+ *
+ * Usage: xinput-translator-bench [repeats]
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xinput.h"
+#include "tools.h"
+#include "linux_evdev/xinput_linux_evdev_translator.h"
+#include "linux_evdev/xinput_linux_evdev_xboxpad.h"
+
+#define STREAM_EVENTS 65536
+#define REPEATS_DEFAULT 8
+
+XINPUT_GAMEPAD_ABS_BEGIN(bench_abs)
+XINPUT_GAMEPAD_ABS_AXIS(ABS_X, sThumbLX)           /* 0x00 */
+XINPUT_GAMEPAD_ABS_SIXA(ABS_Y, sThumbLY)           /* 0x01 */
+XINPUT_GAMEPAD_ABS_TRIG(ABS_Z, bLeftTrigger)       /* 0x02 */
+XINPUT_GAMEPAD_ABS_AXIS(ABS_RX, sThumbRX)          /* 0x03 */
+XINPUT_GAMEPAD_ABS_SIXA(ABS_RY, sThumbRY)          /* 0x04 */
+XINPUT_GAMEPAD_ABS_TRIG(ABS_RZ, bRightTrigger)     /* 0x05 */
+XINPUT_GAMEPAD_ABS_NOPE(ABS_THROTTLE)              /* 0x06 */
+XINPUT_GAMEPAD_ABS_NOPE(ABS_RUDDER)                /* 0x07 */
+XINPUT_GAMEPAD_ABS_NOPE(ABS_WHEEL)                 /* 0x08 */
+XINPUT_GAMEPAD_ABS_NOPE(ABS_GAS)                   /* 0x09 */
+XINPUT_GAMEPAD_ABS_NOPE(ABS_BRAKE)                 /* 0x0a */
+XINPUT_GAMEPAD_ABS_NOPE(0x0b)
+XINPUT_GAMEPAD_ABS_NOPE(0x0c)
+XINPUT_GAMEPAD_ABS_NOPE(0x0d)
+XINPUT_GAMEPAD_ABS_NOPE(0x0e)
+XINPUT_GAMEPAD_ABS_NOPE(0x0f)
+XINPUT_GAMEPAD_ABS_BTTN(ABS_HAT0X, XINPUT_GAMEPAD_DPAD_RIGHT, XINPUT_GAMEPAD_DPAD_LEFT) /* 0x10 */
+XINPUT_GAMEPAD_ABS_BTTN(ABS_HAT0Y, XINPUT_GAMEPAD_DPAD_DOWN, XINPUT_GAMEPAD_DPAD_UP)    /* 0x11 */
+XINPUT_GAMEPAD_ABS_END(bench_abs)
+
+XINPUT_GAMEPAD_KEY_TRANSLATOR(bench_key,
+        BTN_A, BTN_THUMBR,
+        XINPUT_GAMEPAD_A,
+        XINPUT_GAMEPAD_B,
+        0,
+        XINPUT_GAMEPAD_X,
+        XINPUT_GAMEPAD_Y,
+        0,
+        XINPUT_GAMEPAD_LEFT_SHOULDER,
+        XINPUT_GAMEPAD_RIGHT_SHOULDER,
+        0,
+        0,
+        XINPUT_GAMEPAD_BACK,
+        XINPUT_GAMEPAD_START,
+        XINPUT_GAMEPAD_GUIDE,
+        XINPUT_GAMEPAD_LEFT_THUMB,
+        XINPUT_GAMEPAD_RIGHT_THUMB);
+
+XINPUT_GAMEPAD_KEY_TRANSLATOR(bench_key_bis,
+        BTN_TRIGGER_HAPPY1, BTN_TRIGGER_HAPPY4,
+        XINPUT_GAMEPAD_DPAD_LEFT,
+        XINPUT_GAMEPAD_DPAD_RIGHT,
+        XINPUT_GAMEPAD_DPAD_UP,
+        XINPUT_GAMEPAD_DPAD_DOWN);
+
+static const uint16_t bench_keys[] =
+{
+    BTN_A, BTN_B, BTN_X, BTN_Y, BTN_TL, BTN_TR, BTN_SELECT, BTN_START,
+    BTN_MODE, BTN_THUMBL, BTN_THUMBR,
+    BTN_TRIGGER_HAPPY1, BTN_TRIGGER_HAPPY2, BTN_TRIGGER_HAPPY3, BTN_TRIGGER_HAPPY4
+};
+
+static struct input_event stream[STREAM_EVENTS];
+static struct xinput_linux_evdev_translator_compiled compiled;
+static uint32_t random_state = 1;
+
+static uint32_t bench_random(void)
+{
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 8;
+}
+
+static void bench_event(int* count, uint16_t type, uint16_t code, int32_t value)
+{
+    struct input_event* ie = &stream[(*count)++];
+
+    memset(ie, 0, sizeof(*ie));
+    ie->type = type;
+    ie->code = code;
+    ie->value = value;
+}
+
+/*
+ * Makes up frames until the stream is full, each ending with a SYN_REPORT.
+ */
+
+static void bench_stream_make(void)
+{
+    int count = 0;
+    int32_t phase = 0;
+    BOOL pressed[sizeof(bench_keys) / sizeof(bench_keys[0])];
+
+    memset(pressed, 0, sizeof(pressed));
+
+    while(count < STREAM_EVENTS - 8)
+    {
+        uint32_t r = bench_random();
+
+        /* the left stick moves all the time, the rest from time to time */
+
+        phase += 997;
+        bench_event(&count, EV_ABS, ABS_X, (int16_t)phase);
+        bench_event(&count, EV_ABS, ABS_Y, (int16_t)(phase * 3));
+
+        if((r & 3) == 0)
+        {
+            bench_event(&count, EV_ABS, ABS_RX, (int16_t)(r >> 8));
+            bench_event(&count, EV_ABS, ABS_RY, (int16_t)(r >> 4));
+        }
+
+        if((r & 12) == 0)
+        {
+            bench_event(&count, EV_ABS, ((r >> 20) & 1)?ABS_Z:ABS_RZ, (r >> 12) & 0xff);
+        }
+
+        if((r & 0x70) == 0)
+        {
+            int index = (r >> 16) % (sizeof(bench_keys) / sizeof(bench_keys[0]));
+            pressed[index] = !pressed[index];
+            bench_event(&count, EV_KEY, bench_keys[index], pressed[index]);
+        }
+
+        if((r & 0x380) == 0)
+        {
+            bench_event(&count, EV_ABS, ((r >> 21) & 1)?ABS_HAT0X:ABS_HAT0Y, (int32_t)((r >> 22) % 3) - 1);
+        }
+
+        bench_event(&count, EV_SYN, SYN_REPORT, 0);
+    }
+
+    while(count < STREAM_EVENTS)
+    {
+        bench_event(&count, EV_SYN, SYN_REPORT, 0);
+    }
+}
+
+static void bench_table(const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad)
+{
+    switch(ie->type)
+    {
+        case EV_KEY:
+        {
+            xinput_linux_evdev_translator_key_input_event_to_gamepad(&bench_key, ie, gamepad);
+            xinput_linux_evdev_translator_key_input_event_to_gamepad(&bench_key_bis, ie, gamepad);
+            break;
+        }
+        case EV_ABS:
+        {
+            xinput_linux_evdev_translator_abs_input_event_to_gamepad(&bench_abs, ie, gamepad);
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+}
+
+static void bench_switch(const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad)
+{
+    xinput_linux_evdev_xboxpad_input_event_to_gamepad(ie, gamepad, 0);
+}
+
+static void bench_compiled(const struct input_event* ie, XINPUT_GAMEPAD_EX* gamepad)
+{
+    xinput_linux_evdev_translator_compiled_input_event_to_gamepad(&compiled, ie, gamepad);
+}
+
+/*
+ * Every way goes through its own copy of this loop so that the compiled
+ * translator is inlined the way the generic device inlines it.
+ * The best of BENCH_ROUNDS rounds is kept, the others being disturbed.
+ */
+
+#define BENCH_ROUNDS 5
+
+#define BENCH_RUN(_name, _translate, _repeats, _checksum)                       \
+    {                                                                           \
+        XINPUT_GAMEPAD_EX gamepad;                                              \
+        int64_t best = INT64_MAX;                                               \
+        memset(&gamepad, 0, sizeof(gamepad));                                   \
+        for(int round = 0; round < BENCH_ROUNDS; ++round)                       \
+        {                                                                       \
+            int64_t start = timeus();                                           \
+            int64_t elapsed;                                                    \
+            for(int repeat = 0; repeat < (_repeats); ++repeat)                  \
+            {                                                                   \
+                for(int index = 0; index < STREAM_EVENTS; ++index)              \
+                {                                                               \
+                    const struct input_event* ie = &stream[index];              \
+                    if(ie->type == EV_SYN)                                      \
+                    {                                                           \
+                        (_checksum) += gamepad.wButtons + gamepad.sThumbLX + gamepad.bRightTrigger; \
+                    }                                                           \
+                    else                                                        \
+                    {                                                           \
+                        _translate(ie, &gamepad);                               \
+                    }                                                           \
+                }                                                               \
+            }                                                                   \
+            elapsed = timeus() - start;                                         \
+            best = (elapsed < best)?elapsed:best;                               \
+        }                                                                       \
+        printf("%-10s %8.2f ns/event\n", (_name), (best * 1000.0) / ((double)STREAM_EVENTS * (_repeats))); \
+    }
+
+int main(int argc, char** argv)
+{
+    XINPUT_GAMEPAD_EX by_table;
+    XINPUT_GAMEPAD_EX by_switch;
+    XINPUT_GAMEPAD_EX by_compiled;
+    SHORT key_buttons[BTN_TRIGGER_HAPPY4 - BTN_A + 1];
+    struct xinput_linux_evdev_translator_key_translator key = { BTN_A, BTN_TRIGGER_HAPPY4, key_buttons };
+    int repeats = REPEATS_DEFAULT;
+    int frames = 0;
+    int mismatches = 0;
+    uint64_t checksum[3] = {0, 0, 0};
+
+    if(argc > 1)
+    {
+        repeats = atoi(argv[1]);
+    }
+
+    /* the two key tables in one, for the compiler */
+
+    memset(key_buttons, 0, sizeof(key_buttons));
+
+    for(int code = bench_key._first; code <= bench_key._last; ++code)
+    {
+        key_buttons[code - BTN_A] = bench_key._buttons[code - bench_key._first];
+    }
+
+    for(int code = bench_key_bis._first; code <= bench_key_bis._last; ++code)
+    {
+        key_buttons[code - BTN_A] = bench_key_bis._buttons[code - bench_key_bis._first];
+    }
+
+    if(xinput_linux_evdev_translator_compile(&compiled, &bench_abs, &key) != 0)
+    {
+        printf("could not compile the translator\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("compiled: %i axes, %i keys, %i bytes\n", compiled.abs_count, compiled.key_count, (int)sizeof(compiled));
+
+    bench_stream_make();
+
+    /* the three must agree */
+
+    memset(&by_table, 0, sizeof(by_table));
+    memset(&by_switch, 0, sizeof(by_switch));
+    memset(&by_compiled, 0, sizeof(by_compiled));
+
+    for(int index = 0; index < STREAM_EVENTS; ++index)
+    {
+        const struct input_event* ie = &stream[index];
+
+        if(ie->type == EV_SYN)
+        {
+            ++frames;
+
+            if((memcmp(&by_table, &by_switch, sizeof(by_table)) != 0) || (memcmp(&by_table, &by_compiled, sizeof(by_table)) != 0))
+            {
+                if(mismatches++ == 0)
+                {
+                    printf("frame %i: buttons %04x %04x %04x, lx %i %i %i, ly %i %i %i, lt %i %i %i\n", frames,
+                            by_table.wButtons, by_switch.wButtons, by_compiled.wButtons,
+                            by_table.sThumbLX, by_switch.sThumbLX, by_compiled.sThumbLX,
+                            by_table.sThumbLY, by_switch.sThumbLY, by_compiled.sThumbLY,
+                            by_table.bLeftTrigger, by_switch.bLeftTrigger, by_compiled.bLeftTrigger);
+                }
+            }
+        }
+        else
+        {
+            bench_table(ie, &by_table);
+            bench_switch(ie, &by_switch);
+            bench_compiled(ie, &by_compiled);
+        }
+    }
+
+    printf("%i frames, %i mismatches\n", frames, mismatches);
+
+    BENCH_RUN("table", bench_table, repeats, checksum[0]);
+    BENCH_RUN("switch", bench_switch, repeats, checksum[1]);
+    BENCH_RUN("compiled", bench_compiled, repeats, checksum[2]);
+
+    if((checksum[0] != checksum[1]) || (checksum[0] != checksum[2]))
+    {
+        printf("checksums differ: %llx %llx %llx\n", (unsigned long long)checksum[0], (unsigned long long)checksum[1], (unsigned long long)checksum[2]);
+        ++mismatches;
+    }
+
+    return (mismatches == 0)?EXIT_SUCCESS:EXIT_FAILURE;
+}
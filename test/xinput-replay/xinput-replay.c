@@ -0,0 +1,249 @@
+/*
+ * MIT License
+ *
+ * Unix XInput Gamepad interface implementation
+ *
+ * Copyright (c) 2016-2017 Eric Diaz Fernandez
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Records an evdev device, or replays a recording through the generic device.
+ *
+ * Usage:
+ *
+ *  xinput-replay -c /dev/input/eventX out.rec
+ *      records the device until interrupted
+ *
+ *  xinput-replay [-r] [-o gamepads.txt] in.rec
+ *      replays the recording, at max speed or in real time (-r), prints the
+ *      throughput and writes the gamepad after each frame, one per line,
+ *      for comparison with a golden file
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "xinput.h"
+#include "tools.h"
+#include "linux_evdev/xinput_linux_evdev.h"
+#include "linux_evdev/xinput_linux_evdev_record.h"
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void replay_interrupt(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+static void replay_usage(void)
+{
+    printf("usage:\n"
+           "\txinput-replay -c device out.rec\n"
+           "\txinput-replay [-r] [-o gamepads.txt] in.rec\n");
+}
+
+static int replay_capture(const char* device_path, const char* path)
+{
+    struct xinput_linux_evdev_probe_s probed;
+    struct input_event events[64];
+    struct sigaction sa;
+    uint64_t count = 0;
+    int device_fd;
+    int fd;
+    int err = 0;
+
+    if((device_fd = open(device_path, O_RDONLY|O_CLOEXEC)) < 0)
+    {
+        printf("%s: %s\n", device_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    xinput_linux_evdev_probe_device(device_fd, &probed);
+
+    if((fd = xinput_linux_evdev_record_create(path, &probed)) < 0)
+    {
+        printf("%s: %s\n", path, strerror(errno));
+        close_ex(device_fd);
+        return EXIT_FAILURE;
+    }
+
+    /* no SA_RESTART: the read must be interrupted */
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = replay_interrupt;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("recording '%s' until interrupted\n", probed.device_name);
+
+    while(!interrupted)
+    {
+        ssize_t n = read(device_fd, events, sizeof(events));
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            err = errno;
+            break;
+        }
+
+        if(n == 0)
+        {
+            break;
+        }
+
+        if((err = xinput_linux_evdev_record_write(fd, events, n / sizeof(events[0]))) != 0)
+        {
+            break;
+        }
+
+        count += n / sizeof(events[0]);
+    }
+
+    close_ex(fd);
+    close_ex(device_fd);
+
+    printf("%llu events recorded\n", (unsigned long long)count);
+
+    if(err != 0)
+    {
+        printf("%s: %s\n", path, strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void replay_print(uint64_t frame, const XINPUT_GAMEPAD_EX* gamepad, int64_t event_us, void* args)
+{
+    FILE* out = (FILE*)args;
+
+    fprintf(out, "%llu %lli.%06lli %04hx %02hhx %02hhx %6hi %6hi %6hi %6hi\n",
+            (unsigned long long)frame,
+            (long long)(event_us / 1000000),
+            (long long)(event_us % 1000000),
+            gamepad->wButtons,
+            gamepad->bLeftTrigger,
+            gamepad->bRightTrigger,
+            gamepad->sThumbLX,
+            gamepad->sThumbLY,
+            gamepad->sThumbRX,
+            gamepad->sThumbRY);
+}
+
+static int replay_play(const char* path, BOOL realtime, const char* out_path)
+{
+    xinput_linux_evdev_replay_report report;
+    FILE* out = NULL;
+    int err;
+
+    if(out_path != NULL)
+    {
+        if((out = fopen(out_path, "w")) == NULL)
+        {
+            printf("%s: %s\n", out_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    err = xinput_linux_evdev_replay(path, realtime, (out != NULL)?replay_print:NULL, out, &report);
+
+    if(out != NULL)
+    {
+        fclose(out);
+    }
+
+    if(err != 0)
+    {
+        printf("%s: %s\n", path, strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    printf("%llu frames, %llu events, %llu reads in %lli us\n",
+            (unsigned long long)report.frames,
+            (unsigned long long)report.events,
+            (unsigned long long)report.reads,
+            (long long)report.elapsed_us);
+
+    if(report.elapsed_us > 0)
+    {
+        printf("%.0f frames/s\n", (report.frames * 1000000.0) / report.elapsed_us);
+    }
+
+    if(report.events > 0)
+    {
+        printf("%.1f ns/event\n", (report.elapsed_us * 1000.0) / report.events);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    const char* capture = NULL;
+    const char* out_path = NULL;
+    BOOL realtime = FALSE;
+    int opt;
+
+    while((opt = getopt(argc, argv, "c:ro:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'c':
+                capture = optarg;
+                break;
+            case 'r':
+                realtime = TRUE;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            default:
+                replay_usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(optind != argc - 1)
+    {
+        replay_usage();
+        return EXIT_FAILURE;
+    }
+
+    if(capture != NULL)
+    {
+        return replay_capture(capture, argv[optind]);
+    }
+
+    return replay_play(argv[optind], realtime, out_path);
+}
@@ -30,6 +30,8 @@
 #include <wx/msgdlg.h>
 
 #include <xinput.h>
+#include <unistd.h>
+#include <stdint.h>
 #include <wx/stdpaths.h>
 //(*InternalHeaders(wxXinputDialog)
 #include <wx/string.h>
@@ -102,6 +104,8 @@ wxXinputDialog::wxXinputDialog(wxWindow* parent,wxWindowID id)
 {
     _pad_mask = 0;
     _pad_selected = -1;
+    _notify_fd = -1;
+    _notify_source = NULL;
     
     wxString cwd = wxGetCwd();
     wxString dir = wxStandardPaths::Get().GetInstallPrefix().Append("/share/xinput");
@@ -140,7 +144,21 @@ wxXinputDialog::wxXinputDialog(wxWindow* parent,wxWindowID id)
     Connect(ID_POLLINGTIMER,wxEVT_TIMER,(wxObjectEventFunction)&wxXinputDialog::OnPollingTimerTrigger);
     //*)
 
-    pollingTimer.Start(100, false);
+    // the connections of the gamepads wake it too: the timer is only a fallback
+
+#if wxUSE_EVENTLOOP_SOURCE
+    if((_notify_fd = XInputGetNotifyFd((1 << XUSER_MAX_COUNT) - 1)) >= 0)
+    {
+        _notify_source = wxEventLoopBase::AddSourceForFD(_notify_fd, this, wxEVENT_SOURCE_INPUT);
+    }
+#endif
+
+    if(_notify_source == NULL)
+    {
+        pollingTimer.Start(100, false);
+    }
+
+    UpdateGamepads();
     wxSetWorkingDirectory(cwd);
 }
 
@@ -148,6 +166,33 @@ wxXinputDialog::~wxXinputDialog()
 {
     //(*Destroy(wxXinputDialog)
     //*)
+
+    delete _notify_source;
+
+    if(_notify_fd >= 0)
+    {
+        XInputCloseNotifyFd();
+    }
+}
+
+void wxXinputDialog::OnReadWaiting()
+{
+    uint64_t count;
+
+    // rearms it, the states are read after
+
+    if(read(_notify_fd, &count, sizeof(count)) == sizeof(count))
+    {
+        UpdateGamepads();
+    }
+}
+
+void wxXinputDialog::OnWriteWaiting()
+{
+}
+
+void wxXinputDialog::OnExceptionWaiting()
+{
 }
 
 void wxXinputDialog::OnQuit(wxCommandEvent& event)
@@ -162,6 +207,11 @@ void wxXinputDialog::OnAbout(wxCommandEvent& event)
 }
 
 void wxXinputDialog::OnPollingTimerTrigger(wxTimerEvent& event)
+{
+    UpdateGamepads();
+}
+
+void wxXinputDialog::UpdateGamepads()
 {
     XINPUT_CAPABILITIES caps;
     XINPUT_STATE_EX state;
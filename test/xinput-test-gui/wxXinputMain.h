@@ -34,18 +34,30 @@
 #include <wx/statbmp.h>
 #include <wx/listbox.h>
 //*)
+#include <wx/evtloop.h>
+#include <wx/evtloopsrc.h>
 
-class wxXinputDialog: public wxDialog
+// woken by the gamepads through the event loop, see XInputGetNotifyFd
+
+class wxXinputDialog: public wxDialog, public wxEventLoopSourceHandler
 {
     public:
 
         wxXinputDialog(wxWindow* parent,wxWindowID id = -1);
         virtual ~wxXinputDialog();
 
+        virtual void OnReadWaiting();
+        virtual void OnWriteWaiting();
+        virtual void OnExceptionWaiting();
+
     private:
 
         int _pad_mask;
         int _pad_selected;
+        int _notify_fd;
+        wxEventLoopSource* _notify_source;
+
+        void UpdateGamepads();
 
         //(*Handlers(wxXinputDialog)
         void OnQuit(wxCommandEvent& event);
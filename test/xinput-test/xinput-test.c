@@ -77,6 +77,8 @@ int main(void)
     XINPUT_STATE_EX state;
     XINPUT_KEYSTROKE keystroke;
     DWORD serial[XUSER_MAX_COUNT] = {0,0,0,0};
+    DWORD waited[XUSER_MAX_COUNT] = {0,0,0,0};
+    DWORD changed;
     int mode = 0;
 
     while(mode != 1)
@@ -107,7 +109,9 @@ int main(void)
                 }
             }
         }
-        usleep(1000);
+
+        /* sleeps until something happens */
+        XInputWaitForStateEx((1 << XUSER_MAX_COUNT) - 1, waited, 100, &changed);
     }
     
     while(mode != 3)
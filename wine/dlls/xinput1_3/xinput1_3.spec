@@ -8,3 +8,7 @@
 8 stdcall XInputGetKeystroke(long long ptr)
 100 stdcall XInputGetStateEx(long ptr)
 101 stdcall XInputServer(long long ptr long)
+102 stdcall XInputWaitForStateEx(long ptr long ptr)
+103 stdcall XInputGetStateTimed(long ptr)
+104 stdcall XInputGetStateHistory(long long ptr long ptr)
+105 stdcall XInputGetStateBatch(ptr)